@@ -0,0 +1,87 @@
+#include "allocation_counter.h"
+
+#if defined(SIMPLE_APP_COUNT_ALLOCATIONS)
+#include <stdlib.h>
+
+#include <new>
+#endif
+
+namespace simple_app {
+
+#if defined(SIMPLE_APP_COUNT_ALLOCATIONS)
+
+namespace {
+
+// Trivially constructed, so counting works even for allocations made before
+// or during thread-local initialization.
+thread_local uint64_t g_thread_allocations = 0;
+
+void* CountedAllocate(size_t size) {
+  ++g_thread_allocations;
+  if (size == 0)
+    size = 1;
+  void* p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+}  // namespace
+
+bool AllocationCounter::IsEnabled() {
+  return true;
+}
+
+uint64_t AllocationCounter::ThreadAllocations() {
+  return g_thread_allocations;
+}
+
+}  // namespace simple_app
+
+void* operator new(size_t size) {
+  return simple_app::CountedAllocate(size);
+}
+
+void* operator new[](size_t size) {
+  return simple_app::CountedAllocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  ++simple_app::g_thread_allocations;
+  return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  ++simple_app::g_thread_allocations;
+  return malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+#else  // defined(SIMPLE_APP_COUNT_ALLOCATIONS)
+
+bool AllocationCounter::IsEnabled() {
+  return false;
+}
+
+uint64_t AllocationCounter::ThreadAllocations() {
+  return 0;
+}
+
+}  // namespace simple_app
+
+#endif  // defined(SIMPLE_APP_COUNT_ALLOCATIONS)
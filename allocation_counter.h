@@ -0,0 +1,35 @@
+#ifndef ALLOCATION_COUNTER_H_
+#define ALLOCATION_COUNTER_H_
+
+#include <stdint.h>
+
+namespace simple_app {
+
+// Counts heap allocations made by the calling thread, to catch regressions on
+// paths that must not allocate per packet. The count comes from replacement
+// global operator new/delete that are only compiled in when the build sets
+// SIMPLE_APP_COUNT_ALLOCATIONS (cmake -DCOUNT_ALLOCATIONS=ON); otherwise
+// IsEnabled() is false and every count stays zero.
+class AllocationCounter {
+ public:
+  static bool IsEnabled();
+  // Allocations made by the calling thread since it started.
+  static uint64_t ThreadAllocations();
+};
+
+// Allocations made by the calling thread during the lifetime of the scope.
+class ScopedAllocationCount {
+ public:
+  ScopedAllocationCount() : start_(AllocationCounter::ThreadAllocations()) {}
+
+  uint64_t count() const {
+    return AllocationCounter::ThreadAllocations() - start_;
+  }
+
+ private:
+  const uint64_t start_;
+};
+
+}  // namespace simple_app
+
+#endif  // ALLOCATION_COUNTER_H_
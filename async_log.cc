@@ -0,0 +1,365 @@
+#include "async_log.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+namespace {
+
+// How long queued records may wait before the writer wakes up on its own.
+// Producers also wake it each time they fill half a ring.
+const int kWriterIntervalMs = 100;
+const size_t kWriteChunkSize = 16 * 1024;
+
+std::atomic<uint64_t> g_next_sink_id{1};
+
+const char* SeverityName(rtc::LoggingSeverity severity) {
+  switch (severity) {
+    case rtc::LS_SENSITIVE:
+      return "SENSITIVE";
+    case rtc::LS_VERBOSE:
+      return "VERBOSE";
+    case rtc::LS_INFO:
+      return "INFO";
+    case rtc::LS_WARNING:
+      return "WARNING";
+    case rtc::LS_ERROR:
+      return "ERROR";
+    default:
+      return "NONE";
+  }
+}
+
+const char* FileName(const char* path) {
+  const char* slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+void Bump(std::atomic<uint64_t>* counter) {
+  counter->store(counter->load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+}
+
+}  // namespace
+
+// Rings of the calling thread, one per sink it has logged to. Flags them
+// orphaned when the thread exits so the writer can free them.
+class AsyncLogSink::ThreadRings {
+ public:
+  ~ThreadRings() {
+    for (const auto& entry : rings_)
+      entry.second->orphaned.store(true, std::memory_order_release);
+  }
+
+  Ring* Find(uint64_t sink_id) const {
+    for (const auto& entry : rings_) {
+      if (entry.first == sink_id)
+        return entry.second.get();
+    }
+    return nullptr;
+  }
+
+  void Add(uint64_t sink_id, std::shared_ptr<Ring> ring) {
+    // Drop rings of sinks that were destroyed, which flag them orphaned too.
+    auto orphaned = [](const std::pair<uint64_t, std::shared_ptr<Ring>>& e) {
+      return e.second->orphaned.load(std::memory_order_acquire);
+    };
+    rings_.erase(std::remove_if(rings_.begin(), rings_.end(), orphaned),
+                 rings_.end());
+    rings_.emplace_back(sink_id, std::move(ring));
+  }
+
+ private:
+  std::vector<std::pair<uint64_t, std::shared_ptr<Ring>>> rings_;
+};
+
+const size_t AsyncLogSink::kRecordPayloadSize;
+const size_t AsyncLogSink::kRingSize;
+
+void AsyncLogSink::ArgWriter::PutString(const char* str, size_t len) {
+  uint16_t stored;
+  if (!Reserve(1 + sizeof(stored)))
+    return;
+  const size_t room = end_ - pos_ - 1 - sizeof(stored);
+  if (len > room) {
+    len = room;
+    truncated_ = true;
+  }
+  stored = static_cast<uint16_t>(len);
+  *pos_++ = 's';
+  memcpy(pos_, &stored, sizeof(stored));
+  pos_ += sizeof(stored);
+  if (len > 0)
+    memcpy(pos_, str, len);
+  pos_ += len;
+}
+
+AsyncLogSink::AsyncLogSink(std::unique_ptr<rtc::StreamInterface> stream)
+    : id_(g_next_sink_id.fetch_add(1)),
+      stream_(std::move(stream)),
+      min_severity_(rtc::LS_INFO),
+      wake_up_(false, false) {
+  RTC_DCHECK(stream_);
+  // LogMessage fixes its start time on first use; do it now so records
+  // queued before the first LOG do not get negative timestamps.
+  rtc::LogMessage::LogStartTime();
+}
+
+AsyncLogSink::~AsyncLogSink() {
+  Detach();
+  Stop();
+  while (Drain()) {
+  }
+  rtc::CritScope cs(&crit_);
+  for (const std::shared_ptr<Ring>& ring : rings_)
+    ring->orphaned.store(true, std::memory_order_release);
+}
+
+void AsyncLogSink::Start() {
+  RTC_DCHECK(!thread_);
+  thread_.reset(new rtc::PlatformThread(&AsyncLogSink::Run, this,
+                                        "AsyncLogWriter"));
+  thread_->Start();
+}
+
+void AsyncLogSink::Stop() {
+  if (!thread_)
+    return;
+  stop_.store(true);
+  wake_up_.Set();
+  thread_->Stop();
+  thread_.reset();
+  stop_.store(false);
+  // The writer may have exited before draining; nothing else consumes the
+  // rings now, so finish here.
+  while (Drain()) {
+  }
+  stream_->Flush();
+}
+
+void AsyncLogSink::Attach(rtc::LoggingSeverity min_sev) {
+  set_min_severity(min_sev);
+  if (attached_)
+    rtc::LogMessage::RemoveLogToStream(this);
+  rtc::LogMessage::AddLogToStream(this, min_sev);
+  attached_ = true;
+}
+
+void AsyncLogSink::Detach() {
+  if (!attached_)
+    return;
+  rtc::LogMessage::RemoveLogToStream(this);
+  attached_ = false;
+}
+
+void AsyncLogSink::OnLogMessage(const std::string& message) {
+  Ring* ring;
+  Record* record = BeginRecord(&ring);
+  if (!record)
+    return;
+  record->format = nullptr;
+  const bool truncated = message.size() > kRecordPayloadSize;
+  const size_t size = std::min(message.size(), kRecordPayloadSize);
+  memcpy(record->payload, message.data(), size);
+  // Keep the line break LogMessage ended the message with.
+  if (truncated)
+    record->payload[size - 1] = '\n';
+  record->size = static_cast<uint16_t>(size);
+  CommitRecord(ring, truncated);
+}
+
+AsyncLogSink::Stats AsyncLogSink::GetStats() const {
+  rtc::CritScope cs(&crit_);
+  Stats stats = retired_;
+  for (const std::shared_ptr<Ring>& ring : rings_) {
+    stats.records += ring->records_written.load(std::memory_order_relaxed);
+    stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+    stats.truncated += ring->truncated.load(std::memory_order_relaxed);
+  }
+  stats.write_errors = write_errors_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+AsyncLogSink::Record* AsyncLogSink::BeginRecord(Ring** ring) {
+  Ring* const current = CurrentRing();
+  const uint64_t head = current->head.load(std::memory_order_relaxed);
+  if (head - current->tail.load(std::memory_order_acquire) >= kRingSize) {
+    Bump(&current->dropped);
+    return nullptr;
+  }
+  Record* record = &current->records[head % kRingSize];
+  record->time_us = rtc::TimeMicros();
+  *ring = current;
+  return record;
+}
+
+void AsyncLogSink::CommitRecord(Ring* ring, bool truncated) {
+  const uint64_t head = ring->head.load(std::memory_order_relaxed) + 1;
+  ring->head.store(head, std::memory_order_release);
+  Bump(&ring->records_written);
+  if (truncated)
+    Bump(&ring->truncated);
+  // Waking the writer costs a syscall, so only do it every half ring; the
+  // writer's timeout picks up the rest.
+  if (head % (kRingSize / 2) == 0)
+    wake_up_.Set();
+}
+
+AsyncLogSink::Ring* AsyncLogSink::CurrentRing() {
+  static thread_local ThreadRings thread_rings;
+  Ring* ring = thread_rings.Find(id_);
+  if (ring)
+    return ring;
+  std::shared_ptr<Ring> new_ring = std::make_shared<Ring>();
+  ring = new_ring.get();
+  {
+    rtc::CritScope cs(&crit_);
+    rings_.push_back(new_ring);
+  }
+  thread_rings.Add(id_, std::move(new_ring));
+  return ring;
+}
+
+// static
+bool AsyncLogSink::Run(void* obj) {
+  AsyncLogSink* const self = static_cast<AsyncLogSink*>(obj);
+  if (self->Drain())
+    return true;
+  if (self->stop_.load())
+    return false;
+  self->stream_->Flush();
+  self->wake_up_.Wait(kWriterIntervalMs);
+  return true;
+}
+
+bool AsyncLogSink::Drain() {
+  {
+    rtc::CritScope cs(&crit_);
+    drain_rings_ = rings_;
+  }
+  drain_heads_.clear();
+  batch_.clear();
+  for (const std::shared_ptr<Ring>& ring : drain_rings_) {
+    const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    const uint64_t head = ring->head.load(std::memory_order_acquire);
+    drain_heads_.push_back(head);
+    for (uint64_t i = tail; i != head; ++i)
+      batch_.push_back(&ring->records[i % kRingSize]);
+  }
+
+  if (!batch_.empty()) {
+    // Each ring is already in order; merge the threads by timestamp.
+    std::stable_sort(batch_.begin(), batch_.end(),
+                     [](const Record* a, const Record* b) {
+                       return a->time_us < b->time_us;
+                     });
+    // Write in chunks rather than line by line; a FileRotatingStream write
+    // is a syscall.
+    for (size_t i = 0; i < batch_.size(); ++i) {
+      AppendRecord(*batch_[i], &chunk_);
+      if (chunk_.size() < kWriteChunkSize && i + 1 < batch_.size())
+        continue;
+      if (stream_->WriteAll(chunk_.data(), chunk_.size(), nullptr, nullptr) !=
+          rtc::SR_SUCCESS) {
+        Bump(&write_errors_);
+      }
+      chunk_.clear();
+    }
+    for (size_t i = 0; i < drain_rings_.size(); ++i)
+      drain_rings_[i]->tail.store(drain_heads_[i], std::memory_order_release);
+  }
+
+  // Free rings of exited threads once they are empty. A ring flagged after
+  // the drain above still holds its last records and waits for the next one.
+  {
+    rtc::CritScope cs(&crit_);
+    for (auto it = rings_.begin(); it != rings_.end();) {
+      Ring* ring = it->get();
+      if (!ring->orphaned.load(std::memory_order_acquire) ||
+          ring->tail.load(std::memory_order_relaxed) !=
+              ring->head.load(std::memory_order_acquire)) {
+        ++it;
+        continue;
+      }
+      retired_.records += ring->records_written.load(std::memory_order_relaxed);
+      retired_.dropped += ring->dropped.load(std::memory_order_relaxed);
+      retired_.truncated += ring->truncated.load(std::memory_order_relaxed);
+      it = rings_.erase(it);
+    }
+  }
+  drain_rings_.clear();
+  return !batch_.empty();
+}
+
+void AsyncLogSink::AppendRecord(const Record& record, std::string* out) const {
+  if (!record.format) {
+    out->append(record.payload, record.size);
+    return;
+  }
+
+  const AsyncLogFormat& format = *record.format;
+  char buf[128];
+  // LogMessage's timestamp prefix, with the severity in front of the call
+  // site.
+  const int64_t elapsed_ms =
+      record.time_us / rtc::kNumMicrosecsPerMillisec -
+      rtc::LogMessage::LogStartTime();
+  snprintf(buf, sizeof(buf), "[%03" PRId64 ":%03" PRId64 "] %s (%s:%d): ",
+           elapsed_ms / 1000, elapsed_ms % 1000,
+           SeverityName(format.severity), FileName(format.file), format.line);
+  out->append(buf);
+
+  const char* arg = record.payload;
+  const char* const args_end = record.payload + record.size;
+  for (const char* p = format.format; *p; ++p) {
+    if (p[0] != '{' || p[1] != '}' || arg == args_end) {
+      out->push_back(*p);
+      continue;
+    }
+    ++p;
+    const char tag = *arg++;
+    if (tag == 's') {
+      uint16_t len;
+      memcpy(&len, arg, sizeof(len));
+      arg += sizeof(len);
+      out->append(arg, len);
+      arg += len;
+      continue;
+    }
+    uint64_t value;
+    memcpy(&value, arg, sizeof(value));
+    arg += sizeof(value);
+    switch (tag) {
+      case 'i':
+        snprintf(buf, sizeof(buf), "%" PRId64, static_cast<int64_t>(value));
+        break;
+      case 'u':
+        snprintf(buf, sizeof(buf), "%" PRIu64, value);
+        break;
+      case 'b':
+        snprintf(buf, sizeof(buf), "%s", value ? "true" : "false");
+        break;
+      case 'd': {
+        double d;
+        memcpy(&d, &value, sizeof(d));
+        snprintf(buf, sizeof(buf), "%g", d);
+        break;
+      }
+      default:
+        RTC_NOTREACHED();
+        buf[0] = '\0';
+        break;
+    }
+    out->append(buf);
+  }
+  out->push_back('\n');
+}
+
+}  // namespace simple_app
@@ -0,0 +1,263 @@
+#ifndef ASYNC_LOG_H_
+#define ASYNC_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/criticalsection.h"
+#include "rtc_base/event.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/platform_thread.h"
+#include "rtc_base/stream.h"
+
+namespace simple_app {
+
+// Static description of one ASYNC_LOG call site. The record written at the
+// call site refers to it instead of carrying the text.
+struct AsyncLogFormat {
+  const char* file;
+  int line;
+  rtc::LoggingSeverity severity;
+  // Message with a "{}" for each argument.
+  const char* format;
+};
+
+// Log sink that takes writing, and for ASYNC_LOG also formatting, off the
+// logging thread. Each thread that logs gets its own single-producer ring of
+// fixed-size records, so a log call is a few stores into memory only that
+// thread writes; a background thread drains the rings, formats the records in
+// time order and writes them to the output stream, usually an
+// rtc::FileRotatingStream.
+//
+// Two ways in:
+//  - Attach() registers the sink with rtc::LogMessage, so LOG output from
+//    the library is copied into the ring as text. LogMessage still formats on
+//    the calling thread, but the file write no longer happens while it holds
+//    the global log lock.
+//  - ASYNC_LOG(sink, sev, "rtt {} ms on ssrc {}", rtt, ssrc) stores the call
+//    site and the raw arguments; no string is built on the calling thread.
+//
+// When a ring is full the record is dropped and counted rather than blocking
+// the caller. Strings and lines longer than a record are truncated.
+class AsyncLogSink : public rtc::LogSink {
+ public:
+  // Bytes of text or encoded arguments per record.
+  static const size_t kRecordPayloadSize = 232;
+  // Records each logging thread can have in flight.
+  static const size_t kRingSize = 1024;
+
+  struct Stats {
+    uint64_t records = 0;
+    // Dropped because the thread's ring was full.
+    uint64_t dropped = 0;
+    uint64_t truncated = 0;
+    // Failed writes to the stream, each losing up to 16 KB of lines.
+    uint64_t write_errors = 0;
+  };
+
+  // |stream| must be open, e.g. a FileRotatingStream after Open().
+  explicit AsyncLogSink(std::unique_ptr<rtc::StreamInterface> stream);
+  // Detaches and writes out everything still queued.
+  ~AsyncLogSink() override;
+
+  // Starts the writer thread.
+  void Start();
+  // Writes out what is queued and stops the writer thread.
+  void Stop();
+
+  // Registers with rtc::LogMessage for messages at |min_sev| and above.
+  void Attach(rtc::LoggingSeverity min_sev);
+  void Detach();
+
+  // Minimum severity for ASYNC_LOG; Attach() sets it too. Defaults to
+  // LS_INFO.
+  void set_min_severity(rtc::LoggingSeverity min_sev) {
+    min_severity_.store(min_sev, std::memory_order_relaxed);
+  }
+  bool IsLoggable(rtc::LoggingSeverity sev) const {
+    return sev >= min_severity_.load(std::memory_order_relaxed);
+  }
+
+  // rtc::LogSink implementation.
+  void OnLogMessage(const std::string& message) override;
+
+  // Use ASYNC_LOG instead of calling this directly. |text| is the
+  // |format|'s text again, passed along by the macro and unused.
+  template <typename... Args>
+  void Log(const AsyncLogFormat* format,
+           const char* /* text */,
+           const Args&... args) {
+    Ring* ring;
+    Record* record = BeginRecord(&ring);
+    if (!record)
+      return;
+    record->format = format;
+    ArgWriter writer(record->payload, record->payload + kRecordPayloadSize);
+    WriteArgs(&writer, args...);
+    record->size = static_cast<uint16_t>(writer.size());
+    CommitRecord(ring, writer.truncated());
+  }
+
+  // Totals over all threads.
+  Stats GetStats() const;
+
+ private:
+  struct Record {
+    int64_t time_us;
+    // Null for text records.
+    const AsyncLogFormat* format;
+    uint16_t size;
+    char payload[kRecordPayloadSize];
+  };
+
+  // Encodes ASYNC_LOG arguments as a type tag followed by the value.
+  class ArgWriter {
+   public:
+    ArgWriter(char* begin, char* end) : begin_(begin), pos_(begin), end_(end) {}
+
+    void PutInt(char tag, uint64_t value) {
+      if (!Reserve(1 + sizeof(value)))
+        return;
+      *pos_++ = tag;
+      memcpy(pos_, &value, sizeof(value));
+      pos_ += sizeof(value);
+    }
+    void PutDouble(double value) {
+      if (!Reserve(1 + sizeof(value)))
+        return;
+      *pos_++ = 'd';
+      memcpy(pos_, &value, sizeof(value));
+      pos_ += sizeof(value);
+    }
+    void PutString(const char* str, size_t len);
+
+    size_t size() const { return pos_ - begin_; }
+    bool truncated() const { return truncated_; }
+
+   private:
+    bool Reserve(size_t bytes) {
+      if (static_cast<size_t>(end_ - pos_) >= bytes)
+        return true;
+      truncated_ = true;
+      return false;
+    }
+
+    char* const begin_;
+    char* pos_;
+    char* const end_;
+    bool truncated_ = false;
+  };
+
+  // Single-producer/single-consumer ring owned by one logging thread.
+  struct Ring {
+    Record records[kRingSize];
+    // Written by the producer only.
+    std::atomic<uint64_t> head{0};
+    // Written by the writer thread only.
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> records_written{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> truncated{0};
+    // Set when the producing thread exits; the writer frees the ring once it
+    // has drained it.
+    std::atomic<bool> orphaned{false};
+  };
+
+  class ThreadRings;
+
+  static void WriteArgs(ArgWriter*) {}
+  template <typename T, typename... Rest>
+  static void WriteArgs(ArgWriter* writer, const T& arg, const Rest&... rest) {
+    WriteArg(writer, arg);
+    WriteArgs(writer, rest...);
+  }
+  static void WriteArg(ArgWriter* writer, bool value) {
+    writer->PutInt('b', value);
+  }
+  static void WriteArg(ArgWriter* writer, const char* value) {
+    writer->PutString(value, value ? strlen(value) : 0);
+  }
+  static void WriteArg(ArgWriter* writer, const std::string& value) {
+    writer->PutString(value.data(), value.size());
+  }
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value ||
+                                 std::is_enum<T>::value>::type
+  WriteArg(ArgWriter* writer, T value) {
+    if (std::is_signed<T>::value || std::is_enum<T>::value) {
+      writer->PutInt('i', static_cast<uint64_t>(static_cast<int64_t>(value)));
+    } else {
+      writer->PutInt('u', static_cast<uint64_t>(value));
+    }
+  }
+  template <typename T>
+  static typename std::enable_if<std::is_floating_point<T>::value>::type
+  WriteArg(ArgWriter* writer, T value) {
+    writer->PutDouble(value);
+  }
+
+  // Returns the next free record of the calling thread's ring, or null after
+  // counting a drop if the ring is full.
+  Record* BeginRecord(Ring** ring);
+  // Publishes the record returned by BeginRecord().
+  void CommitRecord(Ring* ring, bool truncated);
+  // The calling thread's ring, created on its first record.
+  Ring* CurrentRing();
+
+  static bool Run(void* obj);
+  // Writes out every queued record. Returns false if there was none.
+  bool Drain();
+  // Appends |record| to |out| as one formatted line.
+  void AppendRecord(const Record& record, std::string* out) const;
+
+  const uint64_t id_;
+  std::unique_ptr<rtc::StreamInterface> stream_;
+  std::atomic<int> min_severity_;
+  bool attached_ = false;
+
+  rtc::CriticalSection crit_;
+  std::vector<std::shared_ptr<Ring>> rings_ RTC_GUARDED_BY(crit_);
+  // Counters of rings that were freed.
+  Stats retired_ RTC_GUARDED_BY(crit_);
+
+  // Writer thread state.
+  rtc::Event wake_up_;
+  std::atomic<bool> stop_{false};
+  std::unique_ptr<rtc::PlatformThread> thread_;
+  std::atomic<uint64_t> write_errors_{0};
+  // Reused by Drain() from batch to batch.
+  std::vector<std::shared_ptr<Ring>> drain_rings_;
+  std::vector<uint64_t> drain_heads_;
+  std::vector<const Record*> batch_;
+  std::string chunk_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(AsyncLogSink);
+};
+
+}  // namespace simple_app
+
+// Logs through |sink| without formatting on the calling thread. Arguments may
+// be integers, enums, bools, floating point numbers, C strings and
+// std::strings; each replaces the next "{}" in the format, the first
+// argument after |sev|, which must be a string literal. The format is taken
+// out of __VA_ARGS__ rather than named, so that a call without arguments
+// needs no empty-__VA_ARGS__ extension.
+#define ASYNC_LOG(sink, sev, ...)                                            \
+  do {                                                                       \
+    static const simple_app::AsyncLogFormat async_log_format = {             \
+        __FILE__, __LINE__, rtc::sev, ASYNC_LOG_FORMAT_(__VA_ARGS__, 0)};     \
+    if ((sink)->IsLoggable(rtc::sev))                                        \
+      (sink)->Log(&async_log_format, __VA_ARGS__);                           \
+  } while (0)
+
+#define ASYNC_LOG_FORMAT_(format, ...) format
+
+#endif  // ASYNC_LOG_H_
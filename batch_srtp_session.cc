@@ -0,0 +1,551 @@
+#include "batch_srtp_session.h"
+
+#include <string.h>
+
+#include <bitset>
+#include <utility>
+
+#include "hmac_sha1_key.h"
+#include "openssl/aead.h"
+#include "openssl/aes.h"
+#include "openssl/crypto.h"
+#include "rtc_base/byteorder.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/sslstreamadapter.h"
+
+namespace simple_app {
+
+namespace {
+
+const size_t kRtpHeaderSize = 12;
+const size_t kRtcpHeaderSize = 8;
+const size_t kSrtcpIndexSize = 4;
+const uint32_t kSrtcpEncryptedBit = 0x80000000;
+const uint32_t kMaxSrtcpIndex = 0x7fffffff;
+
+// RFC 3711 4.3: salts are used as 112 bits, the 96-bit GCM salt padded
+// with zeros; the derived GCM salt is truncated back to 96 bits.
+const size_t kKdfSaltSize = 14;
+const size_t kGcmSaltSize = 12;
+const size_t kGcmIvSize = 12;
+const size_t kGcmTagSize = 16;
+const size_t kAuthKeySize = 20;
+const size_t kSha1TagSize = 10;
+const size_t kSha1_32TagSize = 4;
+
+// Key derivation labels, RFC 3711 4.3.2.
+const uint8_t kRtpEncryptionLabel = 0;
+const uint8_t kRtpAuthLabel = 1;
+const uint8_t kRtpSaltLabel = 2;
+const uint8_t kRtcpEncryptionLabel = 3;
+const uint8_t kRtcpAuthLabel = 4;
+const uint8_t kRtcpSaltLabel = 5;
+
+// As libsrtp is configured by SrtpSession.
+const size_t kReplayWindowSize = 1024;
+
+// Runs AES-CTR from |iv| over |length| bytes in place.
+void AesCtr(const AES_KEY& key, uint8_t iv[16], uint8_t* data,
+            size_t length) {
+  uint8_t ecount[AES_BLOCK_SIZE] = {0};
+  unsigned int num = 0;
+  AES_ctr128_encrypt(data, data, length, &key, iv, ecount, &num);
+}
+
+// The AES-CM PRF of RFC 3711 4.3.3, with a key derivation rate of 0.
+void DeriveKey(const AES_KEY& master_key,
+               const uint8_t master_salt[kKdfSaltSize],
+               uint8_t label,
+               uint8_t* out,
+               size_t length) {
+  uint8_t iv[AES_BLOCK_SIZE] = {0};
+  memcpy(iv, master_salt, kKdfSaltSize);
+  iv[7] ^= label;
+  memset(out, 0, length);
+  AesCtr(master_key, iv, out, length);
+}
+
+// Length of the RTP header in |data|, CSRCs and extension included, or 0
+// if it is not a valid RTP header.
+size_t RtpHeaderSize(const uint8_t* data, size_t size) {
+  if (size < kRtpHeaderSize || (data[0] >> 6) != 2)
+    return 0;
+  size_t header_size = kRtpHeaderSize + 4 * (data[0] & 0x0f);
+  if (data[0] & 0x10) {
+    if (size < header_size + 4)
+      return 0;
+    header_size += 4 + 4 * rtc::GetBE16(data + header_size + 2);
+  }
+  return header_size <= size ? header_size : 0;
+}
+
+}  // namespace
+
+struct BatchSrtpSession::Cipher {
+  Cipher() { memset(&aead, 0, sizeof(aead)); }
+  ~Cipher() { EVP_AEAD_CTX_cleanup(&aead); }
+
+  bool gcm = false;
+  size_t tag_size = 0;
+  uint8_t salt[kKdfSaltSize] = {0};
+  // AES-GCM.
+  EVP_AEAD_CTX aead;
+  // AES-CM and HMAC-SHA1.
+  AES_KEY aes;
+  std::unique_ptr<HmacSha1Key> auth;
+};
+
+struct BatchSrtpSession::Stream {
+  // Packet indices seen, RFC 3711 3.3.2, relative to the highest. The
+  // sender only uses |highest| for the rollover counter, through Advance(),
+  // and keeps no bitmap.
+  struct Window {
+    bool Check(uint64_t index) const {
+      if (!started || index > highest)
+        return true;
+      const uint64_t age = highest - index;
+      return age < kReplayWindowSize && !seen[age];
+    }
+    void Add(uint64_t index) {
+      if (!started) {
+        seen.reset();
+      } else if (index > highest) {
+        const uint64_t shift = index - highest;
+        if (shift < kReplayWindowSize)
+          seen <<= shift;
+        else
+          seen.reset();
+      }
+      Advance(index);
+      // Older than the window only if Check() was skipped.
+      const uint64_t age = highest - index;
+      if (age < kReplayWindowSize)
+        seen.set(age);
+    }
+    void Advance(uint64_t index) {
+      if (!started || index > highest)
+        highest = index;
+      started = true;
+    }
+
+    bool started = false;
+    uint64_t highest = 0;
+    std::bitset<kReplayWindowSize> seen;
+  };
+
+  // Estimates the 48-bit index of the RTP packet with |seq|, RFC 3711
+  // 3.3.1. Returns false for a packet from before the rollover counter
+  // started.
+  bool EstimateIndex(uint16_t seq, uint64_t* index) const {
+    if (!rtp.started) {
+      *index = seq;
+      return true;
+    }
+    const uint32_t roc = static_cast<uint32_t>(rtp.highest >> 16);
+    const uint16_t last_seq = static_cast<uint16_t>(rtp.highest);
+    int64_t v = roc;
+    if (last_seq < 0x8000) {
+      if (seq > last_seq && seq - last_seq > 0x8000)
+        v = static_cast<int64_t>(roc) - 1;
+    } else if (seq < last_seq - 0x8000) {
+      v = static_cast<int64_t>(roc) + 1;
+    }
+    if (v < 0)
+      return false;
+    *index = (static_cast<uint64_t>(v) << 16) | seq;
+    return true;
+  }
+
+  Window rtp;
+  Window rtcp;
+  // Index of the last SRTCP packet sent.
+  uint32_t rtcp_sent = 0;
+};
+
+BatchSrtpSession::BatchSrtpSession() {}
+
+BatchSrtpSession::~BatchSrtpSession() {}
+
+bool BatchSrtpSession::SetSend(int crypto_suite,
+                               const uint8_t* key,
+                               size_t length) {
+  return SetKey(SEND, crypto_suite, key, length);
+}
+
+bool BatchSrtpSession::SetRecv(int crypto_suite,
+                               const uint8_t* key,
+                               size_t length) {
+  return SetKey(RECV, crypto_suite, key, length);
+}
+
+bool BatchSrtpSession::SetKey(Direction direction,
+                              int crypto_suite,
+                              const uint8_t* key,
+                              size_t length) {
+  int key_size = 0;
+  int salt_size = 0;
+  if (!rtc::GetSrtpKeyAndSaltLengths(crypto_suite, &key_size, &salt_size)) {
+    LOG(LS_WARNING) << "Unsupported SRTP crypto suite " << crypto_suite;
+    return false;
+  }
+  if (length != static_cast<size_t>(key_size + salt_size)) {
+    LOG(LS_WARNING) << "Wrong SRTP key length " << length << " for "
+                    << rtc::SrtpCryptoSuiteToName(crypto_suite);
+    return false;
+  }
+
+  AES_KEY master_key;
+  if (AES_set_encrypt_key(key, key_size * 8, &master_key) != 0)
+    return false;
+  uint8_t master_salt[kKdfSaltSize] = {0};
+  memcpy(master_salt, key + key_size, salt_size);
+
+  const bool gcm = rtc::IsGcmCryptoSuite(crypto_suite);
+  const size_t session_salt_size = gcm ? kGcmSaltSize : kKdfSaltSize;
+  const uint8_t labels[2][3] = {
+      {kRtpEncryptionLabel, kRtpAuthLabel, kRtpSaltLabel},
+      {kRtcpEncryptionLabel, kRtcpAuthLabel, kRtcpSaltLabel}};
+  std::unique_ptr<Cipher> ciphers[2];
+  for (int i = 0; i < 2; ++i) {
+    std::unique_ptr<Cipher> cipher(new Cipher());
+    cipher->gcm = gcm;
+    DeriveKey(master_key, master_salt, labels[i][2], cipher->salt,
+              session_salt_size);
+    uint8_t session_key[32];
+    DeriveKey(master_key, master_salt, labels[i][0], session_key, key_size);
+    bool ok;
+    if (gcm) {
+      cipher->tag_size = kGcmTagSize;
+      ok = EVP_AEAD_CTX_init(&cipher->aead,
+                             key_size == 16 ? EVP_aead_aes_128_gcm()
+                                            : EVP_aead_aes_256_gcm(),
+                             session_key, key_size, kGcmTagSize,
+                             nullptr) == 1;
+    } else {
+      // SRTCP keeps the 80-bit tag with AES_CM_128_HMAC_SHA1_32.
+      cipher->tag_size =
+          i == 0 && crypto_suite == rtc::SRTP_AES128_CM_SHA1_32
+              ? kSha1_32TagSize
+              : kSha1TagSize;
+      ok = AES_set_encrypt_key(session_key, key_size * 8, &cipher->aes) == 0;
+      uint8_t auth_key[kAuthKeySize];
+      DeriveKey(master_key, master_salt, labels[i][1], auth_key,
+                sizeof(auth_key));
+      cipher->auth.reset(new HmacSha1Key(auth_key, sizeof(auth_key)));
+      OPENSSL_cleanse(auth_key, sizeof(auth_key));
+    }
+    OPENSSL_cleanse(session_key, sizeof(session_key));
+    if (!ok) {
+      LOG(LS_ERROR) << "Failed to set up the SRTP cipher.";
+      OPENSSL_cleanse(&master_key, sizeof(master_key));
+      return false;
+    }
+    ciphers[i] = std::move(cipher);
+  }
+  OPENSSL_cleanse(&master_key, sizeof(master_key));
+
+  direction_ = direction;
+  rtp_ = std::move(ciphers[0]);
+  rtcp_ = std::move(ciphers[1]);
+  streams_.clear();
+  last_stream_ = nullptr;
+  return true;
+}
+
+size_t BatchSrtpSession::ProtectRtp(SrtpPacket* packets, size_t count) {
+  return Process(SEND, &BatchSrtpSession::ProtectRtpPacket, packets, count);
+}
+
+size_t BatchSrtpSession::ProtectRtcp(SrtpPacket* packets, size_t count) {
+  return Process(SEND, &BatchSrtpSession::ProtectRtcpPacket, packets,
+                 count);
+}
+
+size_t BatchSrtpSession::UnprotectRtp(SrtpPacket* packets, size_t count) {
+  return Process(RECV, &BatchSrtpSession::UnprotectRtpPacket, packets,
+                 count);
+}
+
+size_t BatchSrtpSession::UnprotectRtcp(SrtpPacket* packets, size_t count) {
+  return Process(RECV, &BatchSrtpSession::UnprotectRtcpPacket, packets,
+                 count);
+}
+
+size_t BatchSrtpSession::GetSrtpOverhead() const {
+  return rtp_ ? rtp_->tag_size : 0;
+}
+
+size_t BatchSrtpSession::GetSrtcpOverhead() const {
+  return rtcp_ ? rtcp_->tag_size + kSrtcpIndexSize : 0;
+}
+
+size_t BatchSrtpSession::Process(
+    Direction direction,
+    bool (BatchSrtpSession::*process)(SrtpPacket*),
+    SrtpPacket* packets,
+    size_t count) {
+  if (direction_ != direction) {
+    LOG(LS_WARNING) << "SRTP session not set up to "
+                    << (direction == SEND ? "protect." : "unprotect.");
+    for (size_t i = 0; i < count; ++i)
+      packets[i].ok = false;
+    return 0;
+  }
+  size_t processed = 0;
+  for (size_t i = 0; i < count; ++i) {
+    packets[i].ok = (this->*process)(&packets[i]);
+    if (packets[i].ok)
+      ++processed;
+  }
+  return processed;
+}
+
+BatchSrtpSession::Stream* BatchSrtpSession::FindStream(uint32_t ssrc) {
+  if (last_stream_ && last_ssrc_ == ssrc)
+    return last_stream_;
+  auto it = streams_.find(ssrc);
+  if (it == streams_.end())
+    return nullptr;
+  last_ssrc_ = ssrc;
+  last_stream_ = it->second.get();
+  return last_stream_;
+}
+
+BatchSrtpSession::Stream* BatchSrtpSession::AddStream(uint32_t ssrc,
+                                                      const Stream& stream) {
+  std::unique_ptr<Stream>& slot = streams_[ssrc];
+  slot.reset(new Stream(stream));
+  last_ssrc_ = ssrc;
+  last_stream_ = slot.get();
+  return last_stream_;
+}
+
+bool BatchSrtpSession::ProtectRtpPacket(SrtpPacket* packet) {
+  const Cipher& cipher = *rtp_;
+  uint8_t* data = packet->data;
+  const size_t header_size = RtpHeaderSize(data, packet->size);
+  if (header_size == 0 || packet->capacity < packet->size + cipher.tag_size)
+    return false;
+  const uint16_t seq = rtc::GetBE16(data + 2);
+  const uint32_t ssrc = rtc::GetBE32(data + 8);
+  Stream* stream = FindStream(ssrc);
+  if (!stream)
+    stream = AddStream(ssrc, Stream());
+  uint64_t index;
+  if (!stream->EstimateIndex(seq, &index))
+    index = seq;
+  const uint32_t roc = static_cast<uint32_t>(index >> 16);
+
+  uint8_t* payload = data + header_size;
+  const size_t payload_size = packet->size - header_size;
+  if (cipher.gcm) {
+    // RFC 7714 8.1.
+    uint8_t iv[kGcmIvSize] = {0};
+    rtc::SetBE32(iv + 2, ssrc);
+    rtc::SetBE32(iv + 6, roc);
+    rtc::SetBE16(iv + 10, seq);
+    for (size_t i = 0; i < kGcmIvSize; ++i)
+      iv[i] ^= cipher.salt[i];
+    size_t tag_size;
+    if (!EVP_AEAD_CTX_seal_scatter(&cipher.aead, payload,
+                                   payload + payload_size, &tag_size,
+                                   cipher.tag_size, iv, sizeof(iv), payload,
+                                   payload_size, nullptr, 0, data,
+                                   header_size)) {
+      return false;
+    }
+  } else {
+    // RFC 3711 4.1.1 and 4.2.
+    uint8_t iv[AES_BLOCK_SIZE] = {0};
+    rtc::SetBE32(iv + 4, ssrc);
+    rtc::SetBE32(iv + 8, roc);
+    rtc::SetBE16(iv + 12, seq);
+    for (size_t i = 0; i < kKdfSaltSize; ++i)
+      iv[i] ^= cipher.salt[i];
+    AesCtr(cipher.aes, iv, payload, payload_size);
+    uint8_t roc_bytes[4];
+    rtc::SetBE32(roc_bytes, roc);
+    uint8_t digest[kAuthKeySize];
+    cipher.auth->Compute(data, packet->size, roc_bytes, sizeof(roc_bytes),
+                         digest);
+    memcpy(data + packet->size, digest, cipher.tag_size);
+  }
+  stream->rtp.Advance(index);
+  packet->size += cipher.tag_size;
+  return true;
+}
+
+bool BatchSrtpSession::UnprotectRtpPacket(SrtpPacket* packet) {
+  const Cipher& cipher = *rtp_;
+  uint8_t* data = packet->data;
+  if (packet->size < cipher.tag_size)
+    return false;
+  const size_t size = packet->size - cipher.tag_size;
+  const size_t header_size = RtpHeaderSize(data, size);
+  if (header_size == 0)
+    return false;
+  const uint16_t seq = rtc::GetBE16(data + 2);
+  const uint32_t ssrc = rtc::GetBE32(data + 8);
+  // A new SSRC only gets a stream once a packet of it authenticates.
+  Stream* stream = FindStream(ssrc);
+  Stream new_stream;
+  const Stream& state = stream ? *stream : new_stream;
+  uint64_t index;
+  if (!state.EstimateIndex(seq, &index) || !state.rtp.Check(index))
+    return false;
+  const uint32_t roc = static_cast<uint32_t>(index >> 16);
+
+  uint8_t* payload = data + header_size;
+  const size_t payload_size = size - header_size;
+  if (cipher.gcm) {
+    uint8_t iv[kGcmIvSize] = {0};
+    rtc::SetBE32(iv + 2, ssrc);
+    rtc::SetBE32(iv + 6, roc);
+    rtc::SetBE16(iv + 10, seq);
+    for (size_t i = 0; i < kGcmIvSize; ++i)
+      iv[i] ^= cipher.salt[i];
+    if (!EVP_AEAD_CTX_open_gather(&cipher.aead, payload, iv, sizeof(iv),
+                                  payload, payload_size, data + size,
+                                  cipher.tag_size, data, header_size)) {
+      return false;
+    }
+  } else {
+    uint8_t roc_bytes[4];
+    rtc::SetBE32(roc_bytes, roc);
+    uint8_t digest[kAuthKeySize];
+    cipher.auth->Compute(data, size, roc_bytes, sizeof(roc_bytes), digest);
+    if (CRYPTO_memcmp(digest, data + size, cipher.tag_size) != 0)
+      return false;
+    uint8_t iv[AES_BLOCK_SIZE] = {0};
+    rtc::SetBE32(iv + 4, ssrc);
+    rtc::SetBE32(iv + 8, roc);
+    rtc::SetBE16(iv + 12, seq);
+    for (size_t i = 0; i < kKdfSaltSize; ++i)
+      iv[i] ^= cipher.salt[i];
+    AesCtr(cipher.aes, iv, payload, payload_size);
+  }
+  if (!stream)
+    stream = AddStream(ssrc, new_stream);
+  stream->rtp.Add(index);
+  packet->size = size;
+  return true;
+}
+
+bool BatchSrtpSession::ProtectRtcpPacket(SrtpPacket* packet) {
+  const Cipher& cipher = *rtcp_;
+  uint8_t* data = packet->data;
+  const size_t size = packet->size;
+  if (size < kRtcpHeaderSize ||
+      packet->capacity < size + cipher.tag_size + kSrtcpIndexSize) {
+    return false;
+  }
+  const uint32_t ssrc = rtc::GetBE32(data + 4);
+  Stream* stream = FindStream(ssrc);
+  if (!stream)
+    stream = AddStream(ssrc, Stream());
+  // Past this the key has to change, RFC 3711 9.2.
+  if (stream->rtcp_sent >= kMaxSrtcpIndex) {
+    LOG(LS_WARNING) << "SRTCP index exhausted for SSRC " << ssrc;
+    return false;
+  }
+  const uint32_t index = ++stream->rtcp_sent;
+  const uint32_t trailer = kSrtcpEncryptedBit | index;
+
+  uint8_t* payload = data + kRtcpHeaderSize;
+  const size_t payload_size = size - kRtcpHeaderSize;
+  if (cipher.gcm) {
+    // RFC 7714 9.1 and 9.2: the tag, then E and the index.
+    uint8_t iv[kGcmIvSize] = {0};
+    rtc::SetBE32(iv + 2, ssrc);
+    rtc::SetBE32(iv + 8, index);
+    for (size_t i = 0; i < kGcmIvSize; ++i)
+      iv[i] ^= cipher.salt[i];
+    uint8_t aad[kRtcpHeaderSize + kSrtcpIndexSize];
+    memcpy(aad, data, kRtcpHeaderSize);
+    rtc::SetBE32(aad + kRtcpHeaderSize, trailer);
+    size_t tag_size;
+    if (!EVP_AEAD_CTX_seal_scatter(&cipher.aead, payload, data + size,
+                                   &tag_size, cipher.tag_size, iv,
+                                   sizeof(iv), payload, payload_size,
+                                   nullptr, 0, aad, sizeof(aad))) {
+      --stream->rtcp_sent;
+      return false;
+    }
+    rtc::SetBE32(data + size + cipher.tag_size, trailer);
+  } else {
+    // RFC 3711 3.4: E and the index, then the tag over all before it.
+    uint8_t iv[AES_BLOCK_SIZE] = {0};
+    rtc::SetBE32(iv + 4, ssrc);
+    rtc::SetBE32(iv + 10, index);
+    for (size_t i = 0; i < kKdfSaltSize; ++i)
+      iv[i] ^= cipher.salt[i];
+    AesCtr(cipher.aes, iv, payload, payload_size);
+    rtc::SetBE32(data + size, trailer);
+    uint8_t digest[kAuthKeySize];
+    cipher.auth->Compute(data, size + kSrtcpIndexSize, nullptr, 0, digest);
+    memcpy(data + size + kSrtcpIndexSize, digest, cipher.tag_size);
+  }
+  packet->size = size + cipher.tag_size + kSrtcpIndexSize;
+  return true;
+}
+
+bool BatchSrtpSession::UnprotectRtcpPacket(SrtpPacket* packet) {
+  const Cipher& cipher = *rtcp_;
+  uint8_t* data = packet->data;
+  if (packet->size < kRtcpHeaderSize + kSrtcpIndexSize + cipher.tag_size)
+    return false;
+  const size_t size = packet->size - kSrtcpIndexSize - cipher.tag_size;
+  const uint8_t* tag;
+  uint32_t trailer;
+  if (cipher.gcm) {
+    tag = data + size;
+    trailer = rtc::GetBE32(data + size + cipher.tag_size);
+  } else {
+    trailer = rtc::GetBE32(data + size);
+    tag = data + size + kSrtcpIndexSize;
+  }
+  if (!(trailer & kSrtcpEncryptedBit))
+    return false;
+  const uint32_t index = trailer & kMaxSrtcpIndex;
+  const uint32_t ssrc = rtc::GetBE32(data + 4);
+  Stream* stream = FindStream(ssrc);
+  Stream new_stream;
+  if (!(stream ? *stream : new_stream).rtcp.Check(index))
+    return false;
+
+  uint8_t* payload = data + kRtcpHeaderSize;
+  const size_t payload_size = size - kRtcpHeaderSize;
+  if (cipher.gcm) {
+    uint8_t iv[kGcmIvSize] = {0};
+    rtc::SetBE32(iv + 2, ssrc);
+    rtc::SetBE32(iv + 8, index);
+    for (size_t i = 0; i < kGcmIvSize; ++i)
+      iv[i] ^= cipher.salt[i];
+    uint8_t aad[kRtcpHeaderSize + kSrtcpIndexSize];
+    memcpy(aad, data, kRtcpHeaderSize);
+    rtc::SetBE32(aad + kRtcpHeaderSize, trailer);
+    if (!EVP_AEAD_CTX_open_gather(&cipher.aead, payload, iv, sizeof(iv),
+                                  payload, payload_size, tag,
+                                  cipher.tag_size, aad, sizeof(aad))) {
+      return false;
+    }
+  } else {
+    uint8_t digest[kAuthKeySize];
+    cipher.auth->Compute(data, size + kSrtcpIndexSize, nullptr, 0, digest);
+    if (CRYPTO_memcmp(digest, tag, cipher.tag_size) != 0)
+      return false;
+    uint8_t iv[AES_BLOCK_SIZE] = {0};
+    rtc::SetBE32(iv + 4, ssrc);
+    rtc::SetBE32(iv + 10, index);
+    for (size_t i = 0; i < kKdfSaltSize; ++i)
+      iv[i] ^= cipher.salt[i];
+    AesCtr(cipher.aes, iv, payload, payload_size);
+  }
+  if (!stream)
+    stream = AddStream(ssrc, new_stream);
+  stream->rtcp.Add(index);
+  packet->size = size;
+  return true;
+}
+
+}  // namespace simple_app
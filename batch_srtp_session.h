@@ -0,0 +1,103 @@
+#ifndef BATCH_SRTP_SESSION_H_
+#define BATCH_SRTP_SESSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+
+#include "rtc_base/constructormagic.h"
+
+namespace simple_app {
+
+// A packet for BatchSrtpSession, protected or unprotected in place.
+struct SrtpPacket {
+  uint8_t* data = nullptr;
+  // Length of the packet; updated when it is processed.
+  size_t size = 0;
+  // Bytes available at |data|. Protecting writes the tag, and for SRTCP the
+  // index, past |size|, so the caller reserves GetSrtpOverhead() or
+  // GetSrtcpOverhead() bytes of tailroom; a packet without it fails.
+  size_t capacity = 0;
+  // Whether the last call processed the packet.
+  bool ok = false;
+};
+
+// SRTP for many packets per call, in place of cricket::SrtpSession's one
+// libsrtp call per packet, for servers where that shows up in profiles.
+// Wire compatible with the libsrtp setup SrtpSession uses, for its suites:
+//  - AEAD_AES_128_GCM and AEAD_AES_256_GCM (RFC 7714) through BoringSSL's
+//    EVP_AEAD, which runs on AES-NI and PCLMULQDQ where the CPU has them;
+//  - AES_CM_128_HMAC_SHA1_80 and _32 (RFC 3711) through AES-CTR and an
+//    HmacSha1Key, so the HMAC key schedule is done once per key.
+// Session keys are derived and the cipher contexts set up once in
+// SetSend()/SetRecv(); per packet there is a hash lookup for the SSRC,
+// skipped for runs of the same SSRC, and no allocation after the first
+// packet of a stream. Tags are written into the tailroom, so the buffer
+// is never reallocated.
+//
+// As with SrtpSession, one session protects or unprotects, not both.
+// Unprotecting keeps a replay window of 1024 packets per SSRC. Encrypted
+// header extensions (RFC 6904), MKIs and unencrypted SRTCP are not
+// supported. Not thread safe.
+class BatchSrtpSession {
+ public:
+  BatchSrtpSession();
+  ~BatchSrtpSession();
+
+  // Sets the crypto suite, an rtc::SRTP_* value, and the master key
+  // followed by the master salt. Returns false for an unsupported suite or
+  // a key of the wrong length. Forgets every stream seen so far.
+  bool SetSend(int crypto_suite, const uint8_t* key, size_t length);
+  bool SetRecv(int crypto_suite, const uint8_t* key, size_t length);
+
+  // Each returns how many of the |count| packets were processed and sets
+  // their |ok|. Failed packets keep their size, but an AES-GCM packet that
+  // fails authentication has been decrypted in place and is garbage.
+  size_t ProtectRtp(SrtpPacket* packets, size_t count);
+  size_t ProtectRtcp(SrtpPacket* packets, size_t count);
+  size_t UnprotectRtp(SrtpPacket* packets, size_t count);
+  size_t UnprotectRtcp(SrtpPacket* packets, size_t count);
+
+  // Bytes that protecting adds to an RTP or RTCP packet; 0 until a key is
+  // set.
+  size_t GetSrtpOverhead() const;
+  size_t GetSrtcpOverhead() const;
+
+ private:
+  struct Cipher;
+  struct Stream;
+
+  enum Direction { NONE, SEND, RECV };
+
+  bool SetKey(Direction direction,
+              int crypto_suite,
+              const uint8_t* key,
+              size_t length);
+  size_t Process(Direction direction,
+                 bool (BatchSrtpSession::*process)(SrtpPacket*),
+                 SrtpPacket* packets,
+                 size_t count);
+  // Stream of |ssrc|, or null if none has been seen.
+  Stream* FindStream(uint32_t ssrc);
+  Stream* AddStream(uint32_t ssrc, const Stream& stream);
+
+  bool ProtectRtpPacket(SrtpPacket* packet);
+  bool ProtectRtcpPacket(SrtpPacket* packet);
+  bool UnprotectRtpPacket(SrtpPacket* packet);
+  bool UnprotectRtcpPacket(SrtpPacket* packet);
+
+  Direction direction_ = NONE;
+  std::unique_ptr<Cipher> rtp_;
+  std::unique_ptr<Cipher> rtcp_;
+  std::unordered_map<uint32_t, std::unique_ptr<Stream>> streams_;
+  uint32_t last_ssrc_ = 0;
+  Stream* last_stream_ = nullptr;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(BatchSrtpSession);
+};
+
+}  // namespace simple_app
+
+#endif  // BATCH_SRTP_SESSION_H_
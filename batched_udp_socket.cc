@@ -0,0 +1,395 @@
+#include "batched_udp_socket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "errno_logging.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+namespace {
+
+size_t ToSockAddr(int family,
+                  const rtc::SocketAddress& addr,
+                  sockaddr_storage* saddr) {
+  return family == AF_INET6 ? addr.ToDualStackSockAddrStorage(saddr)
+                            : addr.ToSockAddrStorage(saddr);
+}
+
+}  // namespace
+
+const size_t BatchedUdpSocket::kMaxBatchSize;
+const size_t BatchedUdpSocket::kRecvSlotSize;
+
+BatchedUdpSocket* BatchedUdpSocket::Create(
+    rtc::PhysicalSocketServer* ss,
+    const rtc::SocketAddress& bind_address,
+    uint16_t min_port,
+    uint16_t max_port) {
+  int fd = OpenSocket(bind_address.family());
+  if (fd == INVALID_SOCKET)
+    return nullptr;
+
+  BatchedUdpSocket* socket = new BatchedUdpSocket(ss, fd);
+  if (socket->Bind(bind_address, min_port, max_port) < 0) {
+    LOG(LS_ERROR) << "UDP bind failed with error " << socket->GetError();
+    delete socket;
+    return nullptr;
+  }
+  ss->Add(socket);
+  return socket;
+}
+
+BatchedUdpSocket::BatchedUdpSocket(rtc::PhysicalSocketServer* ss, int fd)
+    : ss_(ss), fd_(fd) {}
+
+BatchedUdpSocket::~BatchedUdpSocket() {
+  if (destroyed_)
+    *destroyed_ = true;
+  Close();
+}
+
+rtc::SocketAddress BatchedUdpSocket::GetLocalAddress() const {
+  return local_address_;
+}
+
+rtc::SocketAddress BatchedUdpSocket::GetRemoteAddress() const {
+  return rtc::SocketAddress();
+}
+
+int BatchedUdpSocket::Send(const void* /* pv */,
+                           size_t /* cb */,
+                           const rtc::PacketOptions& /* options */) {
+  // UDP packet sockets are never connected.
+  error_ = ENOTCONN;
+  return -1;
+}
+
+int BatchedUdpSocket::SendTo(const void* pv,
+                             size_t cb,
+                             const rtc::SocketAddress& addr,
+                             const rtc::PacketOptions& options) {
+  sockaddr_storage saddr;
+  size_t len = ToSockAddr(local_address_.family(), addr, &saddr);
+  int ret = ::sendto(fd_, pv, cb, 0, reinterpret_cast<sockaddr*>(&saddr),
+                     static_cast<socklen_t>(len));
+  if (ret < 0) {
+    error_ = errno;
+    if (rtc::IsBlockingError(error_))
+      OnWouldBlock();
+    return -1;
+  }
+  SignalSentPacket(this, rtc::SentPacket(options.packet_id,
+                                         rtc::TimeMillis()));
+  return ret;
+}
+
+int BatchedUdpSocket::SendBatch(const OutgoingPacket* packets,
+                                size_t count) {
+  size_t sent = 0;
+#if defined(WEBRTC_LINUX)
+  mmsghdr msgs[kMaxBatchSize];
+  iovec iovs[kMaxBatchSize];
+  sockaddr_storage addrs[kMaxBatchSize];
+  while (sent < count) {
+    size_t batch = std::min(count - sent, kMaxBatchSize);
+    for (size_t i = 0; i < batch; ++i) {
+      const OutgoingPacket& packet = packets[sent + i];
+      iovs[i].iov_base = const_cast<void*>(packet.data);
+      iovs[i].iov_len = packet.size;
+      memset(&msgs[i], 0, sizeof(msgs[i]));
+      msgs[i].msg_hdr.msg_name = &addrs[i];
+      msgs[i].msg_hdr.msg_namelen = static_cast<socklen_t>(
+          ToSockAddr(local_address_.family(), packet.addr, &addrs[i]));
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int ret = ::sendmmsg(fd_, msgs, static_cast<unsigned int>(batch), 0);
+    if (ret < 0) {
+      error_ = errno;
+      if (rtc::IsBlockingError(error_))
+        OnWouldBlock();
+      break;
+    }
+    sent += ret;
+    if (static_cast<size_t>(ret) < batch)
+      break;
+  }
+#else
+  for (; sent < count; ++sent) {
+    const OutgoingPacket& packet = packets[sent];
+    sockaddr_storage saddr;
+    size_t len = ToSockAddr(local_address_.family(), packet.addr, &saddr);
+    if (::sendto(fd_, packet.data, packet.size, 0,
+                 reinterpret_cast<sockaddr*>(&saddr),
+                 static_cast<socklen_t>(len)) < 0) {
+      error_ = errno;
+      if (rtc::IsBlockingError(error_))
+        OnWouldBlock();
+      break;
+    }
+  }
+#endif  // WEBRTC_LINUX
+  if (sent == 0)
+    return -1;
+
+  const int64_t send_time_ms = rtc::TimeMillis();
+  for (size_t i = 0; i < sent; ++i) {
+    SignalSentPacket(
+        this, rtc::SentPacket(packets[i].options.packet_id, send_time_ms));
+  }
+  return static_cast<int>(sent);
+}
+
+int BatchedUdpSocket::Close() {
+  if (fd_ == INVALID_SOCKET)
+    return 0;
+  ss_->Remove(this);
+  int ret = ::close(fd_);
+  fd_ = INVALID_SOCKET;
+  want_write_ = false;
+  return ret;
+}
+
+rtc::AsyncPacketSocket::State BatchedUdpSocket::GetState() const {
+  return fd_ == INVALID_SOCKET ? STATE_CLOSED : STATE_BOUND;
+}
+
+int BatchedUdpSocket::GetOption(rtc::Socket::Option opt, int* value) {
+  int level;
+  int name;
+  switch (opt) {
+    case rtc::Socket::OPT_RCVBUF:
+      level = SOL_SOCKET;
+      name = SO_RCVBUF;
+      break;
+    case rtc::Socket::OPT_SNDBUF:
+      level = SOL_SOCKET;
+      name = SO_SNDBUF;
+      break;
+    default:
+      error_ = ENOTSUP;
+      return -1;
+  }
+  socklen_t len = sizeof(*value);
+  int ret = ::getsockopt(fd_, level, name, value, &len);
+  if (ret < 0)
+    error_ = errno;
+  return ret;
+}
+
+int BatchedUdpSocket::SetOption(rtc::Socket::Option opt, int value) {
+  int level;
+  int name;
+  switch (opt) {
+    case rtc::Socket::OPT_RCVBUF:
+      level = SOL_SOCKET;
+      name = SO_RCVBUF;
+      break;
+    case rtc::Socket::OPT_SNDBUF:
+      level = SOL_SOCKET;
+      name = SO_SNDBUF;
+      break;
+    case rtc::Socket::OPT_DSCP:
+      // The DSCP sits in the upper six bits of the TOS / traffic class byte.
+      value <<= 2;
+      if (local_address_.family() == AF_INET6) {
+        level = IPPROTO_IPV6;
+        name = IPV6_TCLASS;
+      } else {
+        level = IPPROTO_IP;
+        name = IP_TOS;
+      }
+      break;
+    default:
+      error_ = ENOTSUP;
+      return -1;
+  }
+  int ret = ::setsockopt(fd_, level, name, &value, sizeof(value));
+  if (ret < 0)
+    error_ = errno;
+  return ret;
+}
+
+int BatchedUdpSocket::GetError() const {
+  return error_;
+}
+
+void BatchedUdpSocket::SetError(int error) {
+  error_ = error;
+}
+
+uint32_t BatchedUdpSocket::GetRequestedEvents() {
+  if (fd_ == INVALID_SOCKET)
+    return 0;
+  return rtc::DE_READ | (want_write_ ? rtc::DE_WRITE : 0);
+}
+
+void BatchedUdpSocket::OnPreEvent(uint32_t /* ff */) {}
+
+void BatchedUdpSocket::OnEvent(uint32_t ff, int /* err */) {
+  if ((ff & rtc::DE_WRITE) && want_write_) {
+    want_write_ = false;
+    ss_->Update(this);
+    SignalReadyToSend(this);
+  }
+  if ((ff & rtc::DE_READ) && fd_ != INVALID_SOCKET)
+    ReadBatch();
+}
+
+int BatchedUdpSocket::GetDescriptor() {
+  return fd_;
+}
+
+bool BatchedUdpSocket::IsDescriptorClosed() {
+  // Datagram sockets have no peer that could close them.
+  return false;
+}
+
+int BatchedUdpSocket::OpenSocket(int family) {
+  int fd = ::socket(family, SOCK_DGRAM, 0);
+  if (fd == INVALID_SOCKET) {
+    LOG_WITH_ERRNO(LS_ERROR) << "UDP socket creation failed";
+    return INVALID_SOCKET;
+  }
+  if (::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+    LOG_WITH_ERRNO(LS_ERROR) << "Failed to make UDP socket non-blocking";
+    ::close(fd);
+    return INVALID_SOCKET;
+  }
+  return fd;
+}
+
+int BatchedUdpSocket::Bind(const rtc::SocketAddress& bind_address,
+                           uint16_t min_port,
+                           uint16_t max_port) {
+  if (min_port == 0 && max_port == 0)
+    min_port = max_port = bind_address.port();
+
+  int ret = -1;
+  for (uint32_t port = min_port; ret < 0 && port <= max_port; ++port) {
+    sockaddr_storage saddr;
+    size_t len = rtc::SocketAddress(bind_address.ipaddr(), port)
+                     .ToSockAddrStorage(&saddr);
+    ret = ::bind(fd_, reinterpret_cast<sockaddr*>(&saddr),
+                 static_cast<socklen_t>(len));
+  }
+  if (ret < 0) {
+    error_ = errno;
+    return ret;
+  }
+
+  sockaddr_storage saddr;
+  socklen_t len = sizeof(saddr);
+  if (::getsockname(fd_, reinterpret_cast<sockaddr*>(&saddr), &len) < 0 ||
+      !rtc::SocketAddressFromSockAddrStorage(saddr, &local_address_)) {
+    error_ = errno;
+    return -1;
+  }
+  return 0;
+}
+
+void BatchedUdpSocket::ReadBatch() {
+  if (!recv_slots_)
+    recv_slots_.reset(new char[kMaxBatchSize * kRecvSlotSize]);
+  char* const slots = recv_slots_.get();
+  sockaddr_storage addrs[kMaxBatchSize];
+  size_t sizes[kMaxBatchSize];
+  size_t count = 0;
+#if defined(WEBRTC_LINUX)
+  mmsghdr msgs[kMaxBatchSize];
+  iovec iovs[kMaxBatchSize];
+  for (size_t i = 0; i < kMaxBatchSize; ++i) {
+    iovs[i].iov_base = slots + i * kRecvSlotSize;
+    iovs[i].iov_len = kRecvSlotSize;
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  int ret = ::recvmmsg(fd_, msgs, kMaxBatchSize, MSG_DONTWAIT, nullptr);
+  if (ret < 0) {
+    error_ = errno;
+    if (!rtc::IsBlockingError(error_))
+      LOG_WITH_ERRNO(LS_WARNING) << "recvmmsg failed";
+    return;
+  }
+  for (int i = 0; i < ret; ++i) {
+    if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      LOG(LS_WARNING) << "Dropping datagram longer than " << kRecvSlotSize
+                      << " bytes";
+      // Empty datagrams carry nothing for ICE/RTP either, so zero doubles as
+      // the "skip" marker below.
+      sizes[i] = 0;
+      continue;
+    }
+    sizes[i] = msgs[i].msg_len;
+  }
+  count = ret;
+#else
+  for (; count < kMaxBatchSize; ++count) {
+    socklen_t len = sizeof(addrs[count]);
+    ssize_t ret = ::recvfrom(fd_, slots + count * kRecvSlotSize, kRecvSlotSize,
+                             MSG_DONTWAIT,
+                             reinterpret_cast<sockaddr*>(&addrs[count]),
+                             &len);
+    if (ret < 0) {
+      error_ = errno;
+      if (!rtc::IsBlockingError(error_))
+        LOG_WITH_ERRNO(LS_WARNING) << "recvfrom failed";
+      break;
+    }
+    sizes[count] = ret;
+  }
+#endif  // WEBRTC_LINUX
+
+  const rtc::PacketTime packet_time = rtc::CreatePacketTime(0);
+  bool destroyed = false;
+  destroyed_ = &destroyed;
+  for (size_t i = 0; i < count; ++i) {
+    rtc::SocketAddress remote_address;
+    if (sizes[i] == 0 ||
+        !rtc::SocketAddressFromSockAddrStorage(addrs[i], &remote_address)) {
+      continue;
+    }
+    SignalReadPacket(this, slots + i * kRecvSlotSize, sizes[i],
+                     remote_address, packet_time);
+    // The handler may have closed or deleted the socket.
+    if (destroyed)
+      return;
+    if (fd_ == INVALID_SOCKET)
+      break;
+  }
+  destroyed_ = nullptr;
+}
+
+void BatchedUdpSocket::OnWouldBlock() {
+  if (want_write_)
+    return;
+  want_write_ = true;
+  ss_->Update(this);
+}
+
+BatchedPacketSocketFactory::BatchedPacketSocketFactory(
+    rtc::PhysicalSocketServer* ss)
+    : rtc::BasicPacketSocketFactory(ss), ss_(ss) {}
+
+BatchedPacketSocketFactory::~BatchedPacketSocketFactory() {}
+
+rtc::AsyncPacketSocket* BatchedPacketSocketFactory::CreateUdpSocket(
+    const rtc::SocketAddress& address,
+    uint16_t min_port,
+    uint16_t max_port) {
+  return BatchedUdpSocket::Create(ss_, address, min_port, max_port);
+}
+
+}  // namespace simple_app
@@ -0,0 +1,127 @@
+#ifndef BATCHED_UDP_SOCKET_H_
+#define BATCHED_UDP_SOCKET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+
+#include "p2p/base/basicpacketsocketfactory.h"
+#include "rtc_base/asyncpacketsocket.h"
+#include "rtc_base/physicalsocketserver.h"
+#include "rtc_base/socketaddress.h"
+
+namespace simple_app {
+
+// UDP packet socket that registers its descriptor directly with a
+// PhysicalSocketServer instead of going through PhysicalSocket. Every read
+// event drains up to |kMaxBatchSize| datagrams with a single recvmmsg(2), and
+// SendBatch() hands a burst to the kernel with a single sendmmsg(2). Where the
+// mmsg calls are unavailable both fall back to a recvfrom/sendto loop, so the
+// behaviour is the same, only the syscall count differs.
+//
+// Received datagrams are still delivered one by one through SignalReadPacket,
+// so Ports and TurnServer can consume this socket unchanged.
+class BatchedUdpSocket : public rtc::AsyncPacketSocket,
+                         public rtc::Dispatcher {
+ public:
+  static const size_t kMaxBatchSize = 32;
+  // Large enough for anything that fits an Ethernet MTU, including TURN
+  // ChannelData and DTLS handshake fragments. Longer datagrams are dropped.
+  static const size_t kRecvSlotSize = 4096;
+
+  struct OutgoingPacket {
+    const void* data;
+    size_t size;
+    rtc::SocketAddress addr;
+    rtc::PacketOptions options;
+  };
+
+  // Creates a non-blocking UDP socket bound to |bind_address| with a port in
+  // [|min_port|, |max_port|] (any port when both are zero) and registers it
+  // with |ss|. Returns null on failure.
+  static BatchedUdpSocket* Create(rtc::PhysicalSocketServer* ss,
+                                  const rtc::SocketAddress& bind_address,
+                                  uint16_t min_port,
+                                  uint16_t max_port);
+  ~BatchedUdpSocket() override;
+
+  // AsyncPacketSocket:
+  rtc::SocketAddress GetLocalAddress() const override;
+  rtc::SocketAddress GetRemoteAddress() const override;
+  int Send(const void* pv,
+           size_t cb,
+           const rtc::PacketOptions& options) override;
+  int SendTo(const void* pv,
+             size_t cb,
+             const rtc::SocketAddress& addr,
+             const rtc::PacketOptions& options) override;
+  int Close() override;
+  State GetState() const override;
+  int GetOption(rtc::Socket::Option opt, int* value) override;
+  int SetOption(rtc::Socket::Option opt, int value) override;
+  int GetError() const override;
+  void SetError(int error) override;
+
+  // Sends |count| packets, up to |kMaxBatchSize| per syscall. Returns the
+  // number of packets the kernel accepted, or -1 if none were accepted.
+  // SignalSentPacket fires once per accepted packet with its own packet_id.
+  int SendBatch(const OutgoingPacket* packets, size_t count);
+
+  // Dispatcher:
+  uint32_t GetRequestedEvents() override;
+  void OnPreEvent(uint32_t ff) override;
+  void OnEvent(uint32_t ff, int err) override;
+  int GetDescriptor() override;
+  bool IsDescriptorClosed() override;
+
+ protected:
+  BatchedUdpSocket(rtc::PhysicalSocketServer* ss, int fd);
+
+  // Returns a non-blocking datagram socket of |family|, or INVALID_SOCKET.
+  static int OpenSocket(int family);
+
+  int Bind(const rtc::SocketAddress& bind_address,
+           uint16_t min_port,
+           uint16_t max_port);
+
+  rtc::PhysicalSocketServer* socket_server() const { return ss_; }
+
+ private:
+  void ReadBatch();
+  void OnWouldBlock();
+
+  rtc::PhysicalSocketServer* const ss_;
+  int fd_;
+  int error_ = 0;
+  bool want_write_ = false;
+  rtc::SocketAddress local_address_;
+  // |kMaxBatchSize| slots of |kRecvSlotSize| bytes, allocated on the first
+  // read.
+  std::unique_ptr<char[]> recv_slots_;
+  // Set by the destructor while ReadBatch() delivers packets, since a
+  // SignalReadPacket handler may delete the socket.
+  bool* destroyed_ = nullptr;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(BatchedUdpSocket);
+};
+
+// Packet socket factory that hands out BatchedUdpSocket for UDP and keeps the
+// stock TCP sockets. |ss| must be the socket server of the network thread
+// that will use the sockets.
+class BatchedPacketSocketFactory : public rtc::BasicPacketSocketFactory {
+ public:
+  explicit BatchedPacketSocketFactory(rtc::PhysicalSocketServer* ss);
+  ~BatchedPacketSocketFactory() override;
+
+  rtc::AsyncPacketSocket* CreateUdpSocket(const rtc::SocketAddress& address,
+                                          uint16_t min_port,
+                                          uint16_t max_port) override;
+
+ private:
+  rtc::PhysicalSocketServer* const ss_;
+};
+
+}  // namespace simple_app
+
+#endif  // BATCHED_UDP_SOCKET_H_
@@ -0,0 +1,185 @@
+#include "budgeted_port_allocator.h"
+
+#include "p2p/base/port.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/thread.h"
+#include "rtc_base/timeutils.h"
+#include "rtc_base/trace_event.h"
+
+namespace simple_app {
+
+namespace {
+
+// Above BasicPortAllocatorSession's own message IDs.
+const uint32_t MSG_BUDGET_EXPIRED = 1000;
+
+const char* const kCandidateTypes[] = {
+    cricket::LOCAL_PORT_TYPE, cricket::STUN_PORT_TYPE,
+    cricket::PRFLX_PORT_TYPE, cricket::RELAY_PORT_TYPE};
+
+}  // namespace
+
+BudgetedPortAllocator::BudgetedPortAllocator(
+    rtc::NetworkManager* network_manager,
+    rtc::PacketSocketFactory* socket_factory,
+    const Config& config)
+    : cricket::BasicPortAllocator(network_manager, socket_factory),
+      config_(config) {}
+
+BudgetedPortAllocator::~BudgetedPortAllocator() {}
+
+cricket::PortAllocatorSession* BudgetedPortAllocator::CreateSessionInternal(
+    const std::string& content_name,
+    int component,
+    const std::string& ice_ufrag,
+    const std::string& ice_pwd) {
+  // Here rather than in the constructor: PeerConnection sets the step delay
+  // to kMinimumStepDelay once it has the allocator, and the sessions read it
+  // from the allocator as they go.
+  set_step_delay(0);
+  return new BudgetedPortAllocatorSession(this, content_name, component,
+                                          ice_ufrag, ice_pwd);
+}
+
+BudgetedPortAllocatorSession::BudgetedPortAllocatorSession(
+    BudgetedPortAllocator* allocator,
+    const std::string& content_name,
+    int component,
+    const std::string& ice_ufrag,
+    const std::string& ice_pwd)
+    : cricket::BasicPortAllocatorSession(allocator,
+                                         content_name,
+                                         component,
+                                         ice_ufrag,
+                                         ice_pwd),
+      budgeted_allocator_(allocator) {
+  SignalCandidatesReady.connect(
+      this, &BudgetedPortAllocatorSession::OnCandidatesReady);
+  SignalCandidatesAllocationDone.connect(
+      this, &BudgetedPortAllocatorSession::OnCandidatesAllocationDone);
+}
+
+BudgetedPortAllocatorSession::~BudgetedPortAllocatorSession() {
+  network_thread()->Clear(this, MSG_BUDGET_EXPIRED);
+}
+
+void BudgetedPortAllocatorSession::StartGettingPorts() {
+  start_us_ = rtc::TimeMicros();
+  gathering_ = true;
+  budget_expired_ = false;
+  timeline_.clear();
+  TRACE_EVENT_ASYNC_BEGIN2("webrtc", "IceGathering", this, "content",
+                           TRACE_STR_COPY(content_name().c_str()),
+                           "component", component());
+  Record(MakeEvent(GatheringEvent::STARTED));
+
+  const int budget_ms = budgeted_allocator_->config().budget_ms;
+  if (budget_ms > 0) {
+    network_thread()->Clear(this, MSG_BUDGET_EXPIRED);
+    network_thread()->PostDelayed(RTC_FROM_HERE, budget_ms, this,
+                                  MSG_BUDGET_EXPIRED);
+  }
+  cricket::BasicPortAllocatorSession::StartGettingPorts();
+}
+
+void BudgetedPortAllocatorSession::StopGettingPorts() {
+  network_thread()->Clear(this, MSG_BUDGET_EXPIRED);
+  cricket::BasicPortAllocatorSession::StopGettingPorts();
+}
+
+void BudgetedPortAllocatorSession::ClearGettingPorts() {
+  network_thread()->Clear(this, MSG_BUDGET_EXPIRED);
+  cricket::BasicPortAllocatorSession::ClearGettingPorts();
+}
+
+void BudgetedPortAllocatorSession::OnMessage(rtc::Message* message) {
+  if (message->message_id != MSG_BUDGET_EXPIRED) {
+    cricket::BasicPortAllocatorSession::OnMessage(message);
+    return;
+  }
+  if (!gathering_ || CandidatesAllocationDone())
+    return;
+  budget_expired_ = true;
+  TRACE_EVENT_INSTANT1("webrtc", "IceGathering::BudgetExpired", "content",
+                       TRACE_STR_COPY(content_name().c_str()));
+  Record(MakeEvent(GatheringEvent::BUDGET_EXPIRED));
+  LOG(LS_INFO) << "Gathering for " << content_name() << ":" << component()
+               << " ran out of its "
+               << budgeted_allocator_->config().budget_ms
+               << " ms budget; clearing.";
+  // Marks the ports still allocating as failed and, once that has run,
+  // signals allocation done. Unlike StopGettingPorts(), leaves the session
+  // free to gather again under continual gathering.
+  ClearGettingPorts();
+}
+
+void BudgetedPortAllocatorSession::OnCandidatesReady(
+    cricket::PortAllocatorSession* /* session */,
+    const std::vector<cricket::Candidate>& candidates) {
+  if (!gathering_)
+    return;
+  for (const cricket::Candidate& candidate : candidates) {
+    GatheringEvent event = MakeEvent(GatheringEvent::CANDIDATE);
+    event.candidate_type = candidate.type();
+    event.protocol = candidate.protocol();
+    event.relay_protocol = candidate.relay_protocol();
+    event.network_name = candidate.network_name();
+    TRACE_EVENT_INSTANT2("webrtc", "IceGathering::Candidate", "type",
+                         TRACE_STR_COPY(candidate.type().c_str()),
+                         "protocol",
+                         TRACE_STR_COPY(candidate.protocol().c_str()));
+    Record(event);
+  }
+}
+
+void BudgetedPortAllocatorSession::OnCandidatesAllocationDone(
+    cricket::PortAllocatorSession* /* session */) {
+  if (!gathering_)
+    return;
+  gathering_ = false;
+  network_thread()->Clear(this, MSG_BUDGET_EXPIRED);
+  TRACE_EVENT_ASYNC_END1("webrtc", "IceGathering", this, "budget_expired",
+                         budget_expired_);
+  Record(MakeEvent(GatheringEvent::COMPLETE));
+  LogSummary();
+}
+
+GatheringEvent BudgetedPortAllocatorSession::MakeEvent(
+    GatheringEvent::Type type) const {
+  GatheringEvent event;
+  event.type = type;
+  event.elapsed_us = rtc::TimeMicros() - start_us_;
+  event.content_name = content_name();
+  event.component = component();
+  return event;
+}
+
+void BudgetedPortAllocatorSession::Record(const GatheringEvent& event) {
+  timeline_.push_back(event);
+  budgeted_allocator_->SignalGatheringEvent(event);
+}
+
+void BudgetedPortAllocatorSession::LogSummary() const {
+  size_t candidates = 0;
+  for (const GatheringEvent& event : timeline_) {
+    if (event.type == GatheringEvent::CANDIDATE)
+      ++candidates;
+  }
+  std::string firsts;
+  for (const char* type : kCandidateTypes) {
+    for (const GatheringEvent& event : timeline_) {
+      if (event.type == GatheringEvent::CANDIDATE &&
+          event.candidate_type == type) {
+        firsts += " first " + event.candidate_type + " " +
+                  std::to_string(event.elapsed_us / 1000) + " ms;";
+        break;
+      }
+    }
+  }
+  LOG(LS_INFO) << "Gathering for " << content_name() << ":" << component()
+               << " took " << timeline_.back().elapsed_us / 1000 << " ms,"
+               << (budget_expired_ ? " cut short by its budget," : "")
+               << firsts << " " << candidates << " candidates.";
+}
+
+}  // namespace simple_app
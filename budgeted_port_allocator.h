@@ -0,0 +1,120 @@
+#ifndef BUDGETED_PORT_ALLOCATOR_H_
+#define BUDGETED_PORT_ALLOCATOR_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "p2p/base/packetsocketfactory.h"
+#include "p2p/client/basicportallocator.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/network.h"
+#include "rtc_base/sigslot.h"
+
+namespace simple_app {
+
+// One step of a gathering session, timed from StartGettingPorts().
+struct GatheringEvent {
+  enum Type { STARTED, CANDIDATE, BUDGET_EXPIRED, COMPLETE };
+
+  Type type;
+  int64_t elapsed_us;
+  std::string content_name;
+  int component;
+  // For CANDIDATE: cricket::LOCAL_PORT_TYPE and so on, the candidate's
+  // protocol, the protocol to the TURN server for relay candidates, and
+  // the network.
+  std::string candidate_type;
+  std::string protocol;
+  std::string relay_protocol;
+  std::string network_name;
+};
+
+// BasicPortAllocator that gathers everything at once and within a time
+// budget. BasicPortAllocatorSession runs each network's allocation in
+// phases, UDP and STUN, then relay, then TCP, then SSL TCP, one step delay
+// apart (kDefaultStepDelay, a second). Here the step delay is zero, so the
+// phases of every network start together; each phase already creates its
+// ports, and resolves their STUN and TURN servers, concurrently.
+//
+// When |budget_ms| passes before gathering completes, the session's ports
+// are cleared: those still allocating are given up, and the candidates so
+// far are reported complete, so call setup does not wait on a slow or
+// unreachable TURN server. As with ClearGettingPorts(), a session that
+// gathers continually may still gather later.
+//
+// Each session reports its timeline through SignalGatheringEvent and as
+// "webrtc" TRACE_EVENTs, for TraceRecorder, and logs the time to the first
+// candidate of each type when done. Used on the network thread; the
+// session's regathering metrics that BasicPortAllocator records are not
+// kept.
+class BudgetedPortAllocator : public cricket::BasicPortAllocator {
+ public:
+  struct Config {
+    // 0 waits for every port, as BasicPortAllocator does.
+    int budget_ms = 3000;
+  };
+
+  BudgetedPortAllocator(rtc::NetworkManager* network_manager,
+                        rtc::PacketSocketFactory* socket_factory,
+                        const Config& config);
+  ~BudgetedPortAllocator() override;
+
+  const Config& config() const { return config_; }
+
+  cricket::PortAllocatorSession* CreateSessionInternal(
+      const std::string& content_name,
+      int component,
+      const std::string& ice_ufrag,
+      const std::string& ice_pwd) override;
+
+  sigslot::signal1<const GatheringEvent&> SignalGatheringEvent;
+
+ private:
+  const Config config_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(BudgetedPortAllocator);
+};
+
+// The session BudgetedPortAllocator creates.
+class BudgetedPortAllocatorSession : public cricket::BasicPortAllocatorSession {
+ public:
+  BudgetedPortAllocatorSession(BudgetedPortAllocator* allocator,
+                               const std::string& content_name,
+                               int component,
+                               const std::string& ice_ufrag,
+                               const std::string& ice_pwd);
+  ~BudgetedPortAllocatorSession() override;
+
+  void StartGettingPorts() override;
+  void StopGettingPorts() override;
+  void ClearGettingPorts() override;
+
+  // Everything since the last StartGettingPorts().
+  const std::vector<GatheringEvent>& timeline() const { return timeline_; }
+  bool budget_expired() const { return budget_expired_; }
+
+ protected:
+  void OnMessage(rtc::Message* message) override;
+
+ private:
+  void OnCandidatesReady(cricket::PortAllocatorSession* session,
+                         const std::vector<cricket::Candidate>& candidates);
+  void OnCandidatesAllocationDone(cricket::PortAllocatorSession* session);
+  GatheringEvent MakeEvent(GatheringEvent::Type type) const;
+  void Record(const GatheringEvent& event);
+  void LogSummary() const;
+
+  BudgetedPortAllocator* const budgeted_allocator_;
+  int64_t start_us_ = 0;
+  bool gathering_ = false;
+  bool budget_expired_ = false;
+  std::vector<GatheringEvent> timeline_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(BudgetedPortAllocatorSession);
+};
+
+}  // namespace simple_app
+
+#endif  // BUDGETED_PORT_ALLOCATOR_H_
@@ -0,0 +1,919 @@
+#include "bulk_sctp_transport.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include "errno_logging.h"
+#include "p2p/base/dtlstransportinternal.h"
+#include "rtc_base/bind.h"
+#include "rtc_base/byteorder.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/safe_conversions.h"
+#include "usrsctplib/usrsctp.h"
+
+namespace simple_app {
+
+namespace {
+
+// The PPIDs of RFC 8831, as cricket::SctpTransport uses them.
+enum PayloadProtocolIdentifier {
+  PPID_NONE = 0,
+  PPID_CONTROL = 50,
+  PPID_TEXT_LAST = 51,
+  PPID_BINARY_PARTIAL = 52,
+  PPID_BINARY_LAST = 53,
+  PPID_TEXT_PARTIAL = 54,
+};
+
+// As cricket::SctpTransport, to stay below the DTLS and SRTP overheads on a
+// 1280 byte IPv6 path without MTU discovery.
+const uint32_t kSctpMtu = 1200;
+
+uint32_t GetPpid(cricket::DataMessageType type) {
+  switch (type) {
+    case cricket::DMT_CONTROL:
+      return PPID_CONTROL;
+    case cricket::DMT_BINARY:
+      return PPID_BINARY_LAST;
+    case cricket::DMT_TEXT:
+      return PPID_TEXT_LAST;
+    default:
+      return PPID_NONE;
+  }
+}
+
+bool GetDataMessageType(uint32_t ppid, cricket::DataMessageType* type) {
+  switch (ppid) {
+    case PPID_BINARY_PARTIAL:
+    case PPID_BINARY_LAST:
+      *type = cricket::DMT_BINARY;
+      return true;
+    case PPID_TEXT_PARTIAL:
+    case PPID_TEXT_LAST:
+      *type = cricket::DMT_TEXT;
+      return true;
+    case PPID_CONTROL:
+      *type = cricket::DMT_CONTROL;
+      return true;
+    case PPID_NONE:
+      *type = cricket::DMT_NONE;
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+// usrsctp's process-wide state: its initialization, counted across
+// transports, and the static callbacks, which find their transport in a
+// registry so that none is called once it has closed its socket.
+class BulkSctpTransport::UsrSctp {
+ public:
+  static void Acquire(const SctpTuning& tuning) {
+    rtc::GlobalLockScope lock(&usage_lock_);
+    if (usage_count_++ > 0)
+      return;
+    usrsctp_init(0, &OnSctpOutboundPacket, &DebugPrintf);
+    // As cricket::SctpTransport.
+    usrsctp_sysctl_set_sctp_ecn_enable(0);
+    usrsctp_sysctl_set_sctp_nr_outgoing_streams_default(
+        cricket::kMaxSctpStreams);
+    usrsctp_sysctl_set_sctp_default_cc_module(tuning.congestion_control);
+    usrsctp_sysctl_set_sctp_initial_cwnd(tuning.initial_cwnd);
+  }
+
+  static void Release() {
+    rtc::GlobalLockScope lock(&usage_lock_);
+    if (--usage_count_ > 0)
+      return;
+    // usrsctp_finish() fails while the closed sockets are still being torn
+    // down; cricket::SctpTransport gives it 3 seconds.
+    for (int i = 0; i < 300; ++i) {
+      if (usrsctp_finish() == 0)
+        return;
+      rtc::Thread::SleepMs(10);
+    }
+    LOG(LS_ERROR) << "Failed to shut down usrsctp.";
+  }
+
+  static void Register(BulkSctpTransport* transport, struct socket* sock) {
+    rtc::GlobalLockScope lock(&lock_);
+    transports()[sock] = transport;
+    addresses().insert(transport);
+  }
+
+  static void Unregister(BulkSctpTransport* transport, struct socket* sock) {
+    rtc::GlobalLockScope lock(&lock_);
+    transports().erase(sock);
+    addresses().erase(transport);
+  }
+
+ private:
+  typedef std::unordered_map<struct socket*, BulkSctpTransport*> TransportMap;
+  typedef std::unordered_set<const void*> AddressSet;
+
+  // The transports by socket, for the socket callbacks, and as the
+  // addresses the outbound callback is called with.
+  static TransportMap& transports() {
+    static TransportMap* transports = new TransportMap();
+    return *transports;
+  }
+  static AddressSet& addresses() {
+    static AddressSet* addresses = new AddressSet();
+    return *addresses;
+  }
+
+  // Called for each packet, with the address the transport registered.
+  static int OnSctpOutboundPacket(void* addr,
+                                  void* data,
+                                  size_t length,
+                                  uint8_t /* tos */,
+                                  uint8_t /* set_df */) {
+    rtc::GlobalLockScope lock(&lock_);
+    if (addresses().count(addr)) {
+      static_cast<BulkSctpTransport*>(addr)->QueueOutboundPacket(data,
+                                                                 length);
+    }
+    return 0;
+  }
+
+  // Called with data or a notification; |data| is ours to free.
+  static int OnSctpInboundPacket(struct socket* sock,
+                                 union sctp_sockstore /* addr */,
+                                 void* data,
+                                 size_t length,
+                                 struct sctp_rcvinfo info,
+                                 int flags,
+                                 void* /* ulp_info */) {
+    {
+      rtc::GlobalLockScope lock(&lock_);
+      auto it = transports().find(sock);
+      if (it != transports().end())
+        it->second->QueueInboundPiece(data, length, info, flags);
+    }
+    free(data);
+    return 1;
+  }
+
+  // Called when the socket has more than |send_piece| bytes of free send
+  // space.
+  static int OnSendThreshold(struct socket* sock, uint32_t /* sb_free */) {
+    rtc::GlobalLockScope lock(&lock_);
+    auto it = transports().find(sock);
+    if (it != transports().end())
+      it->second->QueueSendSpace();
+    return 0;
+  }
+
+  static void DebugPrintf(const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    LOG(LS_INFO) << "SCTP: " << buffer;
+  }
+
+  // Separate, since usrsctp_finish() waits for callbacks that take
+  // |lock_|.
+  static rtc::GlobalLockPod usage_lock_;
+  static int usage_count_;
+  static rtc::GlobalLockPod lock_;
+
+  friend class BulkSctpTransport;
+};
+
+rtc::GlobalLockPod BulkSctpTransport::UsrSctp::usage_lock_;
+int BulkSctpTransport::UsrSctp::usage_count_ = 0;
+rtc::GlobalLockPod BulkSctpTransport::UsrSctp::lock_;
+
+BulkSctpTransport::BulkSctpTransport(rtc::Thread* network_thread,
+                                     rtc::PacketTransportInternal* channel,
+                                     const SctpTuning& tuning)
+    : network_thread_(network_thread),
+      tuning_(tuning),
+      transport_channel_(channel),
+      local_port_(cricket::kSctpDefaultPort),
+      remote_port_(cricket::kSctpDefaultPort) {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  RTC_DCHECK(channel);
+  ConnectTransportChannelSignals();
+}
+
+BulkSctpTransport::~BulkSctpTransport() {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  // Also stops the callbacks, so nothing queues or posts past this point.
+  CloseSctpSocket();
+}
+
+void BulkSctpTransport::SetTransportChannel(
+    rtc::PacketTransportInternal* channel) {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  RTC_DCHECK(channel);
+  DisconnectTransportChannelSignals();
+  transport_channel_ = channel;
+  ConnectTransportChannelSignals();
+}
+
+bool BulkSctpTransport::Start(int local_sctp_port, int remote_sctp_port) {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  if (local_sctp_port == -1)
+    local_sctp_port = cricket::kSctpDefaultPort;
+  if (remote_sctp_port == -1)
+    remote_sctp_port = cricket::kSctpDefaultPort;
+  if (started_) {
+    if (local_sctp_port != local_port_ || remote_sctp_port != remote_port_) {
+      LOG(LS_ERROR) << debug_name_
+                    << "->Start(): Can't change SCTP ports once started.";
+      return false;
+    }
+    return true;
+  }
+  local_port_ = local_sctp_port;
+  remote_port_ = remote_sctp_port;
+  started_ = true;
+  // Once DTLS is up; OnWritableState() connects otherwise.
+  if (was_ever_writable_)
+    return Connect();
+  return true;
+}
+
+bool BulkSctpTransport::OpenStream(int sid) {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  if (sid > cricket::kMaxSctpSid) {
+    LOG(LS_WARNING) << debug_name_ << "->OpenStream(...): Not adding data "
+                    << "stream with sid=" << sid << " because sid is too high.";
+    return false;
+  }
+  if (open_streams_.count(sid)) {
+    LOG(LS_WARNING) << debug_name_ << "->OpenStream(...): Not adding data "
+                    << "stream with sid=" << sid
+                    << " because stream is already open.";
+    return false;
+  }
+  if (queued_reset_streams_.count(sid) || sent_reset_streams_.count(sid)) {
+    LOG(LS_WARNING) << debug_name_ << "->OpenStream(...): Not adding data "
+                    << " stream with sid=" << sid
+                    << " because stream is still closing.";
+    return false;
+  }
+  open_streams_.insert(sid);
+  return true;
+}
+
+bool BulkSctpTransport::ResetStream(int sid) {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  StreamSet::iterator found = open_streams_.find(sid);
+  if (found == open_streams_.end()) {
+    LOG(LS_WARNING) << debug_name_ << "->ResetStream(" << sid << "): "
+                    << "stream not found.";
+    return false;
+  }
+  open_streams_.erase(found);
+  queued_reset_streams_.insert(sid);
+  SendQueuedStreamResets();
+  Flush();
+  return true;
+}
+
+bool BulkSctpTransport::SendData(const cricket::SendDataParams& params,
+                                 const rtc::CopyOnWriteBuffer& payload,
+                                 cricket::SendDataResult* result) {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  if (result)
+    *result = cricket::SDR_ERROR;
+  if (!sock_) {
+    LOG(LS_WARNING) << debug_name_ << "->SendData(...): "
+                    << "Not sending packet with sid=" << params.sid
+                    << " len=" << payload.size() << " before Start().";
+    return false;
+  }
+  if (params.type != cricket::DMT_CONTROL &&
+      open_streams_.find(params.sid) == open_streams_.end()) {
+    LOG(LS_WARNING) << debug_name_ << "->SendData(...): "
+                    << "Not sending data because sid is unknown: "
+                    << params.sid;
+    return false;
+  }
+  if (pending_) {
+    ready_to_send_data_ = false;
+    if (result)
+      *result = cricket::SDR_BLOCK;
+    return false;
+  }
+
+  pending_.reset(new PendingMessage());
+  pending_->params = params;
+  pending_->payload = payload;
+  const bool ok = ContinuePendingMessage();
+  Flush();
+  if (!ok)
+    return false;
+  if (pending_ && pending_->sent == 0) {
+    // Not a byte of it fit; the caller keeps it and tries again on
+    // SignalReadyToSendData.
+    pending_.reset();
+    ready_to_send_data_ = false;
+    if (result)
+      *result = cricket::SDR_BLOCK;
+    return false;
+  }
+  if (result)
+    *result = cricket::SDR_SUCCESS;
+  return true;
+}
+
+bool BulkSctpTransport::ReadyToSendData() {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  return ready_to_send_data_;
+}
+
+void BulkSctpTransport::ConnectTransportChannelSignals() {
+  transport_channel_->SignalWritableState.connect(
+      this, &BulkSctpTransport::OnWritableState);
+  transport_channel_->SignalReadPacket.connect(
+      this, &BulkSctpTransport::OnPacketRead);
+}
+
+void BulkSctpTransport::DisconnectTransportChannelSignals() {
+  transport_channel_->SignalWritableState.disconnect(this);
+  transport_channel_->SignalReadPacket.disconnect(this);
+}
+
+void BulkSctpTransport::OnWritableState(
+    rtc::PacketTransportInternal* transport) {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  if (!was_ever_writable_ && transport->writable()) {
+    was_ever_writable_ = true;
+    if (started_)
+      Connect();
+  }
+}
+
+void BulkSctpTransport::OnPacketRead(
+    rtc::PacketTransportInternal* /* transport */,
+    const char* data,
+    size_t length,
+    const rtc::PacketTime& /* packet_time */,
+    int flags) {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  // SRTP shares the DTLS transport; only the rest is SCTP.
+  if (flags & cricket::PF_SRTP_BYPASS)
+    return;
+  if (!sock_)
+    return;
+  // Any data and SACKs this packet produces are queued during the call,
+  // and handed on together.
+  usrsctp_conninput(this, data, length, 0);
+  Flush();
+}
+
+bool BulkSctpTransport::Connect() {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  if (sock_) {
+    LOG(LS_ERROR) << debug_name_ << "->Connect(): "
+                  << "Ignoring attempt to re-create existing socket.";
+    return false;
+  }
+  if (!OpenSctpSocket())
+    return false;
+
+  sockaddr_conn local = {};
+  sockaddr_conn remote = {};
+  local.sconn_family = remote.sconn_family = AF_CONN;
+#if defined(__APPLE__) || defined(__Bitrig__) || defined(__DragonFly__) || \
+    defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+  local.sconn_len = remote.sconn_len = sizeof(sockaddr_conn);
+#endif
+  local.sconn_port = rtc::HostToNetwork16(local_port_);
+  remote.sconn_port = rtc::HostToNetwork16(remote_port_);
+  local.sconn_addr = remote.sconn_addr = this;
+  if (usrsctp_bind(sock_, reinterpret_cast<sockaddr*>(&local),
+                   sizeof(local)) < 0) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->Connect(): "
+                             << "Failed usrsctp_bind";
+    CloseSctpSocket();
+    return false;
+  }
+  if (usrsctp_connect(sock_, reinterpret_cast<sockaddr*>(&remote),
+                      sizeof(remote)) < 0 &&
+      errno != EINPROGRESS) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->Connect(): "
+                             << "Failed usrsctp_connect";
+    CloseSctpSocket();
+    return false;
+  }
+  // Only once bound: a fixed MTU, without discovery.
+  sctp_paddrparams params;
+  memset(&params, 0, sizeof(params));
+  params.spp_assoc_id = 0;
+  params.spp_flags = SPP_PMTUD_DISABLE;
+  params.spp_pathmtu = kSctpMtu;
+  if (usrsctp_setsockopt(sock_, IPPROTO_SCTP, SCTP_PEER_ADDR_PARAMS, &params,
+                         sizeof(params))) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->Connect(): "
+                             << "Failed to set SCTP_PEER_ADDR_PARAMS.";
+  }
+  // The INIT is queued by now.
+  Flush();
+  // A new association starts with empty queues.
+  SetReadyToSendData();
+  return true;
+}
+
+bool BulkSctpTransport::OpenSctpSocket() {
+  UsrSctp::Acquire(tuning_);
+  sock_ = usrsctp_socket(
+      AF_CONN, SOCK_STREAM, IPPROTO_SCTP, &UsrSctp::OnSctpInboundPacket,
+      &UsrSctp::OnSendThreshold,
+      rtc::checked_cast<uint32_t>(tuning_.send_piece), this);
+  if (!sock_) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->OpenSctpSocket(): "
+                             << "Failed to create SCTP socket.";
+    UsrSctp::Release();
+    return false;
+  }
+  UsrSctp::Register(this, sock_);
+  if (!ConfigureSctpSocket()) {
+    CloseSctpSocket();
+    return false;
+  }
+  // Packets for this transport's association come back to it through
+  // |this| as their address.
+  usrsctp_register_address(this);
+  return true;
+}
+
+bool BulkSctpTransport::ConfigureSctpSocket() {
+  if (usrsctp_set_non_blocking(sock_, 1) < 0) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->ConfigureSctpSocket(): "
+                             << "Failed to set SCTP to non blocking.";
+    return false;
+  }
+  // Makes usrsctp_close() abort the association rather than linger, so
+  // usrsctp stops calling back with |this|.
+  linger linger_opt;
+  linger_opt.l_onoff = 1;
+  linger_opt.l_linger = 0;
+  if (usrsctp_setsockopt(sock_, SOL_SOCKET, SO_LINGER, &linger_opt,
+                         sizeof(linger_opt))) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->ConfigureSctpSocket(): "
+                             << "Failed to set SO_LINGER.";
+    return false;
+  }
+  if (usrsctp_setsockopt(sock_, SOL_SOCKET, SO_SNDBUF, &tuning_.send_buffer,
+                         sizeof(tuning_.send_buffer)) ||
+      usrsctp_setsockopt(sock_, SOL_SOCKET, SO_RCVBUF,
+                         &tuning_.receive_buffer,
+                         sizeof(tuning_.receive_buffer))) {
+    LOG_WITH_ERRNO(LS_WARNING) << debug_name_ << "->ConfigureSctpSocket(): "
+                               << "Failed to set the socket buffers.";
+  }
+
+  sctp_assoc_value stream_reset;
+  stream_reset.assoc_id = SCTP_ALL_ASSOC;
+  stream_reset.assoc_value = 1;
+  if (usrsctp_setsockopt(sock_, IPPROTO_SCTP, SCTP_ENABLE_STREAM_RESET,
+                         &stream_reset, sizeof(stream_reset))) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->ConfigureSctpSocket(): "
+                             << "Failed to set SCTP_ENABLE_STREAM_RESET.";
+    return false;
+  }
+  sctp_assoc_value max_burst;
+  max_burst.assoc_id = SCTP_ALL_ASSOC;
+  max_burst.assoc_value = tuning_.max_burst;
+  if (usrsctp_setsockopt(sock_, IPPROTO_SCTP, SCTP_MAX_BURST, &max_burst,
+                         sizeof(max_burst))) {
+    LOG_WITH_ERRNO(LS_WARNING) << debug_name_ << "->ConfigureSctpSocket(): "
+                               << "Failed to set SCTP_MAX_BURST.";
+  }
+  sctp_sack_info sack;
+  sack.sack_assoc_id = SCTP_ALL_ASSOC;
+  sack.sack_delay = tuning_.sack_delay_ms;
+  sack.sack_freq = tuning_.sack_frequency;
+  if (usrsctp_setsockopt(sock_, IPPROTO_SCTP, SCTP_DELAYED_SACK, &sack,
+                         sizeof(sack))) {
+    LOG_WITH_ERRNO(LS_WARNING) << debug_name_ << "->ConfigureSctpSocket(): "
+                               << "Failed to set SCTP_DELAYED_SACK.";
+  }
+
+  // Nagle would hold back the tail of each message.
+  uint32_t nodelay = 1;
+  if (usrsctp_setsockopt(sock_, IPPROTO_SCTP, SCTP_NODELAY, &nodelay,
+                         sizeof(nodelay))) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->ConfigureSctpSocket(): "
+                             << "Failed to set SCTP_NODELAY.";
+    return false;
+  }
+  // Lets a message be sent in pieces, the last with SCTP_EOR.
+  uint32_t eor = 1;
+  if (usrsctp_setsockopt(sock_, IPPROTO_SCTP, SCTP_EXPLICIT_EOR, &eor,
+                         sizeof(eor))) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->ConfigureSctpSocket(): "
+                             << "Failed to set SCTP_EXPLICIT_EOR.";
+    return false;
+  }
+
+  const uint16_t event_types[] = {SCTP_ASSOC_CHANGE, SCTP_PEER_ADDR_CHANGE,
+                                  SCTP_SEND_FAILED_EVENT,
+                                  SCTP_SENDER_DRY_EVENT,
+                                  SCTP_STREAM_RESET_EVENT};
+  sctp_event event;
+  memset(&event, 0, sizeof(event));
+  event.se_assoc_id = SCTP_ALL_ASSOC;
+  event.se_on = 1;
+  for (uint16_t type : event_types) {
+    event.se_type = type;
+    if (usrsctp_setsockopt(sock_, IPPROTO_SCTP, SCTP_EVENT, &event,
+                           sizeof(event)) < 0) {
+      LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->ConfigureSctpSocket(): "
+                               << "Failed to set SCTP_EVENT type: " << type;
+      return false;
+    }
+  }
+  return true;
+}
+
+void BulkSctpTransport::CloseSctpSocket() {
+  if (!sock_)
+    return;
+  // With SO_LINGER set, pending data is dropped and the association
+  // aborted. The ABORT is queued by the time usrsctp_close() returns, and
+  // goes out before the transport stops hearing from usrsctp.
+  usrsctp_close(sock_);
+  {
+    rtc::CritScope cs(&queue_crit_);
+    sending_.SetSize(0);
+    sending_sizes_.clear();
+    std::swap(outbound_, sending_);
+    std::swap(outbound_sizes_, sending_sizes_);
+  }
+  SendPackets();
+  usrsctp_deregister_address(this);
+  UsrSctp::Unregister(this, sock_);
+  sock_ = nullptr;
+  pending_.reset();
+  UsrSctp::Release();
+}
+
+void BulkSctpTransport::AbortAssociation() {
+  CloseSctpSocket();
+  ready_to_send_data_ = false;
+  partial_.clear();
+  queued_reset_streams_.clear();
+  sent_reset_streams_.clear();
+  StreamSet closed;
+  closed.swap(open_streams_);
+  for (uint32_t sid : closed)
+    SignalStreamClosedRemotely(sid);
+}
+
+bool BulkSctpTransport::SendQueuedStreamResets() {
+  // One reset at a time.
+  if (!sent_reset_streams_.empty() || queued_reset_streams_.empty())
+    return true;
+  if (!sock_)
+    return false;
+
+  const size_t num_streams = queued_reset_streams_.size();
+  std::vector<uint8_t> buffer(
+      sizeof(sctp_reset_streams) + num_streams * sizeof(uint16_t), 0);
+  sctp_reset_streams* reset =
+      reinterpret_cast<sctp_reset_streams*>(buffer.data());
+  reset->srs_assoc_id = SCTP_ALL_ASSOC;
+  reset->srs_flags = SCTP_STREAM_RESET_INCOMING | SCTP_STREAM_RESET_OUTGOING;
+  reset->srs_number_streams = rtc::checked_cast<uint16_t>(num_streams);
+  size_t index = 0;
+  for (uint32_t sid : queued_reset_streams_)
+    reset->srs_stream_list[index++] = static_cast<uint16_t>(sid);
+  if (usrsctp_setsockopt(sock_, IPPROTO_SCTP, SCTP_RESET_STREAMS, reset,
+                         rtc::checked_cast<socklen_t>(buffer.size())) < 0) {
+    LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->SendQueuedStreamResets(): "
+                             << "Failed to send a stream reset for "
+                             << num_streams << " streams";
+    return false;
+  }
+  queued_reset_streams_.swap(sent_reset_streams_);
+  return true;
+}
+
+void BulkSctpTransport::SetReadyToSendData() {
+  if (!ready_to_send_data_) {
+    ready_to_send_data_ = true;
+    SignalReadyToSendData();
+  }
+}
+
+bool BulkSctpTransport::ContinuePendingMessage() {
+  const cricket::SendDataParams& params = pending_->params;
+  sctp_sendv_spa spa;
+  memset(&spa, 0, sizeof(spa));
+  spa.sendv_flags |= SCTP_SEND_SNDINFO_VALID;
+  spa.sendv_sndinfo.snd_sid = params.sid;
+  spa.sendv_sndinfo.snd_ppid = rtc::HostToNetwork32(GetPpid(params.type));
+  // Ordered implies reliable.
+  if (!params.ordered) {
+    spa.sendv_sndinfo.snd_flags |= SCTP_UNORDERED;
+    spa.sendv_flags |= SCTP_SEND_PRINFO_VALID;
+    if (params.max_rtx_count >= 0 || params.max_rtx_ms == 0) {
+      spa.sendv_prinfo.pr_policy = SCTP_PR_SCTP_RTX;
+      spa.sendv_prinfo.pr_value = params.max_rtx_count;
+    } else {
+      spa.sendv_prinfo.pr_policy = SCTP_PR_SCTP_TTL;
+      spa.sendv_prinfo.pr_value = params.max_rtx_ms;
+    }
+  }
+
+  const size_t size = pending_->payload.size();
+  const size_t max_piece = std::max<size_t>(1, tuning_.send_piece);
+  // At least once, for an empty message.
+  do {
+    const size_t piece = std::min(size - pending_->sent, max_piece);
+    if (pending_->sent + piece == size)
+      spa.sendv_sndinfo.snd_flags |= SCTP_EOR;
+    else
+      spa.sendv_sndinfo.snd_flags &= ~SCTP_EOR;
+    const ssize_t sent = usrsctp_sendv(
+        sock_, pending_->payload.data() + pending_->sent, piece, nullptr, 0,
+        &spa, rtc::checked_cast<socklen_t>(sizeof(spa)), SCTP_SENDV_SPA, 0);
+    if (sent < 0) {
+      if (errno == EWOULDBLOCK) {
+        // OnSendThreshold() resumes it.
+        ready_to_send_data_ = false;
+        return true;
+      }
+      LOG_WITH_ERRNO(LS_ERROR) << debug_name_ << "->ContinuePendingMessage(): "
+                               << "usrsctp_sendv failed at " << pending_->sent
+                               << " of " << size << " bytes.";
+      // The pieces so far went without SCTP_EOR, and the peer would take
+      // the next message for the rest of this one.
+      if (pending_->sent > 0)
+        AbortAssociation();
+      pending_.reset();
+      return false;
+    }
+    pending_->sent += sent;
+  } while (pending_->sent < size);
+  pending_.reset();
+  return true;
+}
+
+void BulkSctpTransport::QueueOutboundPacket(const void* data, size_t length) {
+  rtc::CritScope cs(&queue_crit_);
+  outbound_.AppendData(static_cast<const uint8_t*>(data), length);
+  outbound_sizes_.push_back(length);
+  PostFlushIfNeeded();
+}
+
+void BulkSctpTransport::QueueInboundPiece(const void* data,
+                                          size_t length,
+                                          const sctp_rcvinfo& info,
+                                          int flags) {
+  rtc::CritScope cs(&queue_crit_);
+  Piece piece;
+  piece.data.SetData(static_cast<const uint8_t*>(data), length);
+  piece.sid = info.rcv_sid;
+  piece.ssn = info.rcv_ssn;
+  piece.tsn = info.rcv_tsn;
+  piece.ppid = rtc::NetworkToHost32(info.rcv_ppid);
+  piece.flags = flags;
+  inbound_.push_back(std::move(piece));
+  PostFlushIfNeeded();
+}
+
+void BulkSctpTransport::QueueSendSpace() {
+  rtc::CritScope cs(&queue_crit_);
+  send_space_ = true;
+  PostFlushIfNeeded();
+}
+
+void BulkSctpTransport::PostFlushIfNeeded() {
+  // On the network thread, usrsctp is being called by this transport,
+  // which flushes when the call returns.
+  if (flush_posted_ || network_thread_->IsCurrent())
+    return;
+  flush_posted_ = true;
+  invoker_.AsyncInvoke<void>(RTC_FROM_HERE, network_thread_,
+                             rtc::Bind(&BulkSctpTransport::Flush, this));
+}
+
+void BulkSctpTransport::Flush() {
+  RTC_DCHECK(network_thread_->IsCurrent());
+  // Signal handlers that send again land here; the outer call picks up
+  // what they queued.
+  if (flushing_)
+    return;
+  flushing_ = true;
+  while (true) {
+    bool send_space;
+    {
+      rtc::CritScope cs(&queue_crit_);
+      flush_posted_ = false;
+      if (outbound_.empty() && inbound_.empty() && !send_space_)
+        break;
+      sending_.SetSize(0);
+      sending_sizes_.clear();
+      delivering_.clear();
+      std::swap(outbound_, sending_);
+      std::swap(outbound_sizes_, sending_sizes_);
+      std::swap(inbound_, delivering_);
+      send_space = send_space_;
+      send_space_ = false;
+    }
+
+    SendPackets();
+    for (Piece& piece : delivering_) {
+      // Dropped once the association is aborted.
+      if (!sock_)
+        break;
+      DeliverPiece(&piece);
+    }
+    if (send_space && sock_) {
+      if (pending_)
+        ContinuePendingMessage();
+      if (!pending_ && sock_)
+        SetReadyToSendData();
+    }
+  }
+  flushing_ = false;
+}
+
+void BulkSctpTransport::SendPackets() {
+  if (sending_sizes_.empty())
+    return;
+  ++batches_sent_;
+  size_t offset = 0;
+  for (size_t size : sending_sizes_) {
+    // The DTLS transport fails while it is not writable; SCTP retransmits.
+    transport_channel_->SendPacket(
+        reinterpret_cast<const char*>(sending_.data() + offset), size,
+        rtc::PacketOptions(), 0);
+    offset += size;
+    ++packets_sent_;
+  }
+  sending_.SetSize(0);
+  sending_sizes_.clear();
+}
+
+void BulkSctpTransport::DeliverPiece(Piece* piece) {
+  if (piece->flags & MSG_NOTIFICATION) {
+    OnNotification(piece->data);
+    return;
+  }
+  cricket::ReceiveDataParams params;
+  if (!GetDataMessageType(piece->ppid, &params.type)) {
+    LOG(LS_ERROR) << debug_name_ << "->DeliverPiece(...): "
+                  << "Received an unknown PPID " << piece->ppid
+                  << " on an SCTP packet. Dropping.";
+    return;
+  }
+  params.sid = piece->sid;
+  params.seq_num = piece->ssn;
+  params.timestamp = piece->tsn;
+
+  auto partial = partial_.find(piece->sid);
+  const size_t partial_size =
+      partial == partial_.end() ? 0 : partial->second.size();
+  if (partial_size + piece->data.size() > tuning_.max_message_size) {
+    LOG(LS_ERROR) << debug_name_ << "->DeliverPiece(...): "
+                  << "Message on sid=" << piece->sid << " is larger than "
+                  << tuning_.max_message_size << " bytes.";
+    AbortAssociation();
+    return;
+  }
+  if (!(piece->flags & MSG_EOR)) {
+    if (partial == partial_.end())
+      partial_[piece->sid] = piece->data;
+    else
+      partial->second.AppendData(piece->data);
+    return;
+  }
+  if (partial == partial_.end()) {
+    SignalDataReceived(params, piece->data);
+    return;
+  }
+  rtc::CopyOnWriteBuffer message(std::move(partial->second));
+  partial_.erase(partial);
+  message.AppendData(piece->data);
+  SignalDataReceived(params, message);
+}
+
+void BulkSctpTransport::OnNotification(const rtc::CopyOnWriteBuffer& buffer) {
+  if (buffer.size() < sizeof(sctp_notification::sn_header))
+    return;
+  const sctp_notification& notification =
+      reinterpret_cast<const sctp_notification&>(*buffer.data());
+  if (buffer.size() != notification.sn_header.sn_length) {
+    LOG(LS_WARNING) << debug_name_ << "->OnNotification(...): "
+                    << "Unexpected notification length " << buffer.size();
+    return;
+  }
+  switch (notification.sn_header.sn_type) {
+    case SCTP_ASSOC_CHANGE:
+      LOG(LS_INFO) << debug_name_ << "->OnNotification(...): "
+                   << "Association change, state "
+                   << notification.sn_assoc_change.sac_state;
+      break;
+    case SCTP_SENDER_DRY_EVENT:
+      if (!pending_)
+        SetReadyToSendData();
+      break;
+    case SCTP_STREAM_RESET_EVENT:
+      OnStreamResetEvent(&notification.sn_strreset_event);
+      break;
+    default:
+      break;
+  }
+}
+
+void BulkSctpTransport::OnStreamResetEvent(
+    const sctp_stream_reset_event* event) {
+  const size_t num_sids =
+      (event->strreset_length - sizeof(*event)) /
+      sizeof(event->strreset_stream_list[0]);
+  if (!(event->strreset_flags & SCTP_STREAM_RESET_DENIED) &&
+      !(event->strreset_flags & SCTP_STREAM_RESET_FAILED)) {
+    for (size_t i = 0; i < num_sids; ++i) {
+      const uint32_t sid = event->strreset_stream_list[i];
+      partial_.erase(sid);
+      if (sent_reset_streams_.erase(sid)) {
+        // Our own reset, done.
+      } else if (open_streams_.erase(sid)) {
+        // The remote side's; ours follows below.
+        queued_reset_streams_.insert(sid);
+        SignalStreamClosedRemotely(sid);
+      } else if (queued_reset_streams_.count(sid)) {
+        SignalStreamClosedRemotely(sid);
+      }
+    }
+  }
+  // The last reset has made progress either way.
+  SendQueuedStreamResets();
+}
+
+BulkSctpTransportFactory::BulkSctpTransportFactory(
+    rtc::Thread* network_thread,
+    const SctpTuning& tuning)
+    : network_thread_(network_thread), tuning_(tuning) {}
+
+std::unique_ptr<cricket::SctpTransportInternal>
+BulkSctpTransportFactory::CreateSctpTransport(
+    rtc::PacketTransportInternal* channel) {
+  return std::unique_ptr<cricket::SctpTransportInternal>(
+      new BulkSctpTransport(network_thread_, channel, tuning_));
+}
+
+BufferedAmountMonitor::BufferedAmountMonitor(
+    webrtc::DataChannelInterface* channel,
+    uint64_t low,
+    uint64_t high,
+    webrtc::DataChannelObserver* observer)
+    : channel_(channel), low_(low), high_(high), observer_(observer) {
+  RTC_DCHECK_LT(low_, high_);
+  channel_->RegisterObserver(this);
+}
+
+BufferedAmountMonitor::~BufferedAmountMonitor() {
+  channel_->UnregisterObserver();
+}
+
+bool BufferedAmountMonitor::Send(const webrtc::DataBuffer& buffer) {
+  if (!channel_->Send(buffer))
+    return false;
+  // DataChannel only reports decreases to its observer.
+  if (!above_high_ && channel_->buffered_amount() >= high_) {
+    above_high_ = true;
+    SignalHighWatermark(this);
+  }
+  return true;
+}
+
+void BufferedAmountMonitor::OnStateChange() {
+  if (observer_)
+    observer_->OnStateChange();
+}
+
+void BufferedAmountMonitor::OnMessage(const webrtc::DataBuffer& buffer) {
+  if (observer_)
+    observer_->OnMessage(buffer);
+}
+
+void BufferedAmountMonitor::OnBufferedAmountChange(uint64_t previous_amount) {
+  if (observer_)
+    observer_->OnBufferedAmountChange(previous_amount);
+  if (above_high_ && channel_->buffered_amount() <= low_) {
+    above_high_ = false;
+    SignalLowWatermark(this);
+  }
+}
+
+}  // namespace simple_app
@@ -0,0 +1,269 @@
+#ifndef BULK_SCTP_TRANSPORT_H_
+#define BULK_SCTP_TRANSPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "api/datachannelinterface.h"
+#include "media/sctp/sctptransportinternal.h"
+#include "rtc_base/asyncinvoker.h"
+#include "rtc_base/buffer.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/copyonwritebuffer.h"
+#include "rtc_base/criticalsection.h"
+#include "rtc_base/sigslot.h"
+#include "rtc_base/thread.h"
+
+struct socket;
+struct sctp_rcvinfo;
+struct sctp_stream_reset_event;
+
+namespace simple_app {
+
+// usrsctp settings for bulk transfer. The socket buffers and the SACK and
+// burst settings apply to each transport's socket; the congestion control
+// module and the initial window are usrsctp globals, taken from the first
+// transport that initializes usrsctp.
+struct SctpTuning {
+  // usrsctp's default send space is 256 KB, a few milliseconds at
+  // loopback rates.
+  int send_buffer = 4 * 1024 * 1024;
+  int receive_buffer = 4 * 1024 * 1024;
+  // Large messages are handed to usrsctp in pieces of this size, and
+  // resumed once this much send space is free again.
+  size_t send_piece = 64 * 1024;
+  // A usrsctp SCTP_CC_* module. SCTP_CC_HTCP, 2, grows the window faster
+  // than the default SCTP_CC_RFC2581 on paths with a large bandwidth-delay
+  // product.
+  uint32_t congestion_control = 2;
+  // In MTUs; usrsctp starts at 3.
+  uint32_t initial_cwnd = 10;
+  // Packets per burst; 0 for no limit.
+  uint32_t max_burst = 0;
+  // A SACK for every |sack_frequency| packets, or after |sack_delay_ms|.
+  uint32_t sack_delay_ms = 20;
+  uint32_t sack_frequency = 2;
+  // The largest message put back together from received pieces. A peer
+  // that sends more on a stream before the end of a message has its
+  // association aborted.
+  size_t max_message_size = 64 * 1024 * 1024;
+};
+
+// cricket::SctpTransportInternal over usrsctp for bulk DataChannels, in
+// place of cricket::SctpTransport, which
+//  - needs the whole message to fit in the send buffer, and otherwise
+//    blocks the channel until it does;
+//  - copies each SCTP packet usrsctp produces into a CopyOnWriteBuffer and
+//    posts it to the network thread on its own, and does the same for each
+//    received message;
+//  - hands the data of a message split by usrsctp's partial delivery on as
+//    separate messages.
+//
+// A message larger than |send_piece| is fed to usrsctp in pieces, straight
+// from the caller's CopyOnWriteBuffer, which is referenced rather than
+// copied until the last piece is in. Another SendData() meanwhile returns
+// SDR_BLOCK, and SignalReadyToSendData follows when the message is done.
+// The packets usrsctp produces while the transport calls it on the network
+// thread are collected in one reused buffer and sent to the DTLS transport
+// when usrsctp returns, and those from usrsctp's timer thread go in one
+// post per batch. Received pieces are put back together per stream, up to
+// |max_message_size|. A send error part way through a message, or a
+// received message over that size, aborts the association and closes all
+// its streams through SignalStreamClosedRemotely.
+//
+// usrsctp sends every association's packets through one callback, so
+// BulkSctpTransport cannot share a process with cricket::SctpTransport,
+// which PeerConnections use for their SCTP DataChannels.
+class BulkSctpTransport : public cricket::SctpTransportInternal,
+                          public sigslot::has_slots<> {
+ public:
+  // |network_thread| is the only thread the methods may be called on, and
+  // the one the signals come from.
+  BulkSctpTransport(rtc::Thread* network_thread,
+                    rtc::PacketTransportInternal* channel,
+                    const SctpTuning& tuning);
+  ~BulkSctpTransport() override;
+
+  // cricket::SctpTransportInternal:
+  void SetTransportChannel(rtc::PacketTransportInternal* channel) override;
+  bool Start(int local_sctp_port, int remote_sctp_port) override;
+  bool OpenStream(int sid) override;
+  bool ResetStream(int sid) override;
+  bool SendData(const cricket::SendDataParams& params,
+                const rtc::CopyOnWriteBuffer& payload,
+                cricket::SendDataResult* result = nullptr) override;
+  bool ReadyToSendData() override;
+  void set_debug_name_for_testing(const char* debug_name) override {
+    debug_name_ = debug_name;
+  }
+
+  // Packets handed to the DTLS transport, and how many batches they came
+  // in.
+  uint64_t packets_sent() const { return packets_sent_; }
+  uint64_t batches_sent() const { return batches_sent_; }
+
+ private:
+  class UsrSctp;
+  struct Piece {
+    rtc::CopyOnWriteBuffer data;
+    uint16_t sid;
+    uint16_t ssn;
+    uint32_t tsn;
+    uint32_t ppid;
+    int flags;
+  };
+  struct PendingMessage {
+    cricket::SendDataParams params;
+    rtc::CopyOnWriteBuffer payload;
+    size_t sent = 0;
+  };
+
+  void ConnectTransportChannelSignals();
+  void DisconnectTransportChannelSignals();
+  void OnWritableState(rtc::PacketTransportInternal* transport);
+  void OnPacketRead(rtc::PacketTransportInternal* transport,
+                    const char* data,
+                    size_t length,
+                    const rtc::PacketTime& packet_time,
+                    int flags);
+
+  bool Connect();
+  bool OpenSctpSocket();
+  bool ConfigureSctpSocket();
+  // Aborts the association, if any, and stops the callbacks.
+  void CloseSctpSocket();
+  // Closes the socket and every stream, for errors the association can't
+  // recover from.
+  void AbortAssociation();
+  bool SendQueuedStreamResets();
+  void SetReadyToSendData();
+  // Hands |pending_| to usrsctp until it is all in or the send buffer is
+  // full. Returns false, dropping the message, on errors; an error after
+  // the first piece also aborts the association.
+  bool ContinuePendingMessage();
+
+  // From usrsctp's callbacks, on any thread.
+  void QueueOutboundPacket(const void* data, size_t length);
+  void QueueInboundPiece(const void* data,
+                         size_t length,
+                         const sctp_rcvinfo& info,
+                         int flags);
+  void QueueSendSpace();
+  // Must hold |queue_crit_|.
+  void PostFlushIfNeeded();
+
+  // Sends what usrsctp queued to the DTLS transport, then delivers the
+  // received data. Called after each call into usrsctp on the network
+  // thread, and posted for usrsctp's timer thread.
+  void Flush();
+  // Sends |sending_| to the DTLS transport.
+  void SendPackets();
+  void DeliverPiece(Piece* piece);
+  void OnNotification(const rtc::CopyOnWriteBuffer& buffer);
+  void OnStreamResetEvent(const sctp_stream_reset_event* event);
+
+  rtc::Thread* const network_thread_;
+  const SctpTuning tuning_;
+  rtc::AsyncInvoker invoker_;
+  rtc::PacketTransportInternal* transport_channel_;
+  bool was_ever_writable_ = false;
+  int local_port_;
+  int remote_port_;
+  struct socket* sock_ = nullptr;
+  bool started_ = false;
+  bool ready_to_send_data_ = false;
+  std::unique_ptr<PendingMessage> pending_;
+
+  // Filled by usrsctp's callbacks.
+  rtc::CriticalSection queue_crit_;
+  rtc::Buffer outbound_ RTC_GUARDED_BY(queue_crit_);
+  std::vector<size_t> outbound_sizes_ RTC_GUARDED_BY(queue_crit_);
+  std::vector<Piece> inbound_ RTC_GUARDED_BY(queue_crit_);
+  bool send_space_ RTC_GUARDED_BY(queue_crit_) = false;
+  bool flush_posted_ RTC_GUARDED_BY(queue_crit_) = false;
+
+  // Flush()'s side of the queues, swapped with them so that both keep
+  // their capacity.
+  bool flushing_ = false;
+  rtc::Buffer sending_;
+  std::vector<size_t> sending_sizes_;
+  std::vector<Piece> delivering_;
+  // Messages of each stream received so far, without their last piece.
+  std::unordered_map<uint16_t, rtc::CopyOnWriteBuffer> partial_;
+  uint64_t packets_sent_ = 0;
+  uint64_t batches_sent_ = 0;
+
+  // As in cricket::SctpTransport: opened streams, streams waiting for
+  // their reset to be sent, and streams with a reset in flight.
+  typedef std::set<uint32_t> StreamSet;
+  StreamSet open_streams_;
+  StreamSet queued_reset_streams_;
+  StreamSet sent_reset_streams_;
+
+  const char* debug_name_ = "BulkSctpTransport";
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(BulkSctpTransport);
+};
+
+// Creates BulkSctpTransports, for code that takes a
+// cricket::SctpTransportInternalFactory.
+class BulkSctpTransportFactory : public cricket::SctpTransportInternalFactory {
+ public:
+  BulkSctpTransportFactory(rtc::Thread* network_thread,
+                           const SctpTuning& tuning);
+
+  // cricket::SctpTransportInternalFactory:
+  std::unique_ptr<cricket::SctpTransportInternal> CreateSctpTransport(
+      rtc::PacketTransportInternal* channel) override;
+
+ private:
+  rtc::Thread* const network_thread_;
+  const SctpTuning tuning_;
+};
+
+// Low and high watermarks on a DataChannel's buffered_amount(), so a bulk
+// sender can stop when the channel has queued enough and resume when it
+// has drained, without polling. SignalHighWatermark fires when a Send()
+// through the monitor leaves |high| bytes or more buffered, and
+// SignalLowWatermark when the amount then falls to |low| or below.
+// Registers itself as the channel's observer and forwards to |observer|.
+// Used on the signaling thread, where DataChannel calls its observer.
+class BufferedAmountMonitor : public webrtc::DataChannelObserver {
+ public:
+  BufferedAmountMonitor(webrtc::DataChannelInterface* channel,
+                        uint64_t low,
+                        uint64_t high,
+                        webrtc::DataChannelObserver* observer);
+  ~BufferedAmountMonitor() override;
+
+  // As DataChannelInterface::Send().
+  bool Send(const webrtc::DataBuffer& buffer);
+  // Between SignalHighWatermark and SignalLowWatermark.
+  bool above_high() const { return above_high_; }
+
+  sigslot::signal1<BufferedAmountMonitor*> SignalHighWatermark;
+  sigslot::signal1<BufferedAmountMonitor*> SignalLowWatermark;
+
+  // webrtc::DataChannelObserver:
+  void OnStateChange() override;
+  void OnMessage(const webrtc::DataBuffer& buffer) override;
+  void OnBufferedAmountChange(uint64_t previous_amount) override;
+
+ private:
+  const rtc::scoped_refptr<webrtc::DataChannelInterface> channel_;
+  const uint64_t low_;
+  const uint64_t high_;
+  webrtc::DataChannelObserver* const observer_;
+  bool above_high_ = false;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(BufferedAmountMonitor);
+};
+
+}  // namespace simple_app
+
+#endif  // BULK_SCTP_TRANSPORT_H_
@@ -0,0 +1,218 @@
+#include "connection_scheduler.h"
+
+#include <functional>
+#include <utility>
+
+#include "p2p/base/candidate.h"
+#include "rtc_base/checks.h"
+
+namespace simple_app {
+
+namespace {
+
+// Heap entries allowed beyond twice the live ones before a rebuild.
+const size_t kCompactSlack = 64;
+
+}  // namespace
+
+bool ConnectionScheduler::BetterRank::operator()(const RankKey& a,
+                                                 const RankKey& b) const {
+  if (a.writable != b.writable)
+    return a.writable;
+  if (a.write_state != b.write_state)
+    return a.write_state < b.write_state;
+  if (a.receiving != b.receiving)
+    return a.receiving;
+  // A reconnecting TCP connection stays writable while disconnected.
+  if (a.writable && a.connected != b.connected)
+    return a.connected;
+  if (a.nominated != b.nominated)
+    return a.nominated;
+  if (a.network_cost != b.network_cost)
+    return a.network_cost < b.network_cost;
+  if (a.priority != b.priority)
+    return a.priority > b.priority;
+  if (a.rtt != b.rtt)
+    return a.rtt < b.rtt;
+  return a.sequence < b.sequence;
+}
+
+bool ConnectionScheduler::Deadline::operator<(const Deadline& other) const {
+  if (due_ms != other.due_ms)
+    return due_ms > other.due_ms;
+  if (last_ping_sent != other.last_ping_sent)
+    return last_ping_sent > other.last_ping_sent;
+  return BetterRank()(other.rank, rank);
+}
+
+ConnectionScheduler::ConnectionScheduler(const Config& config)
+    : config_(config) {}
+
+// has_slots<> disconnects from the connections' signals.
+ConnectionScheduler::~ConnectionScheduler() {}
+
+void ConnectionScheduler::AddConnection(cricket::Connection* conn) {
+  RTC_DCHECK(entries_.find(conn) == entries_.end());
+  Entry& entry = entries_[conn];
+  entry.sequence = next_sequence_++;
+  entry.rank = ranking_.insert(MakeRankKey(conn, entry.sequence)).first;
+  File(conn, &entry);
+  conn->SignalStateChange.connect(this, &ConnectionScheduler::OnStateChange);
+  conn->SignalNominated.connect(this, &ConnectionScheduler::OnStateChange);
+  conn->SignalDestroyed.connect(this,
+                                &ConnectionScheduler::OnConnectionDestroyed);
+}
+
+void ConnectionScheduler::RemoveConnection(cricket::Connection* conn) {
+  conn->SignalStateChange.disconnect(this);
+  conn->SignalNominated.disconnect(this);
+  conn->SignalDestroyed.disconnect(this);
+  Erase(conn);
+}
+
+void ConnectionScheduler::Update(cricket::Connection* conn) {
+  auto it = entries_.find(conn);
+  if (it != entries_.end())
+    File(conn, &it->second);
+}
+
+void ConnectionScheduler::MarkPinged(cricket::Connection* conn) {
+  // The new last_ping_sent() moves the connection back in the heap.
+  Update(conn);
+}
+
+void ConnectionScheduler::SetWeak(bool weak) {
+  if (weak_ == weak)
+    return;
+  weak_ = weak;
+  RefileAll();
+}
+
+void ConnectionScheduler::SetIceRole(cricket::IceRole role) {
+  if (role_ == role)
+    return;
+  role_ = role;
+  RefileAll();
+}
+
+cricket::Connection* ConnectionScheduler::FindNextPingable(int64_t now_ms) {
+  PopStale();
+  if (deadlines_.empty() || deadlines_.top().due_ms > now_ms)
+    return nullptr;
+  return deadlines_.top().rank.conn;
+}
+
+int64_t ConnectionScheduler::NextPingTime() {
+  PopStale();
+  return deadlines_.empty() ? -1 : deadlines_.top().due_ms;
+}
+
+cricket::Connection* ConnectionScheduler::Best() const {
+  return ranking_.empty() ? nullptr : ranking_.begin()->conn;
+}
+
+std::vector<cricket::Connection*> ConnectionScheduler::Ranked() const {
+  std::vector<cricket::Connection*> ranked;
+  ranked.reserve(ranking_.size());
+  for (const RankKey& key : ranking_)
+    ranked.push_back(key.conn);
+  return ranked;
+}
+
+void ConnectionScheduler::OnStateChange(cricket::Connection* conn) {
+  Update(conn);
+}
+
+void ConnectionScheduler::OnConnectionDestroyed(cricket::Connection* conn) {
+  // The connection's signals disconnect themselves as it goes away.
+  Erase(conn);
+}
+
+void ConnectionScheduler::File(cricket::Connection* conn, Entry* entry) {
+  ranking_.erase(entry->rank);
+  entry->rank = ranking_.insert(MakeRankKey(conn, entry->sequence)).first;
+  entry->generation = next_generation_++;
+  entry->due_ms = DueTime(conn);
+  if (entry->due_ms >= 0) {
+    deadlines_.push(Deadline{entry->due_ms, conn->last_ping_sent(),
+                             *entry->rank, entry->generation});
+  }
+  MaybeCompact();
+}
+
+void ConnectionScheduler::Erase(cricket::Connection* conn) {
+  auto it = entries_.find(conn);
+  if (it == entries_.end())
+    return;
+  // Its heap entries go stale with it.
+  ranking_.erase(it->second.rank);
+  entries_.erase(it);
+}
+
+ConnectionScheduler::RankKey ConnectionScheduler::MakeRankKey(
+    cricket::Connection* conn,
+    uint64_t sequence) const {
+  RankKey key;
+  key.writable = conn->writable();
+  key.write_state = conn->write_state();
+  key.receiving = conn->receiving();
+  key.connected = conn->connected();
+  key.nominated = role_ == cricket::ICEROLE_CONTROLLED && conn->nominated();
+  key.network_cost = conn->ComputeNetworkCost();
+  key.priority = conn->priority();
+  key.rtt = conn->rtt();
+  key.sequence = sequence;
+  key.conn = conn;
+  return key;
+}
+
+int64_t ConnectionScheduler::DueTime(const cricket::Connection* conn) const {
+  if (conn->state() == cricket::IceCandidatePairState::FAILED)
+    return -1;
+  // Never connected: nothing can be written to it yet.
+  if (!conn->connected() && !conn->writable())
+    return -1;
+  const cricket::Candidate& remote = conn->remote_candidate();
+  if (remote.username().empty() || remote.password().empty())
+    return -1;
+  if (weak_)
+    return conn->last_ping_sent();
+  if (!conn->active())
+    return -1;
+  if (!conn->writable())
+    return conn->last_ping_sent();
+  return conn->last_ping_sent() + config_.writable_ping_interval_ms;
+}
+
+void ConnectionScheduler::RefileAll() {
+  for (auto& entry : entries_)
+    File(entry.first, &entry.second);
+}
+
+void ConnectionScheduler::PopStale() {
+  while (!deadlines_.empty()) {
+    const Deadline& top = deadlines_.top();
+    auto it = entries_.find(top.rank.conn);
+    if (it != entries_.end() && it->second.generation == top.generation)
+      return;
+    deadlines_.pop();
+  }
+}
+
+void ConnectionScheduler::MaybeCompact() {
+  if (deadlines_.size() <= 2 * entries_.size() + kCompactSlack)
+    return;
+  std::vector<Deadline> live;
+  live.reserve(entries_.size());
+  while (!deadlines_.empty()) {
+    const Deadline& top = deadlines_.top();
+    auto it = entries_.find(top.rank.conn);
+    if (it != entries_.end() && it->second.generation == top.generation)
+      live.push_back(top);
+    deadlines_.pop();
+  }
+  deadlines_ =
+      std::priority_queue<Deadline>(std::less<Deadline>(), std::move(live));
+}
+
+}  // namespace simple_app
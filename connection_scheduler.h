@@ -0,0 +1,150 @@
+#ifndef CONNECTION_SCHEDULER_H_
+#define CONNECTION_SCHEDULER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <queue>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "p2p/base/port.h"
+#include "p2p/base/transportdescription.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/sigslot.h"
+
+namespace simple_app {
+
+// Ping scheduling and ranking of ICE candidate pairs, kept in indexes that
+// are updated one connection at a time. cricket::P2PTransportChannel walks
+// all of its connections in FindNextPingableConnection() on every ping tick
+// and re-sorts all of them on every state change, which grows
+// quadratically with the number of pairs (ICE-TCP, several interfaces,
+// TURN over UDP, TCP and TLS). ConnectionScheduler keeps:
+//  - a min-heap of the time each connection is next due for a ping, with
+//    the least recently pinged and then the best ranked first among equals;
+//  - an ordered set of the connections by ranking.
+// A state change re-files only the connection that changed.
+//
+// The ping policy follows P2PTransportChannel::IsPingable(): failed
+// connections, ones that have neither connected nor become writable, and
+// ones without remote ICE credentials are not pinged. While SetWeak(true),
+// every other connection is due at once. Otherwise unwritable active
+// connections are due at once, writable ones |writable_ping_interval_ms|
+// after their last ping, and timed out ones not at all. Pacing pings
+// across connections stays with the caller.
+//
+// The ranking follows P2PTransportChannel::CompareConnections(): writable
+// first, then by write state, receiving, connected and, when controlled,
+// nominated, then lower network cost, higher priority and lower RTT. The
+// channel's last-data-received and receiving-unchanged tie-breaks are left
+// out because they move on every packet.
+//
+// Connections are re-filed on SignalStateChange and SignalNominated. Pings
+// and RTT updates fire no signal, so call MarkPinged() after each ping and
+// Update() after a ping response. Single threaded, on the network thread.
+class ConnectionScheduler : public sigslot::has_slots<> {
+ public:
+  struct Config {
+    // P2PTransportChannel's interval for stable writable connections.
+    int writable_ping_interval_ms = 2500;
+  };
+
+  explicit ConnectionScheduler(const Config& config);
+  ~ConnectionScheduler() override;
+
+  void AddConnection(cricket::Connection* conn);
+  void RemoveConnection(cricket::Connection* conn);
+  // Re-files |conn| after a change that fires no signal.
+  void Update(cricket::Connection* conn);
+  // Call after pinging |conn|.
+  void MarkPinged(cricket::Connection* conn);
+
+  // Whether the channel is weak; see the class comment.
+  void SetWeak(bool weak);
+  void SetIceRole(cricket::IceRole role);
+
+  // The pingable connection that has been due longest at |now_ms|, or null.
+  // It stays first until MarkPinged() or a state change re-files it.
+  cricket::Connection* FindNextPingable(int64_t now_ms);
+  // When FindNextPingable() will next return a connection, or -1 if no
+  // connection is pingable.
+  int64_t NextPingTime();
+
+  // Best ranked connection, or null.
+  cricket::Connection* Best() const;
+  // All connections, best first.
+  std::vector<cricket::Connection*> Ranked() const;
+  size_t size() const { return entries_.size(); }
+
+ private:
+  // Snapshot of the fields the ranking compares, taken when a connection is
+  // filed, so the set's order cannot change underneath it.
+  struct RankKey {
+    bool writable;
+    int write_state;
+    bool receiving;
+    bool connected;
+    bool nominated;
+    uint32_t network_cost;
+    uint64_t priority;
+    int rtt;
+    // Order of AddConnection(); the final tie-break, as the channel's sort
+    // keeps insertion order.
+    uint64_t sequence;
+    cricket::Connection* conn;
+  };
+  struct BetterRank {
+    bool operator()(const RankKey& a, const RankKey& b) const;
+  };
+  using RankSet = std::set<RankKey, BetterRank>;
+
+  struct Entry {
+    uint64_t sequence;
+    RankSet::iterator rank;
+    // Fresh from |next_generation_| whenever the connection is re-filed, so
+    // heap entries pushed before can be told apart and skipped.
+    uint64_t generation = 0;
+    // Due time in the heap, or -1 if not pingable.
+    int64_t due_ms = -1;
+  };
+  struct Deadline {
+    int64_t due_ms;
+    int64_t last_ping_sent;
+    RankKey rank;
+    uint64_t generation;
+    // Orders the heap with the earliest, least recently pinged, best ranked
+    // deadline on top.
+    bool operator<(const Deadline& other) const;
+  };
+
+  void OnStateChange(cricket::Connection* conn);
+  void OnConnectionDestroyed(cricket::Connection* conn);
+  // Re-reads |conn| into the ranking and the heap.
+  void File(cricket::Connection* conn, Entry* entry);
+  void Erase(cricket::Connection* conn);
+  RankKey MakeRankKey(cricket::Connection* conn, uint64_t sequence) const;
+  // Due time of |conn|, or -1 if it is not pingable.
+  int64_t DueTime(const cricket::Connection* conn) const;
+  void RefileAll();
+  // Pops heap entries for earlier filings of their connections.
+  void PopStale();
+  // Rebuilds the heap once stale entries outnumber live ones.
+  void MaybeCompact();
+
+  const Config config_;
+  bool weak_ = true;
+  cricket::IceRole role_ = cricket::ICEROLE_UNKNOWN;
+  uint64_t next_sequence_ = 0;
+  uint64_t next_generation_ = 0;
+  std::unordered_map<cricket::Connection*, Entry> entries_;
+  RankSet ranking_;
+  std::priority_queue<Deadline> deadlines_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(ConnectionScheduler);
+};
+
+}  // namespace simple_app
+
+#endif  // CONNECTION_SCHEDULER_H_
@@ -0,0 +1,315 @@
+#include "deadline_process_thread.h"
+
+#if defined(WEBRTC_POSIX)
+#include <time.h>
+#endif
+
+#include <algorithm>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/task_queue.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+namespace {
+
+// Same upper bound on a wait as ProcessThreadImpl, so posted tasks and
+// modules that were woken without a Set() still make progress.
+const int64_t kMaxWaitMs = 60 * 1000;
+
+int64_t ThreadCpuTimeMicros() {
+#if defined(WEBRTC_POSIX)
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+  return ts.tv_sec * rtc::kNumMicrosecsPerSec +
+         ts.tv_nsec / rtc::kNumNanosecsPerMicrosec;
+#else
+  return 0;
+#endif
+}
+
+size_t LateWakeupBucket(int64_t late_ms) {
+  size_t bucket = 0;
+  while (late_ms > 0 && bucket + 1 < ModuleProcessStats::kLateWakeupBuckets) {
+    late_ms >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+}  // namespace
+
+const size_t ModuleProcessStats::kLateWakeupBuckets;
+
+DeadlineProcessThread::DeadlineProcessThread(const char* thread_name)
+    : wake_up_(false, false), thread_name_(thread_name) {}
+
+DeadlineProcessThread::~DeadlineProcessThread() {
+  RTC_DCHECK(thread_checker_.CalledOnValidThread());
+  RTC_DCHECK(!thread_.get());
+  RTC_DCHECK(!stop_);
+
+  while (!tasks_.empty()) {
+    delete tasks_.front();
+    tasks_.pop();
+  }
+}
+
+// static
+std::unique_ptr<DeadlineProcessThread> DeadlineProcessThread::Create(
+    const char* thread_name) {
+  return std::unique_ptr<DeadlineProcessThread>(
+      new DeadlineProcessThread(thread_name));
+}
+
+void DeadlineProcessThread::Start() {
+  RTC_DCHECK(thread_checker_.CalledOnValidThread());
+  RTC_DCHECK(!thread_.get());
+  if (thread_.get())
+    return;
+
+  RTC_DCHECK(!stop_);
+
+  {
+    rtc::CritScope lock(&lock_);
+    for (auto& module : modules_)
+      module.first->ProcessThreadAttached(this);
+  }
+
+  thread_.reset(new rtc::PlatformThread(&DeadlineProcessThread::Run, this,
+                                        thread_name_));
+  thread_->Start();
+}
+
+void DeadlineProcessThread::Stop() {
+  RTC_DCHECK(thread_checker_.CalledOnValidThread());
+  if (!thread_.get())
+    return;
+
+  {
+    rtc::CritScope lock(&lock_);
+    stop_ = true;
+  }
+
+  wake_up_.Set();
+
+  thread_->Stop();
+  stop_ = false;
+
+  thread_.reset();
+  rtc::CritScope lock(&lock_);
+  for (auto& module : modules_)
+    module.first->ProcessThreadAttached(nullptr);
+}
+
+void DeadlineProcessThread::WakeUp(webrtc::Module* module) {
+  {
+    rtc::CritScope lock(&lock_);
+    auto it = modules_.find(module);
+    if (it != modules_.end() && it->second.next_callback_ms != 0) {
+      it->second.next_callback_ms = 0;
+      ++it->second.generation;
+      requery_.push_back(module);
+    }
+  }
+  wake_up_.Set();
+}
+
+void DeadlineProcessThread::PostTask(std::unique_ptr<rtc::QueuedTask> task) {
+  {
+    rtc::CritScope lock(&lock_);
+    tasks_.push(task.release());
+  }
+  wake_up_.Set();
+}
+
+void DeadlineProcessThread::RegisterModule(webrtc::Module* module,
+                                           const rtc::Location& from) {
+  RTC_DCHECK(module);
+
+#if RTC_DCHECK_IS_ON
+  {
+    // Catch programmer error.
+    rtc::CritScope lock(&lock_);
+    RTC_DCHECK(modules_.find(module) == modules_.end())
+        << "Already registered here: " << from.ToString();
+  }
+#endif
+
+  // Now that we know the module isn't in the list, we'll call out to notify
+  // the module that it's attached to the worker thread. We don't hold
+  // the lock while we make this call.
+  if (thread_.get())
+    module->ProcessThreadAttached(this);
+
+  {
+    rtc::CritScope lock(&lock_);
+    ModuleEntry& entry = modules_[module];
+    entry.stats.module = module;
+    entry.stats.location = from;
+    requery_.push_back(module);
+  }
+
+  // Wake the thread calling ProcessThread::Process() to update the
+  // waiting time. The waiting time for the just registered module may be
+  // shorter than all other registered modules.
+  wake_up_.Set();
+}
+
+void DeadlineProcessThread::DeRegisterModule(webrtc::Module* module) {
+  RTC_DCHECK(module);
+
+  {
+    rtc::CritScope lock(&lock_);
+    // Heap entries and |requery_| are skipped once the module is gone.
+    modules_.erase(module);
+  }
+
+  // Notify the module that it's been detached.
+  if (thread_.get())
+    module->ProcessThreadAttached(nullptr);
+}
+
+std::vector<ModuleProcessStats> DeadlineProcessThread::GetModuleStats()
+    const {
+  rtc::CritScope lock(&lock_);
+  std::vector<ModuleProcessStats> stats;
+  stats.reserve(modules_.size());
+  for (const auto& module : modules_)
+    stats.push_back(module.second.stats);
+  return stats;
+}
+
+void DeadlineProcessThread::ResetModuleStats() {
+  rtc::CritScope lock(&lock_);
+  for (auto& module : modules_) {
+    ModuleProcessStats& stats = module.second.stats;
+    ModuleProcessStats cleared;
+    cleared.module = stats.module;
+    cleared.location = stats.location;
+    stats = cleared;
+  }
+}
+
+// static
+void DeadlineProcessThread::Run(void* obj) {
+  DeadlineProcessThread* impl = static_cast<DeadlineProcessThread*>(obj);
+  while (impl->Process()) {
+  }
+}
+
+bool DeadlineProcessThread::Process() {
+  int64_t now = rtc::TimeMillis();
+  int64_t next_checkpoint = now + kMaxWaitMs;
+  {
+    rtc::CritScope lock(&lock_);
+    if (stop_)
+      return false;
+
+    std::vector<webrtc::Module*> requery;
+    requery.swap(requery_);
+    for (webrtc::Module* module : requery) {
+      auto it = modules_.find(module);
+      if (it != modules_.end() && it->second.next_callback_ms == 0)
+        ScheduleModule(module, &it->second, now);
+    }
+
+    // Modules that come due again right away wait for the next wakeup, like
+    // they do in ProcessThreadImpl, so this loop always ends.
+    std::vector<webrtc::Module*> processed;
+    while (!deadlines_.empty() && deadlines_.top().run_at_ms <= now) {
+      const Deadline deadline = deadlines_.top();
+      deadlines_.pop();
+      auto it = modules_.find(deadline.module);
+      if (it == modules_.end() ||
+          it->second.generation != deadline.generation) {
+        continue;
+      }
+      ProcessModule(deadline.module, &it->second, deadline.run_at_ms, now);
+      processed.push_back(deadline.module);
+    }
+    // TimeUntilNextProcess() is relative to the time the module is asked,
+    // which is after the Process() calls above.
+    const int64_t processed_ms = processed.empty() ? now : rtc::TimeMillis();
+    for (webrtc::Module* module : processed) {
+      // Process() may have deregistered the module or woken it up.
+      auto it = modules_.find(module);
+      if (it != modules_.end() && it->second.next_callback_ms != 0)
+        ScheduleModule(module, &it->second, processed_ms);
+    }
+
+    PruneStaleDeadlines();
+    if (!deadlines_.empty())
+      next_checkpoint = std::min(next_checkpoint, deadlines_.top().run_at_ms);
+
+    while (!tasks_.empty()) {
+      rtc::QueuedTask* task = tasks_.front();
+      tasks_.pop();
+      lock_.Leave();
+      if (task->Run())
+        delete task;
+      lock_.Enter();
+    }
+  }
+
+  int64_t time_to_wait = next_checkpoint - rtc::TimeMillis();
+  if (time_to_wait > 0)
+    wake_up_.Wait(static_cast<int>(time_to_wait));
+
+  return true;
+}
+
+void DeadlineProcessThread::ScheduleModule(webrtc::Module* module,
+                                           ModuleEntry* entry,
+                                           int64_t now_ms) {
+  int64_t interval = module->TimeUntilNextProcess();
+  if (interval < 0) {
+    // Falling behind, we should call the callback now.
+    interval = 0;
+  }
+  entry->next_callback_ms = now_ms + interval;
+  ++entry->generation;
+  deadlines_.push(Deadline{entry->next_callback_ms, entry->generation, module});
+}
+
+void DeadlineProcessThread::ProcessModule(webrtc::Module* module,
+                                          ModuleEntry* entry,
+                                          int64_t deadline_ms,
+                                          int64_t now_ms) {
+  ModuleProcessStats& stats = entry->stats;
+  ++stats.late_wakeups[LateWakeupBucket(now_ms - deadline_ms)];
+
+  // Marks the module for ScheduleModule() once the batch is done.
+  entry->next_callback_ms = -1;
+
+  const int64_t wall_start_us = rtc::TimeMicros();
+  const int64_t cpu_start_us = ThreadCpuTimeMicros();
+  module->Process();
+  const int64_t cpu_us = ThreadCpuTimeMicros() - cpu_start_us;
+  const int64_t wall_us = rtc::TimeMicros() - wall_start_us;
+
+  // |entry| is gone if Process() deregistered the module.
+  auto it = modules_.find(module);
+  if (it == modules_.end())
+    return;
+  ModuleProcessStats& after = it->second.stats;
+  ++after.process_calls;
+  after.total_wall_time_us += wall_us;
+  after.max_wall_time_us = std::max(after.max_wall_time_us, wall_us);
+  after.total_cpu_time_us += cpu_us;
+  after.max_cpu_time_us = std::max(after.max_cpu_time_us, cpu_us);
+}
+
+void DeadlineProcessThread::PruneStaleDeadlines() {
+  while (!deadlines_.empty()) {
+    const Deadline& top = deadlines_.top();
+    auto it = modules_.find(top.module);
+    if (it != modules_.end() && it->second.generation == top.generation)
+      return;
+    deadlines_.pop();
+  }
+}
+
+}  // namespace simple_app
@@ -0,0 +1,132 @@
+#ifndef DEADLINE_PROCESS_THREAD_H_
+#define DEADLINE_PROCESS_THREAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "modules/include/module.h"
+#include "modules/utility/include/process_thread.h"
+#include "rtc_base/criticalsection.h"
+#include "rtc_base/event.h"
+#include "rtc_base/location.h"
+#include "rtc_base/platform_thread.h"
+#include "rtc_base/thread_checker.h"
+
+namespace simple_app {
+
+// Per-module counters collected by DeadlineProcessThread.
+struct ModuleProcessStats {
+  // Bucket 0 counts Process() calls that started less than 1 ms after their
+  // deadline, bucket i (i > 0) those 2^(i-1) to 2^i - 1 ms late, and the last
+  // bucket everything later than that.
+  static const size_t kLateWakeupBuckets = 9;
+
+  webrtc::Module* module = nullptr;
+  // Where the module was registered from.
+  rtc::Location location;
+  uint64_t process_calls = 0;
+  int64_t total_wall_time_us = 0;
+  int64_t max_wall_time_us = 0;
+  int64_t total_cpu_time_us = 0;
+  int64_t max_cpu_time_us = 0;
+  uint64_t late_wakeups[kLateWakeupBuckets] = {};
+};
+
+// webrtc::ProcessThread that keeps registered modules in a min-heap keyed by
+// their next deadline, so a wakeup only touches the modules that are due and
+// the ones that were just registered or woken up. ProcessThreadImpl instead
+// walks its whole module list and calls TimeUntilNextProcess() on each one
+// every time it wakes.
+//
+// Every Process() call is timed, wall clock and thread CPU time, and its
+// lateness against the deadline is put in a histogram; GetModuleStats()
+// reports them to find the module that stalls the thread.
+//
+// Threading follows ProcessThreadImpl: Start()/Stop() on the construction
+// thread, everything else from any thread, and modules are called with the
+// module lock held, so DeRegisterModule() does not return while the module is
+// being processed.
+class DeadlineProcessThread : public webrtc::ProcessThread {
+ public:
+  explicit DeadlineProcessThread(const char* thread_name);
+  ~DeadlineProcessThread() override;
+
+  // Equivalent of webrtc::ProcessThread::Create().
+  static std::unique_ptr<DeadlineProcessThread> Create(
+      const char* thread_name);
+
+  // webrtc::ProcessThread:
+  void Start() override;
+  void Stop() override;
+  void WakeUp(webrtc::Module* module) override;
+  void PostTask(std::unique_ptr<rtc::QueuedTask> task) override;
+  void RegisterModule(webrtc::Module* module,
+                      const rtc::Location& from) override;
+  void DeRegisterModule(webrtc::Module* module) override;
+
+  // Snapshot of the counters of every registered module. Blocks while a
+  // module is being processed.
+  std::vector<ModuleProcessStats> GetModuleStats() const;
+  void ResetModuleStats();
+
+ private:
+  struct ModuleEntry {
+    // Absolute time of the next Process() call, 0 when the module has to be
+    // asked with TimeUntilNextProcess() first, or -1 from its Process() call
+    // until it is rescheduled.
+    int64_t next_callback_ms = 0;
+    // Bumped whenever |next_callback_ms| changes, so heap entries pushed for
+    // an earlier deadline can be told apart and skipped.
+    uint64_t generation = 0;
+    ModuleProcessStats stats;
+  };
+
+  struct Deadline {
+    int64_t run_at_ms;
+    uint64_t generation;
+    webrtc::Module* module;
+
+    bool operator<(const Deadline& other) const {
+      return run_at_ms > other.run_at_ms;
+    }
+  };
+
+  static void Run(void* obj);
+  // One wakeup of the worker thread. Returns false once Stop() was called.
+  bool Process();
+  // Asks |module| for its next deadline and puts it on the heap.
+  void ScheduleModule(webrtc::Module* module,
+                      ModuleEntry* entry,
+                      int64_t now_ms) RTC_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  void ProcessModule(webrtc::Module* module,
+                     ModuleEntry* entry,
+                     int64_t deadline_ms,
+                     int64_t now_ms) RTC_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+  // Drops heap entries that no longer match their module's deadline.
+  void PruneStaleDeadlines() RTC_EXCLUSIVE_LOCKS_REQUIRED(lock_);
+
+  rtc::CriticalSection lock_;
+  rtc::ThreadChecker thread_checker_;
+  rtc::Event wake_up_;
+  std::unique_ptr<rtc::PlatformThread> thread_;
+  const char* const thread_name_;
+
+  std::unordered_map<webrtc::Module*, ModuleEntry> modules_
+      RTC_GUARDED_BY(lock_);
+  std::priority_queue<Deadline> deadlines_ RTC_GUARDED_BY(lock_);
+  // Modules that were registered or woken up since the last wakeup.
+  std::vector<webrtc::Module*> requery_ RTC_GUARDED_BY(lock_);
+  std::queue<rtc::QueuedTask*> tasks_ RTC_GUARDED_BY(lock_);
+  bool stop_ RTC_GUARDED_BY(lock_) = false;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(DeadlineProcessThread);
+};
+
+}  // namespace simple_app
+
+#endif  // DEADLINE_PROCESS_THREAD_H_
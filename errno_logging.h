@@ -0,0 +1,17 @@
+#ifndef ERRNO_LOGGING_H_
+#define ERRNO_LOGGING_H_
+
+#include <errno.h>
+
+#include "rtc_base/logging.h"
+
+// LOG_WITH_ERRNO(sev) logs the message with errno and its description
+// appended, as upstream's LOG_ERRNO(sev) does. That one goes through LOG_E(),
+// which relies on an empty ##__VA_ARGS__, a GNU extension -pedantic warns
+// about at every use.
+#define LOG_WITH_ERRNO(sev)                                          \
+  LOG_SEVERITY_PRECONDITION(rtc::sev)                                \
+  rtc::LogMessage(__FILE__, __LINE__, rtc::sev, rtc::ERRCTX_ERRNO,   \
+                  errno).stream()
+
+#endif  // ERRNO_LOGGING_H_
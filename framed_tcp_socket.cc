@@ -0,0 +1,683 @@
+#include "framed_tcp_socket.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "errno_logging.h"
+#include "p2p/base/stun.h"
+#include "rtc_base/byteorder.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+namespace {
+
+const size_t kLengthHeaderSize = 2;
+// Type and length, the part of a STUN or ChannelData header that gives the
+// size of the message.
+const size_t kStunLengthHeaderSize = 4;
+const size_t kChannelDataHeaderSize = 4;
+// A STUN message of the largest length, the largest frame either framing
+// can carry.
+const size_t kMaxFrameSize = cricket::kStunHeaderSize + 0xFFFF;
+// Twice the largest frame with its up to 3 bytes of padding, so a partial
+// frame never fills the input ring.
+const size_t kInputRingSize = 2 * (kMaxFrameSize + 3);
+const char kPadding[4] = {0};
+
+#if defined(WEBRTC_LINUX)
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+// Size of the STUN message or ChannelData starting with |header|, and the
+// padding that follows it on the wire.
+size_t StunFrameSize(const uint8_t* header, size_t* pad) {
+  uint16_t type = rtc::GetBE16(header);
+  uint16_t length = rtc::GetBE16(header + 2);
+  if ((type & 0xC000) == 0) {
+    *pad = 0;
+    return cricket::kStunHeaderSize + length;
+  }
+  *pad = (4 - length % 4) % 4;
+  return kChannelDataHeaderSize + length;
+}
+
+bool TranslateOption(rtc::Socket::Option opt,
+                     int family,
+                     int* level,
+                     int* name,
+                     int* value) {
+  switch (opt) {
+    case rtc::Socket::OPT_RCVBUF:
+      *level = SOL_SOCKET;
+      *name = SO_RCVBUF;
+      return true;
+    case rtc::Socket::OPT_SNDBUF:
+      *level = SOL_SOCKET;
+      *name = SO_SNDBUF;
+      return true;
+    case rtc::Socket::OPT_NODELAY:
+      *level = IPPROTO_TCP;
+      *name = TCP_NODELAY;
+      return true;
+    case rtc::Socket::OPT_DSCP:
+      // The DSCP sits in the upper six bits of the TOS / traffic class byte.
+      *value <<= 2;
+      if (family == AF_INET6) {
+        *level = IPPROTO_IPV6;
+        *name = IPV6_TCLASS;
+      } else {
+        *level = IPPROTO_IP;
+        *name = IP_TOS;
+      }
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool LocalAddressOf(int fd, rtc::SocketAddress* address) {
+  sockaddr_storage saddr;
+  socklen_t len = sizeof(saddr);
+  return ::getsockname(fd, reinterpret_cast<sockaddr*>(&saddr), &len) == 0 &&
+         rtc::SocketAddressFromSockAddrStorage(saddr, address);
+}
+
+}  // namespace
+
+// Byte ring whose contents and free space are each at most two pieces, for
+// readv and writev.
+class FramedTcpSocket::Ring {
+ public:
+  explicit Ring(size_t capacity)
+      : buffer_(new char[capacity]), capacity_(capacity) {}
+
+  size_t size() const { return size_; }
+  size_t space() const { return capacity_ - size_; }
+
+  // The bytes, front first. Returns the number of pieces.
+  int Data(iovec* iov) const {
+    if (size_ == 0)
+      return 0;
+    size_t first = std::min(size_, capacity_ - head_);
+    iov[0].iov_base = buffer_.get() + head_;
+    iov[0].iov_len = first;
+    if (first == size_)
+      return 1;
+    iov[1].iov_base = buffer_.get();
+    iov[1].iov_len = size_ - first;
+    return 2;
+  }
+
+  // The free space after the bytes. Returns the number of pieces.
+  int Space(iovec* iov) {
+    if (size_ == capacity_)
+      return 0;
+    size_t tail = Wrap(head_ + size_);
+    size_t first = std::min(space(), capacity_ - tail);
+    iov[0].iov_base = buffer_.get() + tail;
+    iov[0].iov_len = first;
+    if (first == space())
+      return 1;
+    iov[1].iov_base = buffer_.get();
+    iov[1].iov_len = space() - first;
+    return 2;
+  }
+
+  // Appends |length| bytes written into Space().
+  void Produce(size_t length) {
+    RTC_DCHECK_LE(length, space());
+    size_ += length;
+  }
+
+  void Consume(size_t length) {
+    RTC_DCHECK_LE(length, size_);
+    size_ -= length;
+    // Restarting at the front keeps later pieces whole.
+    head_ = size_ == 0 ? 0 : Wrap(head_ + length);
+  }
+
+  void Write(const void* data, size_t length) {
+    RTC_DCHECK_LE(length, space());
+    size_t tail = Wrap(head_ + size_);
+    size_t first = std::min(length, capacity_ - tail);
+    memcpy(buffer_.get() + tail, data, first);
+    memcpy(buffer_.get(), static_cast<const char*>(data) + first,
+           length - first);
+    size_ += length;
+  }
+
+  // |length| bytes from |offset| in, if they are in one piece, else null.
+  const char* Find(size_t offset, size_t length) const {
+    size_t start = Wrap(head_ + offset);
+    return start + length <= capacity_ ? buffer_.get() + start : nullptr;
+  }
+
+  void CopyOut(size_t offset, void* data, size_t length) const {
+    size_t start = Wrap(head_ + offset);
+    size_t first = std::min(length, capacity_ - start);
+    memcpy(data, buffer_.get() + start, first);
+    memcpy(static_cast<char*>(data) + first, buffer_.get(), length - first);
+  }
+
+ private:
+  size_t Wrap(size_t position) const {
+    return position >= capacity_ ? position - capacity_ : position;
+  }
+
+  std::unique_ptr<char[]> buffer_;
+  const size_t capacity_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(Ring);
+};
+
+// static
+FramedTcpSocket* FramedTcpSocket::Connect(
+    rtc::PhysicalSocketServer* ss,
+    const rtc::SocketAddress& bind_address,
+    const rtc::SocketAddress& remote_address,
+    const Config& config) {
+  int fd = OpenSocket(remote_address.family());
+  if (fd == INVALID_SOCKET)
+    return nullptr;
+  std::unique_ptr<FramedTcpSocket> socket(
+      new FramedTcpSocket(ss, fd, STATE_CONNECTING, config));
+
+  sockaddr_storage saddr;
+  if (!bind_address.IsNil()) {
+    size_t len = bind_address.ToSockAddrStorage(&saddr);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&saddr),
+               static_cast<socklen_t>(len)) < 0) {
+      LOG_WITH_ERRNO(LS_ERROR) << "TCP bind failed";
+      return nullptr;
+    }
+  }
+  size_t len = remote_address.ToSockAddrStorage(&saddr);
+  // Even an immediate success is reported through DE_CONNECT, so
+  // SignalConnect always comes from the socket server.
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&saddr),
+                static_cast<socklen_t>(len)) < 0 &&
+      errno != EINPROGRESS) {
+    LOG_WITH_ERRNO(LS_ERROR) << "TCP connect to " << remote_address.ToString()
+                             << " failed";
+    return nullptr;
+  }
+  LocalAddressOf(fd, &socket->local_address_);
+  socket->remote_address_ = remote_address;
+  socket->SetOption(rtc::Socket::OPT_NODELAY, 1);
+  ss->Add(socket.get());
+  socket->added_ = true;
+  return socket.release();
+}
+
+// static
+FramedTcpSocket* FramedTcpSocket::Listen(rtc::PhysicalSocketServer* ss,
+                                         const rtc::SocketAddress& bind_address,
+                                         uint16_t min_port,
+                                         uint16_t max_port,
+                                         const Config& config) {
+  int fd = OpenSocket(bind_address.family());
+  if (fd == INVALID_SOCKET)
+    return nullptr;
+  std::unique_ptr<FramedTcpSocket> socket(
+      new FramedTcpSocket(ss, fd, STATE_BOUND, config));
+
+  if (min_port == 0 && max_port == 0)
+    min_port = max_port = bind_address.port();
+  int ret = -1;
+  for (uint32_t port = min_port; ret < 0 && port <= max_port; ++port) {
+    sockaddr_storage saddr;
+    size_t len = rtc::SocketAddress(bind_address.ipaddr(), port)
+                     .ToSockAddrStorage(&saddr);
+    ret = ::bind(fd, reinterpret_cast<sockaddr*>(&saddr),
+                 static_cast<socklen_t>(len));
+  }
+  if (ret < 0 || ::listen(fd, SOMAXCONN) < 0 ||
+      !LocalAddressOf(fd, &socket->local_address_)) {
+    LOG_WITH_ERRNO(LS_ERROR) << "TCP listen on " << bind_address.ToString()
+                             << " failed";
+    return nullptr;
+  }
+  ss->Add(socket.get());
+  socket->added_ = true;
+  return socket.release();
+}
+
+FramedTcpSocket::FramedTcpSocket(rtc::PhysicalSocketServer* ss,
+                                 int fd,
+                                 State state,
+                                 const Config& config)
+    : ss_(ss), fd_(fd), state_(state), config_(config) {
+  if (state_ != STATE_BOUND) {
+    input_.reset(new Ring(kInputRingSize));
+    output_.reset(
+        new Ring(std::max(config_.max_queued_bytes, kMaxFrameSize)));
+  }
+}
+
+FramedTcpSocket::~FramedTcpSocket() {
+  Close();
+}
+
+size_t FramedTcpSocket::queued_bytes() const {
+  return output_ ? output_->size() : 0;
+}
+
+rtc::SocketAddress FramedTcpSocket::GetLocalAddress() const {
+  return local_address_;
+}
+
+rtc::SocketAddress FramedTcpSocket::GetRemoteAddress() const {
+  return remote_address_;
+}
+
+int FramedTcpSocket::Send(const void* pv,
+                          size_t cb,
+                          const rtc::PacketOptions& options) {
+  if (state_ != STATE_CONNECTING && state_ != STATE_CONNECTED) {
+    error_ = ENOTCONN;
+    return -1;
+  }
+
+  uint8_t header[kLengthHeaderSize];
+  iovec pieces[3];
+  int count = 0;
+  size_t pad = 0;
+  if (config_.framing == FRAMING_LENGTH) {
+    if (cb > 0xFFFF) {
+      error_ = EMSGSIZE;
+      return -1;
+    }
+    rtc::SetBE16(header, static_cast<uint16_t>(cb));
+    pieces[count].iov_base = header;
+    pieces[count++].iov_len = sizeof(header);
+  } else {
+    if (cb < kStunLengthHeaderSize) {
+      error_ = EMSGSIZE;
+      return -1;
+    }
+    // Only whole STUN messages and ChannelData can be framed.
+    if (StunFrameSize(static_cast<const uint8_t*>(pv), &pad) != cb) {
+      error_ = EINVAL;
+      return -1;
+    }
+  }
+  pieces[count].iov_base = const_cast<void*>(pv);
+  pieces[count++].iov_len = cb;
+  if (pad) {
+    pieces[count].iov_base = const_cast<char*>(kPadding);
+    pieces[count++].iov_len = pad;
+  }
+  size_t frame_size = 0;
+  for (int i = 0; i < count; ++i)
+    frame_size += pieces[i].iov_len;
+
+  if (!HasRoomFor(frame_size) && state_ == STATE_CONNECTED && !Flush()) {
+    CloseWithError(error_);
+    return -1;
+  }
+  if (!HasRoomFor(frame_size)) {
+    error_ = EWOULDBLOCK;
+    ready_to_send_pending_ = true;
+    return -1;
+  }
+
+  size_t written = 0;
+  if (!config_.coalesce && state_ == STATE_CONNECTED &&
+      output_->size() == 0) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = pieces;
+    msg.msg_iovlen = count;
+    ssize_t ret = ::sendmsg(fd_, &msg, kSendFlags);
+    if (ret < 0 && !rtc::IsBlockingError(errno)) {
+      error_ = errno;
+      return -1;
+    }
+    written = std::max<ssize_t>(ret, 0);
+  }
+  // Queues what the kernel did not take.
+  for (int i = 0; i < count; ++i) {
+    size_t skip = std::min(written, pieces[i].iov_len);
+    written -= skip;
+    output_->Write(static_cast<const char*>(pieces[i].iov_base) + skip,
+                   pieces[i].iov_len - skip);
+  }
+  if (output_->size() > 0)
+    WantWrite(true);
+
+  SignalSentPacket(this, rtc::SentPacket(options.packet_id,
+                                         rtc::TimeMillis()));
+  return static_cast<int>(cb);
+}
+
+int FramedTcpSocket::SendTo(const void* pv,
+                            size_t cb,
+                            const rtc::SocketAddress& addr,
+                            const rtc::PacketOptions& options) {
+  if (addr != remote_address_) {
+    error_ = ENOTCONN;
+    return -1;
+  }
+  return Send(pv, cb, options);
+}
+
+int FramedTcpSocket::Close() {
+  if (fd_ == INVALID_SOCKET)
+    return 0;
+  if (added_)
+    ss_->Remove(this);
+  added_ = false;
+  int ret = ::close(fd_);
+  fd_ = INVALID_SOCKET;
+  state_ = STATE_CLOSED;
+  want_write_ = false;
+  return ret;
+}
+
+rtc::AsyncPacketSocket::State FramedTcpSocket::GetState() const {
+  return state_;
+}
+
+int FramedTcpSocket::GetOption(rtc::Socket::Option opt, int* value) {
+  int level;
+  int name;
+  int unused = 0;
+  if (opt == rtc::Socket::OPT_DSCP ||
+      !TranslateOption(opt, local_address_.family(), &level, &name,
+                       &unused)) {
+    error_ = ENOTSUP;
+    return -1;
+  }
+  socklen_t len = sizeof(*value);
+  int ret = ::getsockopt(fd_, level, name, value, &len);
+  if (ret < 0)
+    error_ = errno;
+  return ret;
+}
+
+int FramedTcpSocket::SetOption(rtc::Socket::Option opt, int value) {
+  int level;
+  int name;
+  if (!TranslateOption(opt, local_address_.family(), &level, &name,
+                       &value)) {
+    error_ = ENOTSUP;
+    return -1;
+  }
+  int ret = ::setsockopt(fd_, level, name, &value, sizeof(value));
+  if (ret < 0)
+    error_ = errno;
+  return ret;
+}
+
+int FramedTcpSocket::GetError() const {
+  return error_;
+}
+
+void FramedTcpSocket::SetError(int error) {
+  error_ = error;
+}
+
+uint32_t FramedTcpSocket::GetRequestedEvents() {
+  switch (state_) {
+    case STATE_BOUND:
+      return rtc::DE_ACCEPT;
+    case STATE_CONNECTING:
+      return rtc::DE_CONNECT;
+    case STATE_CONNECTED:
+      return rtc::DE_READ | (want_write_ ? rtc::DE_WRITE : 0);
+    default:
+      return 0;
+  }
+}
+
+void FramedTcpSocket::OnPreEvent(uint32_t /* ff */) {}
+
+void FramedTcpSocket::OnEvent(uint32_t ff, int err) {
+  if (ff & rtc::DE_CONNECT) {
+    if (err) {
+      CloseWithError(err);
+      return;
+    }
+    state_ = STATE_CONNECTED;
+    LocalAddressOf(fd_, &local_address_);
+    ss_->Update(this);
+    SignalConnect(this);
+  }
+  if ((ff & rtc::DE_ACCEPT) && fd_ != INVALID_SOCKET)
+    AcceptAll();
+  if ((ff & rtc::DE_READ) && fd_ != INVALID_SOCKET)
+    ReadInput();
+  if ((ff & rtc::DE_WRITE) && fd_ != INVALID_SOCKET && !Flush())
+    CloseWithError(error_);
+  if ((ff & rtc::DE_CLOSE) && fd_ != INVALID_SOCKET)
+    CloseWithError(err);
+}
+
+int FramedTcpSocket::GetDescriptor() {
+  return fd_;
+}
+
+bool FramedTcpSocket::IsDescriptorClosed() {
+  // ReadInput() sees the end of the stream itself.
+  return false;
+}
+
+// static
+int FramedTcpSocket::OpenSocket(int family) {
+  int fd = ::socket(family, SOCK_STREAM, 0);
+  if (fd == INVALID_SOCKET) {
+    LOG_WITH_ERRNO(LS_ERROR) << "TCP socket creation failed";
+    return INVALID_SOCKET;
+  }
+  if (::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+    LOG_WITH_ERRNO(LS_ERROR) << "Failed to make TCP socket non-blocking";
+    ::close(fd);
+    return INVALID_SOCKET;
+  }
+#if defined(WEBRTC_MAC)
+  int value = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &value, sizeof(value));
+#endif
+  return fd;
+}
+
+void FramedTcpSocket::AcceptAll() {
+  while (fd_ != INVALID_SOCKET) {
+    sockaddr_storage saddr;
+    socklen_t len = sizeof(saddr);
+    int fd = ::accept(fd_, reinterpret_cast<sockaddr*>(&saddr), &len);
+    if (fd < 0) {
+      if (!rtc::IsBlockingError(errno))
+        LOG_WITH_ERRNO(LS_WARNING) << "TCP accept failed";
+      return;
+    }
+    if (::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+      LOG_WITH_ERRNO(LS_WARNING)
+          << "Failed to make accepted socket non-blocking";
+      ::close(fd);
+      continue;
+    }
+#if defined(WEBRTC_MAC)
+    int value = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &value, sizeof(value));
+#endif
+    FramedTcpSocket* socket =
+        new FramedTcpSocket(ss_, fd, STATE_CONNECTED, config_);
+    LocalAddressOf(fd, &socket->local_address_);
+    rtc::SocketAddressFromSockAddrStorage(saddr, &socket->remote_address_);
+    socket->SetOption(rtc::Socket::OPT_NODELAY, 1);
+    ss_->Add(socket);
+    socket->added_ = true;
+    SignalNewConnection(this, socket);
+  }
+}
+
+void FramedTcpSocket::ReadInput() {
+  iovec space[2];
+  int count = input_->Space(space);
+  RTC_DCHECK_GT(count, 0);
+  ssize_t ret = ::readv(fd_, space, count);
+  if (ret == 0) {
+    CloseWithError(0);
+    return;
+  }
+  if (ret < 0) {
+    if (!rtc::IsBlockingError(errno))
+      CloseWithError(errno);
+    return;
+  }
+  input_->Produce(ret);
+
+  const rtc::PacketTime packet_time = rtc::CreatePacketTime(0);
+  const size_t offset =
+      config_.framing == FRAMING_LENGTH ? kLengthHeaderSize : 0;
+  size_t packet_size;
+  while (fd_ != INVALID_SOCKET) {
+    size_t frame_size = PeekFrame(&packet_size);
+    if (frame_size == 0)
+      break;
+    const char* packet = input_->Find(offset, packet_size);
+    if (!packet) {
+      if (!scratch_)
+        scratch_.reset(new char[kMaxFrameSize]);
+      input_->CopyOut(offset, scratch_.get(), packet_size);
+      packet = scratch_.get();
+    }
+    SignalReadPacket(this, packet, packet_size, remote_address_,
+                     packet_time);
+    if (fd_ != INVALID_SOCKET)
+      input_->Consume(frame_size);
+  }
+}
+
+size_t FramedTcpSocket::PeekFrame(size_t* packet_size) const {
+  size_t frame_size;
+  if (config_.framing == FRAMING_LENGTH) {
+    uint8_t header[kLengthHeaderSize];
+    if (input_->size() < sizeof(header))
+      return 0;
+    input_->CopyOut(0, header, sizeof(header));
+    *packet_size = rtc::GetBE16(header);
+    frame_size = sizeof(header) + *packet_size;
+  } else {
+    uint8_t header[kStunLengthHeaderSize];
+    if (input_->size() < sizeof(header))
+      return 0;
+    input_->CopyOut(0, header, sizeof(header));
+    size_t pad;
+    *packet_size = StunFrameSize(header, &pad);
+    frame_size = *packet_size + pad;
+  }
+  return input_->size() >= frame_size ? frame_size : 0;
+}
+
+bool FramedTcpSocket::Flush() {
+  while (output_->size() > 0) {
+    iovec pieces[2];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = pieces;
+    msg.msg_iovlen = output_->Data(pieces);
+    size_t size = output_->size();
+    ssize_t ret = ::sendmsg(fd_, &msg, kSendFlags);
+    if (ret < 0) {
+      error_ = errno;
+      if (!rtc::IsBlockingError(error_))
+        return false;
+      break;
+    }
+    output_->Consume(ret);
+    if (static_cast<size_t>(ret) < size)
+      break;
+  }
+  WantWrite(output_->size() > 0);
+  if (ready_to_send_pending_ &&
+      output_->size() <= config_.max_queued_bytes / 2) {
+    ready_to_send_pending_ = false;
+    SignalReadyToSend(this);
+  }
+  return true;
+}
+
+bool FramedTcpSocket::HasRoomFor(size_t frame_size) const {
+  // A frame larger than the whole budget still goes out on its own.
+  return frame_size <= output_->space() &&
+         (output_->size() == 0 ||
+          output_->size() + frame_size <= config_.max_queued_bytes);
+}
+
+void FramedTcpSocket::WantWrite(bool want) {
+  if (want_write_ == want)
+    return;
+  want_write_ = want;
+  if (state_ == STATE_CONNECTED)
+    ss_->Update(this);
+}
+
+void FramedTcpSocket::CloseWithError(int error) {
+  Close();
+  SignalClose(this, error);
+}
+
+FramedPacketSocketFactory::FramedPacketSocketFactory(
+    rtc::PhysicalSocketServer* ss,
+    const FramedTcpSocket::Config& config)
+    : rtc::BasicPacketSocketFactory(ss), ss_(ss), config_(config) {}
+
+FramedPacketSocketFactory::~FramedPacketSocketFactory() {}
+
+rtc::AsyncPacketSocket* FramedPacketSocketFactory::CreateServerTcpSocket(
+    const rtc::SocketAddress& local_address,
+    uint16_t min_port,
+    uint16_t max_port,
+    int opts) {
+  const int tls_opts = OPT_TLS | OPT_TLS_FAKE | OPT_TLS_INSECURE;
+  if (opts & tls_opts) {
+    return rtc::BasicPacketSocketFactory::CreateServerTcpSocket(
+        local_address, min_port, max_port, opts);
+  }
+  return FramedTcpSocket::Listen(ss_, local_address, min_port, max_port,
+                                 ConfigFor(opts));
+}
+
+rtc::AsyncPacketSocket* FramedPacketSocketFactory::CreateClientTcpSocket(
+    const rtc::SocketAddress& local_address,
+    const rtc::SocketAddress& remote_address,
+    const rtc::ProxyInfo& proxy_info,
+    const std::string& user_agent,
+    const rtc::PacketSocketTcpOptions& tcp_options) {
+  const int tls_opts = OPT_TLS | OPT_TLS_FAKE | OPT_TLS_INSECURE;
+  if ((tcp_options.opts & tls_opts) || proxy_info.type != rtc::PROXY_NONE ||
+      remote_address.IsUnresolvedIP()) {
+    return rtc::BasicPacketSocketFactory::CreateClientTcpSocket(
+        local_address, remote_address, proxy_info, user_agent, tcp_options);
+  }
+  // As the base class, binds to the local IP with any port.
+  return FramedTcpSocket::Connect(
+      ss_, rtc::SocketAddress(local_address.ipaddr(), 0), remote_address,
+      ConfigFor(tcp_options.opts));
+}
+
+FramedTcpSocket::Config FramedPacketSocketFactory::ConfigFor(int opts) const {
+  FramedTcpSocket::Config config = config_;
+  config.framing = (opts & OPT_STUN) ? FramedTcpSocket::FRAMING_STUN
+                                     : FramedTcpSocket::FRAMING_LENGTH;
+  return config;
+}
+
+}  // namespace simple_app
@@ -0,0 +1,175 @@
+#ifndef FRAMED_TCP_SOCKET_H_
+#define FRAMED_TCP_SOCKET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "p2p/base/basicpacketsocketfactory.h"
+#include "rtc_base/asyncpacketsocket.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/physicalsocketserver.h"
+#include "rtc_base/socketaddress.h"
+
+namespace simple_app {
+
+// TCP packet socket that registers its descriptor directly with a
+// PhysicalSocketServer, in place of rtc::AsyncTCPSocket and
+// cricket::AsyncStunTCPSocket, and speaks the same framing as either.
+//
+// Those keep their input in an rtc::Buffer and memmove what is left after
+// every frame, and send every packet with its own send(). Here
+//  - input lands in a ring with one readv(2) per read event and frames are
+//    delivered straight from the ring; only a frame that wraps around its
+//    end is copied out first;
+//  - Send() only queues the framed packet in an output ring and asks for a
+//    write event, so everything sent before the socket server's next pass
+//    goes out in a single writev(2) of at most two pieces;
+//  - the output ring is bounded by |max_queued_bytes|: past it Send() fails
+//    with EWOULDBLOCK, and SignalReadyToSend fires once the queue has
+//    drained to half the budget.
+// Listening sockets accept into FramedTcpSockets with the same framing and
+// config. No TLS; FramedPacketSocketFactory leaves that to the stock
+// sockets.
+class FramedTcpSocket : public rtc::AsyncPacketSocket,
+                        public rtc::Dispatcher {
+ public:
+  enum Framing {
+    // rtc::AsyncTCPSocket: a 16-bit big-endian length, then the packet.
+    FRAMING_LENGTH,
+    // cricket::AsyncStunTCPSocket: STUN messages and TURN ChannelData as
+    // they are, the latter padded to four bytes.
+    FRAMING_STUN,
+  };
+
+  struct Config {
+    Framing framing = FRAMING_LENGTH;
+    size_t max_queued_bytes = 256 * 1024;
+    // Off: Send() writes at once when nothing is queued, a syscall per
+    // packet as the stock sockets do, but without copying it.
+    bool coalesce = true;
+  };
+
+  // Binds to |bind_address| and connects to |remote_address|. Returns null
+  // on failure.
+  static FramedTcpSocket* Connect(rtc::PhysicalSocketServer* ss,
+                                  const rtc::SocketAddress& bind_address,
+                                  const rtc::SocketAddress& remote_address,
+                                  const Config& config);
+  // Binds to |bind_address| with a port in [|min_port|, |max_port|] (the
+  // address's port when both are zero) and listens. Returns null on
+  // failure.
+  static FramedTcpSocket* Listen(rtc::PhysicalSocketServer* ss,
+                                 const rtc::SocketAddress& bind_address,
+                                 uint16_t min_port,
+                                 uint16_t max_port,
+                                 const Config& config);
+  ~FramedTcpSocket() override;
+
+  // Bytes waiting in the output ring.
+  size_t queued_bytes() const;
+
+  // AsyncPacketSocket:
+  rtc::SocketAddress GetLocalAddress() const override;
+  rtc::SocketAddress GetRemoteAddress() const override;
+  int Send(const void* pv,
+           size_t cb,
+           const rtc::PacketOptions& options) override;
+  int SendTo(const void* pv,
+             size_t cb,
+             const rtc::SocketAddress& addr,
+             const rtc::PacketOptions& options) override;
+  int Close() override;
+  State GetState() const override;
+  int GetOption(rtc::Socket::Option opt, int* value) override;
+  int SetOption(rtc::Socket::Option opt, int value) override;
+  int GetError() const override;
+  void SetError(int error) override;
+
+  // Dispatcher:
+  uint32_t GetRequestedEvents() override;
+  void OnPreEvent(uint32_t ff) override;
+  void OnEvent(uint32_t ff, int err) override;
+  int GetDescriptor() override;
+  bool IsDescriptorClosed() override;
+
+ private:
+  class Ring;
+
+  FramedTcpSocket(rtc::PhysicalSocketServer* ss,
+                  int fd,
+                  State state,
+                  const Config& config);
+
+  static int OpenSocket(int family);
+
+  // Accepts every pending connection.
+  void AcceptAll();
+  // Reads once into the input ring and delivers the complete frames.
+  void ReadInput();
+  // Frame length at the front of the input ring, padding included, and the
+  // length of the packet it carries; 0 until enough has arrived.
+  size_t PeekFrame(size_t* packet_size) const;
+  // Writes as much of the output ring as the kernel takes. Returns false
+  // on a socket error.
+  bool Flush();
+  bool HasRoomFor(size_t frame_size) const;
+  void WantWrite(bool want);
+  // Closes and signals SignalClose with |error|.
+  void CloseWithError(int error);
+
+  rtc::PhysicalSocketServer* const ss_;
+  int fd_;
+  State state_;
+  const Config config_;
+  int error_ = 0;
+  // Whether |ss_| has the socket; not on the Connect() and Listen() failure
+  // paths.
+  bool added_ = false;
+  bool want_write_ = false;
+  bool ready_to_send_pending_ = false;
+  rtc::SocketAddress local_address_;
+  rtc::SocketAddress remote_address_;
+  std::unique_ptr<Ring> input_;
+  std::unique_ptr<Ring> output_;
+  // For the frames that wrap around the end of |input_|.
+  std::unique_ptr<char[]> scratch_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(FramedTcpSocket);
+};
+
+// BasicPacketSocketFactory that hands out FramedTcpSockets for TCP without
+// TLS or a proxy, with the framing OPT_STUN asks for, and the stock
+// sockets otherwise. |ss| must be the socket server of the network thread
+// that will use the sockets.
+class FramedPacketSocketFactory : public rtc::BasicPacketSocketFactory {
+ public:
+  FramedPacketSocketFactory(rtc::PhysicalSocketServer* ss,
+                            const FramedTcpSocket::Config& config);
+  ~FramedPacketSocketFactory() override;
+
+  rtc::AsyncPacketSocket* CreateServerTcpSocket(
+      const rtc::SocketAddress& local_address,
+      uint16_t min_port,
+      uint16_t max_port,
+      int opts) override;
+  rtc::AsyncPacketSocket* CreateClientTcpSocket(
+      const rtc::SocketAddress& local_address,
+      const rtc::SocketAddress& remote_address,
+      const rtc::ProxyInfo& proxy_info,
+      const std::string& user_agent,
+      const rtc::PacketSocketTcpOptions& tcp_options) override;
+  using rtc::BasicPacketSocketFactory::CreateClientTcpSocket;
+
+ private:
+  FramedTcpSocket::Config ConfigFor(int opts) const;
+
+  rtc::PhysicalSocketServer* const ss_;
+  const FramedTcpSocket::Config config_;
+};
+
+}  // namespace simple_app
+
+#endif  // FRAMED_TCP_SOCKET_H_
@@ -0,0 +1,44 @@
+#include "hmac_sha1_key.h"
+
+#include <string.h>
+
+namespace simple_app {
+
+HmacSha1Key::HmacSha1Key(const void* key, size_t key_length) {
+  uint8_t key_block[SHA_CBLOCK] = {0};
+  if (key_length > SHA_CBLOCK)
+    SHA1(static_cast<const uint8_t*>(key), key_length, key_block);
+  else if (key_length > 0)
+    memcpy(key_block, key, key_length);
+
+  uint8_t pad[SHA_CBLOCK];
+  for (size_t i = 0; i < SHA_CBLOCK; ++i)
+    pad[i] = key_block[i] ^ 0x36;
+  SHA1_Init(&inner_);
+  SHA1_Update(&inner_, pad, sizeof(pad));
+  for (size_t i = 0; i < SHA_CBLOCK; ++i)
+    pad[i] = key_block[i] ^ 0x5c;
+  SHA1_Init(&outer_);
+  SHA1_Update(&outer_, pad, sizeof(pad));
+}
+
+HmacSha1Key::HmacSha1Key(const std::string& key)
+    : HmacSha1Key(key.data(), key.size()) {}
+
+void HmacSha1Key::Compute(const uint8_t* first,
+                          size_t first_length,
+                          const uint8_t* second,
+                          size_t second_length,
+                          uint8_t* out) const {
+  uint8_t inner_digest[SHA_DIGEST_LENGTH];
+  SHA_CTX ctx = inner_;
+  SHA1_Update(&ctx, first, first_length);
+  SHA1_Update(&ctx, second, second_length);
+  SHA1_Final(inner_digest, &ctx);
+
+  ctx = outer_;
+  SHA1_Update(&ctx, inner_digest, sizeof(inner_digest));
+  SHA1_Final(out, &ctx);
+}
+
+}  // namespace simple_app
@@ -0,0 +1,39 @@
+#ifndef HMAC_SHA1_KEY_H_
+#define HMAC_SHA1_KEY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "openssl/sha.h"
+
+namespace simple_app {
+
+// HMAC-SHA1 key with the key schedule done up front. The SHA-1 states after
+// the inner and outer padded key blocks are kept, so each message skips
+// those two compressions, and a key longer than a block is hashed once
+// rather than per message. Used for STUN MESSAGE-INTEGRITY, with one per ICE
+// password or TURN long-term key kept next to the credential, and for the
+// SRTP authentication tag, with one per session key.
+class HmacSha1Key {
+ public:
+  HmacSha1Key(const void* key, size_t key_length);
+  explicit HmacSha1Key(const std::string& key);
+
+  // Writes the HMAC of |first| followed by |second| to |out|, which has room
+  // for SHA_DIGEST_LENGTH bytes.
+  void Compute(const uint8_t* first,
+               size_t first_length,
+               const uint8_t* second,
+               size_t second_length,
+               uint8_t* out) const;
+
+ private:
+  SHA_CTX inner_;
+  SHA_CTX outer_;
+};
+
+}  // namespace simple_app
+
+#endif  // HMAC_SHA1_KEY_H_
@@ -0,0 +1,570 @@
+#include "io_uring_udp_socket.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(WEBRTC_LINUX)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "errno_logging.h"
+#include "rtc_base/logging.h"
+
+// Multishot recvmsg is the newest piece we rely on; older kernel headers
+// simply get the readiness-based fallback.
+#if defined(WEBRTC_LINUX) && defined(IORING_RECV_MULTISHOT)
+#define SIMPLE_APP_HAVE_IO_URING 1
+#endif
+
+namespace simple_app {
+
+#if defined(SIMPLE_APP_HAVE_IO_URING)
+
+namespace {
+
+const unsigned kRingEntries = 256;
+const unsigned kBufferCount = 512;
+// Every buffer in flight can hold one completion; the slack covers the
+// final completions of ended receives and buffer requests.
+const unsigned kCompletionEntries = 2 * kBufferCount;
+// Each buffer holds an io_uring_recvmsg_out header, the source address and
+// the payload, with room for anything that fits an Ethernet MTU.
+const unsigned kBufferSize = 4096;
+const uint16_t kBufferGroup = 0;
+// user_data of requests whose completions carry no packets.
+const uint64_t kInternalUserData = 0;
+
+int IoUringSetup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int IoUringEnter(int fd,
+                 unsigned to_submit,
+                 unsigned min_complete,
+                 unsigned flags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, 0));
+}
+
+}  // namespace
+
+// Minimal raw io_uring: one submission queue, one completion queue and one
+// provided-buffer group, with nothing the receiver does not use.
+class IoUringReceiver::Ring {
+ public:
+  static std::unique_ptr<Ring> Create() {
+    std::unique_ptr<Ring> ring(new Ring());
+    return ring->Init() ? std::move(ring) : nullptr;
+  }
+
+  ~Ring() {
+    if (buffers_)
+      ::munmap(buffers_, kBufferCount * kBufferSize);
+    if (sqes_)
+      ::munmap(sqes_, sqes_size_);
+    if (cq_ptr_ && cq_ptr_ != sq_ptr_)
+      ::munmap(cq_ptr_, cq_size_);
+    if (sq_ptr_)
+      ::munmap(sq_ptr_, sq_size_);
+    if (fd_ >= 0)
+      ::close(fd_);
+  }
+
+  int fd() const { return fd_; }
+
+  // Returns a zeroed submission entry, or null if the queue is full even
+  // after flushing pending entries to the kernel.
+  io_uring_sqe* GetSqe() {
+    if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+        *sq_entries_) {
+      Submit();
+      if (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+          *sq_entries_) {
+        return nullptr;
+      }
+    }
+    unsigned index = sq_local_tail_ & *sq_mask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sq_local_tail_;
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    ++pending_;
+    return sqe;
+  }
+
+  void Submit() {
+    while (pending_ > 0) {
+      int ret = IoUringEnter(fd_, pending_, 0, 0);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        LOG_WITH_ERRNO(LS_ERROR) << "io_uring_enter failed";
+        return;
+      }
+      pending_ -= ret;
+      if (ret == 0)
+        return;
+    }
+  }
+
+  // Hands every available completion to |handler| and releases the CQ slots.
+  // Completions that overflowed the CQ are only flushed back by an
+  // io_uring_enter() with GETEVENTS, so ask for that whenever it happened.
+  template <typename Handler>
+  void Reap(Handler handler) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (true) {
+      for (; head != tail; ++head)
+        handler(cqes_[head & *cq_mask_]);
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      if (__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) &
+          IORING_SQ_CQ_OVERFLOW) {
+        IoUringEnter(fd_, 0, 0, IORING_ENTER_GETEVENTS);
+      }
+      tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      if (head == tail)
+        return;
+    }
+  }
+
+  char* buffer(uint16_t bid) { return buffers_ + bid * kBufferSize; }
+
+  // Queues |bid| to be handed back to the kernel on the next
+  // PublishBuffers().
+  void RecycleBuffer(uint16_t bid) { recycled_.push_back(bid); }
+
+  // Returns the recycled buffers to the group, one request per run of
+  // consecutive ids. The kernel mostly hands buffers out in order, so a
+  // reaped batch usually goes back in one or two requests.
+  void PublishBuffers() {
+    std::sort(recycled_.begin(), recycled_.end());
+    size_t i = 0;
+    while (i < recycled_.size()) {
+      size_t run = 1;
+      while (i + run < recycled_.size() &&
+             recycled_[i + run] == recycled_[i] + run) {
+        ++run;
+      }
+      if (!ProvideBuffers(recycled_[i], static_cast<unsigned>(run)))
+        break;
+      i += run;
+    }
+    recycled_.erase(recycled_.begin(), recycled_.begin() + i);
+  }
+
+ private:
+  Ring() {}
+
+  bool Init() {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = kCompletionEntries;
+    fd_ = IoUringSetup(kRingEntries, &params);
+    if (fd_ < 0) {
+      LOG_WITH_ERRNO(LS_INFO) << "io_uring is not available";
+      return false;
+    }
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+      sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    sq_ptr_ = Map(sq_size_, IORING_OFF_SQ_RING);
+    if (!sq_ptr_)
+      return false;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cq_ptr_ = sq_ptr_;
+    } else {
+      cq_ptr_ = Map(cq_size_, IORING_OFF_CQ_RING);
+      if (!cq_ptr_)
+        return false;
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(Map(sqes_size_, IORING_OFF_SQES));
+    if (!sqes_)
+      return false;
+
+    char* sq = static_cast<char*>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ =
+        reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    sq_flags_ = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_local_tail_ = *sq_tail_;
+    char* cq = static_cast<char*>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    return InitBuffers();
+  }
+
+  bool InitBuffers() {
+    void* buffers = ::mmap(nullptr, kBufferCount * kBufferSize,
+                           PROT_READ | PROT_WRITE,
+                           MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (buffers == MAP_FAILED)
+      return false;
+    buffers_ = static_cast<char*>(buffers);
+    recycled_.reserve(kBufferCount);
+
+    // Provide the whole pool synchronously so kernels without provided
+    // buffers are detected here rather than on the first receive.
+    if (!ProvideBuffers(0, kBufferCount) ||
+        IoUringEnter(fd_, pending_, 1, IORING_ENTER_GETEVENTS) < 0) {
+      return false;
+    }
+    pending_ = 0;
+    int result = -EINVAL;
+    Reap([&result](const io_uring_cqe& cqe) { result = cqe.res; });
+    if (result < 0) {
+      LOG(LS_INFO) << "io_uring provided buffers are not available, error "
+                   << -result;
+      return false;
+    }
+    return true;
+  }
+
+  bool ProvideBuffers(uint16_t first_bid, unsigned count) {
+    io_uring_sqe* sqe = GetSqe();
+    if (!sqe)
+      return false;
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int>(count);
+    sqe->addr = reinterpret_cast<uint64_t>(buffer(first_bid));
+    sqe->len = kBufferSize;
+    sqe->off = first_bid;
+    sqe->buf_group = kBufferGroup;
+    sqe->user_data = kInternalUserData;
+    return true;
+  }
+
+  void* Map(size_t size, off_t offset) {
+    void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd_, offset);
+    if (ptr == MAP_FAILED) {
+      LOG_WITH_ERRNO(LS_ERROR) << "Failed to map io_uring";
+      return nullptr;
+    }
+    return ptr;
+  }
+
+  int fd_ = -1;
+  void* sq_ptr_ = nullptr;
+  size_t sq_size_ = 0;
+  void* cq_ptr_ = nullptr;
+  size_t cq_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_entries_ = nullptr;
+  unsigned* sq_flags_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_local_tail_ = 0;
+  unsigned pending_ = 0;
+
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+
+  char* buffers_ = nullptr;
+  std::vector<uint16_t> recycled_;
+};
+
+namespace {
+
+// Shape of every multishot receive: room for any source address and no
+// control data. The kernel copies it when the request is armed.
+msghdr* RecvMsgTemplate() {
+  static msghdr msg = [] {
+    msghdr m;
+    memset(&m, 0, sizeof(m));
+    m.msg_namelen = sizeof(sockaddr_storage);
+    return m;
+  }();
+  return &msg;
+}
+
+}  // namespace
+
+std::unique_ptr<IoUringReceiver> IoUringReceiver::Create(
+    rtc::PhysicalSocketServer* ss) {
+  std::unique_ptr<Ring> ring = Ring::Create();
+  if (!ring)
+    return nullptr;
+  std::unique_ptr<IoUringReceiver> receiver(
+      new IoUringReceiver(ss, std::move(ring)));
+  ss->Add(receiver.get());
+  return receiver;
+}
+
+IoUringReceiver::IoUringReceiver(rtc::PhysicalSocketServer* ss,
+                                 std::unique_ptr<Ring> ring)
+    : ss_(ss), ring_(std::move(ring)) {}
+
+IoUringReceiver::~IoUringReceiver() {
+  ss_->Remove(this);
+  // Closing the ring cancels every outstanding receive; the sockets go back
+  // to reading on readiness.
+  std::unordered_map<uint64_t, IoUringUdpSocket*> sockets;
+  sockets.swap(sockets_);
+  for (auto& entry : sockets) {
+    entry.second->receiver_ = nullptr;
+    entry.second->id_ = 0;
+    entry.second->FallBackToReadiness();
+  }
+}
+
+bool IoUringReceiver::Attach(IoUringUdpSocket* socket) {
+  uint64_t id = next_id_++;
+  if (!Arm(id, socket->GetDescriptor()))
+    return false;
+  ring_->Submit();
+  socket->id_ = id;
+  sockets_[id] = socket;
+  return true;
+}
+
+void IoUringReceiver::Detach(IoUringUdpSocket* socket) {
+  if (sockets_.erase(socket->id_) == 0)
+    return;
+  io_uring_sqe* sqe = ring_->GetSqe();
+  if (sqe) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = socket->id_;
+    sqe->user_data = kInternalUserData;
+    ring_->Submit();
+  }
+  // Completions still in flight for this id are dropped in
+  // ReapCompletions() since the id is no longer registered.
+  socket->id_ = 0;
+}
+
+uint32_t IoUringReceiver::GetRequestedEvents() {
+  return rtc::DE_READ;
+}
+
+void IoUringReceiver::OnPreEvent(uint32_t /* ff */) {}
+
+void IoUringReceiver::OnEvent(uint32_t ff, int /* err */) {
+  if (ff & rtc::DE_READ)
+    ReapCompletions();
+}
+
+int IoUringReceiver::GetDescriptor() {
+  return ring_->fd();
+}
+
+bool IoUringReceiver::IsDescriptorClosed() {
+  return false;
+}
+
+bool IoUringReceiver::Arm(uint64_t id, int fd) {
+  io_uring_sqe* sqe = ring_->GetSqe();
+  if (!sqe)
+    return false;
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(RecvMsgTemplate());
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->user_data = id;
+  return true;
+}
+
+void IoUringReceiver::ReapCompletions() {
+  const rtc::PacketTime packet_time = rtc::CreatePacketTime(0);
+  const msghdr* msg = RecvMsgTemplate();
+  std::vector<uint64_t> ended;
+  ring_->Reap([this, &packet_time, msg, &ended](const io_uring_cqe& cqe) {
+    if (cqe.user_data == kInternalUserData)
+      return;
+
+    // Look the socket up per completion: delivering a packet may close or
+    // create sockets.
+    auto it = sockets_.find(cqe.user_data);
+    IoUringUdpSocket* socket = it == sockets_.end() ? nullptr : it->second;
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      uint16_t bid = static_cast<uint16_t>(cqe.flags >>
+                                           IORING_CQE_BUFFER_SHIFT);
+      if (socket && cqe.res >= 0) {
+        const char* buf = ring_->buffer(bid);
+        io_uring_recvmsg_out out;
+        memcpy(&out, buf, sizeof(out));
+        const char* name = buf + sizeof(out);
+        const char* payload = name + msg->msg_namelen + msg->msg_controllen;
+        sockaddr_storage saddr;
+        memset(&saddr, 0, sizeof(saddr));
+        memcpy(&saddr, name, std::min<size_t>(out.namelen, sizeof(saddr)));
+        rtc::SocketAddress remote_address;
+        if (out.flags & MSG_TRUNC) {
+          LOG(LS_WARNING) << "Dropping truncated datagram";
+        } else if (rtc::SocketAddressFromSockAddrStorage(saddr,
+                                                         &remote_address)) {
+          socket->SignalReadPacket(socket, payload, out.payloadlen,
+                                   remote_address, packet_time);
+        }
+      }
+      ring_->RecycleBuffer(bid);
+    }
+
+    if (cqe.flags & IORING_CQE_F_MORE)
+      return;
+    // The multishot request ended. Running out of buffers is transient;
+    // anything else means this kernel cannot do it, so stop trying.
+    if (cqe.res >= 0 || cqe.res == -ENOBUFS) {
+      ended.push_back(cqe.user_data);
+      return;
+    }
+    if (!socket)
+      return;
+    LOG(LS_WARNING) << "Multishot recvmsg failed with error " << -cqe.res
+                    << ", falling back to readiness-based reads";
+    sockets_.erase(it);
+    socket->id_ = 0;
+    socket->FallBackToReadiness();
+  });
+
+  // Re-arm only after the buffers are back, otherwise a receive that ended
+  // with ENOBUFS would end again right away.
+  ring_->PublishBuffers();
+  for (uint64_t id : ended) {
+    auto it = sockets_.find(id);
+    if (it == sockets_.end() || Arm(id, it->second->GetDescriptor()))
+      continue;
+    IoUringUdpSocket* socket = it->second;
+    sockets_.erase(it);
+    socket->id_ = 0;
+    socket->FallBackToReadiness();
+  }
+  ring_->Submit();
+}
+
+#else  // SIMPLE_APP_HAVE_IO_URING
+
+class IoUringReceiver::Ring {};
+
+std::unique_ptr<IoUringReceiver> IoUringReceiver::Create(
+    rtc::PhysicalSocketServer* /* ss */) {
+  return nullptr;
+}
+
+IoUringReceiver::~IoUringReceiver() {}
+
+bool IoUringReceiver::Attach(IoUringUdpSocket* /* socket */) {
+  return false;
+}
+
+void IoUringReceiver::Detach(IoUringUdpSocket* /* socket */) {}
+
+uint32_t IoUringReceiver::GetRequestedEvents() {
+  return 0;
+}
+
+void IoUringReceiver::OnPreEvent(uint32_t /* ff */) {}
+
+void IoUringReceiver::OnEvent(uint32_t /* ff */, int /* err */) {}
+
+int IoUringReceiver::GetDescriptor() {
+  return -1;
+}
+
+bool IoUringReceiver::IsDescriptorClosed() {
+  return true;
+}
+
+#endif  // SIMPLE_APP_HAVE_IO_URING
+
+IoUringUdpSocket* IoUringUdpSocket::Create(
+    IoUringReceiver* receiver,
+    rtc::PhysicalSocketServer* ss,
+    const rtc::SocketAddress& bind_address,
+    uint16_t min_port,
+    uint16_t max_port) {
+  int fd = OpenSocket(bind_address.family());
+  if (fd == INVALID_SOCKET)
+    return nullptr;
+
+  IoUringUdpSocket* socket = new IoUringUdpSocket(receiver, ss, fd);
+  if (socket->Bind(bind_address, min_port, max_port) < 0) {
+    LOG(LS_ERROR) << "UDP bind failed with error " << socket->GetError();
+    delete socket;
+    return nullptr;
+  }
+  // Attach before registering with |ss| so the descriptor never asks for
+  // read readiness when the ring takes care of reads.
+  if (!receiver->Attach(socket))
+    socket->receiver_ = nullptr;
+  ss->Add(socket);
+  return socket;
+}
+
+IoUringUdpSocket::IoUringUdpSocket(IoUringReceiver* receiver,
+                                   rtc::PhysicalSocketServer* ss,
+                                   int fd)
+    : BatchedUdpSocket(ss, fd), receiver_(receiver) {}
+
+IoUringUdpSocket::~IoUringUdpSocket() {
+  Close();
+}
+
+int IoUringUdpSocket::Close() {
+  if (receiver_) {
+    receiver_->Detach(this);
+    receiver_ = nullptr;
+  }
+  return BatchedUdpSocket::Close();
+}
+
+uint32_t IoUringUdpSocket::GetRequestedEvents() {
+  uint32_t events = BatchedUdpSocket::GetRequestedEvents();
+  return id_ ? events & ~rtc::DE_READ : events;
+}
+
+void IoUringUdpSocket::FallBackToReadiness() {
+  if (GetState() != STATE_CLOSED)
+    socket_server()->Update(this);
+}
+
+IoUringPacketSocketFactory::IoUringPacketSocketFactory(
+    rtc::PhysicalSocketServer* ss)
+    : BatchedPacketSocketFactory(ss),
+      ss_(ss),
+      receiver_(IoUringReceiver::Create(ss)) {}
+
+IoUringPacketSocketFactory::~IoUringPacketSocketFactory() {}
+
+rtc::AsyncPacketSocket* IoUringPacketSocketFactory::CreateUdpSocket(
+    const rtc::SocketAddress& address,
+    uint16_t min_port,
+    uint16_t max_port) {
+  if (!receiver_) {
+    return BatchedPacketSocketFactory::CreateUdpSocket(address, min_port,
+                                                       max_port);
+  }
+  return IoUringUdpSocket::Create(receiver_.get(), ss_, address, min_port,
+                                  max_port);
+}
+
+}  // namespace simple_app
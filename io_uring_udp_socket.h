@@ -0,0 +1,112 @@
+#ifndef IO_URING_UDP_SOCKET_H_
+#define IO_URING_UDP_SOCKET_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <unordered_map>
+
+#include "batched_udp_socket.h"
+
+namespace simple_app {
+
+class IoUringUdpSocket;
+
+// Completion-based receive path for the UDP sockets of one network thread.
+// Each attached socket has a multishot IORING_OP_RECVMSG armed on a single
+// io_uring, and the kernel picks buffers from a shared provided-buffer group.
+// The io_uring descriptor itself is registered with the PhysicalSocketServer,
+// so a single epoll wakeup reaps the datagrams of every socket without the
+// readiness-then-recv syscall pair. rtc::Thread keeps driving everything
+// through PhysicalSocketServer::Wait() as before.
+//
+// Must be created and used on the thread that runs |ss|.
+class IoUringReceiver : public rtc::Dispatcher {
+ public:
+  // Returns null when the kernel lacks io_uring or provided-buffer rings.
+  static std::unique_ptr<IoUringReceiver> Create(
+      rtc::PhysicalSocketServer* ss);
+  ~IoUringReceiver() override;
+
+  // Arms a multishot receive for |socket|. Returns false if the request
+  // could not be queued, in which case the socket should keep using
+  // readiness-based reads.
+  bool Attach(IoUringUdpSocket* socket);
+  // Cancels the receive for |socket|; no packets are delivered to it after
+  // this returns.
+  void Detach(IoUringUdpSocket* socket);
+
+  // Dispatcher:
+  uint32_t GetRequestedEvents() override;
+  void OnPreEvent(uint32_t ff) override;
+  void OnEvent(uint32_t ff, int err) override;
+  int GetDescriptor() override;
+  bool IsDescriptorClosed() override;
+
+ private:
+  class Ring;
+
+  IoUringReceiver(rtc::PhysicalSocketServer* ss, std::unique_ptr<Ring> ring);
+
+  bool Arm(uint64_t id, int fd);
+  void ReapCompletions();
+
+  rtc::PhysicalSocketServer* const ss_;
+  std::unique_ptr<Ring> ring_;
+  uint64_t next_id_ = 1;
+  std::unordered_map<uint64_t, IoUringUdpSocket*> sockets_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(IoUringReceiver);
+};
+
+// BatchedUdpSocket whose reads complete through an IoUringReceiver. Sends and
+// socket options are unchanged. If the kernel rejects the multishot receive
+// (pre-6.0 kernels) the socket quietly falls back to recvmmsg on readiness.
+class IoUringUdpSocket : public BatchedUdpSocket {
+ public:
+  static IoUringUdpSocket* Create(IoUringReceiver* receiver,
+                                  rtc::PhysicalSocketServer* ss,
+                                  const rtc::SocketAddress& bind_address,
+                                  uint16_t min_port,
+                                  uint16_t max_port);
+  ~IoUringUdpSocket() override;
+
+  // BatchedUdpSocket:
+  int Close() override;
+  uint32_t GetRequestedEvents() override;
+
+ private:
+  friend class IoUringReceiver;
+
+  IoUringUdpSocket(IoUringReceiver* receiver,
+                   rtc::PhysicalSocketServer* ss,
+                   int fd);
+
+  // Switches reads back to readiness notifications from the socket server.
+  void FallBackToReadiness();
+
+  IoUringReceiver* receiver_;
+  uint64_t id_ = 0;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(IoUringUdpSocket);
+};
+
+// Packet socket factory that hands out IoUringUdpSocket when io_uring is
+// usable and BatchedUdpSocket otherwise.
+class IoUringPacketSocketFactory : public BatchedPacketSocketFactory {
+ public:
+  explicit IoUringPacketSocketFactory(rtc::PhysicalSocketServer* ss);
+  ~IoUringPacketSocketFactory() override;
+
+  rtc::AsyncPacketSocket* CreateUdpSocket(const rtc::SocketAddress& address,
+                                          uint16_t min_port,
+                                          uint16_t max_port) override;
+
+ private:
+  rtc::PhysicalSocketServer* const ss_;
+  std::unique_ptr<IoUringReceiver> receiver_;
+};
+
+}  // namespace simple_app
+
+#endif  // IO_URING_UDP_SOCKET_H_
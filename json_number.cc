@@ -0,0 +1,18 @@
+#include "json_number.h"
+
+#include <math.h>
+#include <stdio.h>
+
+namespace simple_app {
+
+void AppendJsonNumber(double value, std::string* out) {
+  if (!isfinite(value)) {
+    out->append("null");
+    return;
+  }
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.17g", value);
+  out->append(buffer);
+}
+
+}  // namespace simple_app
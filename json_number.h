@@ -0,0 +1,15 @@
+#ifndef JSON_NUMBER_H_
+#define JSON_NUMBER_H_
+
+#include <string>
+
+namespace simple_app {
+
+// Appends |value| to |out| as a JSON number with "%.17g", the 17 significant
+// digits that read back as the same double. JSON has no NaN or infinity,
+// which "%.17g" would print as nan and inf, so those are written as null.
+void AppendJsonNumber(double value, std::string* out);
+
+}  // namespace simple_app
+
+#endif  // JSON_NUMBER_H_
@@ -0,0 +1,384 @@
+#include "lock_free_thread.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/nullsocketserver.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+namespace {
+
+const int64_t kImmediate = -1;
+
+void RemoveOrDelete(const rtc::Message& msg, rtc::MessageList* removed) {
+  if (removed)
+    removed->push_back(msg);
+  else
+    delete msg.pdata;
+}
+
+}  // namespace
+
+MpscMessageQueue::MpscMessageQueue() : head_(&stub_), tail_(&stub_) {
+  stub_.next.store(nullptr, std::memory_order_relaxed);
+}
+
+MpscMessageQueue::~MpscMessageQueue() {}
+
+void MpscMessageQueue::Push(Node* node) {
+  node->next.store(nullptr, std::memory_order_relaxed);
+  Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+  prev->next.store(node, std::memory_order_release);
+}
+
+MpscMessageQueue::Node* MpscMessageQueue::Pop() {
+  Node* tail = tail_;
+  Node* next = tail->next.load(std::memory_order_acquire);
+  if (tail == &stub_) {
+    if (!next)
+      return nullptr;
+    tail_ = next;
+    tail = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  if (tail != head_.load(std::memory_order_acquire))
+    return nullptr;
+  // |tail| is the last node; put the stub behind it so it can be handed out.
+  Push(&stub_);
+  next = tail->next.load(std::memory_order_acquire);
+  if (next) {
+    tail_ = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+const int MessageTimerWheel::kLevels;
+const int MessageTimerWheel::kSlotBits;
+const int MessageTimerWheel::kSlots;
+
+MessageTimerWheel::MessageTimerWheel(int64_t now_ms) : current_ms_(now_ms) {}
+
+MessageTimerWheel::~MessageTimerWheel() {}
+
+void MessageTimerWheel::Insert(int64_t trigger_ms, const rtc::Message& msg) {
+  RTC_DCHECK_GT(trigger_ms, current_ms_);
+  Place(Entry{trigger_ms, next_seq_++, msg});
+}
+
+void MessageTimerWheel::Advance(int64_t now_ms,
+                                std::deque<rtc::Message>* due) {
+  while (current_ms_ < now_ms) {
+    if (size_ == 0) {
+      current_ms_ = now_ms;
+      return;
+    }
+    if (level_size_[0] == 0) {
+      // Nothing can expire before the next cascade point.
+      int64_t next_cascade_ms =
+          ((current_ms_ >> kSlotBits) + 1) << kSlotBits;
+      if (next_cascade_ms > now_ms) {
+        current_ms_ = now_ms;
+        return;
+      }
+      current_ms_ = next_cascade_ms;
+    } else {
+      ++current_ms_;
+    }
+
+    // Crossing a block boundary of a level pulls that block one level down.
+    for (int level = 1; level < kLevels; ++level) {
+      const int64_t block_mask = (int64_t{1} << (kSlotBits * level)) - 1;
+      if ((current_ms_ & block_mask) != 0)
+        break;
+      Cascade(level);
+    }
+
+    Slot& slot = slots_[0][current_ms_ & (kSlots - 1)];
+    if (slot.empty())
+      continue;
+    Slot expired;
+    expired.swap(slot);
+    level_size_[0] -= expired.size();
+    size_ -= expired.size();
+    std::sort(expired.begin(), expired.end(),
+              [](const Entry& a, const Entry& b) { return a.seq < b.seq; });
+    for (Entry& entry : expired)
+      due->push_back(entry.msg);
+  }
+}
+
+int MessageTimerWheel::TimeUntilNext(int64_t now_ms) const {
+  if (size_ == 0)
+    return rtc::MessageQueue::kForever;
+
+  int64_t next_ms = std::numeric_limits<int64_t>::max();
+  if (level_size_[0] > 0) {
+    for (int64_t t = current_ms_ + 1; t < current_ms_ + kSlots; ++t) {
+      if (!slots_[0][t & (kSlots - 1)].empty()) {
+        next_ms = t;
+        break;
+      }
+    }
+  }
+  // Upper levels only know which block a message falls into, so wait until
+  // the start of the first non-empty block.
+  for (int level = 1; level < kLevels; ++level) {
+    if (level_size_[level] == 0)
+      continue;
+    const int shift = kSlotBits * level;
+    const int64_t block = current_ms_ >> shift;
+    for (int64_t b = block + 1; b <= block + kSlots; ++b) {
+      if (!slots_[level][b & (kSlots - 1)].empty()) {
+        next_ms = std::min(next_ms, b << shift);
+        break;
+      }
+    }
+  }
+  for (const Entry& entry : overflow_)
+    next_ms = std::min(next_ms, entry.trigger_ms);
+
+  int64_t delay = std::max<int64_t>(0, next_ms - now_ms);
+  return static_cast<int>(
+      std::min<int64_t>(delay, std::numeric_limits<int>::max()));
+}
+
+void MessageTimerWheel::Clear(rtc::MessageHandler* phandler,
+                              uint32_t id,
+                              rtc::MessageList* removed) {
+  auto clear_slot = [phandler, id, removed](Slot* slot) {
+    size_t before = slot->size();
+    slot->erase(std::remove_if(slot->begin(), slot->end(),
+                               [phandler, id, removed](const Entry& entry) {
+                                 if (!entry.msg.Match(phandler, id))
+                                   return false;
+                                 RemoveOrDelete(entry.msg, removed);
+                                 return true;
+                               }),
+                slot->end());
+    return before - slot->size();
+  };
+  for (int level = 0; level < kLevels; ++level) {
+    if (level_size_[level] == 0)
+      continue;
+    for (Slot& slot : slots_[level]) {
+      size_t cleared = clear_slot(&slot);
+      level_size_[level] -= cleared;
+      size_ -= cleared;
+    }
+  }
+  size_ -= clear_slot(&overflow_);
+}
+
+void MessageTimerWheel::Place(Entry entry) {
+  const int64_t delta = entry.trigger_ms - current_ms_;
+  for (int level = 0; level < kLevels; ++level) {
+    if (delta < (int64_t{1} << (kSlotBits * (level + 1)))) {
+      slots_[level][(entry.trigger_ms >> (kSlotBits * level)) & (kSlots - 1)]
+          .push_back(std::move(entry));
+      ++level_size_[level];
+      ++size_;
+      return;
+    }
+  }
+  overflow_.push_back(std::move(entry));
+  ++size_;
+}
+
+void MessageTimerWheel::Cascade(int level) {
+  Slot& slot =
+      slots_[level][(current_ms_ >> (kSlotBits * level)) & (kSlots - 1)];
+  Slot entries;
+  entries.swap(slot);
+  level_size_[level] -= entries.size();
+  size_ -= entries.size();
+  // The top level is where overflow messages come into range.
+  if (level == kLevels - 1) {
+    Slot overflow;
+    overflow.swap(overflow_);
+    size_ -= overflow.size();
+    for (Entry& entry : overflow)
+      Place(std::move(entry));
+  }
+  for (Entry& entry : entries)
+    Place(std::move(entry));
+}
+
+LockFreeThread::LockFreeThread()
+    : LockFreeThread(rtc::SocketServer::CreateDefault()) {}
+
+LockFreeThread::LockFreeThread(std::unique_ptr<rtc::SocketServer> ss)
+    : rtc::Thread(std::move(ss)), wheel_(rtc::TimeMillis()) {}
+
+LockFreeThread::~LockFreeThread() {
+  Stop();
+  Clear(nullptr);
+}
+
+std::unique_ptr<LockFreeThread> LockFreeThread::Create() {
+  return std::unique_ptr<LockFreeThread>(new LockFreeThread(
+      std::unique_ptr<rtc::SocketServer>(new rtc::NullSocketServer())));
+}
+
+std::unique_ptr<LockFreeThread> LockFreeThread::CreateWithSocketServer() {
+  return std::unique_ptr<LockFreeThread>(
+      new LockFreeThread(rtc::SocketServer::CreateDefault()));
+}
+
+bool LockFreeThread::Get(rtc::Message* pmsg, int cmsWait, bool process_io) {
+  // Same contract as MessageQueue::Get(), including Peek() symmetry.
+  if (fPeekKeep_) {
+    *pmsg = msgPeek_;
+    fPeekKeep_ = false;
+    return true;
+  }
+
+  const int64_t msStart = rtc::TimeMillis();
+  int64_t msCurrent = msStart;
+  int64_t cmsElapsed = 0;
+  while (true) {
+    ReceiveSends();
+
+    int64_t cmsDelayNext = kForever;
+    {
+      rtc::CritScope cs(&consumer_crit_);
+      DrainIncoming(msCurrent);
+      while (!ready_.empty()) {
+        *pmsg = ready_.front();
+        ready_.pop_front();
+        if (pmsg->message_id == rtc::MQID_DISPOSE) {
+          RTC_DCHECK(nullptr == pmsg->phandler);
+          delete pmsg->pdata;
+          *pmsg = rtc::Message();
+          continue;
+        }
+        return true;
+      }
+      cmsDelayNext = wheel_.TimeUntilNext(msCurrent);
+    }
+
+    if (IsQuitting())
+      break;
+
+    int64_t cmsNext;
+    if (cmsWait == kForever) {
+      cmsNext = cmsDelayNext;
+    } else {
+      cmsNext = std::max<int64_t>(0, cmsWait - cmsElapsed);
+      if (cmsDelayNext != kForever && cmsDelayNext < cmsNext)
+        cmsNext = cmsDelayNext;
+    }
+    if (!socketserver()->Wait(static_cast<int>(cmsNext), process_io))
+      return false;
+
+    msCurrent = rtc::TimeMillis();
+    cmsElapsed = rtc::TimeDiff(msCurrent, msStart);
+    if (cmsWait != kForever && cmsElapsed >= cmsWait)
+      return false;
+  }
+  return false;
+}
+
+void LockFreeThread::Post(const rtc::Location& posted_from,
+                          rtc::MessageHandler* phandler,
+                          uint32_t id,
+                          rtc::MessageData* pdata,
+                          bool /* time_sensitive */) {
+  Enqueue(posted_from, kImmediate, phandler, id, pdata);
+}
+
+void LockFreeThread::PostDelayed(const rtc::Location& posted_from,
+                                 int cmsDelay,
+                                 rtc::MessageHandler* phandler,
+                                 uint32_t id,
+                                 rtc::MessageData* pdata) {
+  Enqueue(posted_from, rtc::TimeAfter(cmsDelay), phandler, id, pdata);
+}
+
+void LockFreeThread::PostAt(const rtc::Location& posted_from,
+                            int64_t tstamp,
+                            rtc::MessageHandler* phandler,
+                            uint32_t id,
+                            rtc::MessageData* pdata) {
+  Enqueue(posted_from, tstamp, phandler, id, pdata);
+}
+
+void LockFreeThread::PostAt(const rtc::Location& posted_from,
+                            uint32_t tstamp,
+                            rtc::MessageHandler* phandler,
+                            uint32_t id,
+                            rtc::MessageData* pdata) {
+  const int64_t now = rtc::TimeMillis();
+  Enqueue(posted_from,
+          now + rtc::TimeDiff32(tstamp, static_cast<uint32_t>(now)),
+          phandler, id, pdata);
+}
+
+int LockFreeThread::GetDelay() {
+  rtc::CritScope cs(&consumer_crit_);
+  DrainIncoming(rtc::TimeMillis());
+  if (!ready_.empty())
+    return 0;
+  return wheel_.TimeUntilNext(wheel_.now_ms());
+}
+
+void LockFreeThread::Clear(rtc::MessageHandler* phandler,
+                           uint32_t id,
+                           rtc::MessageList* removed) {
+  // Pending sends and a kept Peek() message live in rtc::Thread.
+  rtc::Thread::Clear(phandler, id, removed);
+
+  rtc::CritScope cs(&consumer_crit_);
+  DrainIncoming(rtc::TimeMillis());
+  for (auto it = ready_.begin(); it != ready_.end();) {
+    if (it->Match(phandler, id)) {
+      RemoveOrDelete(*it, removed);
+      it = ready_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  wheel_.Clear(phandler, id, removed);
+}
+
+void LockFreeThread::Enqueue(const rtc::Location& posted_from,
+                             int64_t trigger_ms,
+                             rtc::MessageHandler* phandler,
+                             uint32_t id,
+                             rtc::MessageData* pdata) {
+  if (IsQuitting()) {
+    delete pdata;
+    return;
+  }
+
+  MpscMessageQueue::Node* node = new MpscMessageQueue::Node();
+  node->trigger_ms = trigger_ms;
+  node->msg.posted_from = posted_from;
+  node->msg.phandler = phandler;
+  node->msg.message_id = id;
+  node->msg.pdata = pdata;
+  incoming_.Push(node);
+  WakeUpSocketServer();
+}
+
+void LockFreeThread::DrainIncoming(int64_t now_ms) {
+  while (MpscMessageQueue::Node* node = incoming_.Pop()) {
+    if (node->trigger_ms == kImmediate ||
+        node->trigger_ms <= wheel_.now_ms()) {
+      ready_.push_back(node->msg);
+    } else {
+      wheel_.Insert(node->trigger_ms, node->msg);
+    }
+    delete node;
+  }
+  wheel_.Advance(now_ms, &ready_);
+}
+
+}  // namespace simple_app
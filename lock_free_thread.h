@@ -0,0 +1,170 @@
+#ifndef LOCK_FREE_THREAD_H_
+#define LOCK_FREE_THREAD_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "rtc_base/criticalsection.h"
+#include "rtc_base/thread.h"
+
+namespace simple_app {
+
+// Intrusive multi-producer/single-consumer queue of posted messages
+// (Vyukov's algorithm). Push() never blocks or takes a lock; Pop() must only
+// be called by one consumer at a time.
+class MpscMessageQueue {
+ public:
+  struct Node {
+    std::atomic<Node*> next;
+    // Absolute trigger time for delayed posts, or -1 for immediate ones.
+    int64_t trigger_ms;
+    rtc::Message msg;
+  };
+
+  MpscMessageQueue();
+  ~MpscMessageQueue();
+
+  void Push(Node* node);
+  // Returns null when the queue is empty, or when a producer is half-way
+  // through a push; that producer wakes the consumer once it is done.
+  Node* Pop();
+
+ private:
+  std::atomic<Node*> head_;
+  Node* tail_;
+  Node stub_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(MpscMessageQueue);
+};
+
+// Hierarchical timer wheel of delayed messages with 1 ms resolution: four
+// levels of 64 slots cover ~4.6 hours, later messages wait in an overflow
+// list. Insertion and expiry are O(1) amortized instead of the O(log n) push
+// and O(n) reheap() of MessageQueue's priority queue. Messages due at the
+// same millisecond come out in insertion order. Not thread safe.
+class MessageTimerWheel {
+ public:
+  explicit MessageTimerWheel(int64_t now_ms);
+  ~MessageTimerWheel();
+
+  // Schedules |msg| at |trigger_ms|, which must be later than the last
+  // Advance() time.
+  void Insert(int64_t trigger_ms, const rtc::Message& msg);
+  // Appends every message due at or before |now_ms| to |due|, in trigger
+  // order.
+  void Advance(int64_t now_ms, std::deque<rtc::Message>* due);
+  // Returns a wait that does not overshoot the earliest message, or
+  // rtc::MessageQueue::kForever if the wheel is empty. May be early for
+  // messages on the upper levels; the next Advance() then moves them down.
+  int TimeUntilNext(int64_t now_ms) const;
+  // Removes matching messages into |removed|, or deletes their data when
+  // |removed| is null.
+  void Clear(rtc::MessageHandler* phandler,
+             uint32_t id,
+             rtc::MessageList* removed);
+
+  int64_t now_ms() const { return current_ms_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  static const int kLevels = 4;
+  static const int kSlotBits = 6;
+  static const int kSlots = 1 << kSlotBits;
+
+  struct Entry {
+    int64_t trigger_ms;
+    uint64_t seq;
+    rtc::Message msg;
+  };
+  typedef std::vector<Entry> Slot;
+
+  void Place(Entry entry);
+  void Cascade(int level);
+
+  int64_t current_ms_;
+  uint64_t next_seq_ = 0;
+  size_t size_ = 0;
+  Slot slots_[kLevels][kSlots];
+  size_t level_size_[kLevels] = {};
+  Slot overflow_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(MessageTimerWheel);
+};
+
+// rtc::Thread whose posted and delayed messages bypass MessageQueue's
+// critical section: Post()/PostDelayed()/PostAt() push onto an
+// MpscMessageQueue without locking, and only the thread itself moves them
+// into a ready list and a MessageTimerWheel. Clear() briefly borrows the
+// consumer side so it stays synchronous from any thread, which
+// MessageHandler destruction relies on. Send()/Invoke() keep using
+// rtc::Thread's send list.
+//
+// MessageQueue::size()/empty() are not virtual and only see the base
+// queues, so they always report the messages of this thread as absent.
+class LockFreeThread : public rtc::Thread {
+ public:
+  LockFreeThread();
+  explicit LockFreeThread(std::unique_ptr<rtc::SocketServer> ss);
+  ~LockFreeThread() override;
+
+  // Equivalents of rtc::Thread::Create()/CreateWithSocketServer().
+  static std::unique_ptr<LockFreeThread> Create();
+  static std::unique_ptr<LockFreeThread> CreateWithSocketServer();
+
+  // rtc::MessageQueue:
+  bool Get(rtc::Message* pmsg,
+           int cmsWait = kForever,
+           bool process_io = true) override;
+  void Post(const rtc::Location& posted_from,
+            rtc::MessageHandler* phandler,
+            uint32_t id = 0,
+            rtc::MessageData* pdata = nullptr,
+            bool time_sensitive = false) override;
+  void PostDelayed(const rtc::Location& posted_from,
+                   int cmsDelay,
+                   rtc::MessageHandler* phandler,
+                   uint32_t id = 0,
+                   rtc::MessageData* pdata = nullptr) override;
+  void PostAt(const rtc::Location& posted_from,
+              int64_t tstamp,
+              rtc::MessageHandler* phandler,
+              uint32_t id = 0,
+              rtc::MessageData* pdata = nullptr) override;
+  void PostAt(const rtc::Location& posted_from,
+              uint32_t tstamp,
+              rtc::MessageHandler* phandler,
+              uint32_t id = 0,
+              rtc::MessageData* pdata = nullptr) override;
+  int GetDelay() override;
+
+  // rtc::Thread:
+  void Clear(rtc::MessageHandler* phandler,
+             uint32_t id = rtc::MQID_ANY,
+             rtc::MessageList* removed = nullptr) override;
+
+ private:
+  void Enqueue(const rtc::Location& posted_from,
+               int64_t trigger_ms,
+               rtc::MessageHandler* phandler,
+               uint32_t id,
+               rtc::MessageData* pdata);
+  // Moves everything posted so far into |ready_| and |wheel_|, then the
+  // messages that are due by |now_ms| from |wheel_| into |ready_|.
+  void DrainIncoming(int64_t now_ms)
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(consumer_crit_);
+
+  MpscMessageQueue incoming_;
+  // Held by whoever consumes |incoming_|: the thread itself while picking the
+  // next message, or another thread running Clear(). Producers never take it.
+  rtc::CriticalSection consumer_crit_;
+  std::deque<rtc::Message> ready_ RTC_GUARDED_BY(consumer_crit_);
+  MessageTimerWheel wheel_ RTC_GUARDED_BY(consumer_crit_);
+};
+
+}  // namespace simple_app
+
+#endif  // LOCK_FREE_THREAD_H_
@@ -0,0 +1,203 @@
+#include "media_path_thread.h"
+
+#include <algorithm>
+
+#include "rtc_base/nullsocketserver.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+const char MediaPathThread::kBaseChannelPacketHandOff[] =
+    "channel.cc:OnPacketReceived";
+
+MediaPathThread::MediaPathThread(std::unique_ptr<rtc::SocketServer> ss,
+                                 const Options& options)
+    : rtc::Thread(std::move(ss)), options_(options) {}
+
+MediaPathThread::~MediaPathThread() {
+  Stop();
+  // Before the members Clear() uses go away.
+  DoDestroy();
+}
+
+std::unique_ptr<MediaPathThread> MediaPathThread::Create(
+    const Options& options) {
+  return std::unique_ptr<MediaPathThread>(new MediaPathThread(
+      std::unique_ptr<rtc::SocketServer>(new rtc::NullSocketServer()),
+      options));
+}
+
+std::unique_ptr<MediaPathThread> MediaPathThread::CreateWithSocketServer(
+    const Options& options) {
+  return std::unique_ptr<MediaPathThread>(
+      new MediaPathThread(rtc::SocketServer::CreateDefault(), options));
+}
+
+std::map<std::string, MediaPathThread::HopStats> MediaPathThread::GetHopStats()
+    const {
+  std::map<std::string, HopStats> stats;
+  rtc::CritScope cs(&stats_crit_);
+  for (const auto& entry : stats_)
+    stats[entry.second.first.ToString()] = entry.second.second;
+  return stats;
+}
+
+void MediaPathThread::ResetHopStats() {
+  rtc::CritScope cs(&stats_crit_);
+  stats_.clear();
+}
+
+bool MediaPathThread::Get(rtc::Message* pmsg, int cmsWait, bool process_io) {
+  // A message kept by Peek() was counted when Peek() got it.
+  const bool peeked = fPeekKeep_;
+  if (!rtc::Thread::Get(pmsg, cmsWait, process_io))
+    return false;
+  if (!options_.count_hops || peeked)
+    return true;
+
+  const int64_t now_us = rtc::TimeMicros();
+  rtc::CritScope cs(&stats_crit_);
+  HopStats* stats = StatsFor(pmsg->posted_from);
+  ++stats->posted;
+  auto it = pmsg->pdata ? due_us_.find(pmsg->pdata) : due_us_.end();
+  if (it != due_us_.end()) {
+    const int64_t queued_us = std::max<int64_t>(0, now_us - it->second);
+    stats->queued_us += queued_us;
+    stats->max_queued_us = std::max(stats->max_queued_us, queued_us);
+    due_us_.erase(it);
+  }
+  return true;
+}
+
+void MediaPathThread::Post(const rtc::Location& posted_from,
+                           rtc::MessageHandler* phandler,
+                           uint32_t id,
+                           rtc::MessageData* pdata,
+                           bool time_sensitive) {
+  if (!options_.inline_sites.empty() && IsCurrent() && !IsQuitting() &&
+      ShouldInline(posted_from)) {
+    if (options_.count_hops) {
+      rtc::CritScope cs(&stats_crit_);
+      ++StatsFor(posted_from)->inlined;
+    }
+    rtc::Message msg;
+    msg.posted_from = posted_from;
+    msg.phandler = phandler;
+    msg.message_id = id;
+    msg.pdata = pdata;
+    Dispatch(&msg);
+    return;
+  }
+  // Disposals are deleted by Get() without being returned.
+  if (id != rtc::MQID_DISPOSE)
+    Stamp(pdata, rtc::TimeMicros());
+  rtc::Thread::Post(posted_from, phandler, id, pdata, time_sensitive);
+}
+
+void MediaPathThread::PostDelayed(const rtc::Location& posted_from,
+                                  int cmsDelay,
+                                  rtc::MessageHandler* phandler,
+                                  uint32_t id,
+                                  rtc::MessageData* pdata) {
+  Stamp(pdata, rtc::TimeMicros() + cmsDelay * rtc::kNumMicrosecsPerMillisec);
+  rtc::Thread::PostDelayed(posted_from, cmsDelay, phandler, id, pdata);
+}
+
+void MediaPathThread::PostAt(const rtc::Location& posted_from,
+                             int64_t tstamp,
+                             rtc::MessageHandler* phandler,
+                             uint32_t id,
+                             rtc::MessageData* pdata) {
+  Stamp(pdata, tstamp * rtc::kNumMicrosecsPerMillisec);
+  rtc::Thread::PostAt(posted_from, tstamp, phandler, id, pdata);
+}
+
+void MediaPathThread::PostAt(const rtc::Location& posted_from,
+                             uint32_t tstamp,
+                             rtc::MessageHandler* phandler,
+                             uint32_t id,
+                             rtc::MessageData* pdata) {
+  const int64_t now = rtc::TimeMillis();
+  Stamp(pdata, (now + rtc::TimeDiff32(tstamp, static_cast<uint32_t>(now))) *
+                   rtc::kNumMicrosecsPerMillisec);
+  rtc::Thread::PostAt(posted_from, tstamp, phandler, id, pdata);
+}
+
+void MediaPathThread::Send(const rtc::Location& posted_from,
+                           rtc::MessageHandler* phandler,
+                           uint32_t id,
+                           rtc::MessageData* pdata) {
+  // A Send() on the thread itself is a plain call.
+  if (!options_.count_hops || IsCurrent()) {
+    rtc::Thread::Send(posted_from, phandler, id, pdata);
+    return;
+  }
+  const int64_t start_us = rtc::TimeMicros();
+  rtc::Thread::Send(posted_from, phandler, id, pdata);
+  const int64_t blocked_us = rtc::TimeMicros() - start_us;
+
+  rtc::CritScope cs(&stats_crit_);
+  HopStats* stats = StatsFor(posted_from);
+  ++stats->sent;
+  stats->blocked_us += blocked_us;
+}
+
+void MediaPathThread::Clear(rtc::MessageHandler* phandler,
+                            uint32_t id,
+                            rtc::MessageList* removed) {
+  if (!options_.count_hops) {
+    rtc::Thread::Clear(phandler, id, removed);
+    return;
+  }
+  rtc::MessageList cleared;
+  rtc::Thread::Clear(phandler, id, &cleared);
+  {
+    rtc::CritScope cs(&stats_crit_);
+    for (const rtc::Message& msg : cleared)
+      due_us_.erase(msg.pdata);
+  }
+  for (const rtc::Message& msg : cleared) {
+    if (removed)
+      removed->push_back(msg);
+    else
+      delete msg.pdata;
+  }
+}
+
+bool MediaPathThread::ShouldInline(const rtc::Location& posted_from) {
+  auto it = inline_cache_.find(posted_from.file_and_line());
+  if (it != inline_cache_.end())
+    return it->second;
+  // "path/to/channel.cc:123" in OnPacketReceived() is
+  // "channel.cc:OnPacketReceived".
+  std::string file = posted_from.file_and_line();
+  file = file.substr(0, file.rfind(':'));
+  file = file.substr(file.find_last_of("/\\") + 1);
+  const std::string site = file + ":" + posted_from.function_name();
+  const bool matches =
+      std::find(options_.inline_sites.begin(), options_.inline_sites.end(),
+                site) != options_.inline_sites.end();
+  inline_cache_[posted_from.file_and_line()] = matches;
+  return matches;
+}
+
+void MediaPathThread::Stamp(rtc::MessageData* pdata, int64_t due_us) {
+  if (!options_.count_hops || !pdata || IsQuitting())
+    return;
+  rtc::CritScope cs(&stats_crit_);
+  due_us_[pdata] = due_us;
+}
+
+MediaPathThread::HopStats* MediaPathThread::StatsFor(
+    const rtc::Location& location) {
+  auto it = stats_.find(location.file_and_line());
+  if (it == stats_.end()) {
+    it = stats_
+             .emplace(location.file_and_line(),
+                      std::make_pair(location, HopStats()))
+             .first;
+  }
+  return &it->second.second;
+}
+
+}  // namespace simple_app
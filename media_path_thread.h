@@ -0,0 +1,135 @@
+#ifndef MEDIA_PATH_THREAD_H_
+#define MEDIA_PATH_THREAD_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rtc_base/criticalsection.h"
+#include "rtc_base/thread.h"
+
+namespace simple_app {
+
+// rtc::Thread for the network and worker threads of a PeerConnectionFactory
+// that can count the hops packets make between threads, and can take the
+// hop out of cricket::BaseChannel's receive path.
+//
+// BaseChannel::OnPacketReceived() runs on the network thread, after the
+// SrtpTransport has unprotected the packet and the bundle filter has
+// demuxed it, and hands the packet to the media engine by posting to the
+// worker thread. When network and worker thread are the same, it still
+// posts, to itself; BaseChannel::SendPacket() on the other hand skips its
+// reverse hop. A MediaPathThread used as both threads, with
+// kBaseChannelPacketHandOff in |inline_sites|, dispatches that post right
+// away instead of queuing it, so a received packet goes from the socket to
+// the media engine in one call, without the queue's lock, list node and
+// wake-up.
+class MediaPathThread : public rtc::Thread {
+ public:
+  // "file:function" of the post in BaseChannel::OnPacketReceived().
+  static const char kBaseChannelPacketHandOff[];
+
+  struct Options {
+    // Keeps HopStats, which costs a lock and a hash table entry per
+    // message.
+    bool count_hops = false;
+    // Posts the thread makes to itself from these places, each given as
+    // the file's base name and the function, run during Post() instead of
+    // being queued. Only for posts whose caller does nothing after posting
+    // that the handler could interfere with.
+    std::vector<std::string> inline_sites;
+  };
+
+  // Messages of one RTC_FROM_HERE location.
+  struct HopStats {
+    // Queued by Post(), PostDelayed() or PostAt() and dispatched.
+    uint64_t posted = 0;
+    // Run during Post(), as |inline_sites| says.
+    uint64_t inlined = 0;
+    // From Send() or Invoke() on another thread.
+    uint64_t sent = 0;
+    // How long dispatched messages waited in the queue after they were
+    // due; messages without data are counted but not timed.
+    int64_t queued_us = 0;
+    int64_t max_queued_us = 0;
+    // How long Send() callers were blocked, including the handler.
+    int64_t blocked_us = 0;
+  };
+
+  MediaPathThread(std::unique_ptr<rtc::SocketServer> ss,
+                  const Options& options);
+  ~MediaPathThread() override;
+
+  // Equivalents of rtc::Thread::Create()/CreateWithSocketServer().
+  static std::unique_ptr<MediaPathThread> Create(const Options& options);
+  static std::unique_ptr<MediaPathThread> CreateWithSocketServer(
+      const Options& options);
+
+  // Keyed by Location::ToString(). Empty unless |count_hops|.
+  std::map<std::string, HopStats> GetHopStats() const;
+  void ResetHopStats();
+
+  // rtc::MessageQueue:
+  bool Get(rtc::Message* pmsg,
+           int cmsWait = kForever,
+           bool process_io = true) override;
+  void Post(const rtc::Location& posted_from,
+            rtc::MessageHandler* phandler,
+            uint32_t id = 0,
+            rtc::MessageData* pdata = nullptr,
+            bool time_sensitive = false) override;
+  void PostDelayed(const rtc::Location& posted_from,
+                   int cmsDelay,
+                   rtc::MessageHandler* phandler,
+                   uint32_t id = 0,
+                   rtc::MessageData* pdata = nullptr) override;
+  void PostAt(const rtc::Location& posted_from,
+              int64_t tstamp,
+              rtc::MessageHandler* phandler,
+              uint32_t id = 0,
+              rtc::MessageData* pdata = nullptr) override;
+  void PostAt(const rtc::Location& posted_from,
+              uint32_t tstamp,
+              rtc::MessageHandler* phandler,
+              uint32_t id = 0,
+              rtc::MessageData* pdata = nullptr) override;
+
+  // rtc::Thread:
+  void Send(const rtc::Location& posted_from,
+            rtc::MessageHandler* phandler,
+            uint32_t id = 0,
+            rtc::MessageData* pdata = nullptr) override;
+  void Clear(rtc::MessageHandler* phandler,
+             uint32_t id = rtc::MQID_ANY,
+             rtc::MessageList* removed = nullptr) override;
+
+ private:
+  bool ShouldInline(const rtc::Location& posted_from);
+  // Records when the message with |pdata| is due.
+  void Stamp(rtc::MessageData* pdata, int64_t due_us);
+  HopStats* StatsFor(const rtc::Location& location)
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(stats_crit_);
+
+  const Options options_;
+  // Whether each location, by its file_and_line() literal, is one of
+  // |inline_sites|. Only used on the thread itself.
+  std::unordered_map<const char*, bool> inline_cache_;
+
+  rtc::CriticalSection stats_crit_;
+  std::unordered_map<rtc::MessageData*, int64_t> due_us_
+      RTC_GUARDED_BY(stats_crit_);
+  // By the location's file_and_line() literal.
+  std::unordered_map<const char*, std::pair<rtc::Location, HopStats>> stats_
+      RTC_GUARDED_BY(stats_crit_);
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(MediaPathThread);
+};
+
+}  // namespace simple_app
+
+#endif  // MEDIA_PATH_THREAD_H_
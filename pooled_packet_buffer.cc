@@ -0,0 +1,342 @@
+#include "pooled_packet_buffer.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/criticalsection.h"
+
+namespace simple_app {
+
+namespace {
+
+class ThreadCache;
+
+// Blocks move between thread caches and the depot this many at a time, so
+// the depot lock is taken once per batch rather than once per packet.
+const size_t kTransferBatch = 64;
+// Blocks the depot holds before frees go back to the heap.
+const size_t kMaxDepotBlocks = 16384;
+
+// Shared state of all thread caches: the depot through which blocks freed
+// on one thread reach threads that allocate, and the list of live caches so
+// GetStats() can sum their counters.
+struct Central {
+  rtc::CriticalSection crit;
+  std::vector<void*> depot RTC_GUARDED_BY(crit);
+  std::vector<ThreadCache*> caches RTC_GUARDED_BY(crit);
+  // Counters of caches whose thread has exited.
+  PacketBufferPool::Stats retired RTC_GUARDED_BY(crit);
+};
+
+Central& GetCentral() {
+  // Leaked so that thread caches torn down during exit can still find it.
+  static Central* const central = new Central();
+  return *central;
+}
+
+void AddStats(const PacketBufferPool::Stats& from,
+              PacketBufferPool::Stats* to) {
+  to->hits += from.hits;
+  to->misses += from.misses;
+  to->oversize += from.oversize;
+  to->overflows += from.overflows;
+}
+
+class ThreadCache {
+ public:
+  ThreadCache() {
+    blocks_.reserve(PacketBufferPool::kMaxCachedBlocks);
+    Central& central = GetCentral();
+    rtc::CritScope cs(&central.crit);
+    central.caches.push_back(this);
+  }
+
+  ~ThreadCache() {
+    Central& central = GetCentral();
+    rtc::CritScope cs(&central.crit);
+    ReturnToDepot(blocks_.size(), &central);
+    central.caches.erase(
+        std::find(central.caches.begin(), central.caches.end(), this));
+    AddStats(stats(), &central.retired);
+  }
+
+  void* Allocate() {
+    if (blocks_.empty()) {
+      Central& central = GetCentral();
+      rtc::CritScope cs(&central.crit);
+      const size_t count = std::min(kTransferBatch, central.depot.size());
+      blocks_.insert(blocks_.end(), central.depot.end() - count,
+                     central.depot.end());
+      central.depot.resize(central.depot.size() - count);
+    }
+    if (blocks_.empty()) {
+      Bump(&misses_);
+      return ::operator new(PacketBufferPool::kBlockSize);
+    }
+    Bump(&hits_);
+    void* block = blocks_.back();
+    blocks_.pop_back();
+    return block;
+  }
+
+  void Free(void* block) {
+    if (blocks_.size() >= PacketBufferPool::kMaxCachedBlocks) {
+      Central& central = GetCentral();
+      rtc::CritScope cs(&central.crit);
+      ReturnToDepot(kTransferBatch, &central);
+    }
+    blocks_.push_back(block);
+  }
+
+  void CountOversize() { Bump(&oversize_); }
+
+  // May be called from any thread.
+  PacketBufferPool::Stats stats() const {
+    PacketBufferPool::Stats stats;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.oversize = oversize_.load(std::memory_order_relaxed);
+    stats.overflows = overflows_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  // Moves the |count| most recently freed blocks to the depot, or to the heap
+  // once the depot is full.
+  void ReturnToDepot(size_t count, Central* central)
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(central->crit) {
+    for (size_t i = 0; i < count; ++i) {
+      void* block = blocks_.back();
+      blocks_.pop_back();
+      if (central->depot.size() < kMaxDepotBlocks) {
+        central->depot.push_back(block);
+      } else {
+        Bump(&overflows_);
+        ::operator delete(block);
+      }
+    }
+  }
+
+  // Only the owning thread writes, so a plain load and store suffices; the
+  // atomics only make the reads from GetStats() well defined.
+  static void Bump(std::atomic<uint64_t>* counter) {
+    counter->store(counter->load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+  }
+
+  std::vector<void*> blocks_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> oversize_{0};
+  std::atomic<uint64_t> overflows_{0};
+};
+
+thread_local ThreadCache g_thread_cache;
+
+}  // namespace
+
+const size_t PacketBufferPool::kBlockSize;
+const size_t PacketBufferPool::kMaxCachedBlocks;
+const size_t PooledPacketBuffer::kDefaultHeadroom;
+const size_t PooledPacketBuffer::kDefaultTailroom;
+
+// static
+PacketBufferPool::Stats PacketBufferPool::GetStats() {
+  Central& central = GetCentral();
+  rtc::CritScope cs(&central.crit);
+  Stats stats = central.retired;
+  for (const ThreadCache* cache : central.caches)
+    AddStats(cache->stats(), &stats);
+  return stats;
+}
+
+// static
+void* PacketBufferPool::Allocate(size_t size) {
+  if (size > kBlockSize) {
+    g_thread_cache.CountOversize();
+    return ::operator new(size);
+  }
+  return g_thread_cache.Allocate();
+}
+
+// static
+void PacketBufferPool::Free(void* block, size_t size) {
+  if (size > kBlockSize) {
+    ::operator delete(block);
+    return;
+  }
+  g_thread_cache.Free(block);
+}
+
+PooledPacketBuffer::PooledPacketBuffer()
+    : storage_(nullptr), offset_(0), size_(0) {}
+
+PooledPacketBuffer::PooledPacketBuffer(const PooledPacketBuffer& buf)
+    : storage_(buf.storage_), offset_(buf.offset_), size_(buf.size_) {
+  if (storage_)
+    storage_->ref_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+PooledPacketBuffer::PooledPacketBuffer(PooledPacketBuffer&& buf)
+    : storage_(buf.storage_), offset_(buf.offset_), size_(buf.size_) {
+  buf.storage_ = nullptr;
+  buf.offset_ = 0;
+  buf.size_ = 0;
+}
+
+PooledPacketBuffer::PooledPacketBuffer(size_t size,
+                                       size_t headroom,
+                                       size_t tailroom)
+    : storage_(NewStorage(headroom + size + tailroom)),
+      offset_(headroom),
+      size_(size) {}
+
+PooledPacketBuffer::PooledPacketBuffer(const uint8_t* data,
+                                       size_t size,
+                                       size_t headroom,
+                                       size_t tailroom)
+    : PooledPacketBuffer(size, headroom, tailroom) {
+  if (size > 0)
+    memcpy(storage_->bytes() + offset_, data, size);
+}
+
+PooledPacketBuffer::~PooledPacketBuffer() {
+  Release(storage_);
+}
+
+PooledPacketBuffer& PooledPacketBuffer::operator=(
+    const PooledPacketBuffer& buf) {
+  if (&buf != this) {
+    if (buf.storage_)
+      buf.storage_->ref_count.fetch_add(1, std::memory_order_relaxed);
+    Release(storage_);
+    storage_ = buf.storage_;
+    offset_ = buf.offset_;
+    size_ = buf.size_;
+  }
+  return *this;
+}
+
+PooledPacketBuffer& PooledPacketBuffer::operator=(PooledPacketBuffer&& buf) {
+  std::swap(storage_, buf.storage_);
+  std::swap(offset_, buf.offset_);
+  std::swap(size_, buf.size_);
+  return *this;
+}
+
+uint8_t* PooledPacketBuffer::data() {
+  if (!storage_)
+    return nullptr;
+  // The copy gets the default room, not whatever is left in the shared
+  // block, so a nearly full block does not turn into an oversize one.
+  if (IsShared())
+    Reserve(0, 0);
+  return storage_->bytes() + offset_;
+}
+
+void PooledPacketBuffer::SetData(const uint8_t* data, size_t size) {
+  if (IsShared()) {
+    Release(storage_);
+    storage_ = nullptr;
+  }
+  size_ = 0;
+  Reserve(storage_ ? offset_ : kDefaultHeadroom, size);
+  if (size > 0)
+    memcpy(storage_->bytes() + offset_, data, size);
+  size_ = size;
+}
+
+void PooledPacketBuffer::AppendData(const uint8_t* data, size_t size) {
+  if (size == 0)
+    return;
+  memcpy(Extend(size), data, size);
+}
+
+uint8_t* PooledPacketBuffer::Prepend(size_t size) {
+  Reserve(size, 0);
+  offset_ -= size;
+  size_ += size;
+  return storage_->bytes() + offset_;
+}
+
+uint8_t* PooledPacketBuffer::Extend(size_t size) {
+  Reserve(storage_ ? offset_ : kDefaultHeadroom, size);
+  uint8_t* tail = storage_->bytes() + offset_ + size_;
+  size_ += size;
+  return tail;
+}
+
+void PooledPacketBuffer::TrimFront(size_t size) {
+  RTC_DCHECK_LE(size, size_);
+  offset_ += size;
+  size_ -= size;
+}
+
+void PooledPacketBuffer::SetSize(size_t size) {
+  if (size <= size_) {
+    size_ = size;
+    return;
+  }
+  Extend(size - size_);
+}
+
+void PooledPacketBuffer::Clear() {
+  if (IsShared()) {
+    Release(storage_);
+    storage_ = nullptr;
+    offset_ = 0;
+  } else if (storage_) {
+    offset_ = std::min(kDefaultHeadroom, storage_->capacity);
+  }
+  size_ = 0;
+}
+
+rtc::CopyOnWriteBuffer PooledPacketBuffer::ToCopyOnWriteBuffer() const {
+  return rtc::CopyOnWriteBuffer(cdata(), size_);
+}
+
+// static
+PooledPacketBuffer::Storage* PooledPacketBuffer::NewStorage(size_t capacity) {
+  // Small buffers get a whole block, so the rest of it is tailroom.
+  size_t block_size =
+      std::max(sizeof(Storage) + capacity, PacketBufferPool::kBlockSize);
+  Storage* storage = new (PacketBufferPool::Allocate(block_size)) Storage;
+  storage->ref_count.store(1, std::memory_order_relaxed);
+  storage->capacity = block_size - sizeof(Storage);
+  storage->block_size = block_size;
+  return storage;
+}
+
+// static
+void PooledPacketBuffer::Release(Storage* storage) {
+  if (!storage ||
+      storage->ref_count.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  const size_t block_size = storage->block_size;
+  storage->~Storage();
+  PacketBufferPool::Free(storage, block_size);
+}
+
+void PooledPacketBuffer::Reserve(size_t headroom, size_t tailroom) {
+  if (storage_ && !IsShared() && offset_ >= headroom &&
+      this->tailroom() >= tailroom) {
+    return;
+  }
+  // Reallocating anyway, so restore the default room on both ends.
+  const size_t new_headroom = std::max(headroom, kDefaultHeadroom);
+  const size_t new_tailroom = std::max(tailroom, kDefaultTailroom);
+  Storage* storage = NewStorage(new_headroom + size_ + new_tailroom);
+  if (size_ > 0)
+    memcpy(storage->bytes() + new_headroom, cdata(), size_);
+  Release(storage_);
+  storage_ = storage;
+  offset_ = new_headroom;
+}
+
+}  // namespace simple_app
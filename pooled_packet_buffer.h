@@ -0,0 +1,135 @@
+#ifndef POOLED_PACKET_BUFFER_H_
+#define POOLED_PACKET_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "rtc_base/copyonwritebuffer.h"
+
+namespace simple_app {
+
+// Fixed-size packet blocks cached per thread. Allocation and free touch only
+// the calling thread's cache; when a cache runs empty or full it trades a
+// batch of blocks with a shared depot, so buffers allocated on the network
+// thread and freed on a worker thread still recycle. Requests that do not fit
+// a block fall back to the heap and are counted as oversize.
+class PacketBufferPool {
+ public:
+  // Covers a 1500 byte MTU plus the default headroom and the block header.
+  static const size_t kBlockSize = 2048;
+  // Blocks a thread keeps before it hands a batch to the shared depot.
+  static const size_t kMaxCachedBlocks = 512;
+
+  struct Stats {
+    // Allocations served from a thread cache or the depot.
+    uint64_t hits = 0;
+    // Allocations that needed a new block from the heap.
+    uint64_t misses = 0;
+    // Allocations larger than a block.
+    uint64_t oversize = 0;
+    // Frees that went back to the heap because the depot was full.
+    uint64_t overflows = 0;
+  };
+
+  // Totals over all threads, including ones that have exited.
+  static Stats GetStats();
+
+  // Returns storage for at least |size| bytes.
+  static void* Allocate(size_t size);
+  // |size| must be the value passed to Allocate().
+  static void Free(void* block, size_t size);
+};
+
+// Packet buffer with copy-on-write sharing like rtc::CopyOnWriteBuffer, but
+// backed by PacketBufferPool blocks and with spare room on both ends of the
+// payload. Prepend() and Extend() grow the payload into that room in place,
+// so adding a TURN ChannelData header in front or an SRTP auth tag at the
+// back does not reallocate and copy.
+//
+// Copies share the block until one of them writes. Not thread safe, but
+// copies may be used and destroyed on different threads.
+class PooledPacketBuffer {
+ public:
+  // Enough for a TURN Send indication or ChannelData header.
+  static const size_t kDefaultHeadroom = 64;
+  // Enough for the largest SRTP/SRTCP trailer (AES-GCM tag plus index).
+  static const size_t kDefaultTailroom = 32;
+
+  PooledPacketBuffer();
+  PooledPacketBuffer(const PooledPacketBuffer& buf);
+  PooledPacketBuffer(PooledPacketBuffer&& buf);
+  explicit PooledPacketBuffer(size_t size,
+                              size_t headroom = kDefaultHeadroom,
+                              size_t tailroom = kDefaultTailroom);
+  PooledPacketBuffer(const uint8_t* data,
+                     size_t size,
+                     size_t headroom = kDefaultHeadroom,
+                     size_t tailroom = kDefaultTailroom);
+  ~PooledPacketBuffer();
+
+  PooledPacketBuffer& operator=(const PooledPacketBuffer& buf);
+  PooledPacketBuffer& operator=(PooledPacketBuffer&& buf);
+
+  const uint8_t* cdata() const {
+    return storage_ ? storage_->bytes() + offset_ : nullptr;
+  }
+  const uint8_t* data() const { return cdata(); }
+  // Unshares the block first if another buffer refers to it.
+  uint8_t* data();
+
+  size_t size() const { return size_; }
+  // Bytes that Prepend() can claim without reallocating.
+  size_t headroom() const { return storage_ ? offset_ : 0; }
+  // Bytes that Extend()/AppendData() can claim without reallocating.
+  size_t tailroom() const {
+    return storage_ ? storage_->capacity - offset_ - size_ : 0;
+  }
+
+  void SetData(const uint8_t* data, size_t size);
+  void AppendData(const uint8_t* data, size_t size);
+  // Grows the payload by |size| bytes at the front and returns them.
+  uint8_t* Prepend(size_t size);
+  // Grows the payload by |size| bytes at the back and returns them.
+  uint8_t* Extend(size_t size);
+  // Drops |size| bytes from the front; they become headroom.
+  void TrimFront(size_t size);
+  // Shrinking turns the dropped bytes into tailroom.
+  void SetSize(size_t size);
+  void Clear();
+
+  // Copies the payload into a CopyOnWriteBuffer for APIs that require one.
+  rtc::CopyOnWriteBuffer ToCopyOnWriteBuffer() const;
+
+ private:
+  struct Storage {
+    std::atomic<int> ref_count;
+    // Usable bytes after the header.
+    size_t capacity;
+    // Size passed to PacketBufferPool::Allocate().
+    size_t block_size;
+
+    uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+  };
+
+  static Storage* NewStorage(size_t capacity);
+  static void Release(Storage* storage);
+
+  // Makes this buffer the sole owner of a block with at least |headroom|
+  // bytes in front of and |tailroom| bytes after the current payload,
+  // copying the payload if needed.
+  void Reserve(size_t headroom, size_t tailroom);
+  bool IsShared() const {
+    return storage_ &&
+           storage_->ref_count.load(std::memory_order_acquire) != 1;
+  }
+
+  Storage* storage_;
+  size_t offset_;
+  size_t size_;
+};
+
+}  // namespace simple_app
+
+#endif  // POOLED_PACKET_BUFFER_H_
@@ -0,0 +1,158 @@
+#include "pooled_rtp_receiver.h"
+
+#include "allocation_counter.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+namespace {
+
+const size_t kMinRtpHeaderSize = 12;
+const uint8_t kRtpVersion = 2;
+// RFC 5761 section 4: RTCP packet types 192-223 show up as these values in
+// the RTP marker/payload type byte.
+const uint8_t kMinRtcpPayloadType = 64;
+const uint8_t kMaxRtcpPayloadType = 95;
+
+}  // namespace
+
+const size_t PooledRtpReceiver::kMaxSinks;
+const size_t PooledRtpReceiver::kDefaultPoolSize;
+const size_t PooledRtpReceiver::kPacketCapacity;
+
+PooledRtpReceiver::PooledRtpReceiver(
+    const webrtc::RtpHeaderExtensionMap* extensions,
+    size_t pool_size)
+    : extensions_(extensions) {
+  RTC_DCHECK_GT(pool_size, 0);
+  pool_.reserve(pool_size);
+  for (size_t i = 0; i < pool_size; ++i) {
+    pool_.emplace_back(new webrtc::RtpPacketReceived(extensions_));
+    // RtpPacketReceived has no constructor that takes a capacity, and
+    // Parse() keeps the capacity of a buffer it doesn't share.
+    static_cast<webrtc::RtpPacket&>(*pool_.back()) =
+        webrtc::RtpPacket(extensions_, kPacketCapacity);
+  }
+  for (SinkEntry& entry : sinks_) {
+    entry.ssrc = 0;
+    entry.sink = nullptr;
+  }
+}
+
+PooledRtpReceiver::~PooledRtpReceiver() = default;
+
+bool PooledRtpReceiver::AddSink(uint32_t ssrc,
+                                webrtc::RtpPacketSinkInterface* sink) {
+  RTC_DCHECK(sink);
+  if (num_sinks_ == kMaxSinks)
+    return false;
+  SinkEntry& entry = sinks_[FindSlot(ssrc)];
+  if (entry.sink)
+    return false;
+  entry.ssrc = ssrc;
+  entry.sink = sink;
+  ++num_sinks_;
+  return true;
+}
+
+bool PooledRtpReceiver::RemoveSink(
+    const webrtc::RtpPacketSinkInterface* sink) {
+  // Removal is rare, so rebuild the table rather than repair probe runs.
+  SinkEntry kept[kMaxSinks];
+  size_t num_kept = 0;
+  for (SinkEntry& entry : sinks_) {
+    if (entry.sink && entry.sink != sink)
+      kept[num_kept++] = entry;
+    entry.sink = nullptr;
+  }
+  const bool removed = num_kept != num_sinks_;
+  for (size_t i = 0; i < num_kept; ++i)
+    sinks_[FindSlot(kept[i].ssrc)] = kept[i];
+  num_sinks_ = num_kept;
+  return removed;
+}
+
+void PooledRtpReceiver::SetRtcpSink(webrtc::RtcpPacketSinkInterface* sink) {
+  rtcp_sink_ = sink;
+}
+
+void PooledRtpReceiver::OnReadPacket(
+    rtc::AsyncPacketSocket* /* socket */,
+    const char* data,
+    size_t size,
+    const rtc::SocketAddress& /* remote_address */,
+    const rtc::PacketTime& packet_time) {
+  const int64_t arrival_time_ms =
+      packet_time.timestamp == -1 ? -1 : packet_time.timestamp / 1000;
+  OnPacket(reinterpret_cast<const uint8_t*>(data), size, arrival_time_ms);
+}
+
+void PooledRtpReceiver::OnPacket(const uint8_t* data,
+                                 size_t size,
+                                 int64_t arrival_time_ms) {
+  if (size < kMinRtpHeaderSize || (data[0] >> 6) != kRtpVersion)
+    return;  // STUN, DTLS or garbage.
+  const uint8_t payload_type = data[1] & 0x7f;
+  if (payload_type >= kMinRtcpPayloadType &&
+      payload_type <= kMaxRtcpPayloadType) {
+    ++stats_.rtcp_packets;
+    if (rtcp_sink_)
+      rtcp_sink_->OnRtcpPacket(rtc::ArrayView<const uint8_t>(data, size));
+    return;
+  }
+  if (arrival_time_ms == -1)
+    arrival_time_ms = rtc::TimeMillis();
+  DeliverRtp(data, size, arrival_time_ms);
+}
+
+size_t PooledRtpReceiver::FindSlot(uint32_t ssrc) const {
+  const size_t kNumSlots = sizeof(sinks_) / sizeof(sinks_[0]);
+  // SSRCs are random, but some endpoints pick small sequential ones, so mix
+  // the bits before taking the slot.
+  size_t i = (ssrc * 2654435761u) % kNumSlots;
+  while (sinks_[i].sink && sinks_[i].ssrc != ssrc)
+    i = (i + 1) % kNumSlots;
+  return i;
+}
+
+void PooledRtpReceiver::DeliverRtp(const uint8_t* data,
+                                   size_t size,
+                                   int64_t arrival_time_ms) {
+  if (pool_.empty()) {
+    ++stats_.dropped_packets;
+    return;
+  }
+  std::unique_ptr<webrtc::RtpPacketReceived> packet = std::move(pool_.back());
+  pool_.pop_back();
+
+  webrtc::RtpPacketSinkInterface* sink = nullptr;
+  {
+    ScopedAllocationCount allocations;
+    if (packet->Parse(data, size)) {
+      ++stats_.rtp_packets;
+      const SinkEntry& entry = sinks_[FindSlot(packet->Ssrc())];
+      if (entry.sink) {
+        sink = entry.sink;
+      } else {
+        ++stats_.unknown_ssrc_packets;
+      }
+    } else {
+      ++stats_.dropped_packets;
+    }
+    // Always zero without allocation counting compiled in.
+    RTC_CHECK(size > kPacketCapacity || allocations.count() == 0)
+        << "RTP demux allocated " << allocations.count()
+        << " times for a " << size << " byte packet";
+  }
+
+  if (sink) {
+    packet->set_arrival_time_ms(arrival_time_ms);
+    ScopedAllocationCount allocations;
+    sink->OnRtpPacket(*packet);
+    stats_.sink_allocations += allocations.count();
+  }
+  pool_.push_back(std::move(packet));
+}
+
+}  // namespace simple_app
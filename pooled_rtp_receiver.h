@@ -0,0 +1,105 @@
+#ifndef POOLED_RTP_RECEIVER_H_
+#define POOLED_RTP_RECEIVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "call/rtcp_packet_sink_interface.h"
+#include "call/rtp_packet_sink_interface.h"
+#include "modules/rtp_rtcp/include/rtp_header_extension_map.h"
+#include "modules/rtp_rtcp/source/rtp_packet_received.h"
+#include "rtc_base/asyncpacketsocket.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/sigslot.h"
+
+namespace simple_app {
+
+// Receive path from a packet socket to RtpPacketSinkInterface sinks that does
+// no heap allocation per packet. Packets are parsed into RtpPacketReceived
+// objects taken from a fixed pool, whose buffers are allocated up front and
+// reused from packet to packet, and are routed by SSRC through a
+// fixed-capacity open-addressing table. RTCP (RFC 5761 payload types) goes
+// to an optional RtcpPacketSinkInterface; STUN and other non-RTP traffic is
+// ignored.
+//
+// With allocation counting compiled in (see allocation_counter.h), an
+// allocation in the parse and demux of a packet of up to kPacketCapacity
+// bytes is a fatal error, and stats() reports those made by the sinks. A
+// sink that keeps a copy of the RtpPacketReceived shares its buffer, which
+// makes the next parse into it allocate; sinks copy out what they keep.
+//
+// Must be used on one thread, the one delivering the packets.
+class PooledRtpReceiver : public sigslot::has_slots<> {
+ public:
+  static const size_t kMaxSinks = 64;
+  // Packets in flight at once; more than one only when a sink feeds packets
+  // back in from OnRtpPacket().
+  static const size_t kDefaultPoolSize = 4;
+  // Buffer size of each pooled packet; a larger packet grows the buffer it
+  // is parsed into.
+  static const size_t kPacketCapacity = 1500;
+
+  struct Stats {
+    uint64_t rtp_packets = 0;
+    uint64_t rtcp_packets = 0;
+    // Malformed RTP, or packets dropped because the pool was empty.
+    uint64_t dropped_packets = 0;
+    uint64_t unknown_ssrc_packets = 0;
+    // Only counted with allocation counting compiled in.
+    uint64_t sink_allocations = 0;
+  };
+
+  // |extensions| may be null, in which case header extensions are not
+  // parsed; it must outlive the receiver otherwise.
+  explicit PooledRtpReceiver(
+      const webrtc::RtpHeaderExtensionMap* extensions,
+      size_t pool_size = kDefaultPoolSize);
+  ~PooledRtpReceiver() override;
+
+  // Returns false if |ssrc| already has a sink or the table is full.
+  bool AddSink(uint32_t ssrc, webrtc::RtpPacketSinkInterface* sink);
+  // Removes every SSRC routed to |sink|. Returns false if there was none.
+  bool RemoveSink(const webrtc::RtpPacketSinkInterface* sink);
+  void SetRtcpSink(webrtc::RtcpPacketSinkInterface* sink);
+
+  // Matches AsyncPacketSocket::SignalReadPacket, so the receiver can be
+  // connected straight to a socket.
+  void OnReadPacket(rtc::AsyncPacketSocket* socket,
+                    const char* data,
+                    size_t size,
+                    const rtc::SocketAddress& remote_address,
+                    const rtc::PacketTime& packet_time);
+  // |arrival_time_ms| of -1 means now.
+  void OnPacket(const uint8_t* data, size_t size, int64_t arrival_time_ms);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct SinkEntry {
+    uint32_t ssrc;
+    webrtc::RtpPacketSinkInterface* sink;
+  };
+
+  // Index of the slot for |ssrc|: the one holding it, or the empty slot
+  // where it would go.
+  size_t FindSlot(uint32_t ssrc) const;
+  void DeliverRtp(const uint8_t* data, size_t size, int64_t arrival_time_ms);
+
+  const webrtc::RtpHeaderExtensionMap* const extensions_;
+  std::vector<std::unique_ptr<webrtc::RtpPacketReceived>> pool_;
+  // Open addressing with linear probing; a null sink marks an empty slot.
+  // Twice |kMaxSinks| slots keep probe sequences short.
+  SinkEntry sinks_[2 * kMaxSinks];
+  size_t num_sinks_ = 0;
+  webrtc::RtcpPacketSinkInterface* rtcp_sink_ = nullptr;
+  Stats stats_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(PooledRtpReceiver);
+};
+
+}  // namespace simple_app
+
+#endif  // POOLED_RTP_RECEIVER_H_
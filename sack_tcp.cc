@@ -0,0 +1,899 @@
+#include "sack_tcp.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "rtc_base/byteorder.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+namespace {
+
+// conv, seq, ack, flags, SACK block count, reserved, window, tsval, tsecr.
+const size_t kHeaderSize = 28;
+const size_t kSackBlockSize = 8;
+const size_t kMaxSackBlocks = 4;
+const size_t kMaxHeaderSize = kHeaderSize + kMaxSackBlocks * kSackBlockSize;
+// Smallest packet WR_TOO_LARGE can shrink segments to.
+const size_t kMinPacketSize = 576;
+// Largest packet NotifyMTU() can allow.
+const size_t kMaxPacketSize = 65536;
+const size_t kIpUdpHeaderSize = 28;
+// Out of order ranges the receiver tracks; data past them is dropped.
+const size_t kMaxRanges = 64;
+
+const uint8_t kFlagCtl = 0x01;
+const uint8_t kFlagRst = 0x02;
+// Asks for an immediate ACK, to probe a zero window.
+const uint8_t kFlagProbe = 0x04;
+const char kCtlConnect = 0;
+
+const uint32_t kMinRto = 250;
+const uint32_t kDefaultRto = 1000;
+const uint32_t kMaxRto = 60000;
+const uint8_t kMaxRetransmits = 15;
+// GetNextClock() timeout with no timer running, and once closed.
+const long kDefaultTimeout = 4000;
+const long kClosedTimeout = 60000;
+// Segments delivered after one that is not, before it is counted lost; the
+// duplicate ACK threshold of RFC 5681.
+const uint64_t kReorderThreshold = 3;
+const uint32_t kInitialWindowSegments = 10;
+
+// RFC 8312.
+const double kCubicC = 0.4;
+const double kCubicBeta = 0.7;
+
+bool SeqLess(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) < 0;
+}
+
+bool SeqLessOrEqual(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) <= 0;
+}
+
+}  // namespace
+
+struct SackTcp::Header {
+  uint32_t conv;
+  uint32_t seq;
+  uint32_t ack;
+  uint8_t flags;
+  uint8_t sack_count;
+  uint32_t wnd;
+  uint32_t tsval;
+  uint32_t tsecr;
+  Range sack[kMaxSackBlocks];
+};
+
+ByteRing::ByteRing(size_t capacity)
+    : buffer_(new char[capacity]), capacity_(capacity) {}
+
+size_t ByteRing::Write(const void* data, size_t length) {
+  length = std::min(length, space());
+  CopyIn((head_ + size_) % capacity_, data, length);
+  size_ += length;
+  return length;
+}
+
+bool ByteRing::WriteAt(size_t offset, const void* data, size_t length) {
+  if (offset + length > space())
+    return false;
+  CopyIn((head_ + size_ + offset) % capacity_, data, length);
+  return true;
+}
+
+void ByteRing::Commit(size_t length) {
+  RTC_DCHECK_LE(length, space());
+  size_ += length;
+}
+
+void ByteRing::ReadAt(size_t offset, void* data, size_t length) const {
+  RTC_DCHECK_LE(offset + length, size_);
+  const size_t position = (head_ + offset) % capacity_;
+  const size_t first = std::min(length, capacity_ - position);
+  memcpy(data, &buffer_[position], first);
+  memcpy(static_cast<char*>(data) + first, &buffer_[0], length - first);
+}
+
+const char* ByteRing::Peek(size_t* length) const {
+  *length = std::min(size_, capacity_ - head_);
+  return *length > 0 ? &buffer_[head_] : nullptr;
+}
+
+void ByteRing::Consume(size_t length) {
+  RTC_DCHECK_LE(length, size_);
+  head_ = (head_ + length) % capacity_;
+  size_ -= length;
+}
+
+void ByteRing::CopyIn(size_t position, const void* data, size_t length) {
+  const size_t first = std::min(length, capacity_ - position);
+  memcpy(&buffer_[position], data, first);
+  memcpy(&buffer_[0], static_cast<const char*>(data) + first, length - first);
+}
+
+SackTcp::SendSegment::SendSegment(uint32_t seq, uint32_t len, bool ctrl)
+    : seq(seq), len(len), ctrl(ctrl) {}
+
+// static
+uint32_t SackTcp::Now() {
+  return rtc::Time32();
+}
+
+SackTcp::SackTcp(SackTcpNotify* notify, uint32_t conv, const Config& config)
+    : notify_(notify),
+      conv_(conv),
+      config_(config),
+      max_packet_size_(std::min(
+          std::max(config.max_packet_size, kMinPacketSize), kMaxPacketSize)),
+      packet_(new uint8_t[kMaxPacketSize]),
+      rbuf_(config.receive_buffer_size),
+      sbuf_(config.send_buffer_size),
+      rto_(kDefaultRto),
+      cwnd_(kInitialWindowSegments * mss()),
+      ssthresh_(0xFFFFFFFF) {
+  // Until the peer's first segment tells its window, only the connect
+  // segment goes out.
+  snd_wnd_ = 1;
+  last_window_ = ReceiveWindow();
+}
+
+SackTcp::~SackTcp() {}
+
+int SackTcp::Connect() {
+  if (state_ != TCP_LISTEN) {
+    error_ = EINVAL;
+    return -1;
+  }
+  state_ = TCP_SYN_SENT;
+  QueueConnect();
+  AttemptSend(SF_NONE);
+  return 0;
+}
+
+int SackTcp::Recv(char* buffer, size_t len) {
+  if (state_ != TCP_ESTABLISHED) {
+    error_ = ENOTCONN;
+    return -1;
+  }
+  if (rbuf_.size() == 0) {
+    read_enable_ = true;
+    error_ = EWOULDBLOCK;
+    return -1;
+  }
+  const size_t read = std::min(len, rbuf_.size());
+  rbuf_.ReadAt(0, buffer, read);
+  ConsumeReadData(read);
+  return static_cast<int>(read);
+}
+
+const char* SackTcp::GetReadData(size_t* len) {
+  const char* data = nullptr;
+  *len = 0;
+  if (state_ == TCP_ESTABLISHED)
+    data = rbuf_.Peek(len);
+  if (!data)
+    read_enable_ = true;
+  return data;
+}
+
+void SackTcp::ConsumeReadData(size_t len) {
+  rbuf_.Consume(len);
+  // Tell the sender about the room once it is worth a segment, as
+  // PseudoTcp::Recv() does.
+  const uint32_t window = ReceiveWindow();
+  if (window > last_window_ &&
+      window - last_window_ >=
+          std::min<uint32_t>(rbuf_.capacity() / 2, mss())) {
+    AttemptSend(SF_IMMEDIATE_ACK);
+  }
+}
+
+int SackTcp::Send(const char* buffer, size_t len) {
+  if (state_ != TCP_ESTABLISHED) {
+    error_ = ENOTCONN;
+    return -1;
+  }
+  const size_t written = sbuf_.Write(buffer, len);
+  if (written < len)
+    write_enable_ = true;
+  if (written == 0) {
+    error_ = EWOULDBLOCK;
+    return -1;
+  }
+  AttemptSend(SF_NONE);
+  return static_cast<int>(written);
+}
+
+void SackTcp::Close(bool force) {
+  if (force && state_ != TCP_CLOSED)
+    WritePacket(snd_max_, kFlagRst, 0, 0);
+  shutdown_ = force ? SD_FORCEFUL : SD_GRACEFUL;
+}
+
+void SackTcp::NotifyMTU(uint16_t mtu) {
+  // Leave room for the IPv4 and UDP headers; an MTU that cannot even hold
+  // them is bogus and ignored.
+  if (mtu <= kIpUdpHeaderSize)
+    return;
+  max_packet_size_ = std::min(
+      std::max<size_t>(kMinPacketSize, mtu - kIpUdpHeaderSize),
+      kMaxPacketSize);
+}
+
+void SackTcp::NotifyClock(uint32_t now) {
+  if (state_ == TCP_CLOSED)
+    return;
+
+  if (snd_max_ != snd_una_ &&
+      rtc::TimeDiff32(now, rto_base_) >= static_cast<int32_t>(rto_)) {
+    if (segments_.front().xmit >= kMaxRetransmits) {
+      Closedown(ECONNABORTED);
+      return;
+    }
+    OnTimeout(now);
+    AttemptSend(SF_NONE);
+  }
+
+  // The window update that reopens a zero window may be lost.
+  if (snd_wnd_ == 0 && snd_max_ == snd_una_ && sbuf_.size() > 0 &&
+      rtc::TimeDiff32(now, last_send_) >= static_cast<int32_t>(rto_)) {
+    WritePacket(snd_max_, kFlagProbe, 0, 0);
+  }
+
+  if (t_ack_ != 0 && rtc::TimeDiff32(now, t_ack_) >=
+                         static_cast<int32_t>(config_.ack_delay_ms)) {
+    WritePacket(snd_max_, 0, 0, 0);
+  }
+}
+
+bool SackTcp::NotifyPacket(const char* buffer, size_t len) {
+  if (len < kHeaderSize)
+    return false;
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(buffer);
+  Header header;
+  header.conv = rtc::GetBE32(bytes);
+  header.seq = rtc::GetBE32(bytes + 4);
+  header.ack = rtc::GetBE32(bytes + 8);
+  header.flags = bytes[12];
+  header.sack_count = bytes[13];
+  header.wnd = rtc::GetBE32(bytes + 16);
+  header.tsval = rtc::GetBE32(bytes + 20);
+  header.tsecr = rtc::GetBE32(bytes + 24);
+  if (header.sack_count > kMaxSackBlocks)
+    return false;
+  const size_t header_size = kHeaderSize + header.sack_count * kSackBlockSize;
+  if (len < header_size)
+    return false;
+  for (size_t i = 0; i < header.sack_count; ++i) {
+    const uint8_t* block = bytes + kHeaderSize + i * kSackBlockSize;
+    header.sack[i].start = rtc::GetBE32(block);
+    header.sack[i].end = rtc::GetBE32(block + 4);
+  }
+  return Process(header, buffer + header_size,
+                 static_cast<uint32_t>(len - header_size));
+}
+
+bool SackTcp::GetNextClock(uint32_t now, long& timeout) {
+  if (shutdown_ == SD_FORCEFUL)
+    return false;
+  if (shutdown_ == SD_GRACEFUL &&
+      (state_ != TCP_ESTABLISHED || (sbuf_.size() == 0 && t_ack_ == 0))) {
+    return false;
+  }
+  if (state_ == TCP_CLOSED) {
+    timeout = kClosedTimeout;
+    return true;
+  }
+
+  timeout = kDefaultTimeout;
+  if (t_ack_ != 0) {
+    timeout = std::min<long>(
+        timeout, rtc::TimeDiff32(t_ack_ + config_.ack_delay_ms, now));
+  }
+  if (snd_max_ != snd_una_) {
+    timeout = std::min<long>(
+        timeout, rtc::TimeDiff32(rto_base_ + rto_, now));
+  } else if (snd_wnd_ == 0 && sbuf_.size() > 0) {
+    timeout = std::min<long>(
+        timeout, rtc::TimeDiff32(last_send_ + rto_, now));
+  }
+  timeout = std::max<long>(timeout, 0);
+  return true;
+}
+
+SackTcp::Stats SackTcp::GetStats() const {
+  Stats stats = stats_;
+  stats.congestion_window = cwnd_;
+  stats.slow_start_threshold = ssthresh_;
+  stats.bytes_in_flight = in_flight_;
+  stats.srtt_ms = srtt_;
+  stats.rto_ms = rto_;
+  return stats;
+}
+
+void SackTcp::QueueConnect() {
+  sbuf_.Write(&kCtlConnect, 1);
+  connect_pending_ = true;
+}
+
+SackTcpNotify::WriteResult SackTcp::WritePacket(uint32_t seq,
+                                                uint8_t flags,
+                                                uint32_t offset,
+                                                uint32_t len) {
+  RTC_DCHECK_LE(len, mss());
+  const uint32_t now = Now();
+  uint8_t* packet = packet_.get();
+  rtc::SetBE32(packet, conv_);
+  rtc::SetBE32(packet + 4, seq);
+  rtc::SetBE32(packet + 8, rcv_nxt_);
+  packet[12] = flags;
+  packet[14] = 0;
+  packet[15] = 0;
+  const uint32_t window = ReceiveWindow();
+  rtc::SetBE32(packet + 16, window);
+  rtc::SetBE32(packet + 20, now);
+  rtc::SetBE32(packet + 24, ts_recent_);
+
+  // The range that changed last goes first, as RFC 2018 asks, then the
+  // lowest ones, which hold the sender's oldest holes.
+  size_t blocks = 0;
+  uint8_t* block = packet + kHeaderSize;
+  for (size_t i = 0; i < ranges_.size() + 1 && blocks < kMaxSackBlocks; ++i) {
+    size_t index = i == 0 ? latest_range_ : i - 1;
+    if (index >= ranges_.size() || (i > 0 && index == latest_range_))
+      continue;
+    rtc::SetBE32(block, ranges_[index].start);
+    rtc::SetBE32(block + 4, ranges_[index].end);
+    block += kSackBlockSize;
+    ++blocks;
+  }
+  packet[13] = static_cast<uint8_t>(blocks);
+
+  if (len > 0)
+    sbuf_.ReadAt(offset, block, len);
+  const SackTcpNotify::WriteResult result =
+      notify_->TcpWritePacket(this, reinterpret_cast<const char*>(packet),
+                              (block - packet) + len);
+  // A failed send is as good as lost in the network, except for one that
+  // does not fit.
+  if (result != SackTcpNotify::WR_TOO_LARGE) {
+    last_send_ = now;
+    last_window_ = window;
+    t_ack_ = 0;
+    unacked_segments_ = 0;
+  }
+  return result;
+}
+
+SackTcpNotify::WriteResult SackTcp::Transmit(size_t index) {
+  SackTcpNotify::WriteResult result;
+  while (true) {
+    SendSegment& seg = segments_[index];
+    if (seg.len > mss()) {
+      if (index + 1 == segments_.size() && seg.xmit == 0) {
+        // Never sent; the rest stays queued in |sbuf_|.
+        snd_max_ = seg.seq + mss();
+        seg.len = mss();
+      } else {
+        SendSegment rest = seg;
+        rest.seq = seg.seq + mss();
+        rest.len = seg.len - mss();
+        rest.lost = true;
+        seg.len = mss();
+        ++lost_count_;
+        if (index < scan_hint_)
+          ++scan_hint_;
+        segments_.insert(segments_.begin() + index + 1, rest);
+      }
+    }
+    const SendSegment& current = segments_[index];
+    result = WritePacket(current.seq, current.ctrl ? kFlagCtl : 0,
+                         current.seq - snd_una_, current.len);
+    if (result != SackTcpNotify::WR_TOO_LARGE)
+      break;
+    if (max_packet_size_ <= kMinPacketSize)
+      return result;
+    max_packet_size_ = std::max(kMinPacketSize, max_packet_size_ * 3 / 4);
+  }
+
+  SendSegment& seg = segments_[index];
+  if (seg.lost) {
+    seg.lost = false;
+    --lost_count_;
+  }
+  if (seg.xmit > 0) {
+    ++stats_.segments_retransmitted;
+    retransmitted_.push_back(seg.seq);
+  }
+  in_flight_ += seg.len;
+  ++seg.xmit;
+  seg.xmit_order = next_xmit_order_++;
+  ++stats_.segments_sent;
+  return result;
+}
+
+void SackTcp::AttemptSend(SendFlags flags) {
+  const uint32_t now = Now();
+  const uint64_t sent_before = stats_.segments_sent;
+
+  // Repairs first; they are already inside the peer's window.
+  for (size_t i = lost_hint_; i < segments_.size() && lost_count_ > 0; ++i) {
+    lost_hint_ = i;
+    if (!segments_[i].lost)
+      continue;
+    const uint32_t len = std::min(segments_[i].len, mss());
+    if (in_flight_ > 0 && in_flight_ + len > cwnd_)
+      break;
+    if (Transmit(i) != SackTcpNotify::WR_SUCCESS)
+      return;
+  }
+
+  while (true) {
+    const uint32_t unsent = static_cast<uint32_t>(sbuf_.size()) -
+                            (snd_max_ - snd_una_);
+    if (unsent == 0)
+      break;
+    const bool ctrl = connect_pending_;
+    uint32_t len = 1;
+    if (!ctrl) {
+      if (state_ != TCP_ESTABLISHED)
+        break;
+      const uint32_t window_end = snd_una_ + snd_wnd_;
+      const uint32_t window_room =
+          SeqLess(snd_max_, window_end) ? window_end - snd_max_ : 0;
+      const uint32_t cwnd_room = cwnd_ > in_flight_ ? cwnd_ - in_flight_ : 0;
+      len = std::min(std::min(unsent, mss()), std::min(window_room, cwnd_room));
+      if (len == 0)
+        break;
+      // Wait for room for a full segment rather than send a runt.
+      if (len < mss() && len < unsent && in_flight_ > 0)
+        break;
+      // Nagle's algorithm.
+      if (len < mss() && !config_.no_delay && snd_max_ != snd_una_)
+        break;
+    }
+    if (snd_max_ == snd_una_)
+      rto_base_ = now;
+    segments_.push_back(SendSegment(snd_max_, len, ctrl));
+    snd_max_ += len;
+    const SackTcpNotify::WriteResult result = Transmit(segments_.size() - 1);
+    if (result == SackTcpNotify::WR_TOO_LARGE) {
+      snd_max_ = segments_.back().seq;
+      segments_.pop_back();
+      break;
+    }
+    connect_pending_ = false;
+    if (result == SackTcpNotify::WR_FAIL)
+      break;
+  }
+
+  if (stats_.segments_sent != sent_before)
+    return;
+  if (flags == SF_IMMEDIATE_ACK) {
+    WritePacket(snd_max_, 0, 0, 0);
+  } else if (flags == SF_DELAYED_ACK) {
+    // Every second full segment, or after the delay.
+    if (config_.ack_delay_ms == 0 || ++unacked_segments_ >= 2)
+      WritePacket(snd_max_, 0, 0, 0);
+    else if (t_ack_ == 0)
+      t_ack_ = now;
+  }
+}
+
+void SackTcp::Closedown(uint32_t error) {
+  shutdown_ = SD_FORCEFUL;
+  state_ = TCP_CLOSED;
+  notify_->OnTcpClosed(this, error);
+}
+
+bool SackTcp::Process(const Header& header, const char* data, uint32_t len) {
+  if (header.conv != conv_ || state_ == TCP_CLOSED)
+    return false;
+  if (header.flags & kFlagRst) {
+    Closedown(ECONNRESET);
+    return false;
+  }
+
+  const uint32_t now = Now();
+  bool opened = false;
+  SendFlags flags = (header.flags & kFlagProbe) ? SF_IMMEDIATE_ACK : SF_NONE;
+
+  if (SeqLessOrEqual(header.seq, rcv_nxt_))
+    ts_recent_ = header.tsval;
+
+  if (header.flags & kFlagCtl) {
+    if (header.seq != 0 || len != 1 || data[0] != kCtlConnect)
+      return false;
+    if (!connect_received_) {
+      connect_received_ = true;
+      rcv_nxt_ = 1;
+      if (state_ == TCP_LISTEN) {
+        state_ = TCP_SYN_RECEIVED;
+        QueueConnect();
+      } else if (state_ == TCP_SYN_SENT) {
+        state_ = TCP_ESTABLISHED;
+        opened = true;
+      }
+    }
+    flags = SF_IMMEDIATE_ACK;
+    len = 0;
+  }
+
+  ProcessAck(header, now);
+  if (state_ == TCP_SYN_RECEIVED && snd_una_ != 0) {
+    state_ = TCP_ESTABLISHED;
+    opened = true;
+  }
+
+  // Data only follows the connect segments.
+  if (len > 0 && connect_received_)
+    ProcessData(header.seq, data, len, &flags);
+
+  AttemptSend(flags);
+
+  if (opened)
+    notify_->OnTcpOpen(this);
+  if (state_ == TCP_ESTABLISHED && read_enable_ && rbuf_.size() > 0) {
+    read_enable_ = false;
+    notify_->OnTcpReadable(this);
+  }
+  if (state_ == TCP_ESTABLISHED && write_enable_ &&
+      sbuf_.size() < sbuf_.capacity() / 2) {
+    write_enable_ = false;
+    notify_->OnTcpWriteable(this);
+  }
+  return true;
+}
+
+void SackTcp::ProcessAck(const Header& header, uint32_t now) {
+  const uint32_t ack = header.ack;
+  if (SeqLess(ack, snd_una_) || SeqLess(snd_max_, ack))
+    return;
+  snd_wnd_ = header.wnd;
+
+  uint32_t delivered = 0;
+  const uint64_t delivered_order = delivered_order_;
+  if (ack != snd_una_) {
+    size_t popped = 0;
+    while (!segments_.empty()) {
+      SendSegment& seg = segments_.front();
+      if (SeqLessOrEqual(ack, seg.seq))
+        break;
+      const uint32_t acked =
+          SeqLessOrEqual(seg.seq + seg.len, ack) ? seg.len : ack - seg.seq;
+      if (!seg.sacked) {
+        delivered += acked;
+        delivered_order_ = std::max(delivered_order_, seg.xmit_order);
+      }
+      if (InFlight(seg))
+        in_flight_ -= acked;
+      if (acked < seg.len) {
+        seg.seq += acked;
+        seg.len -= acked;
+        break;
+      }
+      if (seg.lost)
+        --lost_count_;
+      segments_.pop_front();
+      ++popped;
+    }
+    sbuf_.Consume(ack - snd_una_);
+    snd_una_ = ack;
+    rto_base_ = now;
+    scan_hint_ -= std::min(popped, scan_hint_);
+    lost_hint_ -= std::min(popped, lost_hint_);
+    if (in_recovery_ && SeqLessOrEqual(recover_, snd_una_))
+      in_recovery_ = false;
+    if (rto_recovery_ && SeqLessOrEqual(recover_, snd_una_))
+      rto_recovery_ = false;
+  }
+
+  for (size_t i = 0; i < header.sack_count; ++i)
+    delivered += SackRange(header.sack[i].start, header.sack[i].end);
+  // Retransmissions may fill holes in the middle of a block, which the
+  // scans from the block edges above do not reach.
+  for (size_t i = 0; i < retransmitted_.size();) {
+    const size_t index = FindSegment(retransmitted_[i]);
+    if (index == segments_.size() || !InFlight(segments_[index])) {
+      retransmitted_[i] = retransmitted_.back();
+      retransmitted_.pop_back();
+      continue;
+    }
+    const SendSegment& seg = segments_[index];
+    for (size_t j = 0; j < header.sack_count; ++j) {
+      if (SeqLessOrEqual(header.sack[j].start, seg.seq) &&
+          SeqLessOrEqual(seg.seq + seg.len, header.sack[j].end)) {
+        delivered += Sack(index);
+        break;
+      }
+    }
+    ++i;
+  }
+
+  if (delivered == 0)
+    return;
+  if (header.tsecr != 0)
+    UpdateRtt(now - header.tsecr);
+  if (delivered_order_ != delivered_order)
+    MarkLost();
+  GrowWindow(delivered, now);
+}
+
+uint32_t SackTcp::SackRange(uint32_t start, uint32_t end) {
+  if (SeqLess(start, snd_una_))
+    start = snd_una_;
+  if (SeqLess(snd_max_, end))
+    end = snd_max_;
+  if (SeqLessOrEqual(end, start))
+    return 0;
+  // Segments wholly inside the block. The block grows at its edges, so
+  // stop at the first one already marked from either side.
+  size_t first = FindSegment(start);
+  if (segments_[first].seq != start)
+    ++first;
+  size_t last = FindSegment(end - 1);
+  if (segments_[last].seq + segments_[last].len != end) {
+    if (last == 0)
+      return 0;
+    --last;
+  }
+  uint32_t delivered = 0;
+  size_t i = first;
+  for (; i <= last && !segments_[i].sacked; ++i)
+    delivered += Sack(i);
+  for (size_t j = last; j > i && !segments_[j].sacked; --j)
+    delivered += Sack(j);
+  return delivered;
+}
+
+uint32_t SackTcp::Sack(size_t index) {
+  SendSegment& seg = segments_[index];
+  if (seg.sacked)
+    return 0;
+  if (InFlight(seg))
+    in_flight_ -= seg.len;
+  if (seg.lost) {
+    seg.lost = false;
+    --lost_count_;
+  }
+  seg.sacked = true;
+  delivered_order_ = std::max(delivered_order_, seg.xmit_order);
+  return seg.len;
+}
+
+size_t SackTcp::FindSegment(uint32_t seq) const {
+  if (SeqLess(seq, snd_una_) || SeqLessOrEqual(snd_max_, seq))
+    return segments_.size();
+  const uint32_t offset = seq - snd_una_;
+  auto it = std::upper_bound(segments_.begin(), segments_.end(), offset,
+                             [this](uint32_t offset, const SendSegment& seg) {
+                               return offset < seg.seq - snd_una_;
+                             });
+  return (it - segments_.begin()) - 1;
+}
+
+bool SackTcp::InFlight(const SendSegment& seg) const {
+  return seg.xmit > 0 && !seg.sacked && !seg.lost;
+}
+
+void SackTcp::MarkLost() {
+  const uint32_t lost_before = lost_count_;
+  auto delivered_after = [this](const SendSegment& seg) {
+    return seg.xmit_order + kReorderThreshold <= delivered_order_;
+  };
+
+  for (uint32_t seq : retransmitted_) {
+    SendSegment& seg = segments_[FindSegment(seq)];
+    if (InFlight(seg) && delivered_after(seg)) {
+      in_flight_ -= seg.len;
+      seg.lost = true;
+      ++lost_count_;
+    }
+  }
+
+  // First transmissions go out in sequence order, so the scan can stop at
+  // the first one that is still too recent.
+  for (; scan_hint_ < segments_.size(); ++scan_hint_) {
+    SendSegment& seg = segments_[scan_hint_];
+    if (seg.sacked || seg.lost || seg.xmit > 1)
+      continue;
+    if (seg.xmit == 0 || !delivered_after(seg))
+      break;
+    in_flight_ -= seg.len;
+    seg.lost = true;
+    ++lost_count_;
+  }
+
+  if (lost_count_ > lost_before) {
+    lost_hint_ = 0;
+    OnLossEvent();
+  }
+}
+
+void SackTcp::OnLossEvent() {
+  if (in_recovery_ || rto_recovery_)
+    return;
+  in_recovery_ = true;
+  recover_ = snd_max_;
+  ++stats_.loss_recoveries;
+  // Fast convergence.
+  if (cwnd_ < w_max_)
+    w_max_ = cwnd_ * (1 + kCubicBeta) / 2;
+  else
+    w_max_ = cwnd_;
+  cwnd_ = std::max(static_cast<uint32_t>(cwnd_ * kCubicBeta), 2 * mss());
+  ssthresh_ = cwnd_;
+  epoch_start_ = 0;
+}
+
+void SackTcp::OnTimeout(uint32_t now) {
+  ++stats_.timeouts;
+  ssthresh_ = std::max(in_flight_ / 2, 2 * mss());
+  w_max_ = cwnd_;
+  cwnd_ = mss();
+  epoch_start_ = 0;
+  in_recovery_ = false;
+  rto_recovery_ = true;
+  recover_ = snd_max_;
+
+  // Everything outstanding is resent; the SACKed segments are kept, as the
+  // receiver does not renege.
+  for (SendSegment& seg : segments_) {
+    if (InFlight(seg)) {
+      seg.lost = true;
+      ++lost_count_;
+    }
+  }
+  in_flight_ = 0;
+  lost_hint_ = 0;
+  scan_hint_ = segments_.size();
+  retransmitted_.clear();
+  rto_ = std::min(rto_ * 2, kMaxRto);
+  rto_base_ = now;
+}
+
+void SackTcp::GrowWindow(uint32_t acked, uint32_t now) {
+  if (in_recovery_)
+    return;
+  // Only grow a window that is in use (RFC 7661).
+  if (in_flight_ + acked < cwnd_ / 2)
+    return;
+  const uint32_t max_cwnd = static_cast<uint32_t>(sbuf_.capacity());
+
+  if (cwnd_ < ssthresh_) {
+    // Appropriate byte counting, L = 2 (RFC 3465).
+    cwnd_ = std::min(cwnd_ + std::min(acked, 2 * mss()), max_cwnd);
+    return;
+  }
+
+  const double segment = mss();
+  if (epoch_start_ == 0) {
+    epoch_start_ = now | 1;
+    if (cwnd_ < w_max_) {
+      k_ = cbrt((w_max_ - cwnd_) / segment / kCubicC);
+    } else {
+      k_ = 0;
+      w_max_ = cwnd_;
+    }
+    w_est_ = cwnd_;
+  }
+  // W_cubic(t + RTT), in bytes, with t in seconds.
+  const double t = (rtc::TimeDiff32(now, epoch_start_) + srtt_) / 1000.0;
+  double target = w_max_ + kCubicC * (t - k_) * (t - k_) * (t - k_) * segment;
+  // The window standard TCP would have (RFC 8312 section 4.2).
+  w_est_ += 3 * (1 - kCubicBeta) / (1 + kCubicBeta) * acked * segment / cwnd_;
+  target = std::max(target, w_est_);
+  target = std::min(target, 1.5 * cwnd_);
+  if (target > cwnd_) {
+    const double increase = (target - cwnd_) * acked / cwnd_;
+    cwnd_ = std::min(cwnd_ + static_cast<uint32_t>(increase), max_cwnd);
+  }
+}
+
+void SackTcp::UpdateRtt(uint32_t rtt) {
+  rtt = std::max<uint32_t>(rtt, 1);
+  if (srtt_ == 0) {
+    srtt_ = rtt;
+    rttvar_ = rtt / 2;
+  } else {
+    const uint32_t delta = rtt > srtt_ ? rtt - srtt_ : srtt_ - rtt;
+    rttvar_ = (3 * rttvar_ + delta) / 4;
+    srtt_ = (7 * srtt_ + rtt) / 8;
+  }
+  rto_ = std::min(std::max(srtt_ + std::max<uint32_t>(4 * rttvar_, 1),
+                           kMinRto),
+                  kMaxRto);
+}
+
+void SackTcp::ProcessData(uint32_t seq,
+                          const char* data,
+                          uint32_t len,
+                          SendFlags* flags) {
+  // Already have it all; the peer missed an ACK.
+  if (SeqLessOrEqual(seq + len, rcv_nxt_)) {
+    *flags = SF_IMMEDIATE_ACK;
+    return;
+  }
+  if (SeqLess(seq, rcv_nxt_)) {
+    data += rcv_nxt_ - seq;
+    len -= rcv_nxt_ - seq;
+    seq = rcv_nxt_;
+  }
+  const uint32_t offset = seq - rcv_nxt_;
+  const size_t space = rbuf_.space();
+  if (offset >= space) {
+    // Outside the window, such as a window probe.
+    *flags = SF_IMMEDIATE_ACK;
+    return;
+  }
+  len = std::min<uint32_t>(len, static_cast<uint32_t>(space - offset));
+
+  if (seq != rcv_nxt_) {
+    // Out of order: hold it and tell the sender at once (RFC 5681).
+    if (AddReceivedRange(seq, seq + len))
+      rbuf_.WriteAt(offset, data, len);
+    *flags = SF_IMMEDIATE_ACK;
+    return;
+  }
+
+  rbuf_.WriteAt(0, data, len);
+  uint32_t end = seq + len;
+  size_t merged = 0;
+  while (merged < ranges_.size() &&
+         SeqLessOrEqual(ranges_[merged].start, end)) {
+    if (SeqLess(end, ranges_[merged].end))
+      end = ranges_[merged].end;
+    ++merged;
+  }
+  ranges_.erase(ranges_.begin(), ranges_.begin() + merged);
+  latest_range_ = 0;
+  rbuf_.Commit(end - rcv_nxt_);
+  rcv_nxt_ = end;
+  // Filling a hole is acknowledged at once as well.
+  if (merged > 0)
+    *flags = SF_IMMEDIATE_ACK;
+  else if (*flags == SF_NONE)
+    *flags = SF_DELAYED_ACK;
+}
+
+bool SackTcp::AddReceivedRange(uint32_t start, uint32_t end) {
+  // First range ending at or after |start|.
+  size_t first = 0;
+  while (first < ranges_.size() && SeqLess(ranges_[first].end, start))
+    ++first;
+  size_t last = first;
+  while (last < ranges_.size() && SeqLessOrEqual(ranges_[last].start, end))
+    ++last;
+  if (first == last) {
+    if (ranges_.size() >= kMaxRanges)
+      return false;
+    ranges_.insert(ranges_.begin() + first, Range{start, end});
+  } else {
+    Range& range = ranges_[first];
+    if (SeqLess(start, range.start))
+      range.start = start;
+    range.end = SeqLess(end, ranges_[last - 1].end) ? ranges_[last - 1].end
+                                                     : end;
+    ranges_.erase(ranges_.begin() + first + 1, ranges_.begin() + last);
+  }
+  latest_range_ = first;
+  return true;
+}
+
+uint32_t SackTcp::ReceiveWindow() const {
+  return static_cast<uint32_t>(
+      std::min<size_t>(rbuf_.space(), 0xFFFFFFFF));
+}
+
+uint32_t SackTcp::mss() const {
+  return static_cast<uint32_t>(max_packet_size_ - kMaxHeaderSize);
+}
+
+}  // namespace simple_app
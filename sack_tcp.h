@@ -0,0 +1,284 @@
+#ifndef SACK_TCP_H_
+#define SACK_TCP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "rtc_base/constructormagic.h"
+
+namespace simple_app {
+
+class SackTcp;
+
+// Same callbacks as cricket::IPseudoTcpNotify.
+class SackTcpNotify {
+ public:
+  virtual void OnTcpOpen(SackTcp* tcp) = 0;
+  virtual void OnTcpReadable(SackTcp* tcp) = 0;
+  virtual void OnTcpWriteable(SackTcp* tcp) = 0;
+  virtual void OnTcpClosed(SackTcp* tcp, uint32_t error) = 0;
+
+  enum WriteResult { WR_SUCCESS, WR_TOO_LARGE, WR_FAIL };
+  virtual WriteResult TcpWritePacket(SackTcp* tcp,
+                                     const char* buffer,
+                                     size_t len) = 0;
+
+ protected:
+  virtual ~SackTcpNotify() {}
+};
+
+// Fixed size byte ring. Bytes can also be written past the end and
+// committed later, which is how out of order segments are reassembled.
+class ByteRing {
+ public:
+  explicit ByteRing(size_t capacity);
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  size_t space() const { return capacity_ - size_; }
+
+  // Appends up to |length| bytes and returns how many fit.
+  size_t Write(const void* data, size_t length);
+  // Writes |length| bytes |offset| bytes past the end, without appending
+  // them. Returns false if they do not fit.
+  bool WriteAt(size_t offset, const void* data, size_t length);
+  // Appends the first |length| bytes past the end.
+  void Commit(size_t length);
+  // Copies |length| bytes from |offset| bytes into the ring.
+  void ReadAt(size_t offset, void* data, size_t length) const;
+  // The contiguous bytes at the front; the rest follow after Consume().
+  const char* Peek(size_t* length) const;
+  void Consume(size_t length);
+
+ private:
+  void CopyIn(size_t position, const void* data, size_t length);
+
+  std::unique_ptr<char[]> buffer_;
+  const size_t capacity_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(ByteRing);
+};
+
+// Reliable byte stream over a datagram transport, driven the same way as
+// cricket::PseudoTcp: feed it packets with NotifyPacket(), call NotifyClock()
+// when GetNextClock() says, and it writes packets through the notify
+// interface. It is not wire compatible with PseudoTcp; both ends must use
+// it.
+//
+// PseudoTcp's throughput collapses on lossy, long paths: it acknowledges
+// cumulatively only, so one loss per window costs a round trip of fast
+// recovery or a timeout; its send queue is a std::list; and its windows top
+// out at a few hundred kilobytes. SackTcp instead has
+//  - selective acknowledgements (RFC 2018), up to four blocks a segment,
+//    with a segment counted lost once three segments sent after it have
+//    been delivered, so losses, retransmissions lost again included, are
+//    repaired in a round trip without waiting for the timer;
+//  - send and receive queues in ByteRings sized up front, with segment
+//    records in a deque, and Peek()/Consume() to read without copying;
+//  - 32 bit windows, so a window is as large as the receive buffer;
+//  - CUBIC congestion control (RFC 8312), with its TCP-friendly region;
+//  - timestamps on every segment for RTT samples (RFC 7323) and the RFC
+//    6298 retransmission timer.
+// Single threaded.
+class SackTcp {
+ public:
+  struct Config {
+    size_t send_buffer_size = 4 * 1024 * 1024;
+    size_t receive_buffer_size = 4 * 1024 * 1024;
+    // Largest packet handed to TcpWritePacket(), headers included.
+    size_t max_packet_size = 1200;
+    // Disables Nagle's algorithm, as PseudoTcp's OPT_NODELAY.
+    bool no_delay = false;
+    // Delayed ACK timeout; 0 acknowledges every segment at once.
+    uint32_t ack_delay_ms = 100;
+  };
+
+  struct Stats {
+    uint32_t congestion_window = 0;
+    uint32_t slow_start_threshold = 0;
+    uint32_t bytes_in_flight = 0;
+    uint32_t srtt_ms = 0;
+    uint32_t rto_ms = 0;
+    uint64_t segments_sent = 0;
+    uint64_t segments_retransmitted = 0;
+    // Window reductions for losses found through SACK.
+    uint64_t loss_recoveries = 0;
+    uint64_t timeouts = 0;
+  };
+
+  enum TcpState {
+    TCP_LISTEN,
+    TCP_SYN_SENT,
+    TCP_SYN_RECEIVED,
+    TCP_ESTABLISHED,
+    TCP_CLOSED
+  };
+
+  static uint32_t Now();
+
+  SackTcp(SackTcpNotify* notify, uint32_t conv, const Config& config);
+  ~SackTcp();
+
+  // As the PseudoTcp methods of the same names: these return -1 and set
+  // GetError() to EWOULDBLOCK, ENOTCONN or EINVAL on failure.
+  int Connect();
+  int Recv(char* buffer, size_t len);
+  int Send(const char* buffer, size_t len);
+  void Close(bool force);
+  int GetError() const { return error_; }
+  TcpState State() const { return state_; }
+
+  // Received data without copying: up to |*len| contiguous bytes, or null
+  // if there are none. Call ConsumeReadData() with what was used.
+  const char* GetReadData(size_t* len);
+  void ConsumeReadData(size_t len);
+
+  void NotifyMTU(uint16_t mtu);
+  void NotifyClock(uint32_t now);
+  bool NotifyPacket(const char* buffer, size_t len);
+  bool GetNextClock(uint32_t now, long& timeout);
+
+  Stats GetStats() const;
+
+ private:
+  struct Header;
+  // A stretch of the send queue as last transmitted.
+  struct SendSegment {
+    SendSegment(uint32_t seq, uint32_t len, bool ctrl);
+
+    uint32_t seq;
+    uint32_t len;
+    // Carries the connect control byte.
+    bool ctrl;
+    bool sacked = false;
+    // Counted lost and not yet retransmitted.
+    bool lost = false;
+    uint8_t xmit = 0;
+    // Order of the last transmission, from |next_xmit_order_|.
+    uint64_t xmit_order = 0;
+  };
+  // Out of order data held in the receive ring, [start, end).
+  struct Range {
+    uint32_t start;
+    uint32_t end;
+  };
+  enum Shutdown { SD_NONE, SD_GRACEFUL, SD_FORCEFUL };
+  enum SendFlags { SF_NONE, SF_DELAYED_ACK, SF_IMMEDIATE_ACK };
+
+  void QueueConnect();
+  // Sends a segment of |len| bytes from |offset| into |sbuf_|, or a bare
+  // ACK when |len| is 0.
+  SackTcpNotify::WriteResult WritePacket(uint32_t seq,
+                                         uint8_t flags,
+                                         uint32_t offset,
+                                         uint32_t len);
+  // Sends segments_[index], splitting it if it no longer fits a packet.
+  // WR_FAIL still counts as sent; WR_TOO_LARGE means nothing was.
+  SackTcpNotify::WriteResult Transmit(size_t index);
+  void AttemptSend(SendFlags flags);
+  void Closedown(uint32_t error);
+  bool Process(const Header& header, const char* data, uint32_t len);
+  void ProcessAck(const Header& header, uint32_t now);
+  void ProcessData(uint32_t seq,
+                   const char* data,
+                   uint32_t len,
+                   SendFlags* flags);
+  // Marks the segments wholly inside a SACK block and returns the bytes
+  // newly delivered.
+  uint32_t SackRange(uint32_t start, uint32_t end);
+  uint32_t Sack(size_t index);
+  // Index of the segment holding |seq|, or segments_.size().
+  size_t FindSegment(uint32_t seq) const;
+  bool InFlight(const SendSegment& seg) const;
+  void MarkLost();
+  void OnLossEvent();
+  void OnTimeout(uint32_t now);
+  void GrowWindow(uint32_t acked, uint32_t now);
+  void UpdateRtt(uint32_t rtt);
+  // Returns false if there are too many ranges to track another.
+  bool AddReceivedRange(uint32_t start, uint32_t end);
+  uint32_t ReceiveWindow() const;
+  uint32_t mss() const;
+
+  SackTcpNotify* const notify_;
+  const uint32_t conv_;
+  const Config config_;
+  size_t max_packet_size_;
+  std::unique_ptr<uint8_t[]> packet_;
+  Shutdown shutdown_ = SD_NONE;
+  int error_ = 0;
+  TcpState state_ = TCP_LISTEN;
+  bool read_enable_ = true;
+  bool write_enable_ = false;
+
+  // Receive side.
+  ByteRing rbuf_;
+  bool connect_received_ = false;
+  uint32_t rcv_nxt_ = 0;
+  // Disjoint, sorted out of order ranges above |rcv_nxt_|.
+  std::vector<Range> ranges_;
+  // Index in |ranges_| of the range that changed last, reported first.
+  size_t latest_range_ = 0;
+  uint32_t ts_recent_ = 0;
+  uint32_t last_window_ = 0;
+  // When a delayed ACK started waiting, or 0.
+  uint32_t t_ack_ = 0;
+  uint32_t unacked_segments_ = 0;
+
+  // Send side. |sbuf_| starts at |snd_una_|, and |segments_| covers what
+  // has been transmitted, up to |snd_max_|.
+  ByteRing sbuf_;
+  bool connect_pending_ = false;
+  std::deque<SendSegment> segments_;
+  uint32_t snd_una_ = 0;
+  uint32_t snd_max_ = 0;
+  uint32_t snd_wnd_;
+  // Sent bytes neither acknowledged, SACKed nor counted lost.
+  uint32_t in_flight_ = 0;
+  uint32_t lost_count_ = 0;
+  // No segment below this index is lost.
+  size_t lost_hint_ = 0;
+  // Below this index, first transmissions are all SACKed or lost.
+  size_t scan_hint_ = 0;
+  // Sequence numbers of retransmitted segments that may still be in
+  // flight; MarkLost() checks them apart from the scan.
+  std::vector<uint32_t> retransmitted_;
+  uint64_t next_xmit_order_ = 1;
+  // Highest |xmit_order| acknowledged or SACKed.
+  uint64_t delivered_order_ = 0;
+  uint32_t rto_base_ = 0;
+  uint32_t last_send_ = 0;
+
+  // RTT estimation (RFC 6298).
+  uint32_t srtt_ = 0;
+  uint32_t rttvar_ = 0;
+  uint32_t rto_;
+
+  // Congestion control, in bytes. A loss cuts the window once per window
+  // of data: not again until |snd_una_| passes |recover_|.
+  uint32_t cwnd_;
+  uint32_t ssthresh_;
+  bool in_recovery_ = false;
+  // After a timeout; unlike |in_recovery_|, the window still grows.
+  bool rto_recovery_ = false;
+  uint32_t recover_ = 0;
+  // CUBIC state.
+  double w_max_ = 0;
+  double k_ = 0;
+  uint32_t epoch_start_ = 0;
+  double w_est_ = 0;
+
+  Stats stats_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(SackTcp);
+};
+
+}  // namespace simple_app
+
+#endif  // SACK_TCP_H_
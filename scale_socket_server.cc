@@ -0,0 +1,483 @@
+#include "scale_socket_server.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <utility>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+
+namespace simple_app {
+
+namespace {
+
+const uint16_t kFirstEphemeralPort = 49152;
+const size_t kMaxSparePackets = 4096;
+
+}  // namespace
+
+struct ScaleSocketServer::Packet {
+  int64_t deliver_us = 0;
+  uint64_t sequence = 0;
+  rtc::SocketAddress from;
+  rtc::SocketAddress to;
+  std::vector<char> data;
+};
+
+class ScaleSocketServer::Clock : public rtc::ClockInterface {
+ public:
+  explicit Clock(int64_t nanos) : nanos_(nanos) {}
+
+  int64_t TimeNanos() const override { return nanos_.load(); }
+
+  void AdvanceTo(int64_t nanos) {
+    if (nanos > nanos_.load())
+      nanos_.store(nanos);
+  }
+
+ private:
+  std::atomic<int64_t> nanos_;
+};
+
+class ScaleSocketServer::Socket : public rtc::AsyncSocket {
+ public:
+  Socket(ScaleSocketServer* server, int family)
+      : server_(server), family_(family) {}
+  ~Socket() override { Close(); }
+
+  // rtc::AsyncSocket:
+  rtc::SocketAddress GetLocalAddress() const override {
+    return local_address_;
+  }
+  rtc::SocketAddress GetRemoteAddress() const override {
+    return remote_address_;
+  }
+  int Bind(const rtc::SocketAddress& address) override;
+  int Connect(const rtc::SocketAddress& address) override;
+  int Send(const void* pv, size_t cb) override {
+    if (state_ != CS_CONNECTED) {
+      error_ = ENOTCONN;
+      return -1;
+    }
+    return SendTo(pv, cb, remote_address_);
+  }
+  int SendTo(const void* pv,
+             size_t cb,
+             const rtc::SocketAddress& address) override;
+  int Recv(void* pv, size_t cb, int64_t* timestamp) override {
+    return RecvFrom(pv, cb, nullptr, timestamp);
+  }
+  int RecvFrom(void* pv,
+               size_t cb,
+               rtc::SocketAddress* address,
+               int64_t* timestamp) override;
+  int Listen(int /* backlog */) override {
+    error_ = EOPNOTSUPP;
+    return -1;
+  }
+  rtc::AsyncSocket* Accept(rtc::SocketAddress* /* address */) override {
+    error_ = EOPNOTSUPP;
+    return nullptr;
+  }
+  int Close() override;
+  int GetError() const override { return error_; }
+  void SetError(int error) override { error_ = error; }
+  ConnState GetState() const override { return state_; }
+  int GetOption(Option opt, int* value) override {
+    auto it = options_.find(opt);
+    if (it == options_.end())
+      return -1;
+    *value = it->second;
+    return 0;
+  }
+  int SetOption(Option opt, int value) override {
+    options_[opt] = value;
+    return 0;
+  }
+
+  void Receive(std::unique_ptr<Packet> packet) {
+    received_.push_back(std::move(packet));
+  }
+  size_t pending() const { return received_.size(); }
+
+  // Listed in |readable_|.
+  bool listed = false;
+
+ private:
+  ScaleSocketServer* const server_;
+  const int family_;
+  rtc::SocketAddress local_address_;
+  rtc::SocketAddress remote_address_;
+  bool bound_ = false;
+  ConnState state_ = CS_CLOSED;
+  int error_ = 0;
+  std::deque<std::unique_ptr<Packet>> received_;
+  std::map<Option, int> options_;
+};
+
+int ScaleSocketServer::Socket::Bind(const rtc::SocketAddress& address) {
+  if (bound_) {
+    error_ = EINVAL;
+    return -1;
+  }
+  rtc::SocketAddress local = address;
+  int error = server_->Bind(this, &local);
+  if (error) {
+    error_ = error;
+    return -1;
+  }
+  local_address_ = local;
+  bound_ = true;
+  return 0;
+}
+
+int ScaleSocketServer::Socket::Connect(const rtc::SocketAddress& address) {
+  if (!bound_ && Bind(rtc::SocketAddress(rtc::GetAnyIP(family_), 0)) < 0)
+    return -1;
+  remote_address_ = address;
+  state_ = CS_CONNECTED;
+  return 0;
+}
+
+int ScaleSocketServer::Socket::SendTo(const void* pv,
+                                      size_t cb,
+                                      const rtc::SocketAddress& address) {
+  if (!bound_ && Bind(rtc::SocketAddress(rtc::GetAnyIP(family_), 0)) < 0)
+    return -1;
+  server_->SendPacket(local_address_, address, pv, cb);
+  return static_cast<int>(cb);
+}
+
+int ScaleSocketServer::Socket::RecvFrom(void* pv,
+                                        size_t cb,
+                                        rtc::SocketAddress* address,
+                                        int64_t* timestamp) {
+  if (received_.empty()) {
+    error_ = EWOULDBLOCK;
+    return -1;
+  }
+  std::unique_ptr<Packet> packet = std::move(received_.front());
+  received_.pop_front();
+  // Datagram semantics: what does not fit is lost.
+  size_t size = std::min(cb, packet->data.size());
+  memcpy(pv, packet->data.data(), size);
+  if (address)
+    *address = packet->from;
+  if (timestamp)
+    *timestamp = packet->deliver_us;
+  server_->Recycle(std::move(packet));
+  return static_cast<int>(size);
+}
+
+int ScaleSocketServer::Socket::Close() {
+  listed = false;
+  if (bound_) {
+    server_->Unbind(this);
+    bound_ = false;
+  }
+  while (!received_.empty()) {
+    server_->Recycle(std::move(received_.front()));
+    received_.pop_front();
+  }
+  state_ = CS_CLOSED;
+  return 0;
+}
+
+bool ScaleSocketServer::PacketLater::operator()(
+    const std::unique_ptr<Packet>& a,
+    const std::unique_ptr<Packet>& b) const {
+  if (a->deliver_us != b->deliver_us)
+    return a->deliver_us > b->deliver_us;
+  return a->sequence > b->sequence;
+}
+
+bool ScaleSocketServer::LinkKey::operator==(const LinkKey& other) const {
+  return from == other.from && to == other.to;
+}
+
+size_t ScaleSocketServer::LinkKeyHash::operator()(const LinkKey& key) const {
+  return rtc::HashIP(key.from) * 31 + rtc::HashIP(key.to);
+}
+
+size_t ScaleSocketServer::AddressHash::operator()(
+    const rtc::SocketAddress& address) const {
+  return rtc::HashIP(address.ipaddr()) * 31 + address.port();
+}
+
+size_t ScaleSocketServer::IPHash::operator()(const rtc::IPAddress& ip) const {
+  return rtc::HashIP(ip);
+}
+
+ScaleSocketServer::ScaleSocketServer(const Config& config)
+    : config_(config),
+      start_us_(rtc::TimeMicros()),
+      start_wall_us_(rtc::SystemTimeNanos() / rtc::kNumNanosecsPerMicrosec),
+      wakeup_(false, false),
+      random_(config.seed),
+      uniform_(0.0, 1.0) {
+  RTC_DCHECK_GT(config_.time_step_us, 0);
+  if (config_.time_warp) {
+    // Starts where the current clock is, so delayed messages already
+    // posted keep their deadlines.
+    clock_.reset(new Clock(rtc::TimeNanos()));
+    previous_clock_ = rtc::SetClockForTesting(clock_.get());
+  }
+}
+
+ScaleSocketServer::~ScaleSocketServer() {
+  RTC_DCHECK(bindings_.empty()) << "Sockets must be deleted first.";
+  Stats stats = GetStats();
+  LOG(LS_INFO) << "ScaleSocketServer delivered " << stats.packets_delivered
+               << " of " << stats.packets_sent << " packets in "
+               << stats.simulated_us / 1000 << " ms simulated, "
+               << stats.wall_us / 1000 << " ms wall time: "
+               << static_cast<int64_t>(stats.packets_per_second)
+               << " packets/s.";
+  if (clock_)
+    rtc::SetClockForTesting(previous_clock_);
+}
+
+void ScaleSocketServer::SetLinkProfile(const rtc::IPAddress& from,
+                                       const rtc::IPAddress& to,
+                                       const LinkProfile& profile) {
+  links_[LinkKey{from, to}].profile = profile;
+}
+
+void ScaleSocketServer::SetDefaultRoute(const rtc::IPAddress& address) {
+  if (address.family() == AF_INET)
+    default_route_v4_ = address;
+  else
+    default_route_v6_ = address;
+}
+
+ScaleSocketServer::Stats ScaleSocketServer::GetStats() const {
+  Stats stats = stats_;
+  stats.sockets = bindings_.size();
+  stats.packets_in_flight = in_flight_.size();
+  stats.simulated_us = rtc::TimeMicros() - start_us_;
+  stats.wall_us =
+      rtc::SystemTimeNanos() / rtc::kNumNanosecsPerMicrosec - start_wall_us_;
+  if (stats.wall_us > 0) {
+    stats.packets_per_second =
+        stats.packets_delivered * 1e6 / static_cast<double>(stats.wall_us);
+  }
+  return stats;
+}
+
+rtc::Socket* ScaleSocketServer::CreateSocket(int type) {
+  return CreateSocket(AF_INET, type);
+}
+
+rtc::Socket* ScaleSocketServer::CreateSocket(int family, int type) {
+  return CreateAsyncSocket(family, type);
+}
+
+rtc::AsyncSocket* ScaleSocketServer::CreateAsyncSocket(int type) {
+  return CreateAsyncSocket(AF_INET, type);
+}
+
+rtc::AsyncSocket* ScaleSocketServer::CreateAsyncSocket(int family, int type) {
+  if (type != SOCK_DGRAM) {
+    LOG(LS_WARNING) << "ScaleSocketServer only supports UDP sockets.";
+    return nullptr;
+  }
+  return new Socket(this, family);
+}
+
+bool ScaleSocketServer::Wait(int cms, bool process_io) {
+  if (process_io && DeliverDue())
+    return true;
+  if (cms == 0)
+    return true;
+
+  const int64_t now_us = rtc::TimeMicros();
+  // -1 while there is nothing to wait for but WakeUp().
+  int64_t until_us = cms == kForever ? -1 : now_us + cms * 1000;
+  if (process_io && !in_flight_.empty()) {
+    int64_t next_us = in_flight_.front()->deliver_us;
+    if (until_us < 0 || next_us < until_us)
+      until_us = next_us;
+  }
+
+  if (clock_ && until_us >= 0) {
+    // Skips the idle time, unless another thread has posted meanwhile.
+    if (!wakeup_.Wait(0))
+      clock_->AdvanceTo(until_us * rtc::kNumNanosecsPerMicrosec);
+  } else {
+    int wait_ms = rtc::Event::kForever;
+    if (until_us >= 0)
+      wait_ms = static_cast<int>((until_us - now_us + 999) / 1000);
+    wakeup_.Wait(wait_ms);
+  }
+
+  if (process_io)
+    DeliverDue();
+  return true;
+}
+
+void ScaleSocketServer::WakeUp() {
+  wakeup_.Set();
+}
+
+int ScaleSocketServer::Bind(Socket* socket, rtc::SocketAddress* address) {
+  rtc::IPAddress ip = address->ipaddr();
+  if (rtc::IPIsAny(ip)) {
+    const rtc::IPAddress& route =
+        ip.family() == AF_INET6 ? default_route_v6_ : default_route_v4_;
+    if (!route.IsNil())
+      ip = route;
+  }
+
+  if (address->port() != 0) {
+    rtc::SocketAddress bound(ip, address->port());
+    if (!bindings_.emplace(bound, socket).second)
+      return EADDRINUSE;
+    *address = bound;
+    return 0;
+  }
+
+  auto port = next_ports_.emplace(ip, kFirstEphemeralPort).first;
+  for (int i = 0; i <= 0xFFFF - kFirstEphemeralPort; ++i) {
+    rtc::SocketAddress bound(ip, port->second);
+    port->second = port->second == 0xFFFF ? kFirstEphemeralPort
+                                          : port->second + 1;
+    if (bindings_.emplace(bound, socket).second) {
+      *address = bound;
+      return 0;
+    }
+  }
+  return EADDRINUSE;
+}
+
+void ScaleSocketServer::Unbind(Socket* socket) {
+  auto it = bindings_.find(socket->GetLocalAddress());
+  if (it != bindings_.end() && it->second == socket)
+    bindings_.erase(it);
+}
+
+void ScaleSocketServer::SendPacket(const rtc::SocketAddress& from,
+                                   const rtc::SocketAddress& to,
+                                   const void* data,
+                                   size_t size) {
+  ++stats_.packets_sent;
+  const int64_t now_us = rtc::TimeMicros();
+
+  Link* link = nullptr;
+  LinkKey key{from.ipaddr(), to.ipaddr()};
+  auto it = links_.find(key);
+  if (it != links_.end()) {
+    link = &it->second;
+  } else if (config_.default_link.bandwidth_kbps > 0) {
+    // Only links with a bandwidth limit have state worth keeping.
+    link = &links_[key];
+    link->profile = config_.default_link;
+  }
+  const LinkProfile& profile = link ? link->profile : config_.default_link;
+
+  if (profile.loss > 0 && uniform_(random_) < profile.loss) {
+    ++stats_.dropped_loss;
+    return;
+  }
+
+  int64_t deliver_us = now_us;
+  if (profile.bandwidth_kbps > 0) {
+    int64_t start_us = std::max(now_us, link->busy_until_us);
+    if (start_us - now_us > profile.max_queue_ms * 1000) {
+      ++stats_.dropped_queue;
+      return;
+    }
+    link->busy_until_us =
+        start_us + static_cast<int64_t>(size) * 8 * 1000 /
+                       profile.bandwidth_kbps;
+    deliver_us = link->busy_until_us;
+  }
+  deliver_us += profile.delay_ms * 1000;
+  const int64_t step = config_.time_step_us;
+  deliver_us = (deliver_us + step - 1) / step * step;
+
+  std::unique_ptr<Packet> packet = NewPacket();
+  packet->deliver_us = deliver_us;
+  packet->sequence = next_sequence_++;
+  packet->from = from;
+  packet->to = to;
+  const char* bytes = static_cast<const char*>(data);
+  packet->data.assign(bytes, bytes + size);
+  in_flight_.push_back(std::move(packet));
+  std::push_heap(in_flight_.begin(), in_flight_.end(), PacketLater());
+}
+
+bool ScaleSocketServer::DeliverDue() {
+  const int64_t now_us = rtc::TimeMicros();
+  if (in_flight_.empty() || in_flight_.front()->deliver_us > now_us)
+    return false;
+
+  while (!in_flight_.empty() && in_flight_.front()->deliver_us <= now_us) {
+    std::pop_heap(in_flight_.begin(), in_flight_.end(), PacketLater());
+    std::unique_ptr<Packet> packet = std::move(in_flight_.back());
+    in_flight_.pop_back();
+
+    auto it = bindings_.find(packet->to);
+    if (it == bindings_.end()) {
+      it = bindings_.find(rtc::SocketAddress(
+          rtc::GetAnyIP(packet->to.ipaddr().family()), packet->to.port()));
+    }
+    if (it == bindings_.end()) {
+      ++stats_.dropped_unbound;
+      Recycle(std::move(packet));
+      continue;
+    }
+    Socket* socket = it->second;
+    if (!socket->listed) {
+      socket->listed = true;
+      readable_.push_back(it->first);
+    }
+    ++stats_.packets_delivered;
+    socket->Receive(std::move(packet));
+  }
+
+  // AsyncUDPSocket reads one datagram per read event, so each socket is
+  // signalled until its queue is drained. Handlers may close or delete any
+  // socket, so the binding is looked up again after each event. A reader
+  // that leaves packets queued gets another event with the next delivery.
+  for (size_t i = 0; i < readable_.size(); ++i) {
+    const rtc::SocketAddress address = readable_[i];
+    auto it = bindings_.find(address);
+    if (it == bindings_.end())
+      continue;
+    Socket* socket = it->second;
+    socket->listed = false;
+    size_t pending = socket->pending();
+    while (pending > 0) {
+      socket->SignalReadEvent(socket);
+      it = bindings_.find(address);
+      if (it == bindings_.end() || it->second != socket)
+        break;
+      size_t left = socket->pending();
+      if (left >= pending)
+        break;
+      pending = left;
+    }
+  }
+  readable_.clear();
+  return true;
+}
+
+std::unique_ptr<ScaleSocketServer::Packet> ScaleSocketServer::NewPacket() {
+  if (spare_packets_.empty())
+    return std::unique_ptr<Packet>(new Packet());
+  std::unique_ptr<Packet> packet = std::move(spare_packets_.back());
+  spare_packets_.pop_back();
+  return packet;
+}
+
+void ScaleSocketServer::Recycle(std::unique_ptr<Packet> packet) {
+  if (spare_packets_.size() < kMaxSparePackets)
+    spare_packets_.push_back(std::move(packet));
+}
+
+}  // namespace simple_app
@@ -0,0 +1,169 @@
+#ifndef SCALE_SOCKET_SERVER_H_
+#define SCALE_SOCKET_SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "rtc_base/asyncsocket.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/event.h"
+#include "rtc_base/ipaddress.h"
+#include "rtc_base/socketaddress.h"
+#include "rtc_base/socketserver.h"
+#include "rtc_base/timeutils.h"
+
+namespace simple_app {
+
+// In-process UDP network for load tests with thousands of simulated peers,
+// in place of rtc::VirtualSocketServer, whose sorted binding maps and one
+// posted message per packet become the bottleneck at that scale. Here
+//  - bindings and link state live in hash maps, so sending a packet and
+//    delivering it are O(1) apart from the O(log n) delivery queue;
+//  - delivery times are rounded up to |time_step_us|, and every packet due
+//    is handed over within a single Wait(): read events fire straight from
+//    it, socket by socket, with no message posted per packet;
+//  - with |time_warp| set, the server installs its own clock through
+//    rtc::SetClockForTesting(), as rtc::ScopedFakeClock does, and Wait()
+//    jumps it straight to the next packet or delayed message instead of
+//    sleeping, so a simulation runs as fast as the CPU allows;
+//  - every link, a pair of IP addresses, can have its own bandwidth, delay
+//    and loss, with tail drop behind the bandwidth limit.
+// Hand it to the network thread and to rtc::BasicPacketSocketFactory; give
+// the simulated hosts their addresses through the network manager.
+//
+// UDP only: CreateAsyncSocket() returns null for SOCK_STREAM. Sockets and
+// the server are used on the thread that owns the server; WakeUp() may be
+// called from any thread. With |time_warp|, every thread that reads the
+// clock sees warped time, so the simulation belongs on that one thread.
+class ScaleSocketServer : public rtc::SocketServer {
+ public:
+  struct LinkProfile {
+    // 0 is unlimited.
+    int bandwidth_kbps = 0;
+    int delay_ms = 0;
+    // Probability that a packet is lost, from 0 to 1.
+    double loss = 0;
+    // Packets that would wait longer than this behind the bandwidth limit
+    // are dropped.
+    int max_queue_ms = 200;
+  };
+
+  struct Config {
+    bool time_warp = true;
+    int64_t time_step_us = 1000;
+    LinkProfile default_link;
+    // Seed for the loss draws, so runs can be repeated.
+    uint32_t seed = 1;
+  };
+
+  struct Stats {
+    size_t sockets = 0;
+    size_t packets_in_flight = 0;
+    uint64_t packets_sent = 0;
+    uint64_t packets_delivered = 0;
+    uint64_t dropped_loss = 0;
+    uint64_t dropped_queue = 0;
+    // Nothing bound to the destination when the packet arrived.
+    uint64_t dropped_unbound = 0;
+    int64_t simulated_us = 0;
+    int64_t wall_us = 0;
+    // Packets delivered per second of wall time.
+    double packets_per_second = 0;
+  };
+
+  explicit ScaleSocketServer(const Config& config);
+  ~ScaleSocketServer() override;
+
+  // Sets the profile from |from| to |to|; call twice for both directions.
+  void SetLinkProfile(const rtc::IPAddress& from,
+                      const rtc::IPAddress& to,
+                      const LinkProfile& profile);
+  // Address that sockets bound to the any address of its family get.
+  void SetDefaultRoute(const rtc::IPAddress& address);
+
+  Stats GetStats() const;
+
+  // rtc::SocketServer:
+  rtc::Socket* CreateSocket(int type) override;
+  rtc::Socket* CreateSocket(int family, int type) override;
+  rtc::AsyncSocket* CreateAsyncSocket(int type) override;
+  rtc::AsyncSocket* CreateAsyncSocket(int family, int type) override;
+  bool Wait(int cms, bool process_io) override;
+  void WakeUp() override;
+
+ private:
+  class Clock;
+  class Socket;
+  struct Packet;
+  struct PacketLater {
+    bool operator()(const std::unique_ptr<Packet>& a,
+                    const std::unique_ptr<Packet>& b) const;
+  };
+  struct Link {
+    LinkProfile profile;
+    // When the last packet queued on the link finishes serializing.
+    int64_t busy_until_us = 0;
+  };
+  struct LinkKey {
+    rtc::IPAddress from;
+    rtc::IPAddress to;
+    bool operator==(const LinkKey& other) const;
+  };
+  struct LinkKeyHash {
+    size_t operator()(const LinkKey& key) const;
+  };
+  struct AddressHash {
+    size_t operator()(const rtc::SocketAddress& address) const;
+  };
+  struct IPHash {
+    size_t operator()(const rtc::IPAddress& ip) const;
+  };
+
+  // Binds |socket| to |address|, picking a port if it has none, and
+  // returns 0 or an errno value.
+  int Bind(Socket* socket, rtc::SocketAddress* address);
+  void Unbind(Socket* socket);
+  // Queues a packet for delivery, or drops it as its link says.
+  void SendPacket(const rtc::SocketAddress& from,
+                  const rtc::SocketAddress& to,
+                  const void* data,
+                  size_t size);
+  // Hands every packet due to its socket and fires their read events.
+  // Returns true if any packet was due.
+  bool DeliverDue();
+  std::unique_ptr<Packet> NewPacket();
+  void Recycle(std::unique_ptr<Packet> packet);
+
+  const Config config_;
+  std::unique_ptr<Clock> clock_;
+  rtc::ClockInterface* previous_clock_ = nullptr;
+  const int64_t start_us_;
+  const int64_t start_wall_us_;
+  rtc::Event wakeup_;
+  std::minstd_rand random_;
+  std::uniform_real_distribution<double> uniform_;
+
+  std::unordered_map<rtc::SocketAddress, Socket*, AddressHash> bindings_;
+  std::unordered_map<rtc::IPAddress, uint16_t, IPHash> next_ports_;
+  std::unordered_map<LinkKey, Link, LinkKeyHash> links_;
+  rtc::IPAddress default_route_v4_;
+  rtc::IPAddress default_route_v6_;
+  // Min-heap on delivery time, then send order.
+  std::vector<std::unique_ptr<Packet>> in_flight_;
+  std::vector<std::unique_ptr<Packet>> spare_packets_;
+  uint64_t next_sequence_ = 0;
+  // Addresses of sockets given packets in the current DeliverDue().
+  std::vector<rtc::SocketAddress> readable_;
+  Stats stats_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(ScaleSocketServer);
+};
+
+}  // namespace simple_app
+
+#endif  // SCALE_SOCKET_SERVER_H_
@@ -0,0 +1,313 @@
+#include "sdp_view.h"
+
+#include <string.h>
+
+namespace simple_app {
+
+namespace {
+
+const char kSendRecv[] = "sendrecv";
+const char* const kDirections[] = {kSendRecv, "sendonly", "recvonly",
+                                   "inactive"};
+
+}  // namespace
+
+bool SdpString::Equals(const char* text) const {
+  const size_t length = strlen(text);
+  return length == size && memcmp(data, text, length) == 0;
+}
+
+bool SdpString::StartsWith(const char* prefix) const {
+  const size_t length = strlen(prefix);
+  return length <= size && memcmp(data, prefix, length) == 0;
+}
+
+SdpString SdpString::Split(char delimiter) {
+  const char* found = size ? static_cast<const char*>(
+                                 memchr(data, delimiter, size))
+                           : nullptr;
+  SdpString head(data, found ? found - data : size);
+  if (found) {
+    size -= head.size + 1;
+    data = found + 1;
+  } else {
+    data += size;
+    size = 0;
+  }
+  return head;
+}
+
+bool SdpString::ToUInt32(uint32_t* value) const {
+  if (size == 0 || size > 10)
+    return false;
+  uint64_t result = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if (data[i] < '0' || data[i] > '9')
+      return false;
+    result = result * 10 + (data[i] - '0');
+  }
+  if (result > 0xffffffff)
+    return false;
+  *value = static_cast<uint32_t>(result);
+  return true;
+}
+
+SdpView::SdpView() {}
+
+bool SdpView::Parse(const char* sdp, size_t size) {
+  lines_.clear();
+  media_.clear();
+  const char* position = sdp;
+  const char* const end = sdp + size;
+  while (position < end) {
+    const char* newline = static_cast<const char*>(
+        memchr(position, '\n', end - position));
+    const char* line_end = newline ? newline : end;
+    if (line_end > position && line_end[-1] == '\r')
+      --line_end;
+    // As webrtcsdp's GetLine(): "x=value", lowercase type, no space around
+    // the '='.
+    const size_t length = line_end - position;
+    if (length < 3 || position[0] < 'a' || position[0] > 'z' ||
+        position[1] != '=' || position[2] == ' ') {
+      return false;
+    }
+    Line line;
+    line.type = position[0];
+    line.value = SdpString(position + 2, length - 2);
+    if (line.type == 'm') {
+      if (!media_.empty())
+        media_.back().end_line = lines_.size();
+      media_.push_back(Media());
+      media_.back().first_line = lines_.size();
+      if (!ParseMediaLine(line.value, &media_.back()))
+        return false;
+    }
+    lines_.push_back(line);
+    position = newline ? newline + 1 : end;
+  }
+  if (lines_.empty() || lines_[0].type != 'v')
+    return false;
+  if (!media_.empty())
+    media_.back().end_line = lines_.size();
+  return true;
+}
+
+bool SdpView::ParseMediaLine(const SdpString& value, Media* media) const {
+  // m=<media> <port>[/<number of ports>] <proto> <fmt> ...
+  SdpString rest = value;
+  media->type = rest.Split(' ');
+  SdpString port = rest.Split(' ');
+  media->protocol = rest.Split(' ');
+  media->formats = rest;
+  return !media->type.empty() && !media->protocol.empty() &&
+         !media->formats.empty() && port.Split('/').ToUInt32(&media->port);
+}
+
+size_t SdpView::session_end() const {
+  return media_.empty() ? lines_.size() : media_[0].first_line;
+}
+
+bool SdpView::NextAttribute(const char* name,
+                            size_t end,
+                            size_t* line,
+                            SdpString* value) const {
+  const size_t name_length = strlen(name);
+  for (size_t i = *line; i < end; ++i) {
+    const Line& candidate = lines_[i];
+    if (candidate.type != 'a' || !candidate.value.StartsWith(name))
+      continue;
+    const SdpString& text = candidate.value;
+    if (text.size == name_length) {
+      *value = SdpString(text.data + text.size, 0);
+    } else if (text.data[name_length] == ':') {
+      *value = SdpString(text.data + name_length + 1,
+                         text.size - name_length - 1);
+    } else {
+      continue;
+    }
+    *line = i + 1;
+    return true;
+  }
+  *line = end;
+  return false;
+}
+
+bool SdpView::FindSessionAttribute(const char* name, SdpString* value) const {
+  size_t line = 0;
+  return NextAttribute(name, session_end(), &line, value);
+}
+
+bool SdpView::FindMediaAttribute(size_t media_index,
+                                 const char* name,
+                                 SdpString* value) const {
+  const Media& section = media_[media_index];
+  size_t line = section.first_line;
+  return NextAttribute(name, section.end_line, &line, value);
+}
+
+bool SdpView::FindAttributeWithFallback(size_t media_index,
+                                        const char* name,
+                                        SdpString* value) const {
+  return FindMediaAttribute(media_index, name, value) ||
+         FindSessionAttribute(name, value);
+}
+
+bool SdpView::GetMid(size_t media_index, SdpString* mid) const {
+  return FindMediaAttribute(media_index, "mid", mid);
+}
+
+bool SdpView::GetIceCredentials(size_t media_index,
+                                SdpString* ufrag,
+                                SdpString* pwd) const {
+  return FindAttributeWithFallback(media_index, "ice-ufrag", ufrag) &&
+         FindAttributeWithFallback(media_index, "ice-pwd", pwd);
+}
+
+bool SdpView::GetFingerprint(size_t media_index,
+                             SdpString* algorithm,
+                             SdpString* fingerprint) const {
+  SdpString value;
+  if (!FindAttributeWithFallback(media_index, "fingerprint", &value))
+    return false;
+  *algorithm = value.Split(' ');
+  *fingerprint = value;
+  return !algorithm->empty() && !fingerprint->empty();
+}
+
+bool SdpView::GetSetup(size_t media_index, SdpString* setup) const {
+  return FindAttributeWithFallback(media_index, "setup", setup);
+}
+
+SdpString SdpView::GetDirection(size_t media_index) const {
+  // The last one wins, as in webrtcsdp.
+  SdpString direction(kSendRecv, sizeof(kSendRecv) - 1);
+  const Media& section = media_[media_index];
+  for (size_t i = section.first_line; i < section.end_line; ++i) {
+    if (lines_[i].type != 'a')
+      continue;
+    for (const char* candidate : kDirections) {
+      if (lines_[i].value.Equals(candidate))
+        direction = lines_[i].value;
+    }
+  }
+  return direction;
+}
+
+bool SdpView::NextRtpmap(size_t media_index,
+                         size_t* line,
+                         uint32_t* payload_type,
+                         SdpString* encoding) const {
+  const Media& section = media_[media_index];
+  if (*line < section.first_line)
+    *line = section.first_line;
+  SdpString value;
+  if (!NextAttribute("rtpmap", section.end_line, line, &value))
+    return false;
+  if (!value.Split(' ').ToUInt32(payload_type) || value.empty())
+    return false;
+  *encoding = value;
+  return true;
+}
+
+bool SdpView::GetBundleGroup(std::vector<SdpString>* mids) const {
+  size_t line = 0;
+  SdpString value;
+  while (NextAttribute("group", session_end(), &line, &value)) {
+    if (!value.Split(' ').Equals("BUNDLE"))
+      continue;
+    while (!value.empty()) {
+      SdpString mid = value.Split(' ');
+      if (!mid.empty())
+        mids->push_back(mid);
+    }
+    return true;
+  }
+  return false;
+}
+
+SdpBuilder::SdpBuilder(std::string* out) : out_(out) {}
+
+void SdpBuilder::Reserve(size_t size) {
+  out_->reserve(out_->size() + size);
+}
+
+SdpBuilder& SdpBuilder::Begin(char type) {
+  out_->push_back(type);
+  out_->push_back('=');
+  return *this;
+}
+
+SdpBuilder& SdpBuilder::Append(const char* text) {
+  out_->append(text);
+  return *this;
+}
+
+SdpBuilder& SdpBuilder::Append(const SdpString& text) {
+  out_->append(text.data, text.size);
+  return *this;
+}
+
+SdpBuilder& SdpBuilder::Append(const std::string& text) {
+  out_->append(text);
+  return *this;
+}
+
+SdpBuilder& SdpBuilder::Append(char c) {
+  out_->push_back(c);
+  return *this;
+}
+
+SdpBuilder& SdpBuilder::AppendNumber(uint64_t value) {
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[count++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  while (count)
+    out_->push_back(digits[--count]);
+  return *this;
+}
+
+SdpBuilder& SdpBuilder::AppendSigned(int64_t value) {
+  if (value >= 0)
+    return AppendNumber(static_cast<uint64_t>(value));
+  out_->push_back('-');
+  return AppendNumber(0 - static_cast<uint64_t>(value));
+}
+
+void SdpBuilder::End() {
+  out_->append("\r\n", 2);
+}
+
+void SdpBuilder::AddLine(const SdpView::Line& line) {
+  AddLine(line.type, line.value);
+}
+
+void SdpBuilder::AddLine(char type, const SdpString& value) {
+  Begin(type).Append(value).End();
+}
+
+void SdpBuilder::AddAttribute(const char* name) {
+  Begin('a').Append(name).End();
+}
+
+void SdpBuilder::AddAttribute(const char* name, const SdpString& value) {
+  Begin('a').Append(name).Append(':').Append(value).End();
+}
+
+void SdpBuilder::AddAttribute(const char* name, const std::string& value) {
+  Begin('a').Append(name).Append(':').Append(value).End();
+}
+
+void SdpBuilder::AddAttribute(const char* name, uint64_t value) {
+  Begin('a').Append(name).Append(':').AppendNumber(value).End();
+}
+
+void SdpBuilder::AddLines(const SdpView& view, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i)
+    AddLine(view.line(i));
+}
+
+}  // namespace simple_app
@@ -0,0 +1,172 @@
+#ifndef SDP_VIEW_H_
+#define SDP_VIEW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "rtc_base/constructormagic.h"
+
+namespace simple_app {
+
+// A run of characters inside the parsed SDP.
+struct SdpString {
+  SdpString() {}
+  SdpString(const char* data, size_t size) : data(data), size(size) {}
+
+  bool empty() const { return size == 0; }
+  std::string str() const { return std::string(data, size); }
+  bool Equals(const char* text) const;
+  bool StartsWith(const char* prefix) const;
+  // Splits off the text before the first |delimiter| and returns it; the
+  // rest, past the delimiter, is left in |this|. Without a delimiter, all
+  // of it is returned and |this| is left empty.
+  SdpString Split(char delimiter);
+  // False unless all of it is a decimal number that fits.
+  bool ToUInt32(uint32_t* value) const;
+
+  const char* data = nullptr;
+  size_t size = 0;
+};
+
+// A session description parsed in place, for signaling code that only
+// needs some of its fields. webrtc::SdpDeserialize() builds a complete
+// JsepSessionDescription, copying every line into std::strings and running
+// each through std::istringstream and rtc::split(), which takes
+// milliseconds on offers with dozens of m-lines. SdpView makes a single
+// pass that records where each line and media section starts; lookups
+// return SdpStrings pointing into the parsed text. The line and section
+// arrays are kept between Parse() calls, so a view reused for many
+// descriptions stops allocating. The parsed text must outlive the view.
+//
+// Values are as webrtcsdp reads them: lines end with \n or \r\n, the last
+// one possibly without; attributes are "a=name" or "a=name:value", and a
+// media section's transport attributes fall back to the session level.
+class SdpView {
+ public:
+  struct Line {
+    // The letter before the '='.
+    char type;
+    // The rest, without the line ending.
+    SdpString value;
+  };
+
+  struct Media {
+    // "audio", "video" or "application".
+    SdpString type;
+    uint32_t port = 0;
+    SdpString protocol;
+    // The payload types, or the SCTP format, separated by spaces.
+    SdpString formats;
+    // Its lines, the m-line first, are [first_line, end_line).
+    size_t first_line = 0;
+    size_t end_line = 0;
+  };
+
+  SdpView();
+
+  // Returns false unless |sdp| starts with "v=" and is made of well formed
+  // lines, with a well formed m-line at the start of each media section.
+  bool Parse(const char* sdp, size_t size);
+  bool Parse(const std::string& sdp) { return Parse(sdp.data(), sdp.size()); }
+
+  size_t num_lines() const { return lines_.size(); }
+  const Line& line(size_t index) const { return lines_[index]; }
+  // Session level lines are [0, session_end()).
+  size_t session_end() const;
+  size_t num_media() const { return media_.size(); }
+  const Media& media(size_t index) const { return media_[index]; }
+
+  // Looks for "a=|name|" or "a=|name|:" in the lines [|*line|, |end|) and
+  // returns its value, empty for a flag, with |*line| moved past it, so
+  // repeated calls visit every occurrence. False when there is none left.
+  bool NextAttribute(const char* name,
+                     size_t end,
+                     size_t* line,
+                     SdpString* value) const;
+  // The value of the first "a=|name|" at the session level, or in media
+  // section |media_index|.
+  bool FindSessionAttribute(const char* name, SdpString* value) const;
+  bool FindMediaAttribute(size_t media_index,
+                          const char* name,
+                          SdpString* value) const;
+
+  // The values webrtcsdp reads for media section |media_index|. ice-ufrag,
+  // ice-pwd, fingerprint and setup fall back to the session level; the
+  // direction is "sendrecv" unless the section says otherwise.
+  bool GetMid(size_t media_index, SdpString* mid) const;
+  bool GetIceCredentials(size_t media_index,
+                         SdpString* ufrag,
+                         SdpString* pwd) const;
+  bool GetFingerprint(size_t media_index,
+                      SdpString* algorithm,
+                      SdpString* fingerprint) const;
+  bool GetSetup(size_t media_index, SdpString* setup) const;
+  SdpString GetDirection(size_t media_index) const;
+  // The payload type and "name/clockrate[/channels]" of the next
+  // "a=rtpmap" in the section, starting with |*line| at 0. False when there
+  // is none left or it is malformed.
+  bool NextRtpmap(size_t media_index,
+                  size_t* line,
+                  uint32_t* payload_type,
+                  SdpString* encoding) const;
+  // The mids of the session's "a=group:BUNDLE", appended to |mids|.
+  bool GetBundleGroup(std::vector<SdpString>* mids) const;
+
+ private:
+  bool ParseMediaLine(const SdpString& value, Media* media) const;
+  bool FindAttributeWithFallback(size_t media_index,
+                                 const char* name,
+                                 SdpString* value) const;
+
+  std::vector<Line> lines_;
+  std::vector<Media> media_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(SdpView);
+};
+
+// Writes SDP into one std::string, appending each line in place instead
+// of going through std::ostringstream as SdpSerialize() does. Reserve()
+// up front, sized from an earlier description, and a builder that is
+// reused costs no allocation at all. Numbers are formatted without locale
+// or streams.
+class SdpBuilder {
+ public:
+  // Appends to |out|, which must outlive the builder.
+  explicit SdpBuilder(std::string* out);
+
+  void Reserve(size_t size);
+
+  // Starts a "|type|=" line; the Append() calls add to it and End() ends it
+  // with "\r\n".
+  SdpBuilder& Begin(char type);
+  SdpBuilder& Append(const char* text);
+  SdpBuilder& Append(const SdpString& text);
+  SdpBuilder& Append(const std::string& text);
+  SdpBuilder& Append(char c);
+  SdpBuilder& AppendNumber(uint64_t value);
+  SdpBuilder& AppendSigned(int64_t value);
+  void End();
+
+  // Whole lines.
+  void AddLine(const SdpView::Line& line);
+  void AddLine(char type, const SdpString& value);
+  // "a=|name|" and "a=|name|:|value|".
+  void AddAttribute(const char* name);
+  void AddAttribute(const char* name, const SdpString& value);
+  void AddAttribute(const char* name, const std::string& value);
+  void AddAttribute(const char* name, uint64_t value);
+  // Copies the lines [|begin|, |end|) of |view|.
+  void AddLines(const SdpView& view, size_t begin, size_t end);
+
+ private:
+  std::string* const out_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(SdpBuilder);
+};
+
+}  // namespace simple_app
+
+#endif  // SDP_VIEW_H_
@@ -0,0 +1,357 @@
+#include "sharded_peer_connection_factory.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "api/audio_codecs/builtin_audio_decoder_factory.h"
+#include "api/audio_codecs/builtin_audio_encoder_factory.h"
+#include "api/video_codecs/sdp_video_format.h"
+#include "api/video_codecs/video_decoder.h"
+#include "api/video_codecs/video_encoder.h"
+#include "modules/audio_mixer/audio_mixer_impl.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "system_wrappers/include/cpu_info.h"
+
+namespace simple_app {
+
+namespace {
+
+// Lends a shared factory to a PeerConnectionFactory, which wants to own
+// its codec factories.
+class SharedVideoEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  explicit SharedVideoEncoderFactory(webrtc::VideoEncoderFactory* factory)
+      : factory_(factory) {}
+
+  // webrtc::VideoEncoderFactory:
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override {
+    return factory_->GetSupportedFormats();
+  }
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override {
+    return factory_->QueryVideoEncoder(format);
+  }
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override {
+    return factory_->CreateVideoEncoder(format);
+  }
+
+ private:
+  webrtc::VideoEncoderFactory* const factory_;
+};
+
+class SharedVideoDecoderFactory : public webrtc::VideoDecoderFactory {
+ public:
+  explicit SharedVideoDecoderFactory(webrtc::VideoDecoderFactory* factory)
+      : factory_(factory) {}
+
+  // webrtc::VideoDecoderFactory:
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override {
+    return factory_->GetSupportedFormats();
+  }
+  std::unique_ptr<webrtc::VideoDecoder> CreateVideoDecoder(
+      const webrtc::SdpVideoFormat& format) override {
+    return factory_->CreateVideoDecoder(format);
+  }
+
+ private:
+  webrtc::VideoDecoderFactory* const factory_;
+};
+
+// RefCountInterface has no HasOneRef(), but Release() returns the count
+// that is left.
+bool HasOtherReferences(webrtc::PeerConnectionInterface* pc) {
+  pc->AddRef();
+  return pc->Release() > 1;
+}
+
+}  // namespace
+
+// Forwards to the application's observer, counting the shard's open
+// PeerConnections. Holds a reference to its PeerConnection, so that it is
+// deleted only after it.
+class ShardedPeerConnectionFactory::Observer
+    : public webrtc::PeerConnectionObserver {
+ public:
+  Observer(webrtc::PeerConnectionObserver* observer, size_t* active)
+      : observer_(observer), active_(active) {
+    ++*active_;
+  }
+
+  ~Observer() {
+    RTC_DCHECK(!pc_);
+    if (!closed_)
+      --*active_;
+  }
+
+  void set_peer_connection(
+      const rtc::scoped_refptr<webrtc::PeerConnectionInterface>& pc) {
+    pc_ = pc;
+  }
+
+  // Releases the PeerConnection, destroying it, unless something else still
+  // references it.
+  bool ReleaseIfUnreferenced() {
+    if (pc_ && HasOtherReferences(pc_.get()))
+      return false;
+    pc_ = nullptr;
+    return true;
+  }
+
+  // webrtc::PeerConnectionObserver:
+  void OnSignalingChange(
+      webrtc::PeerConnectionInterface::SignalingState new_state) override {
+    if (new_state == webrtc::PeerConnectionInterface::kClosed && !closed_) {
+      closed_ = true;
+      --*active_;
+    }
+    observer_->OnSignalingChange(new_state);
+  }
+  void OnAddStream(
+      rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) override {
+    observer_->OnAddStream(stream);
+  }
+  void OnRemoveStream(
+      rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) override {
+    observer_->OnRemoveStream(stream);
+  }
+  void OnDataChannel(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> channel) override {
+    observer_->OnDataChannel(channel);
+  }
+  void OnRenegotiationNeeded() override { observer_->OnRenegotiationNeeded(); }
+  void OnIceConnectionChange(
+      webrtc::PeerConnectionInterface::IceConnectionState new_state) override {
+    observer_->OnIceConnectionChange(new_state);
+  }
+  void OnIceGatheringChange(
+      webrtc::PeerConnectionInterface::IceGatheringState new_state) override {
+    observer_->OnIceGatheringChange(new_state);
+  }
+  void OnIceCandidate(const webrtc::IceCandidateInterface* candidate) override {
+    observer_->OnIceCandidate(candidate);
+  }
+  void OnIceCandidatesRemoved(
+      const std::vector<cricket::Candidate>& candidates) override {
+    observer_->OnIceCandidatesRemoved(candidates);
+  }
+  void OnIceConnectionReceivingChange(bool receiving) override {
+    observer_->OnIceConnectionReceivingChange(receiving);
+  }
+  void OnAddTrack(
+      rtc::scoped_refptr<webrtc::RtpReceiverInterface> receiver,
+      const std::vector<rtc::scoped_refptr<webrtc::MediaStreamInterface>>&
+          streams) override {
+    observer_->OnAddTrack(receiver, streams);
+  }
+
+ private:
+  webrtc::PeerConnectionObserver* const observer_;
+  size_t* const active_;
+  bool closed_ = false;
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+};
+
+class ShardedPeerConnectionFactory::Shard {
+ public:
+  explicit Shard(const Config& config)
+      : network_thread_(
+            MediaPathThread::CreateWithSocketServer(config.thread_options)) {
+    network_thread_->SetName("PCShardNetwork", this);
+    network_thread_->Start();
+    if (!config.single_media_thread) {
+      worker_thread_ = MediaPathThread::Create(config.thread_options);
+      worker_thread_->SetName("PCShardWorker", this);
+      worker_thread_->Start();
+    }
+  }
+
+  ~Shard() {
+    Prune();
+    if (!observers_.empty()) {
+      LOG(LS_ERROR) << observers_.size()
+                    << " PeerConnections outlive their factory";
+      // Still called by them.
+      for (std::unique_ptr<Observer>& observer : observers_)
+        observer.release();
+    }
+    // Destroyed on the signaling thread through its proxy, with calls to
+    // both of ours, which are stopped after.
+    factory_ = nullptr;
+  }
+
+  bool Initialize(rtc::Thread* signaling_thread,
+                  const Config& config,
+                  bool first) {
+    rtc::scoped_refptr<webrtc::AudioDeviceModule> adm =
+        config.audio_device_module;
+    if (!first) {
+      adm = webrtc::AudioDeviceModule::Create(
+          0, webrtc::AudioDeviceModule::kDummyAudio);
+    }
+    if (config.video_encoder_factory) {
+      RTC_DCHECK(config.video_decoder_factory);
+      factory_ = webrtc::CreatePeerConnectionFactory(
+          network_thread(), worker_thread(), signaling_thread, adm,
+          config.audio_encoder_factory, config.audio_decoder_factory,
+          std::unique_ptr<webrtc::VideoEncoderFactory>(
+              new SharedVideoEncoderFactory(config.video_encoder_factory)),
+          std::unique_ptr<webrtc::VideoDecoderFactory>(
+              new SharedVideoDecoderFactory(config.video_decoder_factory)),
+          config.audio_mixer, config.audio_processing);
+    } else {
+      RTC_DCHECK(!config.video_decoder_factory);
+      // Null cricket factories give the internal codecs, where null
+      // webrtc ones would give none.
+      factory_ = webrtc::CreatePeerConnectionFactory(
+          network_thread(), worker_thread(), signaling_thread, adm.get(),
+          config.audio_encoder_factory, config.audio_decoder_factory, nullptr,
+          nullptr, config.audio_mixer, config.audio_processing);
+    }
+    if (!factory_)
+      return false;
+    factory_->SetOptions(config.options);
+    return true;
+  }
+
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> CreatePeerConnection(
+      const webrtc::PeerConnectionInterface::RTCConfiguration& configuration,
+      std::unique_ptr<cricket::PortAllocator> allocator,
+      std::unique_ptr<rtc::RTCCertificateGeneratorInterface> cert_generator,
+      webrtc::PeerConnectionObserver* observer) {
+    std::unique_ptr<Observer> wrapper(new Observer(observer, &active_));
+    rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc =
+        factory_->CreatePeerConnection(configuration, std::move(allocator),
+                                       std::move(cert_generator),
+                                       wrapper.get());
+    if (!pc)
+      return nullptr;
+    wrapper->set_peer_connection(pc);
+    observers_.push_back(std::move(wrapper));
+    return pc;
+  }
+
+  void Prune() {
+    observers_.erase(
+        std::remove_if(observers_.begin(), observers_.end(),
+                       [](const std::unique_ptr<Observer>& observer) {
+                         return observer->ReleaseIfUnreferenced();
+                       }),
+        observers_.end());
+  }
+
+  webrtc::PeerConnectionFactoryInterface* factory() const {
+    return factory_.get();
+  }
+  MediaPathThread* network_thread() const { return network_thread_.get(); }
+  MediaPathThread* worker_thread() const {
+    return worker_thread_ ? worker_thread_.get() : network_thread_.get();
+  }
+  size_t active() const { return active_; }
+
+ private:
+  std::unique_ptr<MediaPathThread> network_thread_;
+  // Null if |single_media_thread|.
+  std::unique_ptr<MediaPathThread> worker_thread_;
+  rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory_;
+  std::vector<std::unique_ptr<Observer>> observers_;
+  size_t active_ = 0;
+};
+
+ShardedPeerConnectionFactory::ShardedPeerConnectionFactory(
+    rtc::Thread* signaling_thread,
+    const Config& config)
+    : signaling_thread_(signaling_thread), config_(config) {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  // Created here rather than by each shard's factory, so that all of them
+  // share one.
+  if (!config_.audio_encoder_factory)
+    config_.audio_encoder_factory = webrtc::CreateBuiltinAudioEncoderFactory();
+  if (!config_.audio_decoder_factory)
+    config_.audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
+  if (!config_.audio_mixer)
+    config_.audio_mixer = webrtc::AudioMixerImpl::Create();
+  if (!config_.audio_processing)
+    config_.audio_processing = webrtc::AudioProcessing::Create();
+}
+
+ShardedPeerConnectionFactory::~ShardedPeerConnectionFactory() {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+}
+
+bool ShardedPeerConnectionFactory::Initialize() {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  RTC_DCHECK(shards_.empty());
+  size_t num_shards = config_.num_shards;
+  if (num_shards == 0)
+    num_shards = std::max<uint32_t>(1, webrtc::CpuInfo::DetectNumberOfCores());
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(new Shard(config_));
+    if (!shards_.back()->Initialize(signaling_thread_, config_, i == 0)) {
+      LOG(LS_ERROR) << "Failed to create the factory of shard " << i;
+      shards_.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t ShardedPeerConnectionFactory::PickShard() {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  RTC_DCHECK(!shards_.empty());
+  Prune();
+  size_t picked = next_shard_;
+  if (config_.assignment == LEAST_LOADED) {
+    // Starting after the last pick, so that ties go round robin.
+    for (size_t i = 1; i < shards_.size(); ++i) {
+      const size_t candidate = (next_shard_ + i) % shards_.size();
+      if (shards_[candidate]->active() < shards_[picked]->active())
+        picked = candidate;
+    }
+  }
+  next_shard_ = (picked + 1) % shards_.size();
+  return picked;
+}
+
+rtc::scoped_refptr<webrtc::PeerConnectionInterface>
+ShardedPeerConnectionFactory::CreatePeerConnection(
+    size_t shard,
+    const webrtc::PeerConnectionInterface::RTCConfiguration& configuration,
+    std::unique_ptr<cricket::PortAllocator> allocator,
+    std::unique_ptr<rtc::RTCCertificateGeneratorInterface> cert_generator,
+    webrtc::PeerConnectionObserver* observer) {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  RTC_DCHECK_LT(shard, shards_.size());
+  return shards_[shard]->CreatePeerConnection(
+      configuration, std::move(allocator), std::move(cert_generator),
+      observer);
+}
+
+webrtc::PeerConnectionFactoryInterface*
+ShardedPeerConnectionFactory::shard_factory(size_t shard) const {
+  return shards_[shard]->factory();
+}
+
+MediaPathThread* ShardedPeerConnectionFactory::network_thread(
+    size_t shard) const {
+  return shards_[shard]->network_thread();
+}
+
+MediaPathThread* ShardedPeerConnectionFactory::worker_thread(
+    size_t shard) const {
+  return shards_[shard]->worker_thread();
+}
+
+size_t ShardedPeerConnectionFactory::active_peer_connections(
+    size_t shard) const {
+  return shards_[shard]->active();
+}
+
+void ShardedPeerConnectionFactory::Prune() {
+  RTC_DCHECK(signaling_thread_->IsCurrent());
+  for (const std::unique_ptr<Shard>& shard : shards_)
+    shard->Prune();
+}
+
+}  // namespace simple_app
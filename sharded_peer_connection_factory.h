@@ -0,0 +1,120 @@
+#ifndef SHARDED_PEER_CONNECTION_FACTORY_H_
+#define SHARDED_PEER_CONNECTION_FACTORY_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <vector>
+
+#include "api/audio/audio_mixer.h"
+#include "api/audio_codecs/audio_decoder_factory.h"
+#include "api/audio_codecs/audio_encoder_factory.h"
+#include "api/peerconnectioninterface.h"
+#include "api/video_codecs/video_decoder_factory.h"
+#include "api/video_codecs/video_encoder_factory.h"
+#include "media_path_thread.h"
+#include "modules/audio_device/include/audio_device.h"
+#include "modules/audio_processing/include/audio_processing.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/scoped_ref_ptr.h"
+
+namespace simple_app {
+
+// Spreads PeerConnections over several network/worker thread pairs. A
+// PeerConnectionFactory runs every PeerConnection it creates on its one
+// network thread and one worker thread, so a server using many cores needs
+// many factories, each with its own ADM, APM, mixer and codec factories.
+// ShardedPeerConnectionFactory creates one factory per shard, each with its
+// own pair of threads, all sharing the signaling thread, the codec
+// factories, the mixer and the APM, and picks a shard for each new
+// PeerConnection.
+//
+// Only the first shard drives |audio_device_module|; the others get a
+// dummy ADM. Remote audio of every shard is mixed into the shared mixer and
+// played out by it, but local audio is captured only on the first shard.
+//
+// Lives on the signaling thread. Every PeerConnection, stream and track
+// created through it must be released before it is destroyed.
+class ShardedPeerConnectionFactory {
+ public:
+  enum Assignment {
+    ROUND_ROBIN,
+    // The shard with the fewest PeerConnections that are not closed.
+    LEAST_LOADED,
+  };
+
+  struct Config {
+    // Zero means one shard per core.
+    size_t num_shards = 0;
+    Assignment assignment = ROUND_ROBIN;
+    // Null for the built-in audio codecs.
+    rtc::scoped_refptr<webrtc::AudioEncoderFactory> audio_encoder_factory;
+    rtc::scoped_refptr<webrtc::AudioDecoderFactory> audio_decoder_factory;
+    // Not owned, and called on every shard's worker thread, so they must be
+    // thread safe. Both or neither; null for the internal video codecs.
+    webrtc::VideoEncoderFactory* video_encoder_factory = nullptr;
+    webrtc::VideoDecoderFactory* video_decoder_factory = nullptr;
+    // Null for the platform's default device.
+    rtc::scoped_refptr<webrtc::AudioDeviceModule> audio_device_module;
+    // Null to create one for all shards.
+    rtc::scoped_refptr<webrtc::AudioMixer> audio_mixer;
+    rtc::scoped_refptr<webrtc::AudioProcessing> audio_processing;
+    webrtc::PeerConnectionFactoryInterface::Options options;
+    // For each shard's threads.
+    MediaPathThread::Options thread_options;
+    // Runs each shard's worker on its network thread. With
+    // MediaPathThread::kBaseChannelPacketHandOff in |thread_options|'s
+    // inline sites, received packets then reach the media engine without
+    // being posted.
+    bool single_media_thread = false;
+  };
+
+  // |signaling_thread| must be the current thread, and outlive the factory.
+  ShardedPeerConnectionFactory(rtc::Thread* signaling_thread,
+                               const Config& config);
+  ~ShardedPeerConnectionFactory();
+
+  // Returns false if a shard's factory could not be created.
+  bool Initialize();
+
+  // Picks the shard for the next PeerConnection, as |assignment| says.
+  size_t PickShard();
+  // As PeerConnectionFactoryInterface::CreatePeerConnection(), on |shard|.
+  // |allocator| may be null for the shard factory's own; one passed in must
+  // use the shard's network thread. The PeerConnection's tracks are to be
+  // created with shard_factory(|shard|), so that they run on the same
+  // threads. |observer| is called on the signaling thread, as usual.
+  rtc::scoped_refptr<webrtc::PeerConnectionInterface> CreatePeerConnection(
+      size_t shard,
+      const webrtc::PeerConnectionInterface::RTCConfiguration& configuration,
+      std::unique_ptr<cricket::PortAllocator> allocator,
+      std::unique_ptr<rtc::RTCCertificateGeneratorInterface> cert_generator,
+      webrtc::PeerConnectionObserver* observer);
+
+  size_t num_shards() const { return shards_.size(); }
+  webrtc::PeerConnectionFactoryInterface* shard_factory(size_t shard) const;
+  // The same thread if |single_media_thread|.
+  MediaPathThread* network_thread(size_t shard) const;
+  MediaPathThread* worker_thread(size_t shard) const;
+  // PeerConnections on |shard| that are not closed.
+  size_t active_peer_connections(size_t shard) const;
+
+  // Releases the PeerConnections that only the factory still references.
+  // PickShard() does this too.
+  void Prune();
+
+ private:
+  class Shard;
+  class Observer;
+
+  rtc::Thread* const signaling_thread_;
+  Config config_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  size_t next_shard_ = 0;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(ShardedPeerConnectionFactory);
+};
+
+}  // namespace simple_app
+
+#endif  // SHARDED_PEER_CONNECTION_FACTORY_H_
@@ -0,0 +1,544 @@
+#include "sharded_turn_server.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "batched_udp_socket.h"
+#include "p2p/base/stun.h"
+#include "rtc_base/byteorder.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/physicalsocketserver.h"
+#include "rtc_base/timeutils.h"
+#include "stun_view.h"
+#include "system_wrappers/include/cpu_info.h"
+
+namespace simple_app {
+
+namespace {
+
+const size_t kChannelDataHeaderSize = 4;
+const size_t kStunHeaderSize = 20;
+const size_t kStunTransactionIdOffset = 8;
+const size_t kStunTransactionIdSize = 12;
+// A ChannelBind installs a permission for the peer that lasts this long
+// (RFC 5766 section 8); the channel itself lasts longer, but TurnServer
+// drops data once the permission is gone.
+const int64_t kPermissionLifetimeMs = 5 * 60 * 1000;
+// ChannelBind requests waiting for their response. Answers come within a
+// round trip, so anything beyond this is from clients that never got one.
+const size_t kMaxPendingBinds = 1024;
+
+bool IsChannelData(const char* data, size_t size) {
+  // Channel numbers are 0x4000-0x7FFF, so the first two bits are 01; STUN
+  // messages start with 00.
+  return size >= kChannelDataHeaderSize && (data[0] & 0xC0) == 0x40;
+}
+
+std::string TransactionId(const char* data) {
+  return std::string(data + kStunTransactionIdOffset, kStunTransactionIdSize);
+}
+
+// BatchedUdpSocket bound with SO_REUSEPORT, so every shard can listen on the
+// same address.
+class ReusePortUdpSocket : public BatchedUdpSocket {
+ public:
+  static BatchedUdpSocket* Create(rtc::PhysicalSocketServer* ss,
+                                  const rtc::SocketAddress& bind_address) {
+    int fd = OpenSocket(bind_address.family());
+    if (fd == INVALID_SOCKET)
+      return nullptr;
+#if defined(SO_REUSEPORT)
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+      LOG(LS_WARNING) << "SO_REUSEPORT failed with error " << errno;
+#endif
+
+    ReusePortUdpSocket* socket = new ReusePortUdpSocket(ss, fd);
+    if (socket->Bind(bind_address, 0, 0) < 0) {
+      LOG(LS_ERROR) << "UDP bind failed with error " << socket->GetError();
+      delete socket;
+      return nullptr;
+    }
+    ss->Add(socket);
+    return socket;
+  }
+
+ private:
+  ReusePortUdpSocket(rtc::PhysicalSocketServer* ss, int fd)
+      : BatchedUdpSocket(ss, fd) {}
+};
+
+}  // namespace
+
+ForwardingPacketSocket::ForwardingPacketSocket(rtc::AsyncPacketSocket* socket)
+    : socket_(socket) {
+  socket_->SignalReadPacket.connect(this,
+                                    &ForwardingPacketSocket::OnReadPacket);
+  socket_->SignalSentPacket.connect(this,
+                                    &ForwardingPacketSocket::OnSentPacket);
+  socket_->SignalReadyToSend.connect(this,
+                                     &ForwardingPacketSocket::OnReadyToSend);
+  socket_->SignalClose.connect(this, &ForwardingPacketSocket::OnClose);
+}
+
+ForwardingPacketSocket::~ForwardingPacketSocket() = default;
+
+rtc::SocketAddress ForwardingPacketSocket::GetLocalAddress() const {
+  return socket_->GetLocalAddress();
+}
+
+rtc::SocketAddress ForwardingPacketSocket::GetRemoteAddress() const {
+  return socket_->GetRemoteAddress();
+}
+
+int ForwardingPacketSocket::Send(const void* pv,
+                                 size_t cb,
+                                 const rtc::PacketOptions& options) {
+  return socket_->Send(pv, cb, options);
+}
+
+int ForwardingPacketSocket::SendTo(const void* pv,
+                                   size_t cb,
+                                   const rtc::SocketAddress& addr,
+                                   const rtc::PacketOptions& options) {
+  return socket_->SendTo(pv, cb, addr, options);
+}
+
+int ForwardingPacketSocket::Close() {
+  return socket_->Close();
+}
+
+rtc::AsyncPacketSocket::State ForwardingPacketSocket::GetState() const {
+  return socket_->GetState();
+}
+
+int ForwardingPacketSocket::GetOption(rtc::Socket::Option opt, int* value) {
+  return socket_->GetOption(opt, value);
+}
+
+int ForwardingPacketSocket::SetOption(rtc::Socket::Option opt, int value) {
+  return socket_->SetOption(opt, value);
+}
+
+int ForwardingPacketSocket::GetError() const {
+  return socket_->GetError();
+}
+
+void ForwardingPacketSocket::SetError(int error) {
+  socket_->SetError(error);
+}
+
+void ForwardingPacketSocket::OnReadPacket(
+    rtc::AsyncPacketSocket* /* socket */,
+    const char* data,
+    size_t size,
+    const rtc::SocketAddress& remote_address,
+    const rtc::PacketTime& packet_time) {
+  SignalReadPacket(this, data, size, remote_address, packet_time);
+}
+
+void ForwardingPacketSocket::OnSentPacket(
+    rtc::AsyncPacketSocket* /* socket */,
+    const rtc::SentPacket& sent_packet) {
+  SignalSentPacket(this, sent_packet);
+}
+
+void ForwardingPacketSocket::OnReadyToSend(
+    rtc::AsyncPacketSocket* /* socket */) {
+  SignalReadyToSend(this);
+}
+
+void ForwardingPacketSocket::OnClose(rtc::AsyncPacketSocket* /* socket */,
+                                     int error) {
+  SignalClose(this, error);
+}
+
+size_t TurnFastPath::AddressHash::operator()(
+    const rtc::SocketAddress& address) const {
+  return rtc::HashIP(address.ipaddr()) * 31 + address.port();
+}
+
+size_t TurnFastPath::ChannelKeyHash::operator()(const ChannelKey& key) const {
+  return AddressHash()(key.client) * 31 + key.channel;
+}
+
+size_t TurnFastPath::PeerKeyHash::operator()(const PeerKey& key) const {
+  return AddressHash()(key.peer) * 31 +
+         std::hash<const TurnRelaySocket*>()(key.relay);
+}
+
+TurnFastPath::TurnFastPath() = default;
+
+TurnFastPath::~TurnFastPath() {
+  RTC_DCHECK(relays_.empty());
+}
+
+bool TurnFastPath::OnClientPacket(rtc::AsyncPacketSocket* internal_socket,
+                                  const char* data,
+                                  size_t size,
+                                  const rtc::SocketAddress& client) {
+  if (IsChannelData(data, size)) {
+    const ChannelKey key = {client, rtc::GetBE16(data)};
+    const size_t length = rtc::GetBE16(data + 2);
+    auto it = channels_.find(key);
+    if (it != channels_.end() &&
+        size >= kChannelDataHeaderSize + length) {
+      if (it->second.expires_ms > rtc::TimeMillis()) {
+        it->second.relay->SendTo(data + kChannelDataHeaderSize, length,
+                                 it->second.peer, rtc::PacketOptions());
+        Bump(&to_peer_);
+        return true;
+      }
+      EraseChannel(key);
+    }
+  } else if (size >= kStunHeaderSize &&
+             rtc::GetBE16(data) == cricket::TURN_CHANNEL_BIND_REQUEST) {
+    OnChannelBindRequest(internal_socket, data, size, client);
+  }
+  Bump(&slow_path_);
+  return false;
+}
+
+void TurnFastPath::OnServerPacket(const char* data,
+                                  size_t size,
+                                  const rtc::SocketAddress& client) {
+  if (size < kStunHeaderSize || IsChannelData(data, size))
+    return;
+  switch (rtc::GetBE16(data)) {
+    case cricket::TURN_CHANNEL_BIND_RESPONSE:
+      OnChannelBindResponse(TransactionId(data), client);
+      break;
+    case cricket::STUN_ALLOCATE_RESPONSE:
+      OnAllocateResponse(data, size, client);
+      break;
+  }
+}
+
+bool TurnFastPath::OnPeerPacket(TurnRelaySocket* relay,
+                                const char* data,
+                                size_t size,
+                                const rtc::SocketAddress& peer) {
+  auto it = peers_.find(PeerKey{relay, peer});
+  if (it == peers_.end() || size > 0xFFFF) {
+    Bump(&slow_path_);
+    return false;
+  }
+  const PeerRoute& route = it->second;
+  if (route.expires_ms <= rtc::TimeMillis()) {
+    EraseChannel(ChannelKey{route.client, route.channel});
+    Bump(&slow_path_);
+    return false;
+  }
+  send_buffer_.resize(kChannelDataHeaderSize + size);
+  rtc::SetBE16(send_buffer_.data(), route.channel);
+  rtc::SetBE16(send_buffer_.data() + 2, static_cast<uint16_t>(size));
+  memcpy(send_buffer_.data() + kChannelDataHeaderSize, data, size);
+  route.internal_socket->SendTo(send_buffer_.data(), send_buffer_.size(),
+                                route.client, rtc::PacketOptions());
+  Bump(&to_client_);
+  return true;
+}
+
+void TurnFastPath::AddRelay(TurnRelaySocket* relay) {
+  relays_[relay->GetLocalAddress()] = relay;
+}
+
+void TurnFastPath::RemoveRelay(TurnRelaySocket* relay) {
+  for (auto it = relays_.begin(); it != relays_.end();) {
+    if (it->second == relay)
+      it = relays_.erase(it);
+    else
+      ++it;
+  }
+  for (auto it = allocations_.begin(); it != allocations_.end();) {
+    if (it->second == relay)
+      it = allocations_.erase(it);
+    else
+      ++it;
+  }
+  for (auto it = channels_.begin(); it != channels_.end();) {
+    if (it->second.relay == relay)
+      it = channels_.erase(it);
+    else
+      ++it;
+  }
+  for (auto it = peers_.begin(); it != peers_.end();) {
+    if (it->first.relay == relay)
+      it = peers_.erase(it);
+    else
+      ++it;
+  }
+  num_channels_.store(channels_.size(), std::memory_order_relaxed);
+}
+
+TurnFastPath::Stats TurnFastPath::GetStats() const {
+  Stats stats;
+  stats.to_peer = to_peer_.load(std::memory_order_relaxed);
+  stats.to_client = to_client_.load(std::memory_order_relaxed);
+  stats.slow_path = slow_path_.load(std::memory_order_relaxed);
+  stats.channels = num_channels_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void TurnFastPath::OnChannelBindRequest(
+    rtc::AsyncPacketSocket* internal_socket,
+    const char* data,
+    size_t size,
+    const rtc::SocketAddress& client) {
+  StunView msg;
+  uint32_t channel;
+  rtc::SocketAddress peer;
+  if (!msg.Parse(data, size) ||
+      !msg.GetUInt32(cricket::STUN_ATTR_CHANNEL_NUMBER, &channel) ||
+      !msg.GetXorAddress(cricket::STUN_ATTR_XOR_PEER_ADDRESS, &peer)) {
+    return;  // TurnServer will reject it.
+  }
+
+  if (pending_binds_.size() >= kMaxPendingBinds)
+    pending_binds_.clear();
+  PendingBind& pending = pending_binds_[TransactionId(data)];
+  pending.client = client;
+  pending.internal_socket = internal_socket;
+  pending.channel = static_cast<uint16_t>(channel >> 16);
+  pending.peer = peer;
+}
+
+void TurnFastPath::OnChannelBindResponse(const std::string& transaction_id,
+                                         const rtc::SocketAddress& client) {
+  auto pending_it = pending_binds_.find(transaction_id);
+  if (pending_it == pending_binds_.end())
+    return;
+  const PendingBind pending = pending_it->second;
+  pending_binds_.erase(pending_it);
+  if (pending.client != client)
+    return;
+  auto allocation_it = allocations_.find(client);
+  if (allocation_it == allocations_.end())
+    return;
+
+  TurnRelaySocket* const relay = allocation_it->second;
+  const int64_t expires_ms = rtc::TimeMillis() + kPermissionLifetimeMs;
+  channels_[ChannelKey{client, pending.channel}] =
+      ChannelRoute{pending.peer, relay, expires_ms};
+  peers_[PeerKey{relay, pending.peer}] =
+      PeerRoute{client, pending.channel, pending.internal_socket, expires_ms};
+  num_channels_.store(channels_.size(), std::memory_order_relaxed);
+}
+
+void TurnFastPath::OnAllocateResponse(const char* data,
+                                      size_t size,
+                                      const rtc::SocketAddress& client) {
+  StunView msg;
+  rtc::SocketAddress relayed;
+  if (!msg.Parse(data, size) ||
+      !msg.GetXorAddress(cricket::STUN_ATTR_XOR_RELAYED_ADDRESS, &relayed)) {
+    return;
+  }
+  auto it = relays_.find(relayed);
+  if (it != relays_.end())
+    allocations_[client] = it->second;
+}
+
+void TurnFastPath::EraseChannel(const ChannelKey& key) {
+  auto it = channels_.find(key);
+  if (it == channels_.end())
+    return;
+  peers_.erase(PeerKey{it->second.relay, it->second.peer});
+  channels_.erase(it);
+  num_channels_.store(channels_.size(), std::memory_order_relaxed);
+}
+
+// static
+void TurnFastPath::Bump(std::atomic<uint64_t>* counter) {
+  // Only the server thread writes; the atomic is for GetStats().
+  counter->store(counter->load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+}
+
+TurnRelaySocket::TurnRelaySocket(rtc::AsyncPacketSocket* socket,
+                                 TurnFastPath* fast_path)
+    : ForwardingPacketSocket(socket), fast_path_(fast_path) {
+  fast_path_->AddRelay(this);
+}
+
+TurnRelaySocket::~TurnRelaySocket() {
+  fast_path_->RemoveRelay(this);
+}
+
+void TurnRelaySocket::OnReadPacket(rtc::AsyncPacketSocket* socket,
+                                   const char* data,
+                                   size_t size,
+                                   const rtc::SocketAddress& remote_address,
+                                   const rtc::PacketTime& packet_time) {
+  if (!fast_path_->OnPeerPacket(this, data, size, remote_address)) {
+    ForwardingPacketSocket::OnReadPacket(socket, data, size, remote_address,
+                                         packet_time);
+  }
+}
+
+TurnInternalSocket::TurnInternalSocket(rtc::AsyncPacketSocket* socket,
+                                       TurnFastPath* fast_path)
+    : ForwardingPacketSocket(socket), fast_path_(fast_path) {}
+
+int TurnInternalSocket::SendTo(const void* pv,
+                               size_t cb,
+                               const rtc::SocketAddress& addr,
+                               const rtc::PacketOptions& options) {
+  fast_path_->OnServerPacket(static_cast<const char*>(pv), cb, addr);
+  return ForwardingPacketSocket::SendTo(pv, cb, addr, options);
+}
+
+void TurnInternalSocket::OnReadPacket(rtc::AsyncPacketSocket* socket,
+                                      const char* data,
+                                      size_t size,
+                                      const rtc::SocketAddress& remote_address,
+                                      const rtc::PacketTime& packet_time) {
+  if (!fast_path_->OnClientPacket(this, data, size, remote_address)) {
+    ForwardingPacketSocket::OnReadPacket(socket, data, size, remote_address,
+                                         packet_time);
+  }
+}
+
+TurnFastPathSocketFactory::TurnFastPathSocketFactory(
+    rtc::PacketSocketFactory* factory,
+    TurnFastPath* fast_path)
+    : factory_(factory), fast_path_(fast_path) {}
+
+TurnFastPathSocketFactory::~TurnFastPathSocketFactory() = default;
+
+rtc::AsyncPacketSocket* TurnFastPathSocketFactory::CreateUdpSocket(
+    const rtc::SocketAddress& address,
+    uint16_t min_port,
+    uint16_t max_port) {
+  rtc::AsyncPacketSocket* socket =
+      factory_->CreateUdpSocket(address, min_port, max_port);
+  return socket ? new TurnRelaySocket(socket, fast_path_) : nullptr;
+}
+
+rtc::AsyncPacketSocket* TurnFastPathSocketFactory::CreateServerTcpSocket(
+    const rtc::SocketAddress& local_address,
+    uint16_t min_port,
+    uint16_t max_port,
+    int opts) {
+  return factory_->CreateServerTcpSocket(local_address, min_port, max_port,
+                                         opts);
+}
+
+rtc::AsyncPacketSocket* TurnFastPathSocketFactory::CreateClientTcpSocket(
+    const rtc::SocketAddress& local_address,
+    const rtc::SocketAddress& remote_address,
+    const rtc::ProxyInfo& proxy_info,
+    const std::string& user_agent,
+    int opts) {
+  return factory_->CreateClientTcpSocket(local_address, remote_address,
+                                         proxy_info, user_agent, opts);
+}
+
+rtc::AsyncResolverInterface* TurnFastPathSocketFactory::CreateAsyncResolver() {
+  return factory_->CreateAsyncResolver();
+}
+
+class ShardedTurnServer::Shard {
+ public:
+  explicit Shard(const Config& config)
+      : config_(config),
+        thread_(new rtc::Thread(std::unique_ptr<rtc::SocketServer>(
+            new rtc::PhysicalSocketServer()))) {
+    thread_->SetName("TurnShard", this);
+  }
+
+  ~Shard() { Stop(); }
+
+  bool Start() {
+    RTC_DCHECK(!started_);
+    thread_->Start();
+    started_ = true;
+    if (thread_->Invoke<bool>(RTC_FROM_HERE, [this] { return Init(); }))
+      return true;
+    Stop();
+    return false;
+  }
+
+  void Stop() {
+    if (!started_)
+      return;
+    thread_->Invoke<void>(RTC_FROM_HERE, [this] { server_.reset(); });
+    thread_->Stop();
+    started_ = false;
+  }
+
+  TurnFastPath::Stats GetStats() const { return fast_path_.GetStats(); }
+
+ private:
+  bool Init() {
+    rtc::PhysicalSocketServer* ss =
+        static_cast<rtc::PhysicalSocketServer*>(thread_->socketserver());
+    BatchedUdpSocket* socket =
+        ReusePortUdpSocket::Create(ss, config_.internal_address);
+    if (!socket)
+      return false;
+
+    server_.reset(new cricket::TurnServer(thread_.get()));
+    server_->set_realm(config_.realm);
+    server_->set_software(config_.software);
+    server_->set_auth_hook(config_.auth_hook);
+    server_->AddInternalSocket(new TurnInternalSocket(socket, &fast_path_),
+                               cricket::PROTO_UDP);
+    server_->SetExternalSocketFactory(
+        new TurnFastPathSocketFactory(new BatchedPacketSocketFactory(ss),
+                                      &fast_path_),
+        config_.external_address);
+    return true;
+  }
+
+  const Config& config_;
+  std::unique_ptr<rtc::Thread> thread_;
+  bool started_ = false;
+  // Outlives |server_|, whose relay sockets unregister from it.
+  TurnFastPath fast_path_;
+  std::unique_ptr<cricket::TurnServer> server_;
+};
+
+ShardedTurnServer::ShardedTurnServer(const Config& config) : config_(config) {
+  size_t num_shards = config_.num_shards;
+  if (num_shards == 0)
+    num_shards = std::max<uint32_t>(1, webrtc::CpuInfo::DetectNumberOfCores());
+  for (size_t i = 0; i < num_shards; ++i)
+    shards_.emplace_back(new Shard(config_));
+}
+
+ShardedTurnServer::~ShardedTurnServer() {
+  Stop();
+}
+
+bool ShardedTurnServer::Start() {
+  size_t started = 0;
+  for (const std::unique_ptr<Shard>& shard : shards_) {
+    if (shard->Start())
+      ++started;
+  }
+  if (started < shards_.size()) {
+    LOG(LS_WARNING) << "Only " << started << " of " << shards_.size()
+                    << " TURN shards could bind "
+                    << config_.internal_address.ToString();
+  }
+  return started > 0;
+}
+
+void ShardedTurnServer::Stop() {
+  for (const std::unique_ptr<Shard>& shard : shards_)
+    shard->Stop();
+}
+
+std::vector<TurnFastPath::Stats> ShardedTurnServer::GetStats() const {
+  std::vector<TurnFastPath::Stats> stats;
+  for (const std::unique_ptr<Shard>& shard : shards_)
+    stats.push_back(shard->GetStats());
+  return stats;
+}
+
+}  // namespace simple_app
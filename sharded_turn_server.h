@@ -0,0 +1,303 @@
+#ifndef SHARDED_TURN_SERVER_H_
+#define SHARDED_TURN_SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "p2p/base/packetsocketfactory.h"
+#include "p2p/base/turnserver.h"
+#include "rtc_base/asyncpacketsocket.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/socketaddress.h"
+#include "rtc_base/thread.h"
+
+namespace simple_app {
+
+// AsyncPacketSocket that owns another one and passes everything through, so
+// subclasses can look at or divert the traffic in between.
+class ForwardingPacketSocket : public rtc::AsyncPacketSocket {
+ public:
+  explicit ForwardingPacketSocket(rtc::AsyncPacketSocket* socket);
+  ~ForwardingPacketSocket() override;
+
+  rtc::SocketAddress GetLocalAddress() const override;
+  rtc::SocketAddress GetRemoteAddress() const override;
+  int Send(const void* pv,
+           size_t cb,
+           const rtc::PacketOptions& options) override;
+  int SendTo(const void* pv,
+             size_t cb,
+             const rtc::SocketAddress& addr,
+             const rtc::PacketOptions& options) override;
+  int Close() override;
+  State GetState() const override;
+  int GetOption(rtc::Socket::Option opt, int* value) override;
+  int SetOption(rtc::Socket::Option opt, int value) override;
+  int GetError() const override;
+  void SetError(int error) override;
+
+ protected:
+  // Re-emits SignalReadPacket by default.
+  virtual void OnReadPacket(rtc::AsyncPacketSocket* socket,
+                            const char* data,
+                            size_t size,
+                            const rtc::SocketAddress& remote_address,
+                            const rtc::PacketTime& packet_time);
+
+ private:
+  void OnSentPacket(rtc::AsyncPacketSocket* socket,
+                    const rtc::SentPacket& sent_packet);
+  void OnReadyToSend(rtc::AsyncPacketSocket* socket);
+  void OnClose(rtc::AsyncPacketSocket* socket, int error);
+
+  std::unique_ptr<rtc::AsyncPacketSocket> socket_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(ForwardingPacketSocket);
+};
+
+class TurnRelaySocket;
+
+// Relays ChannelData for channels that cricket::TurnServer has bound without
+// handing the packets to TurnServer, whose per-allocation permission and
+// channel lists are linear scans that also parse every packet as STUN first.
+//
+// TurnFastPath learns the bindings by watching the server's own traffic: a
+// ChannelBind request from a client is remembered by transaction id, and
+// becomes a route only when TurnServer answers it with a success response,
+// so authentication and validation stay with TurnServer. Routes live in hash
+// tables keyed by (client, channel) and (relay socket, peer), and expire
+// with the 5 minute permission the bind installed unless the client binds
+// again; after that, packets take the slow path until it does. Routes go
+// away with the allocation's relay socket.
+//
+// Single threaded: everything runs on the thread of the TurnServer.
+class TurnFastPath {
+ public:
+  struct Stats {
+    // ChannelData relayed client to peer and peer to client.
+    uint64_t to_peer = 0;
+    uint64_t to_client = 0;
+    // Packets handed to TurnServer.
+    uint64_t slow_path = 0;
+    uint64_t channels = 0;
+  };
+
+  TurnFastPath();
+  ~TurnFastPath();
+
+  // Packet from a client on an internal socket. Returns true if it was
+  // relayed and must not go to TurnServer.
+  bool OnClientPacket(rtc::AsyncPacketSocket* internal_socket,
+                      const char* data,
+                      size_t size,
+                      const rtc::SocketAddress& client);
+  // Packet TurnServer sends to a client.
+  void OnServerPacket(const char* data,
+                      size_t size,
+                      const rtc::SocketAddress& client);
+  // Packet from a peer on |relay|. Returns true if it was relayed.
+  bool OnPeerPacket(TurnRelaySocket* relay,
+                    const char* data,
+                    size_t size,
+                    const rtc::SocketAddress& peer);
+
+  void AddRelay(TurnRelaySocket* relay);
+  void RemoveRelay(TurnRelaySocket* relay);
+
+  // May be called from any thread.
+  Stats GetStats() const;
+
+ private:
+  struct AddressHash {
+    size_t operator()(const rtc::SocketAddress& address) const;
+  };
+  struct ChannelKey {
+    rtc::SocketAddress client;
+    uint16_t channel;
+    bool operator==(const ChannelKey& o) const {
+      return channel == o.channel && client == o.client;
+    }
+  };
+  struct ChannelKeyHash {
+    size_t operator()(const ChannelKey& key) const;
+  };
+  struct PeerKey {
+    const TurnRelaySocket* relay;
+    rtc::SocketAddress peer;
+    bool operator==(const PeerKey& o) const {
+      return relay == o.relay && peer == o.peer;
+    }
+  };
+  struct PeerKeyHash {
+    size_t operator()(const PeerKey& key) const;
+  };
+
+  struct ChannelRoute {
+    rtc::SocketAddress peer;
+    TurnRelaySocket* relay;
+    int64_t expires_ms;
+  };
+  struct PeerRoute {
+    rtc::SocketAddress client;
+    uint16_t channel;
+    rtc::AsyncPacketSocket* internal_socket;
+    int64_t expires_ms;
+  };
+  struct PendingBind {
+    rtc::SocketAddress client;
+    rtc::AsyncPacketSocket* internal_socket;
+    uint16_t channel;
+    rtc::SocketAddress peer;
+  };
+
+  void OnChannelBindRequest(rtc::AsyncPacketSocket* internal_socket,
+                            const char* data,
+                            size_t size,
+                            const rtc::SocketAddress& client);
+  void OnChannelBindResponse(const std::string& transaction_id,
+                             const rtc::SocketAddress& client);
+  void OnAllocateResponse(const char* data,
+                          size_t size,
+                          const rtc::SocketAddress& client);
+  // Drops both directions of the route of |client| on |channel|.
+  void EraseChannel(const ChannelKey& key);
+  static void Bump(std::atomic<uint64_t>* counter);
+
+  // Relay sockets by local address, to match XOR-RELAYED-ADDRESS.
+  std::unordered_map<rtc::SocketAddress, TurnRelaySocket*, AddressHash>
+      relays_;
+  // Relay socket of each client's allocation.
+  std::unordered_map<rtc::SocketAddress, TurnRelaySocket*, AddressHash>
+      allocations_;
+  std::unordered_map<ChannelKey, ChannelRoute, ChannelKeyHash> channels_;
+  std::unordered_map<PeerKey, PeerRoute, PeerKeyHash> peers_;
+  std::unordered_map<std::string, PendingBind> pending_binds_;
+  // Scratch buffer for ChannelData headed to clients.
+  std::vector<char> send_buffer_;
+
+  std::atomic<uint64_t> to_peer_{0};
+  std::atomic<uint64_t> to_client_{0};
+  std::atomic<uint64_t> slow_path_{0};
+  std::atomic<uint64_t> num_channels_{0};
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(TurnFastPath);
+};
+
+// Relay socket of one allocation, handed to TurnServer by
+// TurnFastPathSocketFactory.
+class TurnRelaySocket : public ForwardingPacketSocket {
+ public:
+  TurnRelaySocket(rtc::AsyncPacketSocket* socket, TurnFastPath* fast_path);
+  ~TurnRelaySocket() override;
+
+ protected:
+  void OnReadPacket(rtc::AsyncPacketSocket* socket,
+                    const char* data,
+                    size_t size,
+                    const rtc::SocketAddress& remote_address,
+                    const rtc::PacketTime& packet_time) override;
+
+ private:
+  TurnFastPath* const fast_path_;
+};
+
+// Internal (client facing) socket of a TurnServer.
+class TurnInternalSocket : public ForwardingPacketSocket {
+ public:
+  TurnInternalSocket(rtc::AsyncPacketSocket* socket, TurnFastPath* fast_path);
+
+  int SendTo(const void* pv,
+             size_t cb,
+             const rtc::SocketAddress& addr,
+             const rtc::PacketOptions& options) override;
+
+ protected:
+  void OnReadPacket(rtc::AsyncPacketSocket* socket,
+                    const char* data,
+                    size_t size,
+                    const rtc::SocketAddress& remote_address,
+                    const rtc::PacketTime& packet_time) override;
+
+ private:
+  TurnFastPath* const fast_path_;
+};
+
+// Wraps the UDP sockets of |factory| in TurnRelaySockets; everything else
+// comes from |factory| unchanged. Takes ownership of |factory|.
+class TurnFastPathSocketFactory : public rtc::PacketSocketFactory {
+ public:
+  TurnFastPathSocketFactory(rtc::PacketSocketFactory* factory,
+                            TurnFastPath* fast_path);
+  ~TurnFastPathSocketFactory() override;
+
+  rtc::AsyncPacketSocket* CreateUdpSocket(const rtc::SocketAddress& address,
+                                          uint16_t min_port,
+                                          uint16_t max_port) override;
+  rtc::AsyncPacketSocket* CreateServerTcpSocket(
+      const rtc::SocketAddress& local_address,
+      uint16_t min_port,
+      uint16_t max_port,
+      int opts) override;
+  rtc::AsyncPacketSocket* CreateClientTcpSocket(
+      const rtc::SocketAddress& local_address,
+      const rtc::SocketAddress& remote_address,
+      const rtc::ProxyInfo& proxy_info,
+      const std::string& user_agent,
+      int opts) override;
+  rtc::AsyncResolverInterface* CreateAsyncResolver() override;
+
+ private:
+  std::unique_ptr<rtc::PacketSocketFactory> factory_;
+  TurnFastPath* const fast_path_;
+};
+
+// UDP TURN server spread over several threads. Each shard is a thread with
+// its own cricket::TurnServer, TurnFastPath and UDP socket; all shards bind
+// the same address with SO_REUSEPORT, so the kernel hashes each client
+// 5-tuple to one shard and an allocation never crosses threads. Without
+// SO_REUSEPORT only the first shard can bind and the rest stay idle.
+class ShardedTurnServer {
+ public:
+  struct Config {
+    // Address clients send to.
+    rtc::SocketAddress internal_address;
+    // Address relay sockets are bound to; port 0 picks any port.
+    rtc::SocketAddress external_address;
+    std::string realm;
+    std::string software;
+    // Called on the shard threads, so it must be thread safe.
+    cricket::TurnAuthInterface* auth_hook = nullptr;
+    // Zero means one shard per core.
+    size_t num_shards = 0;
+  };
+
+  explicit ShardedTurnServer(const Config& config);
+  ~ShardedTurnServer();
+
+  // Returns false if no shard could bind the internal address.
+  bool Start();
+  void Stop();
+
+  size_t num_shards() const { return shards_.size(); }
+  // One entry per shard, so relayed packets per second per core can be
+  // derived by sampling twice.
+  std::vector<TurnFastPath::Stats> GetStats() const;
+
+ private:
+  class Shard;
+
+  const Config config_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(ShardedTurnServer);
+};
+
+}  // namespace simple_app
+
+#endif  // SHARDED_TURN_SERVER_H_
@@ -0,0 +1,433 @@
+#include "shared_udp_port_allocator.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <deque>
+#include <utility>
+
+#include "hmac_sha1_key.h"
+#include "p2p/base/stun.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/ipaddress.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/messagehandler.h"
+#include "stun_view.h"
+
+namespace simple_app {
+
+namespace {
+
+// Remote addresses remembered per port; the oldest is forgotten first.
+// Enough for every candidate pair of one session.
+const size_t kMaxAddressesPerPort = 32;
+
+}  // namespace
+
+// What a UDPPort sees as its socket. Sends go out through the shared socket;
+// packets come in through SharedUdpSocket::OnReadPacket(), which hands them
+// to the port directly. Close() leaves the shared socket open.
+class SharedUdpSocket::PortSocket : public rtc::AsyncPacketSocket {
+ public:
+  explicit PortSocket(SharedUdpSocket* owner) : owner_(owner) {}
+
+  rtc::SocketAddress GetLocalAddress() const override {
+    return owner_->socket_->GetLocalAddress();
+  }
+  rtc::SocketAddress GetRemoteAddress() const override {
+    return rtc::SocketAddress();
+  }
+  int Send(const void* /* data */,
+           size_t /* size */,
+           const rtc::PacketOptions& /* options */) override {
+    SetError(ENOTCONN);
+    return -1;
+  }
+  int SendTo(const void* data,
+             size_t size,
+             const rtc::SocketAddress& address,
+             const rtc::PacketOptions& options) override {
+    // Answers to our own checks come back from where they were sent.
+    owner_->Learn(address, this);
+    owner_->sending_ = this;
+    const int result = owner_->socket_->SendTo(data, size, address, options);
+    owner_->sending_ = nullptr;
+    return result;
+  }
+  int Close() override { return 0; }
+  State GetState() const override { return owner_->socket_->GetState(); }
+  int GetOption(rtc::Socket::Option option, int* value) override {
+    return owner_->socket_->GetOption(option, value);
+  }
+  int SetOption(rtc::Socket::Option option, int value) override {
+    return owner_->socket_->SetOption(option, value);
+  }
+  int GetError() const override { return owner_->socket_->GetError(); }
+  void SetError(int error) override { owner_->socket_->SetError(error); }
+
+  cricket::UDPPort* port = nullptr;
+  // Registered ufrag, empty if none, and its password's key.
+  std::string ufrag;
+  std::unique_ptr<HmacSha1Key> key;
+  // Learned remote addresses, oldest first. Some may since have moved to
+  // another port.
+  std::deque<rtc::SocketAddress> addresses;
+
+ private:
+  SharedUdpSocket* const owner_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(PortSocket);
+};
+
+size_t SharedUdpSocket::AddressHash::operator()(
+    const rtc::SocketAddress& address) const {
+  return rtc::HashIP(address.ipaddr()) * 31 + address.port();
+}
+
+// static
+std::unique_ptr<SharedUdpSocket> SharedUdpSocket::Create(
+    rtc::PacketSocketFactory* factory,
+    const rtc::SocketAddress& address) {
+  rtc::AsyncPacketSocket* socket =
+      factory->CreateUdpSocket(address, address.port(), address.port());
+  if (!socket) {
+    LOG(LS_ERROR) << "Failed to bind shared UDP socket to "
+                  << address.ToString();
+    return nullptr;
+  }
+  const rtc::IPAddress& ip = address.ipaddr();
+  const int prefix_length = ip.family() == AF_INET6 ? 128 : 32;
+  rtc::Network* network = new rtc::Network(
+      "shared-udp-" + ip.ToString(), "Shared UDP socket", ip, prefix_length);
+  network->AddIP(rtc::InterfaceAddress(ip));
+  return std::unique_ptr<SharedUdpSocket>(
+      new SharedUdpSocket(socket, network));
+}
+
+SharedUdpSocket::SharedUdpSocket(rtc::AsyncPacketSocket* socket,
+                                 rtc::Network* network)
+    : socket_(socket), network_(network), address_(socket->GetLocalAddress()) {
+  socket_->SignalReadPacket.connect(this, &SharedUdpSocket::OnReadPacket);
+  socket_->SignalSentPacket.connect(this, &SharedUdpSocket::OnSentPacket);
+  socket_->SignalReadyToSend.connect(this, &SharedUdpSocket::OnReadyToSend);
+}
+
+SharedUdpSocket::~SharedUdpSocket() {
+  RTC_DCHECK(ports_.empty());
+}
+
+cricket::UDPPort* SharedUdpSocket::CreatePort(
+    rtc::Thread* thread,
+    rtc::PacketSocketFactory* factory,
+    const std::string& ice_ufrag,
+    const std::string& ice_pwd,
+    const std::string& origin) {
+  std::unique_ptr<PortSocket> port_socket(new PortSocket(this));
+  cricket::UDPPort* port =
+      cricket::UDPPort::Create(thread, factory, network_.get(),
+                               port_socket.get(), ice_ufrag, ice_pwd, origin,
+                               false /* emit_local_for_anyaddress */);
+  if (!port)
+    return nullptr;
+  port_socket->port = port;
+  RegisterUfrag(port_socket.get());
+  ports_[port] = std::move(port_socket);
+  return port;
+}
+
+void SharedUdpSocket::RemovePort(cricket::UDPPort* port) {
+  auto it = ports_.find(port);
+  if (it == ports_.end())
+    return;
+  PortSocket* port_socket = it->second.get();
+  UnregisterUfrag(port_socket);
+  Forget(port_socket);
+  if (sending_ == port_socket)
+    sending_ = nullptr;
+  ports_.erase(it);
+}
+
+void SharedUdpSocket::UpdatePort(cricket::UDPPort* port) {
+  auto it = ports_.find(port);
+  if (it == ports_.end())
+    return;
+  PortSocket* port_socket = it->second.get();
+  UnregisterUfrag(port_socket);
+  RegisterUfrag(port_socket);
+}
+
+SharedUdpSocket::Stats SharedUdpSocket::GetStats() const {
+  Stats stats = stats_;
+  stats.ports = ports_.size();
+  stats.addresses = ports_by_address_.size();
+  return stats;
+}
+
+void SharedUdpSocket::OnReadPacket(rtc::AsyncPacketSocket* /* socket */,
+                                   const char* data,
+                                   size_t size,
+                                   const rtc::SocketAddress& remote_address,
+                                   const rtc::PacketTime& packet_time) {
+  // RTP, RTCP and most of a session's traffic starts with 0b10; only STUN
+  // and DTLS start with 0b00, and only STUN requests can carry a USERNAME.
+  PortSocket* port_socket = nullptr;
+  if (size >= cricket::kStunHeaderSize && (data[0] & 0xC0) == 0) {
+    port_socket = FindByUsername(data, size);
+    if (port_socket) {
+      Learn(remote_address, port_socket);
+      ++stats_.routed_by_ufrag;
+    }
+  }
+  if (!port_socket) {
+    auto it = ports_by_address_.find(remote_address);
+    if (it == ports_by_address_.end()) {
+      ++stats_.dropped;
+      return;
+    }
+    port_socket = it->second;
+    ++stats_.routed_by_address;
+  }
+  port_socket->port->HandleIncomingPacket(port_socket, data, size,
+                                          remote_address, packet_time);
+}
+
+void SharedUdpSocket::OnSentPacket(rtc::AsyncPacketSocket* /* socket */,
+                                   const rtc::SentPacket& sent_packet) {
+  if (sending_)
+    sending_->SignalSentPacket(sending_, sent_packet);
+}
+
+void SharedUdpSocket::OnReadyToSend(
+    rtc::AsyncPacketSocket* /* socket */) {
+  for (const auto& entry : ports_)
+    entry.second->SignalReadyToSend(entry.second.get());
+}
+
+SharedUdpSocket::PortSocket* SharedUdpSocket::FindByUsername(const char* data,
+                                                             size_t size) {
+  StunView request;
+  if (!request.Parse(data, size) ||
+      request.type() != cricket::STUN_BINDING_REQUEST) {
+    return nullptr;
+  }
+  const char* username;
+  size_t username_length;
+  if (!request.GetByteString(cricket::STUN_ATTR_USERNAME, &username,
+                             &username_length)) {
+    return nullptr;
+  }
+  // "<our ufrag>:<their ufrag>"
+  const char* colon =
+      static_cast<const char*>(memchr(username, ':', username_length));
+  if (!colon)
+    return nullptr;
+  auto it = ports_by_ufrag_.find(std::string(username, colon - username));
+  if (it == ports_by_ufrag_.end())
+    return nullptr;
+  // Unchecked, a forged request could steer another peer's media to the
+  // wrong session.
+  if (!request.ValidateMessageIntegrity(*it->second->key))
+    return nullptr;
+  return it->second;
+}
+
+void SharedUdpSocket::RegisterUfrag(PortSocket* port_socket) {
+  const std::string ufrag = port_socket->port->username_fragment();
+  // A pooled session has no credentials until it is taken.
+  if (ufrag.empty())
+    return;
+  auto result = ports_by_ufrag_.insert(std::make_pair(ufrag, port_socket));
+  if (!result.second) {
+    LOG(LS_WARNING) << "ufrag " << ufrag << " is already in use on "
+                    << address_.ToString() << "; ignoring the new port.";
+    return;
+  }
+  port_socket->ufrag = ufrag;
+  port_socket->key.reset(new HmacSha1Key(port_socket->port->password()));
+}
+
+void SharedUdpSocket::UnregisterUfrag(PortSocket* port_socket) {
+  if (port_socket->ufrag.empty())
+    return;
+  ports_by_ufrag_.erase(port_socket->ufrag);
+  port_socket->ufrag.clear();
+  port_socket->key.reset();
+}
+
+void SharedUdpSocket::Learn(const rtc::SocketAddress& address,
+                            PortSocket* port_socket) {
+  PortSocket*& owner = ports_by_address_[address];
+  if (owner == port_socket)
+    return;
+  owner = port_socket;
+  std::deque<rtc::SocketAddress>& addresses = port_socket->addresses;
+  addresses.push_back(address);
+  if (addresses.size() > kMaxAddressesPerPort) {
+    auto it = ports_by_address_.find(addresses.front());
+    if (it != ports_by_address_.end() && it->second == port_socket)
+      ports_by_address_.erase(it);
+    addresses.pop_front();
+  }
+}
+
+void SharedUdpSocket::Forget(PortSocket* port_socket) {
+  for (const rtc::SocketAddress& address : port_socket->addresses) {
+    auto it = ports_by_address_.find(address);
+    if (it != ports_by_address_.end() && it->second == port_socket)
+      ports_by_address_.erase(it);
+  }
+  port_socket->addresses.clear();
+}
+
+namespace {
+
+// Gathers, asynchronously as PortAllocatorSessions do, one host candidate
+// per shared socket.
+class SharedUdpPortAllocatorSession : public cricket::PortAllocatorSession,
+                                      public rtc::MessageHandler {
+ public:
+  SharedUdpPortAllocatorSession(SharedUdpPortAllocator* allocator,
+                                const std::string& content_name,
+                                int component,
+                                const std::string& ice_ufrag,
+                                const std::string& ice_pwd)
+      : cricket::PortAllocatorSession(content_name,
+                                      component,
+                                      ice_ufrag,
+                                      ice_pwd,
+                                      allocator->flags()),
+        allocator_(allocator) {}
+
+  ~SharedUdpPortAllocatorSession() override {
+    allocator_->network_thread()->Clear(this);
+    for (const PortEntry& entry : ports_) {
+      entry.socket->RemovePort(entry.port);
+      delete entry.port;
+    }
+  }
+
+  // cricket::PortAllocatorSession:
+  void SetCandidateFilter(uint32_t filter) override {
+    candidate_filter_ = filter;
+  }
+  void StartGettingPorts() override {
+    if (getting_ports_ || allocated_)
+      return;
+    getting_ports_ = true;
+    stopped_ = false;
+    allocator_->network_thread()->Post(RTC_FROM_HERE, this);
+  }
+  void StopGettingPorts() override {
+    ClearGettingPorts();
+    stopped_ = true;
+  }
+  bool IsGettingPorts() override { return getting_ports_; }
+  void ClearGettingPorts() override {
+    allocator_->network_thread()->Clear(this);
+    getting_ports_ = false;
+  }
+  bool IsStopped() const override { return stopped_; }
+  std::vector<cricket::PortInterface*> ReadyPorts() const override {
+    std::vector<cricket::PortInterface*> ports;
+    for (const PortEntry& entry : ports_)
+      ports.push_back(entry.port);
+    return ports;
+  }
+  std::vector<cricket::Candidate> ReadyCandidates() const override {
+    std::vector<cricket::Candidate> candidates;
+    if (!(candidate_filter_ & cricket::CF_HOST))
+      return candidates;
+    for (const PortEntry& entry : ports_) {
+      const std::vector<cricket::Candidate>& port_candidates =
+          entry.port->Candidates();
+      candidates.insert(candidates.end(), port_candidates.begin(),
+                        port_candidates.end());
+    }
+    return candidates;
+  }
+  bool CandidatesAllocationDone() const override { return allocated_; }
+  void PruneAllPorts() override {
+    for (const PortEntry& entry : ports_)
+      entry.port->Prune();
+  }
+
+ protected:
+  void UpdateIceParametersInternal() override {
+    for (const PortEntry& entry : ports_) {
+      entry.port->SetIceParameters(component(), ice_ufrag(), ice_pwd());
+      entry.socket->UpdatePort(entry.port);
+    }
+  }
+
+ private:
+  struct PortEntry {
+    cricket::UDPPort* port;
+    SharedUdpSocket* socket;
+  };
+
+  // rtc::MessageHandler:
+  void OnMessage(rtc::Message* /* msg */) override {
+    getting_ports_ = false;
+    allocated_ = true;
+    for (SharedUdpSocket* socket : allocator_->sockets()) {
+      cricket::UDPPort* port = socket->CreatePort(
+          allocator_->network_thread(), allocator_->socket_factory(),
+          ice_ufrag(), ice_pwd(), allocator_->origin());
+      if (!port)
+        continue;
+      port->set_content_name(content_name());
+      port->set_component(component());
+      port->set_generation(generation());
+      port->KeepAliveUntilPruned();
+      port->SignalDestroyed.connect(
+          this, &SharedUdpPortAllocatorSession::OnPortDestroyed);
+      ports_.push_back(PortEntry{port, socket});
+      // The shared socket is bound, so this fills in the candidate at once.
+      port->PrepareAddress();
+      SignalPortReady(this, port);
+      if (candidate_filter_ & cricket::CF_HOST)
+        SignalCandidatesReady(this, port->Candidates());
+    }
+    SignalCandidatesAllocationDone(this);
+  }
+
+  void OnPortDestroyed(cricket::PortInterface* port) {
+    for (auto it = ports_.begin(); it != ports_.end(); ++it) {
+      if (it->port == port) {
+        it->socket->RemovePort(it->port);
+        ports_.erase(it);
+        return;
+      }
+    }
+  }
+
+  SharedUdpPortAllocator* const allocator_;
+  uint32_t candidate_filter_ = cricket::CF_ALL;
+  bool getting_ports_ = false;
+  bool allocated_ = false;
+  bool stopped_ = false;
+  std::vector<PortEntry> ports_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(SharedUdpPortAllocatorSession);
+};
+
+}  // namespace
+
+SharedUdpPortAllocator::SharedUdpPortAllocator(
+    rtc::Thread* network_thread,
+    rtc::PacketSocketFactory* factory,
+    const std::vector<SharedUdpSocket*>& sockets)
+    : network_thread_(network_thread), factory_(factory), sockets_(sockets) {}
+
+SharedUdpPortAllocator::~SharedUdpPortAllocator() {}
+
+cricket::PortAllocatorSession* SharedUdpPortAllocator::CreateSessionInternal(
+    const std::string& content_name,
+    int component,
+    const std::string& ice_ufrag,
+    const std::string& ice_pwd) {
+  return new SharedUdpPortAllocatorSession(this, content_name, component,
+                                           ice_ufrag, ice_pwd);
+}
+
+}  // namespace simple_app
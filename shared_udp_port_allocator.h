@@ -0,0 +1,150 @@
+#ifndef SHARED_UDP_PORT_ALLOCATOR_H_
+#define SHARED_UDP_PORT_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "p2p/base/packetsocketfactory.h"
+#include "p2p/base/portallocator.h"
+#include "p2p/base/stunport.h"
+#include "rtc_base/asyncpacketsocket.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/network.h"
+#include "rtc_base/sigslot.h"
+#include "rtc_base/socketaddress.h"
+#include "rtc_base/thread.h"
+
+namespace simple_app {
+
+// One bound UDP socket that the host UDPPorts of many ICE sessions share,
+// so a server with thousands of PeerConnections uses one port and one file
+// descriptor per interface rather than one per session.
+//
+// Each port gets a thin AsyncPacketSocket of its own that sends through the
+// shared socket. Incoming packets are demultiplexed to ports:
+//  - a STUN request goes to the port whose ufrag starts its USERNAME, once
+//    its MESSAGE-INTEGRITY checks out against that port's password, and
+//    the sender's address is remembered for that port;
+//  - anything else goes to the port that last got a request from the same
+//    address, and is dropped if there is none.
+// Ports then find their Connection by address, as usual.
+//
+// A PeerConnection has to bundle and multiplex RTCP so it needs a single
+// ICE transport, since two ports with the same ufrag can't be told apart.
+// Ports share socket options, so a DSCP set by one applies to all. Used on
+// the network thread only.
+class SharedUdpSocket : public sigslot::has_slots<> {
+ public:
+  struct Stats {
+    uint64_t routed_by_ufrag = 0;
+    uint64_t routed_by_address = 0;
+    // No port for the packet, or a STUN request that failed its check.
+    uint64_t dropped = 0;
+    size_t ports = 0;
+    size_t addresses = 0;
+  };
+
+  // Binds |address| through |factory|. It becomes the candidate address, so
+  // it must be an interface address, not the any address. Returns null if
+  // binding fails.
+  static std::unique_ptr<SharedUdpSocket> Create(
+      rtc::PacketSocketFactory* factory,
+      const rtc::SocketAddress& address);
+  ~SharedUdpSocket() override;
+
+  // Creates a host UDPPort on this socket for an ICE session, or returns
+  // null. The caller owns the port and calls RemovePort() before deleting
+  // it, or when it fires SignalDestroyed.
+  cricket::UDPPort* CreatePort(rtc::Thread* thread,
+                               rtc::PacketSocketFactory* factory,
+                               const std::string& ice_ufrag,
+                               const std::string& ice_pwd,
+                               const std::string& origin);
+  void RemovePort(cricket::UDPPort* port);
+  // Call after port->SetIceParameters().
+  void UpdatePort(cricket::UDPPort* port);
+
+  const rtc::SocketAddress& address() const { return address_; }
+  Stats GetStats() const;
+
+ private:
+  class PortSocket;
+  struct AddressHash {
+    size_t operator()(const rtc::SocketAddress& address) const;
+  };
+
+  SharedUdpSocket(rtc::AsyncPacketSocket* socket, rtc::Network* network);
+
+  void OnReadPacket(rtc::AsyncPacketSocket* socket,
+                    const char* data,
+                    size_t size,
+                    const rtc::SocketAddress& remote_address,
+                    const rtc::PacketTime& packet_time);
+  void OnSentPacket(rtc::AsyncPacketSocket* socket,
+                    const rtc::SentPacket& sent_packet);
+  void OnReadyToSend(rtc::AsyncPacketSocket* socket);
+  // Port for a STUN request in |data|, checked against its ufrag and
+  // password, or null.
+  PortSocket* FindByUsername(const char* data, size_t size);
+  void RegisterUfrag(PortSocket* port_socket);
+  void UnregisterUfrag(PortSocket* port_socket);
+  void Learn(const rtc::SocketAddress& address, PortSocket* port_socket);
+  void Forget(PortSocket* port_socket);
+
+  std::unique_ptr<rtc::AsyncPacketSocket> socket_;
+  std::unique_ptr<rtc::Network> network_;
+  const rtc::SocketAddress address_;
+  std::unordered_map<cricket::UDPPort*, std::unique_ptr<PortSocket>> ports_;
+  std::unordered_map<std::string, PortSocket*> ports_by_ufrag_;
+  std::unordered_map<rtc::SocketAddress, PortSocket*, AddressHash>
+      ports_by_address_;
+  // The port socket inside a SendTo(), which gets the SignalSentPacket the
+  // shared socket fires from it.
+  PortSocket* sending_ = nullptr;
+  Stats stats_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(SharedUdpSocket);
+};
+
+// PortAllocator whose sessions gather one host candidate per
+// SharedUdpSocket and nothing else: no STUN or TURN servers, no TCP, no
+// per-session sockets. Meant for servers, typically acting as ICE-lite
+// agents with public addresses; create one per PeerConnection over the
+// same sockets, which must outlive it.
+class SharedUdpPortAllocator : public cricket::PortAllocator {
+ public:
+  SharedUdpPortAllocator(rtc::Thread* network_thread,
+                         rtc::PacketSocketFactory* factory,
+                         const std::vector<SharedUdpSocket*>& sockets);
+  ~SharedUdpPortAllocator() override;
+
+  // cricket::PortAllocator:
+  void SetNetworkIgnoreMask(int /* network_ignore_mask */) override {}
+
+  rtc::Thread* network_thread() const { return network_thread_; }
+  rtc::PacketSocketFactory* socket_factory() const { return factory_; }
+  const std::vector<SharedUdpSocket*>& sockets() const { return sockets_; }
+
+ protected:
+  cricket::PortAllocatorSession* CreateSessionInternal(
+      const std::string& content_name,
+      int component,
+      const std::string& ice_ufrag,
+      const std::string& ice_pwd) override;
+
+ private:
+  rtc::Thread* const network_thread_;
+  rtc::PacketSocketFactory* const factory_;
+  const std::vector<SharedUdpSocket*> sockets_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(SharedUdpPortAllocator);
+};
+
+}  // namespace simple_app
+
+#endif  // SHARED_UDP_PORT_ALLOCATOR_H_
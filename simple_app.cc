@@ -1,9 +1,12 @@
 #include "rtc_base/thread.h"
+#include "rtc_base/physicalsocketserver.h"
 #include "p2p/base/basicpacketsocketfactory.h"
 #include "api/peerconnectioninterface.h"
 #include "api/test/fakeconstraints.h"
 #include "media/engine/webrtcvideocapturerfactory.h"
 
+#include "io_uring_udp_socket.h"
+
 int main(int argc, char* argv[]) {
   // something from base
   rtc::Thread* thread = rtc::Thread::Current();
@@ -12,6 +15,20 @@ int main(int argc, char* argv[]) {
   std::unique_ptr<rtc::BasicPacketSocketFactory> socket_factory(
     new rtc::BasicPacketSocketFactory());
 
+  // udp sockets that read through io_uring, or in recvmmsg batches when the
+  // kernel has no io_uring. the factory takes the socket server of the
+  // network thread that runs its sockets; they get no events otherwise, and
+  // it is created, used and destroyed on that thread.
+  rtc::PhysicalSocketServer network_socket_server;
+  rtc::Thread network_thread(&network_socket_server);
+  network_thread.Start();
+  std::unique_ptr<simple_app::IoUringPacketSocketFactory>
+    io_uring_socket_factory;
+  network_thread.Invoke<void>(RTC_FROM_HERE, [&] {
+    io_uring_socket_factory.reset(
+      new simple_app::IoUringPacketSocketFactory(&network_socket_server));
+  });
+
   // something from api
   rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>
     peer_connection_factory = webrtc::CreatePeerConnectionFactory();
@@ -23,5 +40,8 @@ int main(int argc, char* argv[]) {
   cricket::WebRtcVideoDeviceCapturerFactory factory;
   std::unique_ptr<cricket::VideoCapturer> capturer = factory.Create(cricket::Device("", 0));
 
+  network_thread.Invoke<void>(RTC_FROM_HERE,
+                              [&] { io_uring_socket_factory.reset(); });
+  network_thread.Stop();
   return 0;
 }
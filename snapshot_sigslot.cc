@@ -0,0 +1,193 @@
+#include "snapshot_sigslot.h"
+
+#include <thread>
+
+namespace simple_app {
+
+SnapshotSignalBase::SnapshotSignalBase()
+    : sigslot::_signal_base_interface(&SnapshotSignalBase::do_slot_disconnect,
+                                      &SnapshotSignalBase::do_slot_duplicate),
+      snapshot_(nullptr),
+      epoch_(0) {
+  emitting_[0].store(0);
+  emitting_[1].store(0);
+}
+
+SnapshotSignalBase::SnapshotSignalBase(const SnapshotSignalBase& o)
+    : sigslot::_signal_base_interface(&SnapshotSignalBase::do_slot_disconnect,
+                                      &SnapshotSignalBase::do_slot_duplicate),
+      snapshot_(nullptr),
+      epoch_(0) {
+  emitting_[0].store(0);
+  emitting_[1].store(0);
+  sigslot::lock_block<snapshot_threaded> lock(this);
+  for (const Slot* slot : o.slots_) {
+    slot->connection.getdest()->signal_connect(this);
+    slots_.push_back(new Slot(slot->connection));
+  }
+  publish();
+}
+
+SnapshotSignalBase::~SnapshotSignalBase() {
+  disconnect_all();
+  sigslot::lock_block<snapshot_threaded> lock(this);
+  reclaim();
+}
+
+bool SnapshotSignalBase::is_empty() {
+  sigslot::lock_block<snapshot_threaded> lock(this);
+  return slots_.empty();
+}
+
+void SnapshotSignalBase::disconnect_all() {
+  std::vector<sigslot::has_slots_interface*> dests;
+  {
+    sigslot::lock_block<snapshot_threaded> lock(this);
+    if (slots_.empty())
+      return;
+    for (Slot* slot : slots_) {
+      slot->connected.store(false, std::memory_order_release);
+      dests.push_back(slot->connection.getdest());
+      retired_slots_.push_back(slot);
+    }
+    slots_.clear();
+    publish();
+  }
+  for (sigslot::has_slots_interface* pdest : dests)
+    pdest->signal_disconnect(this);
+  wait_for_emitters();
+}
+
+#if !defined(NDEBUG)
+bool SnapshotSignalBase::connected(sigslot::has_slots_interface* pclass) {
+  sigslot::lock_block<snapshot_threaded> lock(this);
+  for (const Slot* slot : slots_) {
+    if (slot->connection.getdest() == pclass)
+      return true;
+  }
+  return false;
+}
+#endif
+
+void SnapshotSignalBase::disconnect(sigslot::has_slots_interface* pclass) {
+  {
+    sigslot::lock_block<snapshot_threaded> lock(this);
+    if (remove_slots(pclass, true) == 0)
+      return;
+  }
+  pclass->signal_disconnect(this);
+  wait_for_emitters();
+}
+
+void SnapshotSignalBase::add_connection(
+    const sigslot::_opaque_connection& connection) {
+  sigslot::lock_block<snapshot_threaded> lock(this);
+  slots_.push_back(new Slot(connection));
+  publish();
+}
+
+// static
+void SnapshotSignalBase::do_slot_disconnect(
+    sigslot::_signal_base_interface* p,
+    sigslot::has_slots_interface* pslot) {
+  SnapshotSignalBase* const self = static_cast<SnapshotSignalBase*>(p);
+  {
+    sigslot::lock_block<snapshot_threaded> lock(self);
+    if (self->remove_slots(pslot, false) == 0)
+      return;
+  }
+  // Called from ~has_slots(), so the slot object is about to go away.
+  self->wait_for_emitters();
+}
+
+// static
+void SnapshotSignalBase::do_slot_duplicate(
+    sigslot::_signal_base_interface* p,
+    const sigslot::has_slots_interface* oldtarget,
+    sigslot::has_slots_interface* newtarget) {
+  SnapshotSignalBase* const self = static_cast<SnapshotSignalBase*>(p);
+  sigslot::lock_block<snapshot_threaded> lock(self);
+  const size_t count = self->slots_.size();
+  for (size_t i = 0; i < count; ++i) {
+    const Slot* slot = self->slots_[i];
+    if (slot->connection.getdest() == oldtarget)
+      self->slots_.push_back(new Slot(slot->connection.duplicate(newtarget)));
+  }
+  if (self->slots_.size() != count)
+    self->publish();
+}
+
+int SnapshotSignalBase::remove_slots(sigslot::has_slots_interface* pclass,
+                                     bool first_only) {
+  int removed = 0;
+  for (auto it = slots_.begin(); it != slots_.end();) {
+    Slot* slot = *it;
+    if (slot->connection.getdest() != pclass) {
+      ++it;
+      continue;
+    }
+    slot->connected.store(false, std::memory_order_release);
+    retired_slots_.push_back(slot);
+    it = slots_.erase(it);
+    ++removed;
+    if (first_only)
+      break;
+  }
+  if (removed > 0)
+    publish();
+  return removed;
+}
+
+void SnapshotSignalBase::publish() {
+  Snapshot* snapshot = nullptr;
+  if (!slots_.empty()) {
+    snapshot = new Snapshot();
+    snapshot->slots = slots_;
+  }
+  Snapshot* previous = snapshot_.exchange(snapshot);
+  if (previous)
+    retired_snapshots_.push_back(previous);
+  reclaim();
+}
+
+void SnapshotSignalBase::reclaim() {
+  // An emit bumps its count before it loads |snapshot_|, so once both counts
+  // read zero after the swap, later emits only see the new snapshot.
+  if (emitting_[0].load() != 0 || emitting_[1].load() != 0)
+    return;
+  for (Snapshot* snapshot : retired_snapshots_)
+    delete snapshot;
+  retired_snapshots_.clear();
+  for (Slot* slot : retired_slots_)
+    delete slot;
+  retired_slots_.clear();
+}
+
+void SnapshotSignalBase::wait_for_emitters() {
+  for (const EmitScope* scope = EmitScope::current_scope(); scope;
+       scope = scope->outer_) {
+    if (scope->signal_ == this)
+      return;
+  }
+
+  rtc::CritScope grace(&grace_crit_);
+  std::vector<Snapshot*> snapshots;
+  std::vector<Slot*> slots;
+  {
+    sigslot::lock_block<snapshot_threaded> lock(this);
+    snapshots.swap(retired_snapshots_);
+    slots.swap(retired_slots_);
+  }
+  // Emits that start in the new epoch load |snapshot_| after these were
+  // retired, so only those counted against the previous one can see them.
+  const unsigned previous = epoch_.fetch_add(1);
+  while (emitting_[previous & 1].load() != 0)
+    std::this_thread::yield();
+
+  for (Snapshot* snapshot : snapshots)
+    delete snapshot;
+  for (Slot* slot : slots)
+    delete slot;
+}
+
+}  // namespace simple_app
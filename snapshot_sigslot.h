@@ -0,0 +1,177 @@
+#ifndef SNAPSHOT_SIGSLOT_H_
+#define SNAPSHOT_SIGSLOT_H_
+
+#include <atomic>
+#include <vector>
+
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/criticalsection.h"
+#include "rtc_base/sigslot.h"
+
+namespace simple_app {
+
+// sigslot thread policy for signals that are emitted on a hot path while
+// other threads may connect or disconnect, e.g.
+//
+//   sigslot::signal1<rtc::AsyncSocket*, simple_app::snapshot_threaded>
+//
+// Connect and disconnect copy the slot list under a mutex and publish the
+// copy with an atomic pointer swap; emit() iterates the published snapshot
+// without taking any lock. The mutex inherited from multi_threaded_local only
+// serializes the writers.
+//
+// Disconnect is deferred rather than blocking emission: the slot is flagged
+// so emits already iterating an older snapshot skip it, and the old snapshot
+// is freed once the emits that could see it are done. A disconnect from
+// another thread returns only after the emits that started before it have
+// finished, so the slot object may be destroyed right after, as with the
+// locking policies; emits that start later are not waited for, so steady
+// emission elsewhere cannot hold it up. A disconnect made from inside an
+// emit of the same signal does not wait, since that emit may be the one it
+// would wait for.
+class snapshot_threaded : public sigslot::multi_threaded_local {};
+
+// Argument-independent part of
+// sigslot::signal_with_thread_policy<snapshot_threaded, ...>.
+class SnapshotSignalBase : public sigslot::_signal_base_interface,
+                           public snapshot_threaded {
+ public:
+  bool is_empty();
+  void disconnect_all();
+#if !defined(NDEBUG)
+  bool connected(sigslot::has_slots_interface* pclass);
+#endif
+  void disconnect(sigslot::has_slots_interface* pclass);
+
+ protected:
+  struct Slot {
+    explicit Slot(const sigslot::_opaque_connection& connection)
+        : connection(connection), connected(true) {}
+
+    const sigslot::_opaque_connection connection;
+    // Cleared on disconnect; emits that still see the slot skip it.
+    std::atomic<bool> connected;
+  };
+
+  struct Snapshot {
+    std::vector<Slot*> slots;
+  };
+
+  // Counts the calling thread as emitting |signal| while in scope and pins
+  // the snapshot it iterates.
+  class EmitScope {
+   public:
+    explicit EmitScope(SnapshotSignalBase* signal)
+        : signal_(signal), outer_(current_scope()) {
+      // Counts against the current epoch's parity. Retries if a waiter
+      // moved to the next epoch meanwhile, so that once a waiter has
+      // advanced the epoch, no new emit joins the count it waits on.
+      while (true) {
+        const unsigned epoch = signal_->epoch_.load();
+        parity_ = epoch & 1;
+        signal_->emitting_[parity_].fetch_add(1);
+        if (signal_->epoch_.load() == epoch)
+          break;
+        signal_->emitting_[parity_].fetch_sub(1);
+      }
+      current_scope() = this;
+      snapshot_ = signal_->snapshot_.load();
+    }
+    ~EmitScope() {
+      current_scope() = outer_;
+      signal_->emitting_[parity_].fetch_sub(1, std::memory_order_release);
+    }
+
+    // Null when nothing is connected.
+    const Snapshot* snapshot() const { return snapshot_; }
+
+   private:
+    friend class SnapshotSignalBase;
+
+    static const EmitScope*& current_scope() {
+      static thread_local const EmitScope* scope = nullptr;
+      return scope;
+    }
+
+    SnapshotSignalBase* const signal_;
+    const EmitScope* const outer_;
+    unsigned parity_;
+    const Snapshot* snapshot_;
+
+    RTC_DISALLOW_COPY_AND_ASSIGN(EmitScope);
+  };
+
+  SnapshotSignalBase();
+  SnapshotSignalBase(const SnapshotSignalBase& o);
+  ~SnapshotSignalBase();
+
+  void add_connection(const sigslot::_opaque_connection& connection);
+
+ private:
+  SnapshotSignalBase& operator=(const SnapshotSignalBase&);
+
+  static void do_slot_disconnect(sigslot::_signal_base_interface* p,
+                                 sigslot::has_slots_interface* pslot);
+  static void do_slot_duplicate(sigslot::_signal_base_interface* p,
+                                const sigslot::has_slots_interface* oldtarget,
+                                sigslot::has_slots_interface* newtarget);
+
+  // The following three must be called with the writer lock held.
+  // Flags and drops the slots going to |pclass|, only the first one if
+  // |first_only|. Returns how many were dropped.
+  int remove_slots(sigslot::has_slots_interface* pclass, bool first_only);
+  // Swaps in a snapshot of |slots_| and retires the previous one.
+  void publish();
+  // Frees retired slots and snapshots if no emit can still see them.
+  void reclaim();
+
+  // Returns once emits on other threads that started before the call are
+  // done, and frees what was retired before it. Must be called without the
+  // writer lock.
+  void wait_for_emitters();
+
+  std::vector<Slot*> slots_;
+  std::atomic<Snapshot*> snapshot_;
+  // Running emits, by the parity of the epoch they started in. A waiter
+  // advances |epoch_| and waits for the previous parity's count to drain;
+  // |grace_crit_| keeps a second waiter from advancing it again meanwhile.
+  std::atomic<unsigned> epoch_;
+  std::atomic<int> emitting_[2];
+  rtc::CriticalSection grace_crit_;
+  std::vector<Slot*> retired_slots_;
+  std::vector<Snapshot*> retired_snapshots_;
+};
+
+}  // namespace simple_app
+
+namespace sigslot {
+
+template <typename... Args>
+class signal_with_thread_policy<simple_app::snapshot_threaded, Args...>
+    : public simple_app::SnapshotSignalBase {
+ public:
+  signal_with_thread_policy() {}
+
+  template <class desttype>
+  void connect(desttype* pclass, void (desttype::*pmemfun)(Args...)) {
+    this->add_connection(_opaque_connection(pclass, pmemfun));
+    pclass->signal_connect(static_cast<_signal_base_interface*>(this));
+  }
+
+  void emit(Args... args) {
+    EmitScope scope(this);
+    const Snapshot* snapshot = scope.snapshot();
+    if (!snapshot)
+      return;
+    for (const Slot* slot : snapshot->slots) {
+      if (slot->connected.load(std::memory_order_acquire))
+        slot->connection.emit<Args...>(args...);
+    }
+  }
+
+  void operator()(Args... args) { emit(args...); }
+};
+
+}  // namespace sigslot
+
+#endif  // SNAPSHOT_SIGSLOT_H_
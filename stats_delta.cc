@@ -0,0 +1,615 @@
+#include "stats_delta.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <utility>
+
+#include "api/stats/rtcstats_objects.h"
+#include "json_number.h"
+#include "rtc_base/byteorder.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/refcountedobject.h"
+
+namespace simple_app {
+
+namespace {
+
+typedef webrtc::RTCStatsMemberInterface Member;
+
+const uint8_t kVersion = 1;
+const uint64_t kFlagSnapshot = 1;
+
+enum RecordTag : uint8_t {
+  TAG_TYPE = 1,
+  TAG_ADD = 2,
+  TAG_CHANGE = 3,
+  TAG_REMOVE = 4,
+};
+
+// Types whose objects get a new ID rather than new values.
+bool IsStable(const char* type) {
+  return type == webrtc::RTCCertificateStats::kType ||
+         type == webrtc::RTCCodecStats::kType ||
+         type == webrtc::RTCLocalIceCandidateStats::kType ||
+         type == webrtc::RTCRemoteIceCandidateStats::kType;
+}
+
+void WriteVarint(uint64_t value, rtc::Buffer* out) {
+  uint8_t bytes[10];
+  size_t size = 0;
+  while (value >= 0x80) {
+    bytes[size++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  bytes[size++] = static_cast<uint8_t>(value);
+  out->AppendData(bytes, size);
+}
+
+void WriteValue(bool value, rtc::Buffer* out) {
+  WriteVarint(value ? 1 : 0, out);
+}
+
+void WriteValue(int64_t value, rtc::Buffer* out) {
+  WriteVarint((static_cast<uint64_t>(value) << 1) ^
+                  static_cast<uint64_t>(value >> 63),
+              out);
+}
+
+void WriteValue(int32_t value, rtc::Buffer* out) {
+  WriteValue(static_cast<int64_t>(value), out);
+}
+
+void WriteValue(uint64_t value, rtc::Buffer* out) {
+  WriteVarint(value, out);
+}
+
+void WriteValue(uint32_t value, rtc::Buffer* out) {
+  WriteVarint(value, out);
+}
+
+void WriteValue(double value, rtc::Buffer* out) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint8_t bytes[8];
+  rtc::SetLE64(bytes, bits);
+  out->AppendData(bytes, sizeof(bytes));
+}
+
+void WriteValue(const std::string& value, rtc::Buffer* out) {
+  WriteVarint(value.size(), out);
+  out->AppendData(value.data(), value.size());
+}
+
+template <typename T>
+void WriteScalar(const Member& member, rtc::Buffer* out) {
+  WriteValue(*member.cast_to<webrtc::RTCStatsMember<T>>(), out);
+}
+
+template <typename T>
+void WriteSequence(const Member& member, rtc::Buffer* out) {
+  const std::vector<T>& values =
+      *member.cast_to<webrtc::RTCStatsMember<std::vector<T>>>();
+  WriteVarint(values.size(), out);
+  for (const T& value : values)
+    WriteValue(value, out);
+}
+
+void WriteMember(const Member& member, rtc::Buffer* out) {
+  switch (member.type()) {
+    case Member::kBool:
+      return WriteScalar<bool>(member, out);
+    case Member::kInt32:
+      return WriteScalar<int32_t>(member, out);
+    case Member::kUint32:
+      return WriteScalar<uint32_t>(member, out);
+    case Member::kInt64:
+      return WriteScalar<int64_t>(member, out);
+    case Member::kUint64:
+      return WriteScalar<uint64_t>(member, out);
+    case Member::kDouble:
+      return WriteScalar<double>(member, out);
+    case Member::kString:
+      return WriteScalar<std::string>(member, out);
+    case Member::kSequenceBool:
+      return WriteSequence<bool>(member, out);
+    case Member::kSequenceInt32:
+      return WriteSequence<int32_t>(member, out);
+    case Member::kSequenceUint32:
+      return WriteSequence<uint32_t>(member, out);
+    case Member::kSequenceInt64:
+      return WriteSequence<int64_t>(member, out);
+    case Member::kSequenceUint64:
+      return WriteSequence<uint64_t>(member, out);
+    case Member::kSequenceDouble:
+      return WriteSequence<double>(member, out);
+    case Member::kSequenceString:
+      return WriteSequence<std::string>(member, out);
+  }
+  RTC_NOTREACHED();
+}
+
+void WriteChange(size_t index, const Member& member, rtc::Buffer* out) {
+  WriteVarint(index << 1 | (member.is_defined() ? 1 : 0), out);
+  if (member.is_defined())
+    WriteMember(member, out);
+}
+
+void AppendJsonString(const std::string& value, std::string* json) {
+  *json += '"';
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      *json += '\\';
+      *json += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      *json += escape;
+    } else {
+      *json += c;
+    }
+  }
+  *json += '"';
+}
+
+}  // namespace
+
+struct StatsDeltaEncoder::Object {
+  uint32_t handle = 0;
+  uint32_t generation = 0;
+  const char* type = nullptr;
+  bool stable = false;
+  // The object's members in |previous_|; empty for stable types.
+  std::vector<const Member*> members;
+};
+
+StatsDeltaEncoder::StatsDeltaEncoder() {}
+
+StatsDeltaEncoder::~StatsDeltaEncoder() {}
+
+void StatsDeltaEncoder::Encode(
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report,
+    rtc::Buffer* out) {
+  const size_t start = out->size();
+  last_stats_ = EncodeStats();
+  const bool snapshot = snapshot_;
+  if (snapshot) {
+    types_.clear();
+    objects_.clear();
+    free_handles_.clear();
+    next_handle_ = 0;
+    snapshot_ = false;
+  }
+  ++generation_;
+
+  out->AppendData(kVersion);
+  WriteVarint(snapshot ? kFlagSnapshot : 0, out);
+  WriteValue(report->timestamp_us(), out);
+
+  for (const webrtc::RTCStats& stats : *report) {
+    ++last_stats_.objects;
+    auto it = objects_.find(stats.id());
+    if (it != objects_.end() && it->second->type != stats.type()) {
+      // Same ID, different type: cannot happen with WebRTC's IDs, but keeps
+      // the member lists below in step.
+      RemoveHandle(it->second->handle, out);
+      objects_.erase(it);
+      it = objects_.end();
+    }
+    if (it != objects_.end() && it->second->stable) {
+      it->second->generation = generation_;
+      continue;
+    }
+
+    std::vector<const Member*> members = stats.Members();
+    Object* object;
+    if (it == objects_.end()) {
+      const uint32_t type_index = TypeIndex(stats, members, out);
+      std::unique_ptr<Object>& slot = objects_[stats.id()];
+      slot.reset(new Object());
+      object = slot.get();
+      object->handle = NewHandle();
+      object->type = stats.type();
+      object->stable = IsStable(stats.type());
+      out->AppendData(static_cast<uint8_t>(TAG_ADD));
+      WriteVarint(object->handle, out);
+      WriteVarint(type_index, out);
+      WriteValue(stats.id(), out);
+      changed_.clear();
+      for (size_t i = 0; i < members.size(); ++i) {
+        if (members[i]->is_defined())
+          changed_.push_back(i);
+      }
+      ++last_stats_.added;
+    } else {
+      object = it->second.get();
+      RTC_DCHECK_EQ(members.size(), object->members.size());
+      changed_.clear();
+      for (size_t i = 0; i < members.size(); ++i) {
+        if (*members[i] != *object->members[i])
+          changed_.push_back(i);
+      }
+      if (!changed_.empty()) {
+        out->AppendData(static_cast<uint8_t>(TAG_CHANGE));
+        WriteVarint(object->handle, out);
+        ++last_stats_.changed;
+      }
+    }
+    if (it == objects_.end() || !changed_.empty()) {
+      WriteVarint(changed_.size(), out);
+      for (size_t index : changed_)
+        WriteChange(index, *members[index], out);
+      last_stats_.members_changed += changed_.size();
+    }
+    object->generation = generation_;
+    if (object->stable)
+      object->members.clear();
+    else
+      object->members = std::move(members);
+  }
+
+  for (auto it = objects_.begin(); it != objects_.end();) {
+    if (it->second->generation == generation_) {
+      ++it;
+      continue;
+    }
+    RemoveHandle(it->second->handle, out);
+    it = objects_.erase(it);
+    ++last_stats_.removed;
+  }
+  previous_ = report;
+  last_stats_.bytes = out->size() - start;
+}
+
+void StatsDeltaEncoder::Reset() {
+  snapshot_ = true;
+}
+
+uint32_t StatsDeltaEncoder::TypeIndex(
+    const webrtc::RTCStats& stats,
+    const std::vector<const Member*>& members,
+    rtc::Buffer* out) {
+  auto it = types_.find(stats.type());
+  if (it != types_.end())
+    return it->second;
+  const uint32_t index = static_cast<uint32_t>(types_.size());
+  types_[stats.type()] = index;
+  out->AppendData(static_cast<uint8_t>(TAG_TYPE));
+  WriteVarint(index, out);
+  WriteValue(std::string(stats.type()), out);
+  WriteVarint(members.size(), out);
+  for (const Member* member : members) {
+    WriteVarint(member->type(), out);
+    WriteValue(std::string(member->name()), out);
+  }
+  return index;
+}
+
+uint32_t StatsDeltaEncoder::NewHandle() {
+  if (free_handles_.empty())
+    return next_handle_++;
+  const uint32_t handle = free_handles_.back();
+  free_handles_.pop_back();
+  return handle;
+}
+
+void StatsDeltaEncoder::RemoveHandle(uint32_t handle, rtc::Buffer* out) {
+  out->AppendData(static_cast<uint8_t>(TAG_REMOVE));
+  WriteVarint(handle, out);
+  free_handles_.push_back(handle);
+}
+
+class StatsDeltaDecoder::Reader {
+ public:
+  Reader(const uint8_t* data, size_t size) : data_(data), end_(data + size) {}
+
+  bool empty() const { return data_ == end_; }
+
+  bool ReadVarint(uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (data_ == end_)
+        return false;
+      const uint8_t byte = *data_++;
+      *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  bool ReadIndex(size_t* value) {
+    uint64_t v;
+    if (!ReadVarint(&v) || v > 0xffffffff)
+      return false;
+    *value = static_cast<size_t>(v);
+    return true;
+  }
+
+  bool ReadSigned(int64_t* value) {
+    uint64_t v;
+    if (!ReadVarint(&v))
+      return false;
+    *value = static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    return true;
+  }
+
+  bool ReadDouble(double* value) {
+    if (end_ - data_ < 8)
+      return false;
+    const uint64_t bits = rtc::GetLE64(data_);
+    memcpy(value, &bits, sizeof(*value));
+    data_ += 8;
+    return true;
+  }
+
+  bool ReadString(std::string* value) {
+    uint64_t size;
+    if (!ReadVarint(&size) || size > static_cast<uint64_t>(end_ - data_))
+      return false;
+    value->assign(reinterpret_cast<const char*>(data_),
+                  static_cast<size_t>(size));
+    data_ += size;
+    return true;
+  }
+
+  // Reads one value of |type|, a scalar type, and appends it as JSON.
+  bool ReadJson(Member::Type type, std::string* json) {
+    uint64_t u;
+    int64_t i;
+    double d;
+    std::string s;
+    switch (type) {
+      case Member::kBool:
+        if (!ReadVarint(&u))
+          return false;
+        *json += u ? "true" : "false";
+        return true;
+      case Member::kInt32:
+      case Member::kInt64:
+        if (!ReadSigned(&i))
+          return false;
+        *json += std::to_string(i);
+        return true;
+      case Member::kUint32:
+      case Member::kUint64:
+        if (!ReadVarint(&u))
+          return false;
+        *json += std::to_string(u);
+        return true;
+      case Member::kDouble:
+        if (!ReadDouble(&d))
+          return false;
+        AppendJsonNumber(d, json);
+        return true;
+      case Member::kString:
+        if (!ReadString(&s))
+          return false;
+        AppendJsonString(s, json);
+        return true;
+      default:
+        return false;
+    }
+  }
+
+ private:
+  const uint8_t* data_;
+  const uint8_t* const end_;
+};
+
+StatsDeltaDecoder::StatsDeltaDecoder() {}
+
+StatsDeltaDecoder::~StatsDeltaDecoder() {}
+
+bool StatsDeltaDecoder::Apply(const uint8_t* data, size_t size) {
+  Reader reader(data, size);
+  uint64_t version;
+  uint64_t flags;
+  if (!reader.ReadVarint(&version) || version != kVersion ||
+      !reader.ReadVarint(&flags) || !reader.ReadSigned(&timestamp_us_)) {
+    return false;
+  }
+  if (flags & kFlagSnapshot) {
+    types_.clear();
+    objects_.clear();
+    handles_.clear();
+  }
+
+  while (!reader.empty()) {
+    uint64_t tag;
+    size_t handle;
+    if (!reader.ReadVarint(&tag))
+      return false;
+    switch (tag) {
+      case TAG_TYPE: {
+        size_t index;
+        size_t count;
+        Type type;
+        if (!reader.ReadIndex(&index) || index != types_.size() ||
+            !reader.ReadString(&type.name) || !reader.ReadIndex(&count)) {
+          return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+          uint64_t member_type;
+          std::string name;
+          if (!reader.ReadVarint(&member_type) ||
+              member_type > Member::kSequenceString ||
+              !reader.ReadString(&name)) {
+            return false;
+          }
+          type.member_types.push_back(
+              static_cast<Member::Type>(member_type));
+          type.member_names.push_back(std::move(name));
+        }
+        types_.push_back(std::move(type));
+        break;
+      }
+      case TAG_ADD: {
+        size_t type_index;
+        std::string id;
+        if (!reader.ReadIndex(&handle) || !reader.ReadIndex(&type_index) ||
+            type_index >= types_.size() || !reader.ReadString(&id) ||
+            objects_.count(id)) {
+          return false;
+        }
+        // The encoder hands out handles densely, reusing freed ones first,
+        // so a new one is at most one past the end.
+        if (handle > handles_.size())
+          return false;
+        if (handle == handles_.size())
+          handles_.push_back(nullptr);
+        if (handles_[handle])
+          return false;
+        Object& object = objects_[id];
+        object.id = id;
+        object.type = types_[type_index].name;
+        object.type_index = type_index;
+        object.values.resize(types_[type_index].member_names.size());
+        handles_[handle] = &object;
+        if (!ReadChanges(&reader, &object))
+          return false;
+        break;
+      }
+      case TAG_CHANGE:
+        if (!reader.ReadIndex(&handle) || handle >= handles_.size() ||
+            !handles_[handle] || !ReadChanges(&reader, handles_[handle])) {
+          return false;
+        }
+        break;
+      case TAG_REMOVE:
+        if (!reader.ReadIndex(&handle) || handle >= handles_.size() ||
+            !handles_[handle]) {
+          return false;
+        }
+        objects_.erase(handles_[handle]->id);
+        handles_[handle] = nullptr;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+bool StatsDeltaDecoder::ReadChanges(Reader* reader, Object* object) {
+  const Type& type = types_[object->type_index];
+  size_t count;
+  if (!reader->ReadIndex(&count))
+    return false;
+  for (size_t i = 0; i < count; ++i) {
+    size_t change;
+    if (!reader->ReadIndex(&change))
+      return false;
+    const size_t index = change >> 1;
+    if (index >= object->values.size())
+      return false;
+    std::string& json = object->values[index];
+    json.clear();
+    if (!(change & 1))
+      continue;
+    const Member::Type member_type = type.member_types[index];
+    if (member_type < Member::kSequenceBool) {
+      if (!reader->ReadJson(member_type, &json))
+        return false;
+      continue;
+    }
+    // The sequence types follow the scalar ones in the same order.
+    const Member::Type element_type = static_cast<Member::Type>(
+        member_type - Member::kSequenceBool + Member::kBool);
+    size_t size;
+    if (!reader->ReadIndex(&size))
+      return false;
+    json += '[';
+    for (size_t j = 0; j < size; ++j) {
+      if (j > 0)
+        json += ',';
+      if (!reader->ReadJson(element_type, &json))
+        return false;
+    }
+    json += ']';
+  }
+  return true;
+}
+
+const std::vector<std::string>& StatsDeltaDecoder::member_names(
+    const Object& object) const {
+  return types_[object.type_index].member_names;
+}
+
+std::string StatsDeltaDecoder::ToJson() const {
+  std::string json = "[";
+  for (const auto& entry : objects_) {
+    const Object& object = entry.second;
+    if (json.size() > 1)
+      json += ',';
+    json += "{\"type\":";
+    AppendJsonString(object.type, &json);
+    json += ",\"id\":";
+    AppendJsonString(object.id, &json);
+    json += ",\"timestamp\":" + std::to_string(timestamp_us_);
+    const std::vector<std::string>& names = member_names(object);
+    for (size_t i = 0; i < names.size(); ++i) {
+      if (object.values[i].empty())
+        continue;
+      json += ',';
+      AppendJsonString(names[i], &json);
+      json += ':' + object.values[i];
+    }
+    json += '}';
+  }
+  json += ']';
+  return json;
+}
+
+// Forwards reports to the subscription while it exists; the PeerConnection
+// holds a reference until it has delivered.
+class StatsDeltaSubscription::Callback
+    : public webrtc::RTCStatsCollectorCallback {
+ public:
+  explicit Callback(StatsDeltaSubscription* owner) : owner_(owner) {}
+
+  void Detach() { owner_ = nullptr; }
+  bool pending() const { return pending_; }
+  void set_pending() { pending_ = true; }
+
+  // RTCStatsCollectorCallback:
+  void OnStatsDelivered(
+      const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report)
+      override {
+    pending_ = false;
+    if (owner_)
+      owner_->OnReport(report);
+  }
+
+ private:
+  StatsDeltaSubscription* owner_;
+  bool pending_ = false;
+};
+
+StatsDeltaSubscription::StatsDeltaSubscription(
+    webrtc::PeerConnectionInterface* pc)
+    : pc_(pc), callback_(new rtc::RefCountedObject<Callback>(this)) {}
+
+StatsDeltaSubscription::~StatsDeltaSubscription() {
+  callback_->Detach();
+}
+
+void StatsDeltaSubscription::Poll() {
+  if (callback_->pending())
+    return;
+  callback_->set_pending();
+  pc_->GetStats(callback_.get());
+}
+
+void StatsDeltaSubscription::Reset() {
+  encoder_.Reset();
+}
+
+void StatsDeltaSubscription::OnReport(
+    const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
+  buffer_.Clear();
+  encoder_.Encode(report, &buffer_);
+  SignalDelta(this, buffer_);
+}
+
+}  // namespace simple_app
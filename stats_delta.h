@@ -0,0 +1,177 @@
+#ifndef STATS_DELTA_H_
+#define STATS_DELTA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "api/peerconnectioninterface.h"
+#include "api/stats/rtcstats.h"
+#include "api/stats/rtcstatsreport.h"
+#include "rtc_base/buffer.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/scoped_ref_ptr.h"
+#include "rtc_base/sigslot.h"
+
+namespace simple_app {
+
+// Encodes the successive RTCStatsReports of one PeerConnection as compact
+// binary deltas: only the objects and members that changed since the
+// previous report, instead of RTCStatsReport::ToJson()'s every member of
+// every object as text. Per report, the encoder
+//  - walks each object's members once and compares them by value with the
+//    previous report's, which it keeps a reference to, without formatting
+//    any of them;
+//  - skips the certificate, codec and candidate objects it has already
+//    sent, since WebRTC gives those a new ID whenever they change;
+//  - names each type's members and each object's ID once, and refers to
+//    them by index afterwards.
+//
+// Wire format. Integers are unsigned LEB128 varints, signed ones zigzagged
+// first; doubles are 8 bytes little-endian; strings are a varint length
+// followed by the bytes; sequences a varint count followed by the values.
+//   report  := version=1 flags timestamp_us record*
+//   flags   := bit 0 set for a snapshot: the reader drops all state first
+//   record  := 1 type_index type_name member_count (member_type name)*
+//            | 2 handle type_index id changes   (new object)
+//            | 3 handle changes                 (changed object)
+//            | 4 handle                         (removed object)
+//   changes := count (member_index << 1 | defined, value if defined)*
+// with member_type an RTCStatsMemberInterface::Type. Type indices count
+// up from 0 and handles of removed objects are reused. Objects carry the
+// report's timestamp.
+class StatsDeltaEncoder {
+ public:
+  struct EncodeStats {
+    size_t objects = 0;
+    size_t added = 0;
+    size_t changed = 0;
+    size_t removed = 0;
+    size_t members_changed = 0;
+    size_t bytes = 0;
+  };
+
+  StatsDeltaEncoder();
+  ~StatsDeltaEncoder();
+
+  // Appends the delta from the report encoded last to |report| to |out|,
+  // and keeps |report| for the next call.
+  void Encode(const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report,
+              rtc::Buffer* out);
+  // Makes the next report a snapshot, for a new reader.
+  void Reset();
+
+  const EncodeStats& last_stats() const { return last_stats_; }
+
+ private:
+  struct Object;
+
+  // Returns the index of |stats|'s type, writing its record first if it
+  // is new.
+  uint32_t TypeIndex(const webrtc::RTCStats& stats,
+                     const std::vector<const webrtc::RTCStatsMemberInterface*>&
+                         members,
+                     rtc::Buffer* out);
+  uint32_t NewHandle();
+  // Writes the removal of |handle| and frees it.
+  void RemoveHandle(uint32_t handle, rtc::Buffer* out);
+
+  std::unordered_map<const char*, uint32_t> types_;
+  std::unordered_map<std::string, std::unique_ptr<Object>> objects_;
+  std::vector<uint32_t> free_handles_;
+  uint32_t next_handle_ = 0;
+  uint32_t generation_ = 0;
+  bool snapshot_ = true;
+  std::vector<size_t> changed_;
+  // Holds the members that |objects_| point to.
+  rtc::scoped_refptr<const webrtc::RTCStatsReport> previous_;
+  EncodeStats last_stats_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(StatsDeltaEncoder);
+};
+
+// Applies StatsDeltaEncoder's output and keeps the resulting objects, with
+// their values formatted as JSON.
+class StatsDeltaDecoder {
+ public:
+  struct Object {
+    std::string id;
+    std::string type;
+    // Indexed as member_names(); empty for members that are not defined.
+    std::vector<std::string> values;
+    size_t type_index = 0;
+  };
+
+  StatsDeltaDecoder();
+  ~StatsDeltaDecoder();
+
+  // Returns false for malformed input, after which the state is undefined
+  // until the next snapshot.
+  bool Apply(const uint8_t* data, size_t size);
+
+  int64_t timestamp_us() const { return timestamp_us_; }
+  const std::map<std::string, Object>& objects() const { return objects_; }
+  const std::vector<std::string>& member_names(const Object& object) const;
+  // Same shape as RTCStatsReport::ToJson().
+  std::string ToJson() const;
+
+ private:
+  struct Type {
+    std::string name;
+    std::vector<std::string> member_names;
+    std::vector<webrtc::RTCStatsMemberInterface::Type> member_types;
+  };
+  class Reader;
+
+  bool ReadChanges(Reader* reader, Object* object);
+
+  int64_t timestamp_us_ = 0;
+  std::vector<Type> types_;
+  std::map<std::string, Object> objects_;
+  // By handle; null for free handles.
+  std::vector<Object*> handles_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(StatsDeltaDecoder);
+};
+
+// Polls a PeerConnection's stats and signals each report as a delta.
+// Poll() does nothing while a report is still on its way, so a slow
+// collector is not asked again before it has answered. Lives on the
+// signaling thread, where the reports are delivered.
+class StatsDeltaSubscription {
+ public:
+  explicit StatsDeltaSubscription(webrtc::PeerConnectionInterface* pc);
+  ~StatsDeltaSubscription();
+
+  void Poll();
+  // Makes the next delta a snapshot.
+  void Reset();
+
+  const StatsDeltaEncoder::EncodeStats& last_stats() const {
+    return encoder_.last_stats();
+  }
+
+  // The encoded delta, valid during the call.
+  sigslot::signal2<StatsDeltaSubscription*, const rtc::Buffer&> SignalDelta;
+
+ private:
+  class Callback;
+
+  void OnReport(const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report);
+
+  const rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+  rtc::scoped_refptr<Callback> callback_;
+  StatsDeltaEncoder encoder_;
+  rtc::Buffer buffer_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(StatsDeltaSubscription);
+};
+
+}  // namespace simple_app
+
+#endif  // STATS_DELTA_H_
@@ -0,0 +1,159 @@
+#include "stun_integrity.h"
+
+#include "rtc_base/byteorder.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STUN_CRC32_PCLMUL 1
+#endif
+
+namespace simple_app {
+
+namespace {
+
+// Reflected CRC-32 polynomial (IEEE 802.3), as in RFC 5389 section 15.5.
+const uint32_t kCrc32Polynomial = 0xEDB88320;
+
+struct Crc32Tables {
+  uint32_t table[8][256];
+};
+
+const Crc32Tables* MakeCrc32Tables() {
+  Crc32Tables* tables = new Crc32Tables;
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc & 1) ? (crc >> 1) ^ kCrc32Polynomial : crc >> 1;
+    tables->table[0][i] = crc;
+  }
+  for (uint32_t i = 0; i < 256; ++i) {
+    for (int t = 1; t < 8; ++t) {
+      const uint32_t prev = tables->table[t - 1][i];
+      tables->table[t][i] = (prev >> 8) ^ tables->table[0][prev & 0xFF];
+    }
+  }
+  return tables;
+}
+
+// Takes and returns the CRC register, i.e. without the final inversion.
+uint32_t Crc32SliceBy8(uint32_t crc, const uint8_t* data, size_t length) {
+  static const Crc32Tables* const tables = MakeCrc32Tables();
+  const uint32_t(*t)[256] = tables->table;
+  while (length >= 8) {
+    const uint32_t lo = rtc::GetLE32(data) ^ crc;
+    const uint32_t hi = rtc::GetLE32(data + 4);
+    crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^
+          t[4][lo >> 24] ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+          t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    data += 8;
+    length -= 8;
+  }
+  while (length-- > 0)
+    crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(STUN_CRC32_PCLMUL)
+
+// The folding needs four 16 byte lanes to start with.
+const size_t kPclmulMinLength = 64;
+
+bool HasPclmul() {
+  static const bool has_pclmul =
+      __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+  return has_pclmul;
+}
+
+// CRC-32 by folding with carry-less multiplies, from Intel's "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction", with
+// the bit-reflected constants for the IEEE polynomial. |length| is at least
+// kPclmulMinLength and a multiple of 16. Takes and returns the CRC register.
+__attribute__((target("pclmul,sse4.1"))) uint32_t Crc32Pclmul(
+    uint32_t crc,
+    const uint8_t* data,
+    size_t length) {
+  alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+  alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+  alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+  alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+  const __m128i* in = reinterpret_cast<const __m128i*>(data);
+  __m128i x1 = _mm_loadu_si128(in);
+  __m128i x2 = _mm_loadu_si128(in + 1);
+  __m128i x3 = _mm_loadu_si128(in + 2);
+  __m128i x4 = _mm_loadu_si128(in + 3);
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+  in += 4;
+  length -= 64;
+
+  // Fold four lanes at a time.
+  __m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+  while (length >= 64) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    const __m128i x6 = _mm_clmulepi64_si128(x2, k, 0x00);
+    const __m128i x7 = _mm_clmulepi64_si128(x3, k, 0x00);
+    const __m128i x8 = _mm_clmulepi64_si128(x4, k, 0x00);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x11), x5);
+    x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k, 0x11), x6);
+    x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k, 0x11), x7);
+    x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k, 0x11), x8);
+    x1 = _mm_xor_si128(x1, _mm_loadu_si128(in));
+    x2 = _mm_xor_si128(x2, _mm_loadu_si128(in + 1));
+    x3 = _mm_xor_si128(x3, _mm_loadu_si128(in + 2));
+    x4 = _mm_xor_si128(x4, _mm_loadu_si128(in + 3));
+    in += 4;
+    length -= 64;
+  }
+
+  // Fold the lanes into one, then the remaining 16 byte blocks into it.
+  k = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+  const __m128i lanes[] = {x2, x3, x4};
+  for (const __m128i& lane : lanes) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, lane), x5);
+  }
+  while (length >= 16) {
+    const __m128i x5 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(in)), x5);
+    ++in;
+    length -= 16;
+  }
+
+  // Fold 128 bits to 64.
+  const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  // Barrett reduction to 32 bits.
+  k = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, low32), k, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+#endif  // defined(STUN_CRC32_PCLMUL)
+
+}  // namespace
+
+uint32_t StunCrc32(const void* data, size_t length) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint32_t crc = 0xFFFFFFFF;
+#if defined(STUN_CRC32_PCLMUL)
+  if (length >= kPclmulMinLength && HasPclmul()) {
+    const size_t folded = length & ~static_cast<size_t>(15);
+    crc = Crc32Pclmul(crc, bytes, folded);
+    bytes += folded;
+    length -= folded;
+  }
+#endif
+  return ~Crc32SliceBy8(crc, bytes, length);
+}
+
+}  // namespace simple_app
@@ -0,0 +1,411 @@
+#include "stun_view.h"
+
+#include <string.h>
+
+#include "rtc_base/byteorder.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/ipaddress.h"
+#include "rtc_base/logging.h"
+#include "stun_integrity.h"
+
+namespace simple_app {
+
+namespace {
+
+using cricket::kStunAttributeHeaderSize;
+using cricket::kStunHeaderSize;
+using cricket::kStunMagicCookie;
+using cricket::kStunMessageIntegritySize;
+using cricket::kStunTransactionIdLength;
+using cricket::kStunTransactionIdOffset;
+
+// RFC 5389 section 15.5.
+const uint32_t kFingerprintXorValue = 0x5354554E;
+const size_t kFingerprintSize = 4;
+const size_t kXorMaskSize = 16;
+// Big enough for any answer LiteStunServer sends.
+const size_t kMaxResponseSize = 128;
+
+size_t Padded(size_t length) {
+  return (length + 3) & ~static_cast<size_t>(3);
+}
+
+// XOR-*-ADDRESS values are masked with the magic cookie followed by the
+// transaction id (RFC 5389 section 15.2). Legacy messages use the cookie
+// too, as StunXorAddressAttribute does.
+void MakeXorMask(const uint8_t* message, uint8_t* mask) {
+  rtc::SetBE32(mask, kStunMagicCookie);
+  memcpy(mask + 4, message + kStunTransactionIdOffset,
+         kStunTransactionIdLength);
+}
+
+}  // namespace
+
+const size_t StunView::kMaxAttributes;
+
+StunView::StunView() {}
+
+bool StunView::Parse(const void* data, size_t size) {
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = size;
+  num_attributes_ = 0;
+  // The first two bits of a STUN message are zero; ChannelData and RTP have
+  // other values there.
+  if (size < kStunHeaderSize || (data_[0] & 0xC0) != 0)
+    return false;
+  const size_t length = rtc::GetBE16(data_ + 2);
+  if (length % 4 != 0 || kStunHeaderSize + length != size)
+    return false;
+  type_ = rtc::GetBE16(data_);
+  legacy_ = rtc::GetBE32(data_ + 4) != kStunMagicCookie;
+
+  size_t pos = kStunHeaderSize;
+  while (pos < size) {
+    if (size - pos < kStunAttributeHeaderSize ||
+        num_attributes_ == kMaxAttributes) {
+      return false;
+    }
+    Attribute& attr = attributes_[num_attributes_++];
+    attr.type = rtc::GetBE16(data_ + pos);
+    attr.length = rtc::GetBE16(data_ + pos + 2);
+    attr.value = data_ + pos + kStunAttributeHeaderSize;
+    pos += kStunAttributeHeaderSize;
+    if (size - pos < Padded(attr.length))
+      return false;
+    pos += Padded(attr.length);
+  }
+  return true;
+}
+
+const uint8_t* StunView::transaction_id() const {
+  return legacy_ ? data_ + 4 : data_ + kStunTransactionIdOffset;
+}
+
+size_t StunView::transaction_id_length() const {
+  return legacy_ ? cricket::kStunLegacyTransactionIdLength
+                 : kStunTransactionIdLength;
+}
+
+const StunView::Attribute* StunView::Find(int type) const {
+  for (size_t i = 0; i < num_attributes_; ++i) {
+    if (attributes_[i].type == type)
+      return &attributes_[i];
+  }
+  return nullptr;
+}
+
+bool StunView::GetUInt32(int type, uint32_t* value) const {
+  const Attribute* attr = Find(type);
+  if (!attr || attr->length != 4)
+    return false;
+  *value = rtc::GetBE32(attr->value);
+  return true;
+}
+
+bool StunView::GetUInt64(int type, uint64_t* value) const {
+  const Attribute* attr = Find(type);
+  if (!attr || attr->length != 8)
+    return false;
+  *value = rtc::GetBE64(attr->value);
+  return true;
+}
+
+bool StunView::GetByteString(int type,
+                             const char** data,
+                             size_t* length) const {
+  const Attribute* attr = Find(type);
+  if (!attr)
+    return false;
+  *data = reinterpret_cast<const char*>(attr->value);
+  *length = attr->length;
+  return true;
+}
+
+bool StunView::GetAddress(int type, rtc::SocketAddress* address) const {
+  const Attribute* attr = Find(type);
+  return attr && DecodeAddress(*attr, false, address);
+}
+
+bool StunView::GetXorAddress(int type, rtc::SocketAddress* address) const {
+  const Attribute* attr = Find(type);
+  return attr && DecodeAddress(*attr, true, address);
+}
+
+int StunView::GetErrorCodeValue() const {
+  const Attribute* attr = Find(cricket::STUN_ATTR_ERROR_CODE);
+  if (!attr || attr->length < 4)
+    return cricket::STUN_ERROR_GLOBAL_FAILURE;
+  return (attr->value[2] & 0x7) * 100 + attr->value[3];
+}
+
+bool StunView::ValidateMessageIntegrity(const HmacSha1Key& key) const {
+  const Attribute* attr = Find(cricket::STUN_ATTR_MESSAGE_INTEGRITY);
+  if (!attr || attr->length != kStunMessageIntegritySize)
+    return false;
+  // The HMAC covers everything before the attribute, with the header length
+  // as if the message ended right after it.
+  const size_t mi_pos = attr->value - kStunAttributeHeaderSize - data_;
+  uint8_t header[kStunHeaderSize];
+  memcpy(header, data_, kStunHeaderSize);
+  rtc::SetBE16(header + 2,
+               static_cast<uint16_t>(mi_pos + kStunAttributeHeaderSize +
+                                     kStunMessageIntegritySize -
+                                     kStunHeaderSize));
+  uint8_t hmac[kStunMessageIntegritySize];
+  key.Compute(header, sizeof(header), data_ + kStunHeaderSize,
+              mi_pos - kStunHeaderSize, hmac);
+  return memcmp(hmac, attr->value, sizeof(hmac)) == 0;
+}
+
+bool StunView::ValidateMessageIntegrity(const void* key,
+                                        size_t key_length) const {
+  return ValidateMessageIntegrity(HmacSha1Key(key, key_length));
+}
+
+bool StunView::ValidateMessageIntegrity(const std::string& password) const {
+  return ValidateMessageIntegrity(HmacSha1Key(password));
+}
+
+bool StunView::ValidateFingerprint() const {
+  if (legacy_ || num_attributes_ == 0)
+    return false;
+  const Attribute& attr = attributes_[num_attributes_ - 1];
+  if (attr.type != cricket::STUN_ATTR_FINGERPRINT ||
+      attr.length != kFingerprintSize) {
+    return false;
+  }
+  const size_t fingerprint_pos = attr.value - kStunAttributeHeaderSize - data_;
+  return (StunCrc32(data_, fingerprint_pos) ^ kFingerprintXorValue) ==
+         rtc::GetBE32(attr.value);
+}
+
+bool StunView::DecodeAddress(const Attribute& attr,
+                             bool xored,
+                             rtc::SocketAddress* address) const {
+  if (attr.length < 4)
+    return false;
+  const uint8_t family = attr.value[1];
+  size_t ip_length;
+  if (family == cricket::STUN_ADDRESS_IPV4)
+    ip_length = sizeof(in_addr);
+  else if (family == cricket::STUN_ADDRESS_IPV6)
+    ip_length = sizeof(in6_addr);
+  else
+    return false;
+  if (attr.length != 4 + ip_length)
+    return false;
+
+  uint8_t mask[kXorMaskSize] = {0};
+  if (xored)
+    MakeXorMask(data_, mask);
+  uint16_t port = rtc::GetBE16(attr.value + 2) ^ rtc::GetBE16(mask);
+  uint8_t ip[sizeof(in6_addr)];
+  for (size_t i = 0; i < ip_length; ++i)
+    ip[i] = attr.value[4 + i] ^ mask[i];
+
+  if (family == cricket::STUN_ADDRESS_IPV4) {
+    in_addr ip4;
+    memcpy(&ip4, ip, sizeof(ip4));
+    address->SetIP(rtc::IPAddress(ip4));
+  } else {
+    in6_addr ip6;
+    memcpy(&ip6, ip, sizeof(ip6));
+    address->SetIP(rtc::IPAddress(ip6));
+  }
+  address->SetPort(port);
+  return true;
+}
+
+StunBuilder::StunBuilder(void* buffer, size_t capacity)
+    : buffer_(static_cast<uint8_t*>(buffer)), capacity_(capacity) {}
+
+void StunBuilder::Start(int type, const uint8_t* transaction_id) {
+  size_ = 0;
+  ok_ = capacity_ >= kStunHeaderSize;
+  if (!ok_)
+    return;
+  rtc::SetBE16(buffer_, static_cast<uint16_t>(type));
+  rtc::SetBE16(buffer_ + 2, 0);
+  rtc::SetBE32(buffer_ + 4, kStunMagicCookie);
+  memcpy(buffer_ + kStunTransactionIdOffset, transaction_id,
+         kStunTransactionIdLength);
+  size_ = kStunHeaderSize;
+}
+
+void StunBuilder::StartResponse(int type, const StunView& request) {
+  Start(type, request.data() + kStunTransactionIdOffset);
+  // Echo the cookie field too: legacy transaction ids start there.
+  if (ok_)
+    memcpy(buffer_ + 4, request.data() + 4, 4);
+}
+
+void StunBuilder::AddUInt32(int type, uint32_t value) {
+  uint8_t* out = AddAttribute(type, 4);
+  if (out)
+    rtc::SetBE32(out, value);
+}
+
+void StunBuilder::AddUInt64(int type, uint64_t value) {
+  uint8_t* out = AddAttribute(type, 8);
+  if (out)
+    rtc::SetBE64(out, value);
+}
+
+void StunBuilder::AddByteString(int type, const void* data, size_t length) {
+  uint8_t* out = AddAttribute(type, length);
+  if (out && length > 0)
+    memcpy(out, data, length);
+}
+
+void StunBuilder::AddAddress(int type, const rtc::SocketAddress& address) {
+  const int family = address.ipaddr().family();
+  if (family != AF_INET && family != AF_INET6) {
+    ok_ = false;
+    return;
+  }
+  uint8_t* out = AddAttribute(
+      type, 4 + (family == AF_INET ? sizeof(in_addr) : sizeof(in6_addr)));
+  if (out)
+    WriteAddress(out, address, false);
+}
+
+void StunBuilder::AddXorAddress(int type, const rtc::SocketAddress& address) {
+  const int family = address.ipaddr().family();
+  if (family != AF_INET && family != AF_INET6) {
+    ok_ = false;
+    return;
+  }
+  uint8_t* out = AddAttribute(
+      type, 4 + (family == AF_INET ? sizeof(in_addr) : sizeof(in6_addr)));
+  if (out)
+    WriteAddress(out, address, true);
+}
+
+void StunBuilder::AddErrorCode(int code, const char* reason) {
+  const size_t reason_length = strlen(reason);
+  uint8_t* out = AddAttribute(cricket::STUN_ATTR_ERROR_CODE,
+                              4 + reason_length);
+  if (!out)
+    return;
+  out[2] = static_cast<uint8_t>(code / 100);
+  out[3] = static_cast<uint8_t>(code % 100);
+  memcpy(out + 4, reason, reason_length);
+}
+
+void StunBuilder::AddMessageIntegrity(const HmacSha1Key& key) {
+  // Adding the attribute first leaves the header length covering it, which
+  // is what the HMAC is computed with.
+  uint8_t* out = AddAttribute(cricket::STUN_ATTR_MESSAGE_INTEGRITY,
+                              kStunMessageIntegritySize);
+  if (!out)
+    return;
+  key.Compute(buffer_, out - kStunAttributeHeaderSize - buffer_, nullptr, 0,
+              out);
+}
+
+void StunBuilder::AddMessageIntegrity(const void* key, size_t key_length) {
+  AddMessageIntegrity(HmacSha1Key(key, key_length));
+}
+
+void StunBuilder::AddMessageIntegrity(const std::string& password) {
+  AddMessageIntegrity(HmacSha1Key(password));
+}
+
+void StunBuilder::AddFingerprint() {
+  uint8_t* out = AddAttribute(cricket::STUN_ATTR_FINGERPRINT, kFingerprintSize);
+  if (!out)
+    return;
+  const uint32_t crc =
+      StunCrc32(buffer_, out - kStunAttributeHeaderSize - buffer_);
+  rtc::SetBE32(out, crc ^ kFingerprintXorValue);
+}
+
+uint8_t* StunBuilder::AddAttribute(int type, size_t length) {
+  if (!ok_ || size_ < kStunHeaderSize)
+    return nullptr;
+  const size_t padded = Padded(length);
+  const size_t attr_size = kStunAttributeHeaderSize + padded;
+  if (length > 0xFFFF || capacity_ - size_ < attr_size ||
+      size_ + attr_size - kStunHeaderSize > 0xFFFF) {
+    ok_ = false;
+    return nullptr;
+  }
+  uint8_t* attr = buffer_ + size_;
+  rtc::SetBE16(attr, static_cast<uint16_t>(type));
+  rtc::SetBE16(attr + 2, static_cast<uint16_t>(length));
+  uint8_t* value = attr + kStunAttributeHeaderSize;
+  memset(value, 0, padded);
+  size_ += attr_size;
+  rtc::SetBE16(buffer_ + 2, static_cast<uint16_t>(size_ - kStunHeaderSize));
+  return value;
+}
+
+void StunBuilder::WriteAddress(uint8_t* value,
+                               const rtc::SocketAddress& address,
+                               bool xored) {
+  uint8_t mask[kXorMaskSize] = {0};
+  if (xored)
+    MakeXorMask(buffer_, mask);
+  uint8_t ip[sizeof(in6_addr)];
+  size_t ip_length;
+  if (address.ipaddr().family() == AF_INET) {
+    const in_addr ip4 = address.ipaddr().ipv4_address();
+    memcpy(ip, &ip4, sizeof(ip4));
+    ip_length = sizeof(ip4);
+    value[1] = cricket::STUN_ADDRESS_IPV4;
+  } else {
+    const in6_addr ip6 = address.ipaddr().ipv6_address();
+    memcpy(ip, &ip6, sizeof(ip6));
+    ip_length = sizeof(ip6);
+    value[1] = cricket::STUN_ADDRESS_IPV6;
+  }
+  rtc::SetBE16(value + 2, address.port() ^ rtc::GetBE16(mask));
+  for (size_t i = 0; i < ip_length; ++i)
+    value[4 + i] = ip[i] ^ mask[i];
+}
+
+LiteStunServer::LiteStunServer(rtc::AsyncPacketSocket* socket)
+    : socket_(socket) {
+  socket_->SignalReadPacket.connect(this, &LiteStunServer::OnPacket);
+}
+
+LiteStunServer::~LiteStunServer() {
+  socket_->SignalReadPacket.disconnect(this);
+}
+
+void LiteStunServer::OnPacket(rtc::AsyncPacketSocket* /* socket */,
+                              const char* data,
+                              size_t size,
+                              const rtc::SocketAddress& remote_address,
+                              const rtc::PacketTime& /* packet_time */) {
+  StunView request;
+  if (!request.Parse(data, size) || !cricket::IsStunRequestType(request.type()))
+    return;
+
+  uint8_t buffer[kMaxResponseSize];
+  StunBuilder response(buffer, sizeof(buffer));
+  if (request.type() == cricket::STUN_BINDING_REQUEST) {
+    response.StartResponse(cricket::STUN_BINDING_RESPONSE, request);
+    if (request.IsLegacy()) {
+      response.AddAddress(cricket::STUN_ATTR_MAPPED_ADDRESS, remote_address);
+    } else {
+      response.AddXorAddress(cricket::STUN_ATTR_XOR_MAPPED_ADDRESS,
+                             remote_address);
+    }
+  } else {
+    response.StartResponse(cricket::GetStunErrorResponseType(request.type()),
+                           request);
+    response.AddErrorCode(cricket::STUN_ERROR_GLOBAL_FAILURE,
+                          "Operation Not Supported");
+  }
+  if (!response.ok())
+    return;
+
+  rtc::PacketOptions options;
+  if (socket_->SendTo(response.data(), response.size(), remote_address,
+                      options) < 0) {
+    LOG(LS_ERROR) << "Failed to send STUN response: " << socket_->GetError();
+  }
+}
+
+}  // namespace simple_app
@@ -0,0 +1,169 @@
+#ifndef STUN_VIEW_H_
+#define STUN_VIEW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+#include "hmac_sha1_key.h"
+#include "p2p/base/stun.h"
+#include "rtc_base/asyncpacketsocket.h"
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/sigslot.h"
+#include "rtc_base/socketaddress.h"
+
+namespace simple_app {
+
+// A STUN message parsed in place. cricket::StunMessage::Read() copies every
+// attribute into its own heap allocated StunAttribute; StunView only checks
+// the framing and records where each attribute starts, in a fixed array, so
+// parsing, lookups and the integrity and fingerprint checks allocate
+// nothing. The parsed buffer must outlive the view.
+class StunView {
+ public:
+  // Parse() rejects messages with more attributes than this. ICE and TURN
+  // messages carry about ten.
+  static const size_t kMaxAttributes = 32;
+
+  struct Attribute {
+    uint16_t type;
+    // Without the padding.
+    uint16_t length;
+    // Points into the parsed buffer.
+    const uint8_t* value;
+  };
+
+  StunView();
+
+  // Returns false unless |data| is exactly one well formed STUN message.
+  // Like StunMessage::Read(), accepts RFC 3489 messages, which have no
+  // magic cookie.
+  bool Parse(const void* data, size_t size);
+
+  int type() const { return type_; }
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool IsLegacy() const { return legacy_; }
+  // cricket::kStunTransactionIdLength bytes, or
+  // cricket::kStunLegacyTransactionIdLength for legacy messages.
+  const uint8_t* transaction_id() const;
+  size_t transaction_id_length() const;
+
+  size_t num_attributes() const { return num_attributes_; }
+  const Attribute& attribute(size_t index) const { return attributes_[index]; }
+  // First attribute of |type|, or null.
+  const Attribute* Find(int type) const;
+
+  // Each returns false if the attribute is missing or malformed.
+  bool GetUInt32(int type, uint32_t* value) const;
+  bool GetUInt64(int type, uint64_t* value) const;
+  bool GetByteString(int type, const char** data, size_t* length) const;
+  bool GetAddress(int type, rtc::SocketAddress* address) const;
+  // For the XOR-MAPPED-ADDRESS, XOR-PEER-ADDRESS and XOR-RELAYED-ADDRESS
+  // attributes.
+  bool GetXorAddress(int type, rtc::SocketAddress* address) const;
+  // As StunMessage::GetErrorCodeValue(): the ERROR-CODE value, or
+  // STUN_ERROR_GLOBAL_FAILURE if there is none.
+  int GetErrorCodeValue() const;
+
+  // Same results as StunMessage::ValidateMessageIntegrity() and
+  // ValidateFingerprint(), computed on the parsed buffer without copying it.
+  // Pass an HmacSha1Key kept with the credential to skip the HMAC key
+  // schedule; the other overloads redo it on each call.
+  bool ValidateMessageIntegrity(const HmacSha1Key& key) const;
+  bool ValidateMessageIntegrity(const void* key, size_t key_length) const;
+  bool ValidateMessageIntegrity(const std::string& password) const;
+  bool ValidateFingerprint() const;
+
+ private:
+  bool DecodeAddress(const Attribute& attr,
+                     bool xored,
+                     rtc::SocketAddress* address) const;
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  int type_ = 0;
+  bool legacy_ = false;
+  size_t num_attributes_ = 0;
+  Attribute attributes_[kMaxAttributes];
+};
+
+// Writes a STUN message into caller provided storage, such as a stack buffer,
+// instead of building StunAttribute objects and serializing them through an
+// rtc::ByteBufferWriter. The header length is kept current as attributes are
+// appended, so MESSAGE-INTEGRITY and FINGERPRINT are computed straight over
+// the bytes already written.
+//
+// Running out of room sets ok() to false and ignores further calls; check it
+// before sending.
+class StunBuilder {
+ public:
+  StunBuilder(void* buffer, size_t capacity);
+
+  // Writes the header. |transaction_id| is cricket::kStunTransactionIdLength
+  // bytes and follows the magic cookie.
+  void Start(int type, const uint8_t* transaction_id);
+  // Writes the header of a response of |type| to |request|, which may be a
+  // legacy message.
+  void StartResponse(int type, const StunView& request);
+
+  void AddUInt32(int type, uint32_t value);
+  void AddUInt64(int type, uint64_t value);
+  void AddByteString(int type, const void* data, size_t length);
+  void AddAddress(int type, const rtc::SocketAddress& address);
+  void AddXorAddress(int type, const rtc::SocketAddress& address);
+  void AddErrorCode(int code, const char* reason);
+  // Only FINGERPRINT may follow.
+  void AddMessageIntegrity(const HmacSha1Key& key);
+  void AddMessageIntegrity(const void* key, size_t key_length);
+  void AddMessageIntegrity(const std::string& password);
+  // Must be last.
+  void AddFingerprint();
+
+  bool ok() const { return ok_; }
+  const uint8_t* data() const { return buffer_; }
+  size_t size() const { return size_; }
+
+ private:
+  // Appends an attribute header and zeroed, padded room for |length| bytes
+  // of value. Returns the value, or null if it does not fit.
+  uint8_t* AddAttribute(int type, size_t length);
+  void WriteAddress(uint8_t* value,
+                    const rtc::SocketAddress& address,
+                    bool xored);
+
+  uint8_t* const buffer_;
+  const size_t capacity_;
+  size_t size_ = 0;
+  bool ok_ = true;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(StunBuilder);
+};
+
+// Stand-in for cricket::StunServer that answers with StunView and
+// StunBuilder, so a binding request costs no heap allocation. Answers
+// binding requests with XOR-MAPPED-ADDRESS, or MAPPED-ADDRESS for legacy
+// clients, and other requests with a 600 error, as StunServer does.
+class LiteStunServer : public sigslot::has_slots<> {
+ public:
+  // Takes ownership of |socket|.
+  explicit LiteStunServer(rtc::AsyncPacketSocket* socket);
+  ~LiteStunServer() override;
+
+ private:
+  void OnPacket(rtc::AsyncPacketSocket* socket,
+                const char* data,
+                size_t size,
+                const rtc::SocketAddress& remote_address,
+                const rtc::PacketTime& packet_time);
+
+  std::unique_ptr<rtc::AsyncPacketSocket> socket_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(LiteStunServer);
+};
+
+}  // namespace simple_app
+
+#endif  // STUN_VIEW_H_
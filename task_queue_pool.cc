@@ -0,0 +1,365 @@
+#include "task_queue_pool.h"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "rtc_base/checks.h"
+#include "rtc_base/refcount.h"
+#include "rtc_base/refcountedobject.h"
+#include "rtc_base/timeutils.h"
+#include "system_wrappers/include/cpu_info.h"
+
+namespace simple_app {
+
+namespace {
+
+// Tasks a worker runs from one queue before it lets the other queues on its
+// run list go first.
+const int kMaxTasksPerSlice = 16;
+
+const int kPriorityLevels = 3;
+const int64_t kNoDelayedTask = std::numeric_limits<int64_t>::max();
+
+thread_local PooledTaskQueue* g_current_queue = nullptr;
+
+int RunListIndex(rtc::TaskQueue::Priority priority) {
+  switch (priority) {
+    case rtc::TaskQueue::Priority::HIGH:
+      return 0;
+    case rtc::TaskQueue::Priority::NORMAL:
+      return 1;
+    case rtc::TaskQueue::Priority::LOW:
+      return 2;
+  }
+  return 1;
+}
+
+}  // namespace
+
+// Pending tasks of one PooledTaskQueue. |scheduled_| is set while the queue
+// sits on a run list or is being run, so at most one worker ever runs it.
+class TaskQueuePool::Queue : public rtc::RefCountInterface {
+ public:
+  Queue(TaskQueuePool* pool,
+        PooledTaskQueue* owner,
+        rtc::TaskQueue::Priority priority)
+      : pool_(pool),
+        owner_(owner),
+        run_list_index_(RunListIndex(priority)),
+        done_(false, false) {}
+
+  int run_list_index() const { return run_list_index_; }
+
+  void Post(std::unique_ptr<rtc::QueuedTask> task) {
+    bool schedule = false;
+    {
+      rtc::CritScope cs(&crit_);
+      if (closed_)
+        return;  // |task| is deleted outside the lock.
+      pending_.push_back(std::move(task));
+      if (!scheduled_) {
+        scheduled_ = true;
+        schedule = true;
+      }
+    }
+    if (schedule)
+      pool_->Schedule(this);
+  }
+
+  // Runs up to kMaxTasksPerSlice tasks on the calling worker. Returns true if
+  // tasks are left and the queue has to go back on a run list.
+  bool RunSlice() {
+    for (int i = 0; i < kMaxTasksPerSlice; ++i) {
+      std::unique_ptr<rtc::QueuedTask> task;
+      {
+        rtc::CritScope cs(&crit_);
+        if (closed_ || pending_.empty()) {
+          scheduled_ = false;
+          return false;
+        }
+        task = std::move(pending_.front());
+        pending_.pop_front();
+        running_ = true;
+      }
+
+      PooledTaskQueue* const previous = g_current_queue;
+      g_current_queue = owner_;
+      if (!task->Run())
+        task.release();
+      task.reset();
+      g_current_queue = previous;
+
+      rtc::CritScope cs(&crit_);
+      running_ = false;
+      if (closed_) {
+        done_.Set();
+        return false;
+      }
+    }
+    rtc::CritScope cs(&crit_);
+    if (closed_ || pending_.empty()) {
+      scheduled_ = false;
+      return false;
+    }
+    return true;
+  }
+
+  // Drops pending tasks, rejects new ones and waits for a task that is
+  // running on another thread.
+  void Close() {
+    std::deque<std::unique_ptr<rtc::QueuedTask>> dropped;
+    bool wait = false;
+    {
+      rtc::CritScope cs(&crit_);
+      closed_ = true;
+      dropped.swap(pending_);
+      wait = running_;
+    }
+    dropped.clear();
+    if (wait)
+      done_.Wait(rtc::Event::kForever);
+  }
+
+ private:
+  TaskQueuePool* const pool_;
+  PooledTaskQueue* const owner_;
+  const int run_list_index_;
+
+  rtc::CriticalSection crit_;
+  std::deque<std::unique_ptr<rtc::QueuedTask>> pending_ RTC_GUARDED_BY(crit_);
+  bool scheduled_ RTC_GUARDED_BY(crit_) = false;
+  bool running_ RTC_GUARDED_BY(crit_) = false;
+  bool closed_ RTC_GUARDED_BY(crit_) = false;
+  // Signaled by the worker when it finishes the task Close() waits for.
+  rtc::Event done_;
+};
+
+struct TaskQueuePool::Worker {
+  Worker(TaskQueuePool* pool, size_t index)
+      : pool(pool),
+        index(index),
+        thread(&TaskQueuePool::WorkerThread,
+               this,
+               ("TaskQueuePool" + std::to_string(index)).c_str()),
+        wake_event(false, false) {}
+
+  TaskQueuePool* const pool;
+  const size_t index;
+  rtc::PlatformThread thread;
+  rtc::Event wake_event;
+  // Set while the worker is about to sleep on |wake_event|; cleared by
+  // whoever wakes it, so one Schedule() wakes at most one worker.
+  std::atomic<bool> idle{false};
+
+  rtc::CriticalSection crit;
+  std::deque<rtc::scoped_refptr<Queue>> run_lists[kPriorityLevels]
+      RTC_GUARDED_BY(crit);
+};
+
+TaskQueuePool::TaskQueuePool(size_t num_workers)
+    : next_delayed_ms_(kNoDelayedTask) {
+  if (num_workers == 0)
+    num_workers = std::max<uint32_t>(1, webrtc::CpuInfo::DetectNumberOfCores());
+  for (size_t i = 0; i < num_workers; ++i)
+    workers_.emplace_back(new Worker(this, i));
+  // Start only once |workers_| is complete, since workers steal from it.
+  for (auto& worker : workers_)
+    worker->thread.Start();
+}
+
+TaskQueuePool::~TaskQueuePool() {
+  stopping_.store(true);
+  for (auto& worker : workers_)
+    worker->wake_event.Set();
+  for (auto& worker : workers_)
+    worker->thread.Stop();
+
+  rtc::CritScope cs(&delayed_crit_);
+  while (!delayed_.empty()) {
+    delete delayed_.top().task;
+    delayed_.pop();
+  }
+}
+
+// static
+void TaskQueuePool::WorkerThread(void* param) {
+  Worker* worker = static_cast<Worker*>(param);
+  worker->pool->RunWorker(worker);
+}
+
+// static
+TaskQueuePool::Worker*& TaskQueuePool::CurrentWorker() {
+  static thread_local Worker* worker = nullptr;
+  return worker;
+}
+
+void TaskQueuePool::RunWorker(Worker* worker) {
+  CurrentWorker() = worker;
+  while (!stopping_.load()) {
+    if (rtc::TimeMillis() >= next_delayed_ms_.load(std::memory_order_relaxed))
+      RunDueDelayedTasks();
+
+    rtc::scoped_refptr<Queue> queue = TakeRunnable(worker);
+    if (!queue) {
+      RunDueDelayedTasks();
+      worker->idle.store(true);
+      // Re-check after announcing idleness: a Schedule() or an earlier
+      // PostDelayed() that ran before the store is seen here, one that runs
+      // after it sets |wake_event|.
+      queue = TakeRunnable(worker);
+      if (!queue && !stopping_.load())
+        worker->wake_event.Wait(DelayedWaitMs());
+      worker->idle.store(false);
+      if (!queue)
+        continue;
+    }
+
+    if (queue->RunSlice()) {
+      rtc::CritScope cs(&worker->crit);
+      worker->run_lists[queue->run_list_index()].push_back(queue);
+    }
+  }
+  CurrentWorker() = nullptr;
+}
+
+void TaskQueuePool::Schedule(Queue* queue) {
+  // Work posted from a worker stays on that worker, where its caches are
+  // warm; idle workers steal it if the poster stays busy.
+  Worker* target = CurrentWorker();
+  if (!target || target->pool != this)
+    target = workers_[next_worker_.fetch_add(1) % workers_.size()].get();
+  {
+    rtc::CritScope cs(&target->crit);
+    target->run_lists[queue->run_list_index()].push_back(queue);
+  }
+  WakeOne();
+}
+
+void TaskQueuePool::PostDelayed(Queue* queue,
+                                std::unique_ptr<rtc::QueuedTask> task,
+                                uint32_t milliseconds) {
+  const int64_t run_at_ms = rtc::TimeAfter(milliseconds);
+  bool earliest = false;
+  {
+    rtc::CritScope cs(&delayed_crit_);
+    const uint64_t seq = next_delayed_seq_++;
+    delayed_.push(DelayedTask{run_at_ms, seq, queue, task.release()});
+    if (delayed_.top().seq == seq) {
+      // Sequentially consistent, against the |idle| store in RunWorker().
+      next_delayed_ms_.store(run_at_ms);
+      earliest = true;
+    }
+  }
+  // A sleeping worker may be waiting for a later timer.
+  if (earliest)
+    WakeOne();
+}
+
+void TaskQueuePool::RunDueDelayedTasks() {
+  const int64_t now_ms = rtc::TimeMillis();
+  std::vector<std::pair<rtc::scoped_refptr<Queue>, rtc::QueuedTask*>> due;
+  {
+    rtc::CritScope cs(&delayed_crit_);
+    while (!delayed_.empty() && delayed_.top().run_at_ms <= now_ms) {
+      due.emplace_back(delayed_.top().queue, delayed_.top().task);
+      delayed_.pop();
+    }
+    next_delayed_ms_.store(
+        delayed_.empty() ? kNoDelayedTask : delayed_.top().run_at_ms,
+        std::memory_order_relaxed);
+  }
+  // Heap order is due-time then posting order, so tasks that share a due
+  // time reach their queue in the order they were posted.
+  for (auto& entry : due)
+    entry.first->Post(std::unique_ptr<rtc::QueuedTask>(entry.second));
+}
+
+int TaskQueuePool::DelayedWaitMs() const {
+  const int64_t next_ms = next_delayed_ms_.load();
+  if (next_ms == kNoDelayedTask)
+    return rtc::Event::kForever;
+  return static_cast<int>(std::min<int64_t>(
+      std::max<int64_t>(0, next_ms - rtc::TimeMillis()),
+      std::numeric_limits<int>::max()));
+}
+
+rtc::scoped_refptr<TaskQueuePool::Queue> TaskQueuePool::TakeRunnable(
+    Worker* worker) {
+  rtc::scoped_refptr<Queue> queue;
+  {
+    rtc::CritScope cs(&worker->crit);
+    for (auto& run_list : worker->run_lists) {
+      if (!run_list.empty()) {
+        queue = std::move(run_list.front());
+        run_list.pop_front();
+        return queue;
+      }
+    }
+  }
+  // Steal from the back, away from where the victim is working.
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    Worker* victim = workers_[(worker->index + i) % workers_.size()].get();
+    rtc::CritScope cs(&victim->crit);
+    for (auto& run_list : victim->run_lists) {
+      if (!run_list.empty()) {
+        queue = std::move(run_list.back());
+        run_list.pop_back();
+        return queue;
+      }
+    }
+  }
+  return queue;
+}
+
+void TaskQueuePool::WakeOne() {
+  const size_t start = next_worker_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    Worker* worker = workers_[(start + i) % workers_.size()].get();
+    if (worker->idle.load() && worker->idle.exchange(false)) {
+      worker->wake_event.Set();
+      return;
+    }
+  }
+}
+
+PooledTaskQueue::PooledTaskQueue(TaskQueuePool* pool,
+                                 const char* queue_name,
+                                 rtc::TaskQueue::Priority priority)
+    : pool_(pool),
+      queue_(new rtc::RefCountedObject<TaskQueuePool::Queue>(pool,
+                                                              this,
+                                                              priority)) {
+  RTC_DCHECK(pool);
+  RTC_DCHECK(queue_name);
+}
+
+PooledTaskQueue::~PooledTaskQueue() {
+  RTC_DCHECK(!IsCurrent());
+  queue_->Close();
+}
+
+// static
+PooledTaskQueue* PooledTaskQueue::Current() {
+  return g_current_queue;
+}
+
+bool PooledTaskQueue::IsCurrent() const {
+  return Current() == this;
+}
+
+void PooledTaskQueue::PostTask(std::unique_ptr<rtc::QueuedTask> task) {
+  queue_->Post(std::move(task));
+}
+
+void PooledTaskQueue::PostDelayedTask(std::unique_ptr<rtc::QueuedTask> task,
+                                      uint32_t milliseconds) {
+  if (milliseconds == 0) {
+    PostTask(std::move(task));
+    return;
+  }
+  pool_->PostDelayed(queue_.get(), std::move(task), milliseconds);
+}
+
+}  // namespace simple_app
@@ -0,0 +1,140 @@
+#ifndef TASK_QUEUE_POOL_H_
+#define TASK_QUEUE_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <type_traits>
+#include <vector>
+
+#include "rtc_base/criticalsection.h"
+#include "rtc_base/event.h"
+#include "rtc_base/platform_thread.h"
+#include "rtc_base/scoped_ref_ptr.h"
+#include "rtc_base/task_queue.h"
+
+namespace simple_app {
+
+class PooledTaskQueue;
+
+// Fixed set of worker threads that runs the tasks of many PooledTaskQueues.
+// A queue with pending tasks sits in the run list of one worker; idle workers
+// steal queues from the back of the other workers' lists, so one busy worker
+// never strands runnable queues. Within a run list, queues of
+// TaskQueue::Priority::HIGH go before NORMAL, and NORMAL before LOW.
+//
+// The pool must outlive every PooledTaskQueue created on it.
+class TaskQueuePool {
+ public:
+  // |num_workers| == 0 picks one worker per core.
+  explicit TaskQueuePool(size_t num_workers = 0);
+  ~TaskQueuePool();
+
+  size_t num_workers() const { return workers_.size(); }
+
+ private:
+  friend class PooledTaskQueue;
+  class Queue;
+  struct Worker;
+
+  struct DelayedTask {
+    int64_t run_at_ms;
+    uint64_t seq;
+    rtc::scoped_refptr<Queue> queue;
+    // Raw because std::priority_queue only hands out const references; the
+    // heap owns the task until it is moved to |queue|.
+    rtc::QueuedTask* task;
+
+    bool operator<(const DelayedTask& other) const {
+      if (run_at_ms != other.run_at_ms)
+        return run_at_ms > other.run_at_ms;
+      return seq > other.seq;
+    }
+  };
+
+  static void WorkerThread(void* param);
+  // The worker running on the calling thread, or null.
+  static Worker*& CurrentWorker();
+  void RunWorker(Worker* worker);
+
+  // Puts |queue|, which just got its first pending task, on a run list.
+  void Schedule(Queue* queue);
+  void PostDelayed(Queue* queue,
+                   std::unique_ptr<rtc::QueuedTask> task,
+                   uint32_t milliseconds);
+  // Hands due delayed tasks to their queues.
+  void RunDueDelayedTasks();
+  // How long a worker may sleep before the next delayed task is due.
+  int DelayedWaitMs() const;
+  // Pops the next queue from |worker|'s own list, or steals one from another
+  // worker. Returns null when every list is empty.
+  rtc::scoped_refptr<Queue> TakeRunnable(Worker* worker);
+  // Wakes an idle worker, if there is one.
+  void WakeOne();
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_{0};
+  std::atomic<bool> stopping_{false};
+
+  rtc::CriticalSection delayed_crit_;
+  std::priority_queue<DelayedTask> delayed_ RTC_GUARDED_BY(delayed_crit_);
+  uint64_t next_delayed_seq_ RTC_GUARDED_BY(delayed_crit_) = 0;
+  // Due time of the top of |delayed_|, readable without the lock so busy
+  // workers can tell cheaply whether a timer expired between two slices.
+  std::atomic<int64_t> next_delayed_ms_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(TaskQueuePool);
+};
+
+// Drop-in for rtc::TaskQueue that borrows a TaskQueuePool worker whenever it
+// has work instead of owning an OS thread. Tasks of one queue run one at a
+// time and in posting order, and Current()/IsCurrent() work from inside them.
+//
+// rtc::TaskQueue itself is not pluggable, so queues created inside webrtc keep
+// their own threads; this only helps queues the application creates.
+class PooledTaskQueue {
+ public:
+  PooledTaskQueue(TaskQueuePool* pool,
+                  const char* queue_name,
+                  rtc::TaskQueue::Priority priority =
+                      rtc::TaskQueue::Priority::NORMAL);
+  // Drops pending tasks and waits for a running one to finish. Must not be
+  // called from a task of this queue.
+  ~PooledTaskQueue();
+
+  static PooledTaskQueue* Current();
+  bool IsCurrent() const;
+
+  void PostTask(std::unique_ptr<rtc::QueuedTask> task);
+  void PostDelayedTask(std::unique_ptr<rtc::QueuedTask> task,
+                       uint32_t milliseconds);
+
+  template <class Closure,
+            typename std::enable_if<
+                std::is_copy_constructible<Closure>::value>::type* = nullptr>
+  void PostTask(const Closure& closure) {
+    PostTask(std::unique_ptr<rtc::QueuedTask>(
+        new rtc::ClosureTask<Closure>(closure)));
+  }
+
+  template <class Closure>
+  void PostDelayedTask(const Closure& closure, uint32_t milliseconds) {
+    PostDelayedTask(std::unique_ptr<rtc::QueuedTask>(
+                        new rtc::ClosureTask<Closure>(closure)),
+                    milliseconds);
+  }
+
+ private:
+  TaskQueuePool* const pool_;
+  const rtc::scoped_refptr<TaskQueuePool::Queue> queue_;
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(PooledTaskQueue);
+};
+
+}  // namespace simple_app
+
+#endif  // TASK_QUEUE_POOL_H_
@@ -0,0 +1,385 @@
+#include "trace_recorder.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "json_number.h"
+#include "rtc_base/checks.h"
+#include "rtc_base/event_tracer.h"
+#include "rtc_base/platform_thread.h"
+#include "rtc_base/timeutils.h"
+#include "rtc_base/trace_event.h"
+
+namespace simple_app {
+
+namespace {
+
+const char kDisabledByDefaultPrefix[] = "disabled-by-default-";
+
+// Handed out once the category table is full; never enabled.
+const unsigned char kCategoryTableFull = 0;
+
+void AppendJsonString(const char* str, std::string* out) {
+  out->push_back('"');
+  for (const char* p = str; *p; ++p) {
+    const unsigned char c = static_cast<unsigned char>(*p);
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(*p);
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out->append(escaped);
+    } else {
+      out->push_back(*p);
+    }
+  }
+  out->push_back('"');
+}
+
+void CopyText(const char* str, char* dest, size_t size) {
+  strncpy(dest, str ? str : "", size - 1);
+  dest[size - 1] = '\0';
+}
+
+}  // namespace
+
+// Keeps the calling thread's buffer alive and flags it when the thread exits,
+// so its events can still be exported until the next Clear().
+class TraceRecorder::ThreadBufferHolder {
+ public:
+  ~ThreadBufferHolder() {
+    if (buffer)
+      buffer->thread_exited.store(true);
+  }
+
+  std::shared_ptr<ThreadBuffer> buffer;
+};
+
+TraceRecorder* TraceRecorder::instance_ = nullptr;
+
+const int TraceRecorder::kMaxArgs;
+const size_t TraceRecorder::kDefaultEventsPerThread;
+const size_t TraceRecorder::kMaxCategories;
+const size_t TraceRecorder::kCopiedTextSize;
+
+// static
+TraceRecorder* TraceRecorder::Install(size_t events_per_thread) {
+  // Thread-safe static initialization makes concurrent first calls install
+  // the tracer once.
+  static TraceRecorder* const recorder = [events_per_thread] {
+    instance_ = new TraceRecorder(events_per_thread);
+    webrtc::SetupEventTracer(&TraceRecorder::GetCategoryEnabled,
+                             &TraceRecorder::AddTraceEvent);
+    return instance_;
+  }();
+  return recorder;
+}
+
+TraceRecorder::TraceRecorder(size_t events_per_thread)
+    : events_per_thread_(events_per_thread) {
+  RTC_DCHECK_GT(events_per_thread, 0);
+  memset(category_enabled_, 0, sizeof(category_enabled_));
+}
+
+void TraceRecorder::Start(const std::string& categories) {
+  rtc::CritScope cs(&crit_);
+  filter_.clear();
+  filter_all_ = false;
+  size_t pos = 0;
+  while (pos <= categories.size()) {
+    size_t end = categories.find(',', pos);
+    if (end == std::string::npos)
+      end = categories.size();
+    std::string category = categories.substr(pos, end - pos);
+    category.erase(0, category.find_first_not_of(' '));
+    category.erase(category.find_last_not_of(' ') + 1);
+    if (category == "*")
+      filter_all_ = true;
+    else if (!category.empty())
+      filter_.push_back(category);
+    pos = end + 1;
+  }
+  if (filter_.empty())
+    filter_all_ = true;
+  UpdateCategories();
+  recording_.store(true);
+}
+
+void TraceRecorder::Stop() {
+  rtc::CritScope cs(&crit_);
+  recording_.store(false);
+  memset(category_enabled_, 0, sizeof(category_enabled_));
+}
+
+std::string TraceRecorder::ExportJson() {
+  const bool was_recording = Pause();
+  std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  {
+    rtc::CritScope cs(&crit_);
+    const int pid = static_cast<int>(getpid());
+    for (const std::shared_ptr<ThreadBuffer>& buffer : buffers_) {
+      if (!first)
+        json.push_back(',');
+      first = false;
+      char prefix[96];
+      snprintf(prefix, sizeof(prefix),
+               "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,"
+               "\"args\":{\"name\":",
+               pid, buffer->tid);
+      json.append(prefix);
+      AppendJsonString(buffer->thread_name.c_str(), &json);
+      json.append("}}");
+
+      const uint64_t written = buffer->written.load();
+      const size_t capacity = buffer->events.size();
+      const uint64_t begin = written > capacity ? written - capacity : 0;
+      for (uint64_t i = begin; i < written; ++i) {
+        json.push_back(',');
+        AppendEventJson(*buffer, buffer->events[i % capacity], &json);
+      }
+    }
+  }
+  json.append("]}\n");
+  Resume(was_recording);
+  return json;
+}
+
+bool TraceRecorder::WriteJson(const std::string& path) {
+  const std::string json = ExportJson();
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file)
+    return false;
+  const bool ok = fwrite(json.data(), 1, json.size(), file) == json.size();
+  return fclose(file) == 0 && ok;
+}
+
+void TraceRecorder::Clear() {
+  const bool was_recording = Pause();
+  {
+    rtc::CritScope cs(&crit_);
+    buffers_.erase(
+        std::remove_if(buffers_.begin(), buffers_.end(),
+                       [](const std::shared_ptr<ThreadBuffer>& buffer) {
+                         return buffer->thread_exited.load();
+                       }),
+        buffers_.end());
+    for (const std::shared_ptr<ThreadBuffer>& buffer : buffers_)
+      buffer->written.store(0);
+  }
+  Resume(was_recording);
+}
+
+uint64_t TraceRecorder::OverwrittenEvents() const {
+  rtc::CritScope cs(&crit_);
+  uint64_t overwritten = 0;
+  for (const std::shared_ptr<ThreadBuffer>& buffer : buffers_) {
+    const uint64_t written = buffer->written.load(std::memory_order_relaxed);
+    if (written > buffer->events.size())
+      overwritten += written - buffer->events.size();
+  }
+  return overwritten;
+}
+
+// static
+const unsigned char* TraceRecorder::GetCategoryEnabled(const char* name) {
+  return instance_->RegisterCategory(name);
+}
+
+// static
+void TraceRecorder::AddTraceEvent(char phase,
+                                  const unsigned char* category_enabled,
+                                  const char* name,
+                                  unsigned long long id,
+                                  int num_args,
+                                  const char** arg_names,
+                                  const unsigned char* arg_types,
+                                  const unsigned long long* arg_values,
+                                  unsigned char flags) {
+  TraceRecorder* const self = instance_;
+  if (!self->recording_.load(std::memory_order_relaxed))
+    return;
+  ThreadBuffer* const buffer = self->CurrentThreadBuffer();
+  // Pairs with Pause(): either it sees |writing| and waits for this event, or
+  // this sees recording stopped and backs out.
+  buffer->writing.store(true);
+  if (!self->recording_.load()) {
+    buffer->writing.store(false, std::memory_order_release);
+    return;
+  }
+
+  const uint64_t written = buffer->written.load(std::memory_order_relaxed);
+  Event& event = buffer->events[written % buffer->events.size()];
+  event.time_us = rtc::TimeMicros();
+  event.name = name;
+  event.category_enabled = category_enabled;
+  event.id = id;
+  event.phase = phase;
+  event.flags = flags;
+  event.num_args = static_cast<unsigned char>(std::min(num_args, kMaxArgs));
+  if (flags & TRACE_EVENT_FLAG_COPY) {
+    CopyText(name, event.copied_name, kCopiedTextSize);
+    event.name = nullptr;
+  }
+  bool arg_copied = false;
+  for (int i = 0; i < event.num_args; ++i) {
+    // COPY events may pass argument names that do not outlive the call.
+    event.arg_names[i] =
+        (flags & TRACE_EVENT_FLAG_COPY) ? (i == 0 ? "arg0" : "arg1")
+                                        : arg_names[i];
+    event.arg_types[i] = arg_types[i];
+    event.arg_values[i] = arg_values[i];
+    if (arg_types[i] != TRACE_VALUE_TYPE_COPY_STRING)
+      continue;
+    if (arg_copied) {
+      event.arg_values[i] = 0;
+      continue;
+    }
+    webrtc::trace_event_internal::TraceValueUnion value;
+    value.as_uint = arg_values[i];
+    CopyText(value.as_string, event.copied_arg, kCopiedTextSize);
+    arg_copied = true;
+  }
+  buffer->written.store(written + 1, std::memory_order_relaxed);
+  buffer->writing.store(false, std::memory_order_release);
+}
+
+const unsigned char* TraceRecorder::RegisterCategory(const char* name) {
+  rtc::CritScope cs(&crit_);
+  for (size_t i = 0; i < num_categories_; ++i) {
+    if (category_names_[i] == name)
+      return &category_enabled_[i];
+  }
+  if (num_categories_ == kMaxCategories)
+    return &kCategoryTableFull;
+  const size_t i = num_categories_++;
+  category_names_[i] = name;
+  category_enabled_[i] = recording_.load() && MatchesFilter(name);
+  return &category_enabled_[i];
+}
+
+bool TraceRecorder::MatchesFilter(const std::string& category) const {
+  if (std::find(filter_.begin(), filter_.end(), category) != filter_.end())
+    return true;
+  return filter_all_ &&
+         category.compare(0, sizeof(kDisabledByDefaultPrefix) - 1,
+                          kDisabledByDefaultPrefix) != 0;
+}
+
+void TraceRecorder::UpdateCategories() {
+  for (size_t i = 0; i < num_categories_; ++i)
+    category_enabled_[i] = MatchesFilter(category_names_[i]);
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::CurrentThreadBuffer() {
+  static thread_local ThreadBufferHolder holder;
+  if (holder.buffer)
+    return holder.buffer.get();
+  std::shared_ptr<ThreadBuffer> buffer =
+      std::make_shared<ThreadBuffer>(events_per_thread_);
+  buffer->tid = static_cast<int>(rtc::CurrentThreadId());
+  char thread_name[64] = {0};
+  if (pthread_getname_np(pthread_self(), thread_name, sizeof(thread_name)) !=
+          0 ||
+      thread_name[0] == '\0') {
+    snprintf(thread_name, sizeof(thread_name), "thread %d", buffer->tid);
+  }
+  buffer->thread_name = thread_name;
+  {
+    rtc::CritScope cs(&crit_);
+    buffers_.push_back(buffer);
+  }
+  holder.buffer = std::move(buffer);
+  return holder.buffer.get();
+}
+
+bool TraceRecorder::Pause() {
+  const bool was_recording = recording_.exchange(false);
+  rtc::CritScope cs(&crit_);
+  for (const std::shared_ptr<ThreadBuffer>& buffer : buffers_) {
+    while (buffer->writing.load(std::memory_order_acquire))
+      std::this_thread::yield();
+  }
+  return was_recording;
+}
+
+void TraceRecorder::Resume(bool was_recording) {
+  if (was_recording)
+    recording_.store(true);
+}
+
+void TraceRecorder::AppendEventJson(const ThreadBuffer& buffer,
+                                    const Event& event,
+                                    std::string* out) const {
+  char buf[128];
+  const char phase[2] = {event.phase, '\0'};
+  out->append("{\"ph\":");
+  AppendJsonString(phase, out);
+  out->append(",\"cat\":");
+  if (event.category_enabled == &kCategoryTableFull) {
+    AppendJsonString("(too many categories)", out);
+  } else {
+    const size_t index = event.category_enabled - category_enabled_;
+    AppendJsonString(category_names_[index].c_str(), out);
+  }
+  out->append(",\"name\":");
+  AppendJsonString(event.name ? event.name : event.copied_name, out);
+  snprintf(buf, sizeof(buf), ",\"ts\":%" PRId64 ",\"pid\":%d,\"tid\":%d",
+           event.time_us, static_cast<int>(getpid()), buffer.tid);
+  out->append(buf);
+  if (event.flags & TRACE_EVENT_FLAG_HAS_ID) {
+    snprintf(buf, sizeof(buf), ",\"id\":\"0x%llx\"", event.id);
+    out->append(buf);
+  }
+  if (event.phase == TRACE_EVENT_PHASE_INSTANT)
+    out->append(",\"s\":\"t\"");
+
+  out->append(",\"args\":{");
+  for (int i = 0; i < event.num_args; ++i) {
+    if (i > 0)
+      out->push_back(',');
+    AppendJsonString(event.arg_names[i], out);
+    out->push_back(':');
+    webrtc::trace_event_internal::TraceValueUnion value;
+    value.as_uint = event.arg_values[i];
+    switch (event.arg_types[i]) {
+      case TRACE_VALUE_TYPE_BOOL:
+        out->append(value.as_bool ? "true" : "false");
+        break;
+      case TRACE_VALUE_TYPE_UINT:
+        snprintf(buf, sizeof(buf), "%llu", value.as_uint);
+        out->append(buf);
+        break;
+      case TRACE_VALUE_TYPE_INT:
+        snprintf(buf, sizeof(buf), "%lld", value.as_int);
+        out->append(buf);
+        break;
+      case TRACE_VALUE_TYPE_DOUBLE:
+        AppendJsonNumber(value.as_double, out);
+        break;
+      case TRACE_VALUE_TYPE_POINTER:
+        snprintf(buf, sizeof(buf), "\"%p\"", value.as_pointer);
+        out->append(buf);
+        break;
+      case TRACE_VALUE_TYPE_STRING:
+        AppendJsonString(value.as_string ? value.as_string : "", out);
+        break;
+      case TRACE_VALUE_TYPE_COPY_STRING:
+        AppendJsonString(value.as_uint ? event.copied_arg : "", out);
+        break;
+      default:
+        out->append("null");
+        break;
+    }
+  }
+  out->append("}}");
+}
+
+}  // namespace simple_app
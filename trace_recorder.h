@@ -0,0 +1,144 @@
+#ifndef TRACE_RECORDER_H_
+#define TRACE_RECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rtc_base/constructormagic.h"
+#include "rtc_base/criticalsection.h"
+
+namespace simple_app {
+
+// In-process consumer of the library's TRACE_EVENT* macros, registered
+// through webrtc::SetupEventTracer(). Each thread records into its own ring
+// of fixed-size events that overwrites its oldest events when full, so
+// memory stays bounded however long recording runs and the dump always holds
+// the most recent window. ExportJson() writes the Chrome trace event format,
+// which chrome://tracing and ui.perfetto.dev both load, so encode, pacing,
+// network and decode spans of a call show up on one timeline.
+//
+// While stopped, or for categories not selected by Start(), a TRACE_EVENT
+// costs one load and branch on the category flag the macro caches.
+//
+// Use the single instance from Install(); the tracer callbacks are plain
+// functions, so there can only be one.
+class TraceRecorder {
+ public:
+  // Events each thread keeps; about 120 bytes apiece.
+  static const size_t kDefaultEventsPerThread = 8192;
+
+  // Registers the recorder with webrtc::SetupEventTracer() on first call and
+  // returns it; later calls ignore |events_per_thread|. Never destroyed.
+  static TraceRecorder* Install(
+      size_t events_per_thread = kDefaultEventsPerThread);
+
+  // Starts recording the comma-separated |categories|, e.g.
+  // "webrtc,webrtc_stats". "*" or an empty string selects every category
+  // except "disabled-by-default-*" ones, which must be named.
+  void Start(const std::string& categories);
+  void Stop();
+  bool IsRecording() const { return recording_.load(); }
+
+  // Returns the recorded events as a Chrome trace event JSON object. Briefly
+  // pauses recording if it is running.
+  std::string ExportJson();
+  // Writes ExportJson() to |path|. Returns false if the file can't be written.
+  bool WriteJson(const std::string& path);
+  // Drops all recorded events and the rings of threads that have exited.
+  void Clear();
+
+  // Events overwritten because a thread's ring was full.
+  uint64_t OverwrittenEvents() const;
+
+ private:
+  static const int kMaxArgs = 2;
+  static const size_t kMaxCategories = 128;
+  static const size_t kCopiedTextSize = 24;
+
+  struct Event {
+    int64_t time_us;
+    const char* name;
+    const unsigned char* category_enabled;
+    unsigned long long id;
+    char phase;
+    unsigned char flags;
+    unsigned char num_args;
+    unsigned char arg_types[kMaxArgs];
+    const char* arg_names[kMaxArgs];
+    unsigned long long arg_values[kMaxArgs];
+    // Truncated copies of the name of a COPY event and of its first
+    // TRACE_STR_COPY argument; further copied arguments come out empty.
+    char copied_name[kCopiedTextSize];
+    char copied_arg[kCopiedTextSize];
+  };
+
+  struct ThreadBuffer {
+    explicit ThreadBuffer(size_t capacity) : events(capacity) {}
+
+    std::vector<Event> events;
+    // Events ever written; the ring holds the last |events.size()| of them.
+    std::atomic<uint64_t> written{0};
+    // Set by the owning thread while it writes an event, so a dump can wait
+    // for it instead of reading a half written event.
+    std::atomic<bool> writing{false};
+    std::atomic<bool> thread_exited{false};
+    int tid = 0;
+    std::string thread_name;
+  };
+
+  class ThreadBufferHolder;
+
+  explicit TraceRecorder(size_t events_per_thread);
+
+  // webrtc::SetupEventTracer() callbacks.
+  static const unsigned char* GetCategoryEnabled(const char* name);
+  static void AddTraceEvent(char phase,
+                            const unsigned char* category_enabled,
+                            const char* name,
+                            unsigned long long id,
+                            int num_args,
+                            const char** arg_names,
+                            const unsigned char* arg_types,
+                            const unsigned long long* arg_values,
+                            unsigned char flags);
+
+  const unsigned char* RegisterCategory(const char* name);
+  bool MatchesFilter(const std::string& category) const
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(crit_);
+  void UpdateCategories() RTC_EXCLUSIVE_LOCKS_REQUIRED(crit_);
+  ThreadBuffer* CurrentThreadBuffer();
+  // Stops writers and waits for events being written. Returns whether
+  // recording was on, to pass to Resume().
+  bool Pause();
+  void Resume(bool was_recording);
+  void AppendEventJson(const ThreadBuffer& buffer,
+                       const Event& event,
+                       std::string* out) const
+      RTC_EXCLUSIVE_LOCKS_REQUIRED(crit_);
+
+  static TraceRecorder* instance_;
+
+  const size_t events_per_thread_;
+  std::atomic<bool> recording_{false};
+
+  rtc::CriticalSection crit_;
+  bool filter_all_ RTC_GUARDED_BY(crit_) = false;
+  std::vector<std::string> filter_ RTC_GUARDED_BY(crit_);
+  // Flags the TRACE_EVENT macros check. They read them without
+  // synchronization, as with Chrome's tracer; only Start() and Stop() write.
+  unsigned char category_enabled_[kMaxCategories];
+  std::string category_names_[kMaxCategories] RTC_GUARDED_BY(crit_);
+  size_t num_categories_ RTC_GUARDED_BY(crit_) = 0;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers_ RTC_GUARDED_BY(crit_);
+
+  RTC_DISALLOW_COPY_AND_ASSIGN(TraceRecorder);
+};
+
+}  // namespace simple_app
+
+#endif  // TRACE_RECORDER_H_